@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+
+#define BENCH_WARMUP_FRAMES 60
+
+static const char *scenarioNames[BENCH_SCENARIO_COUNT] = {
+  "none",
+  "empty",
+  "draws",
+  "instances",
+  "resize",
+  "lod",
+  "lights",
+  "occlusion",
+  "startup",
+  "replay"
+};
+
+static const char *stageNames[BENCH_STAGE_COUNT] = {
+  "wait",
+  "acquire",
+  "build",
+  "record",
+  "submit",
+  "present"
+};
+
+double benchNowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+bool benchParseScenario(const char *name, BenchScenario *pScenario) {
+  for (int i = 0; i < BENCH_SCENARIO_COUNT; i++) {
+    if (strcmp(name, scenarioNames[i]) == 0) {
+      *pScenario = (BenchScenario)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *benchScenarioName(BenchScenario scenario) {
+  return scenario < BENCH_SCENARIO_COUNT ? scenarioNames[scenario] : "unknown";
+}
+
+void benchInit(Bench *pBench, BenchScenario scenario, u32 frameCount, const char *outputPath, double processStartMs) {
+  memset(pBench, 0, sizeof(Bench));
+  pBench->scenario = scenario;
+  pBench->processStartMs = processStartMs;
+  if (scenario == BENCH_SCENARIO_NONE) {
+    return;
+  }
+
+  // Startup is measured from a cold process, warming up would hide it
+  pBench->warmupFrames = scenario == BENCH_SCENARIO_STARTUP ? 0 : BENCH_WARMUP_FRAMES;
+  pBench->frameCount = frameCount > 0 ? frameCount : 1;
+  pBench->outputPath = outputPath;
+  pBench->frameMs = malloc(sizeof(double) * pBench->frameCount);
+  pBench->latencyMs = calloc(pBench->frameCount, sizeof(double));
+  if (pBench->frameMs == NULL || pBench->latencyMs == NULL) {
+    printf("Failed to allocate benchmark samples!\n");
+    exit(20);
+  }
+}
+
+void benchDestroy(Bench *pBench) {
+  free(pBench->frameMs);
+  free(pBench->latencyMs);
+  pBench->frameMs = NULL;
+  pBench->latencyMs = NULL;
+}
+
+void benchBeginFrame(Bench *pBench) {
+  if (!benchEnabled(pBench)) return;
+  pBench->frameStartMs = benchNowMs();
+  pBench->stageStartMs = pBench->frameStartMs;
+}
+
+void benchMark(Bench *pBench, BenchStage stage) {
+  if (!benchEnabled(pBench)) return;
+  double now = benchNowMs();
+  if (pBench->frame >= pBench->warmupFrames) {
+    pBench->stageMs[stage] += now - pBench->stageStartMs;
+  }
+  pBench->stageStartMs = now;
+}
+
+void benchRecordLatency(Bench *pBench, double latencyMs) {
+  if (!benchEnabled(pBench)) return;
+  if (pBench->frame >= pBench->warmupFrames && pBench->frame - pBench->warmupFrames < pBench->frameCount) {
+    pBench->latencyMs[pBench->frame - pBench->warmupFrames] = latencyMs;
+  }
+}
+
+void benchCountTriangles(Bench *pBench, u64 triangles) {
+  if (!benchEnabled(pBench)) return;
+  if (pBench->frame >= pBench->warmupFrames) {
+    pBench->triangles += (double)triangles;
+  }
+}
+
+void benchCountOcclusion(Bench *pBench, u32 tested, u32 culled) {
+  if (!benchEnabled(pBench) || pBench->frame < pBench->warmupFrames) return;
+  pBench->occlusionTested += tested;
+  pBench->occlusionCulled += culled;
+  pBench->occlusionFrames++;
+}
+
+void benchRecordGpuTimes(Bench *pBench, const char *const *names, const double *ms, u32 count) {
+  if (!benchEnabled(pBench) || pBench->frame < pBench->warmupFrames) return;
+  if (count > BENCH_MAX_GPU_TIMES) count = BENCH_MAX_GPU_TIMES;
+  pBench->gpuCount = count;
+  for (u32 i = 0; i < count; i++) {
+    pBench->gpuNames[i] = names[i];
+    pBench->gpuMs[i] += ms[i];
+  }
+  pBench->gpuFrames++;
+}
+
+void benchEndFrame(Bench *pBench) {
+  if (!benchEnabled(pBench)) return;
+  double now = benchNowMs();
+  if (pBench->frame == 0) {
+    pBench->startupMs = now - pBench->processStartMs;
+  }
+  if (pBench->frame >= pBench->warmupFrames) {
+    pBench->frameMs[pBench->frame - pBench->warmupFrames] = now - pBench->frameStartMs;
+  }
+  pBench->frame++;
+}
+
+bool benchFinished(const Bench *pBench) {
+  return benchEnabled(pBench) && pBench->frame >= pBench->warmupFrames + pBench->frameCount;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+// Nearest-rank percentile of sorted samples
+static double percentile(const double *sorted, u32 count, double p) {
+  u32 rank = (u32)(p / 100.0 * count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > count) rank = count;
+  return sorted[rank - 1];
+}
+
+void benchWriteReport(const Bench *pBench) {
+  u32 count = pBench->frame > pBench->warmupFrames ? pBench->frame - pBench->warmupFrames : 0;
+  if (count > pBench->frameCount) count = pBench->frameCount;
+  if (count == 0) {
+    printf("No benchmark frames were measured!\n");
+    exit(20);
+  }
+
+  double *sorted = malloc(sizeof(double) * count);
+  double *sortedLatency = malloc(sizeof(double) * count);
+  if (sorted == NULL || sortedLatency == NULL) {
+    printf("Failed to allocate benchmark samples!\n");
+    exit(20);
+  }
+  memcpy(sorted, pBench->frameMs, sizeof(double) * count);
+  qsort(sorted, count, sizeof(double), compareDoubles);
+  memcpy(sortedLatency, pBench->latencyMs, sizeof(double) * count);
+  qsort(sortedLatency, count, sizeof(double), compareDoubles);
+  double total = 0.0;
+  for (u32 i = 0; i < count; i++) {
+    total += sorted[i];
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  FILE *file = stdout;
+  if (pBench->outputPath != NULL) {
+    file = fopen(pBench->outputPath, "w");
+    if (file == NULL) {
+      printf("Failed to open %s!\n", pBench->outputPath);
+      exit(20);
+    }
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"scenario\": \"%s\",\n", benchScenarioName(pBench->scenario));
+  fprintf(file, "  \"frames\": %u,\n", count);
+  fprintf(file, "  \"startup_ms\": %.3f,\n", pBench->startupMs);
+  fprintf(file, "  \"frame_ms\": {\n");
+  fprintf(file, "    \"mean\": %.4f,\n", total / count);
+  fprintf(file, "    \"p50\": %.4f,\n", percentile(sorted, count, 50.0));
+  fprintf(file, "    \"p90\": %.4f,\n", percentile(sorted, count, 90.0));
+  fprintf(file, "    \"p99\": %.4f,\n", percentile(sorted, count, 99.0));
+  fprintf(file, "    \"max\": %.4f\n", sorted[count - 1]);
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"latency_ms\": {\n");
+  fprintf(file, "    \"p50\": %.4f,\n", percentile(sortedLatency, count, 50.0));
+  fprintf(file, "    \"p99\": %.4f,\n", percentile(sortedLatency, count, 99.0));
+  fprintf(file, "    \"max\": %.4f\n", sortedLatency[count - 1]);
+  fprintf(file, "  },\n");
+  fprintf(file, "  \"stage_ms\": {\n");
+  for (int stage = 0; stage < BENCH_STAGE_COUNT; stage++) {
+    fprintf(file, "    \"%s\": %.4f%s\n", stageNames[stage], pBench->stageMs[stage] / count, stage + 1 < BENCH_STAGE_COUNT ? "," : "");
+  }
+  fprintf(file, "  },\n");
+  if (pBench->gpuFrames > 0) {
+    fprintf(file, "  \"gpu_ms\": {\n");
+    for (u32 i = 0; i < pBench->gpuCount; i++) {
+      fprintf(file, "    \"%s\": %.4f%s\n", pBench->gpuNames[i], pBench->gpuMs[i] / pBench->gpuFrames, i + 1 < pBench->gpuCount ? "," : "");
+    }
+    fprintf(file, "  },\n");
+  }
+  fprintf(file, "  \"triangles_per_frame\": %.0f,\n", pBench->triangles / count);
+  if (pBench->occlusionFrames > 0) {
+    fprintf(file, "  \"occlusion\": {\n");
+    fprintf(file, "    \"tested\": %.1f,\n", pBench->occlusionTested / pBench->occlusionFrames);
+    fprintf(file, "    \"culled\": %.1f\n", pBench->occlusionCulled / pBench->occlusionFrames);
+    fprintf(file, "  },\n");
+  }
+  fprintf(file, "  \"lights\": %u,\n", pBench->lightCount);
+  fprintf(file, "  \"peak_rss_kb\": %ld\n", usage.ru_maxrss);
+  fprintf(file, "}\n");
+
+  if (file != stdout) {
+    fclose(file);
+  }
+  free(sorted);
+  free(sortedLatency);
+}
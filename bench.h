@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+typedef enum BenchScenario {
+  BENCH_SCENARIO_NONE = 0, // Not benchmarking
+  BENCH_SCENARIO_EMPTY, // Clear and present only
+  BENCH_SCENARIO_DRAWS, // One draw per object
+  BENCH_SCENARIO_INSTANCES, // The same objects as a single instanced draw
+  BENCH_SCENARIO_RESIZE, // Resizes the window every few frames
+  BENCH_SCENARIO_LOD, // A field of detailed meshes receding from the camera
+  BENCH_SCENARIO_LIGHTS, // The LOD field lit by 1024 dynamic lights unless --lights says otherwise
+  BENCH_SCENARIO_OCCLUSION, // The LOD field behind a wall of spheres that hides most of it
+  BENCH_SCENARIO_STARTUP, // Time to the first presented frame
+  BENCH_SCENARIO_REPLAY, // A recording played back by replay/replay
+  BENCH_SCENARIO_COUNT
+} BenchScenario;
+
+#define BENCH_MAX_GPU_TIMES 8
+
+// CPU time of each part of drawFrame
+typedef enum BenchStage {
+  BENCH_STAGE_WAIT = 0,
+  BENCH_STAGE_ACQUIRE,
+  BENCH_STAGE_BUILD,
+  BENCH_STAGE_RECORD,
+  BENCH_STAGE_SUBMIT,
+  BENCH_STAGE_PRESENT,
+  BENCH_STAGE_COUNT
+} BenchStage;
+
+typedef struct Bench {
+  BenchScenario scenario;
+  u32 warmupFrames; // Run but not measured
+  u32 frameCount; // Measured frames
+  const char *outputPath; // NULL writes the report to stdout
+  u32 frame; // Frames run so far, including warmup
+  double *frameMs;
+  double *latencyMs; // Age of the simulation state each measured frame showed
+  double stageMs[BENCH_STAGE_COUNT]; // Summed over measured frames
+  double triangles; // Summed over measured frames
+  double occlusionTested; // Summed over occlusionFrames
+  double occlusionCulled;
+  u32 occlusionFrames;
+  u32 lightCount; // Set by the caller, reported as is
+  const char *gpuNames[BENCH_MAX_GPU_TIMES];
+  double gpuMs[BENCH_MAX_GPU_TIMES]; // Summed over gpuFrames
+  u32 gpuCount;
+  u32 gpuFrames;
+  double processStartMs;
+  double startupMs; // Process start to the end of the first frame
+  double frameStartMs;
+  double stageStartMs;
+} Bench;
+
+double benchNowMs(void);
+
+bool benchParseScenario(const char *name, BenchScenario *pScenario);
+const char *benchScenarioName(BenchScenario scenario);
+
+// processStartMs comes from benchNowMs() at the top of main
+void benchInit(Bench *pBench, BenchScenario scenario, u32 frameCount, const char *outputPath, double processStartMs);
+void benchDestroy(Bench *pBench);
+
+static inline bool benchEnabled(const Bench *pBench) {
+  return pBench->scenario != BENCH_SCENARIO_NONE;
+}
+
+void benchBeginFrame(Bench *pBench);
+// Charges the time since the previous mark to stage
+void benchMark(Bench *pBench, BenchStage stage);
+// Time from the simulation step a frame drew to its present, call before benchEndFrame
+void benchRecordLatency(Bench *pBench, double latencyMs);
+// Triangles submitted this frame
+void benchCountTriangles(Bench *pBench, u64 triangles);
+// Draws the occlusion cull tested and hid in an earlier frame
+void benchCountOcclusion(Bench *pBench, u32 tested, u32 culled);
+// GPU time of named passes, measured by timestamps of an earlier frame.
+// names must outlive the bench.
+void benchRecordGpuTimes(Bench *pBench, const char *const *names, const double *ms, u32 count);
+void benchEndFrame(Bench *pBench);
+bool benchFinished(const Bench *pBench);
+
+// Frame time and latency percentiles, mean stage and GPU pass times, triangles, occlusion culled draws, lights
+// and peak RSS as JSON
+void benchWriteReport(const Bench *pBench);
@@ -0,0 +1,146 @@
+// Compares a benchmark report against a stored baseline. Exits 1 when a
+// metric got worse by more than the threshold or is missing from either.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#define MAX_METRICS 64
+#define MAX_KEY 128
+#define MAX_DEPTH 4
+
+typedef struct Metric {
+  char key[MAX_KEY]; // Dotted path, e.g. frame_ms.p99
+  double value;
+} Metric;
+
+typedef struct Report {
+  Metric metrics[MAX_METRICS];
+  int count;
+} Report;
+
+static const char *defaultMetrics[] = { "frame_ms.p50", "frame_ms.p99", "latency_ms.p99", "startup_ms", "peak_rss_kb" };
+
+static char *readText(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  char *text = malloc(size + 1);
+  size_t read = fread(text, 1, size, file);
+  text[read] = '\0';
+  fclose(file);
+  return text;
+}
+
+// Flattens the numeric leaves of the reports bench.c writes. Not a general
+// JSON parser: no arrays and no escapes in strings.
+static void parseReport(const char *text, Report *pReport) {
+  char path[MAX_DEPTH][MAX_KEY] = {{0}};
+  char key[MAX_KEY] = {0};
+  int depth = 0;
+  pReport->count = 0;
+
+  for (const char *p = text; *p; p++) {
+    if (*p == '{') {
+      if (depth > 0 && depth <= MAX_DEPTH) strcpy(path[depth - 1], key);
+      depth++;
+    } else if (*p == '}') {
+      depth--;
+    } else if (*p == '"') {
+      const char *end = strchr(p + 1, '"');
+      if (end == NULL) return;
+      size_t keyLength = end - p - 1 < MAX_KEY - 1 ? (size_t)(end - p - 1) : MAX_KEY - 1;
+      memcpy(key, p + 1, keyLength);
+      key[keyLength] = '\0';
+      p = end;
+
+      const char *colon = p + 1;
+      while (isspace((unsigned char)*colon)) colon++;
+      if (*colon != ':') continue; // A string value, not a key
+
+      const char *value = colon + 1;
+      while (isspace((unsigned char)*value)) value++;
+      char *numberEnd;
+      double number = strtod(value, &numberEnd);
+      if (numberEnd == value || pReport->count == MAX_METRICS) continue;
+
+      Metric *pMetric = &pReport->metrics[pReport->count++];
+      int length = 0;
+      for (int i = 0; i < depth - 1 && i < MAX_DEPTH && length < MAX_KEY; i++) {
+        length += snprintf(pMetric->key + length, MAX_KEY - length, "%s.", path[i]);
+      }
+      if (length < MAX_KEY) {
+        snprintf(pMetric->key + length, MAX_KEY - length, "%s", key);
+      }
+      pMetric->value = number;
+      p = numberEnd - 1;
+    }
+  }
+}
+
+static bool findMetric(const Report *pReport, const char *key, double *pValue) {
+  for (int i = 0; i < pReport->count; i++) {
+    if (strcmp(pReport->metrics[i].key, key) == 0) {
+      *pValue = pReport->metrics[i].value;
+      return true;
+    }
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    printf("Usage: %s baseline.json result.json threshold-percent [metric...]\n", argv[0]);
+    return 2;
+  }
+
+  char *baselineText = readText(argv[1]);
+  if (baselineText == NULL) {
+    printf("%s: no baseline, skipping comparison\n", argv[2]);
+    return 0;
+  }
+  char *resultText = readText(argv[2]);
+  if (resultText == NULL) {
+    printf("Failed to read %s!\n", argv[2]);
+    return 2;
+  }
+  double threshold = atof(argv[3]);
+
+  Report baseline, result;
+  parseReport(baselineText, &baseline);
+  parseReport(resultText, &result);
+
+  const char **metrics = defaultMetrics;
+  int metricCount = sizeof(defaultMetrics) / sizeof(defaultMetrics[0]);
+  if (argc > 4) {
+    metrics = (const char**)&argv[4];
+    metricCount = argc - 4;
+  }
+
+  int regressions = 0;
+  printf("%s (threshold %.1f%%)\n", argv[2], threshold);
+  for (int i = 0; i < metricCount; i++) {
+    double before, after;
+    bool inBaseline = findMetric(&baseline, metrics[i], &before);
+    bool inResult = findMetric(&result, metrics[i], &after);
+    if (!inBaseline || !inResult) {
+      // Otherwise a metric that stops being reported drops out of the gate unnoticed
+      printf("  %-16s MISSING from %s\n", metrics[i], inBaseline ? "result" : "baseline");
+      regressions++;
+      continue;
+    }
+
+    // Every metric is a cost, so only increases count
+    double change = before > 0.0 ? (after - before) / before * 100.0 : 0.0;
+    bool regressed = change > threshold;
+    regressions += regressed;
+    printf("  %-16s %12.3f -> %12.3f  %+7.1f%%%s\n", metrics[i], before, after, change, regressed ? "  REGRESSION" : "");
+  }
+
+  free(baselineText);
+  free(resultText);
+  return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// Frustum culling throughput per kernel, in objects culled per second per core.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cull.h"
+
+#define OBJECT_COUNT 1000000
+#define RUNS 9
+
+static double nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static u32 rngState = 0x12345678u;
+static float nextFloat(float min, float max) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return min + (max - min) * ((rngState & 0xFFFFFF) / (float)0xFFFFFF);
+}
+
+// Column-major, right handed, looking down -Z, Vulkan clip space
+static void perspective(float m[16], float fovY, float aspect, float zNear, float zFar) {
+  float f = 1.0f / tanf(fovY * 0.5f);
+  memset(m, 0, sizeof(float) * 16);
+  m[0] = f / aspect;
+  m[5] = -f;
+  m[10] = zFar / (zNear - zFar);
+  m[11] = -1.0f;
+  m[14] = zNear * zFar / (zNear - zFar);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+typedef u32 (*CullFunction)(const void *pSet, const Frustum *pFrustum, u32 count, u32 threads, u32 *pVisible);
+
+static u32 runSpheres(const void *pSet, const Frustum *pFrustum, u32 count, u32 threads, u32 *pVisible) {
+  if (threads > 1) return cullSpheresParallel(pSet, pFrustum, threads, pVisible);
+  return cullSpheres(pSet, pFrustum, 0, count, pVisible);
+}
+
+static u32 runAabbs(const void *pSet, const Frustum *pFrustum, u32 count, u32 threads, u32 *pVisible) {
+  if (threads > 1) return cullAabbsParallel(pSet, pFrustum, threads, pVisible);
+  return cullAabbs(pSet, pFrustum, 0, count, pVisible);
+}
+
+static double measure(CullFunction function, const void *pSet, const Frustum *pFrustum, u32 threads, u32 *pVisible, u32 *pVisibleCount) {
+  double samples[RUNS];
+  for (u32 run = 0; run < RUNS; run++) {
+    double start = nowMs();
+    *pVisibleCount = function(pSet, pFrustum, OBJECT_COUNT, threads, pVisible);
+    samples[run] = nowMs() - start;
+  }
+  qsort(samples, RUNS, sizeof(double), compareDoubles);
+  return samples[RUNS / 2];
+}
+
+int main(void) {
+  CullSpheres spheres;
+  CullAabbs aabbs;
+  cullSpheresInit(&spheres, OBJECT_COUNT);
+  cullAabbsInit(&aabbs, OBJECT_COUNT);
+
+  for (u32 i = 0; i < OBJECT_COUNT; i++) {
+    float x = nextFloat(-200.0f, 200.0f);
+    float y = nextFloat(-200.0f, 200.0f);
+    float z = nextFloat(-200.0f, 200.0f);
+    float r = nextFloat(0.1f, 2.0f);
+    float min[3] = { x - r, y - r, z - r };
+    float max[3] = { x + r, y + r, z + r };
+    cullSpheresAdd(&spheres, x, y, z, r);
+    cullAabbsAdd(&aabbs, min, max);
+  }
+
+  float viewProjection[16];
+  perspective(viewProjection, 1.0f, 16.0f / 9.0f, 0.1f, 150.0f);
+  Frustum frustum;
+  frustumFromViewProjection(&frustum, viewProjection);
+
+  u32 *pVisible = malloc(sizeof(u32) * OBJECT_COUNT);
+  u32 *pReference = malloc(sizeof(u32) * OBJECT_COUNT);
+  u32 threads = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+
+  struct {
+    const char *name;
+    CullFunction function;
+    const void *pSet;
+  } sets[] = {
+    { "sphere", runSpheres, &spheres },
+    { "aabb", runAabbs, &aabbs }
+  };
+
+  printf("%u objects, detected kernel: %s, %u cores\n", OBJECT_COUNT, cullImplName(cullDetectImpl()), threads);
+  printf("%-8s %-8s %8s %10s %12s %14s\n", "shape", "kernel", "threads", "ms", "visible", "Mobj/s/core");
+
+  for (u32 s = 0; s < 2; s++) {
+    u32 referenceCount = 0;
+    cullSetImpl(CULL_IMPL_SCALAR);
+    referenceCount = sets[s].function(sets[s].pSet, &frustum, OBJECT_COUNT, 1, pReference);
+
+    for (u32 impl = 0; impl < CULL_IMPL_COUNT; impl++) {
+      if (!cullSetImpl((CullImpl)impl)) continue;
+
+      u32 configs[2] = { 1, threads };
+      for (u32 c = 0; c < (threads > 1 ? 2u : 1u); c++) {
+        u32 visibleCount = 0;
+        double ms = measure(sets[s].function, sets[s].pSet, &frustum, configs[c], pVisible, &visibleCount);
+
+        if (visibleCount != referenceCount || memcmp(pVisible, pReference, sizeof(u32) * visibleCount) != 0) {
+          printf("%s/%s disagrees with the scalar kernel!\n", sets[s].name, cullImplName((CullImpl)impl));
+          return 1;
+        }
+
+        double perCore = OBJECT_COUNT / (ms / 1000.0) / 1e6 / configs[c];
+        printf("%-8s %-8s %8u %10.3f %12u %14.1f\n", sets[s].name, cullImplName((CullImpl)impl), configs[c], ms, visibleCount, perCore);
+      }
+    }
+  }
+
+  free(pVisible);
+  free(pReference);
+  cullSpheresDestroy(&spheres);
+  cullAabbsDestroy(&aabbs);
+  return 0;
+}
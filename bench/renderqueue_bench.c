@@ -0,0 +1,104 @@
+// Sort cost and state change counts for the render queue at 10k-1M draws.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "renderqueue.h"
+
+#define PASSES 4
+#define PIPELINES 64
+#define MATERIALS 1024
+#define RUNS 7
+
+static double nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// xorshift32, deterministic between runs
+static u32 rngState = 0x9E3779B9u;
+static u32 nextRandom(void) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return rngState;
+}
+
+static void fillQueue(RenderQueue *pQueue, u32 count) {
+  rngState = 0x9E3779B9u;
+  renderQueueReset(pQueue);
+  for (u32 i = 0; i < count; i++) {
+    RenderDraw draw = { .vertexCount = 3, .instanceCount = 1, .objectIndex = i };
+    u32 pass = nextRandom() % PASSES;
+    u32 pipeline = nextRandom() % PIPELINES;
+    u32 material = nextRandom() % MATERIALS;
+    float depth = (nextRandom() & 0xFFFFFF) / (float)0xFFFFFF;
+    renderQueueSubmit(pQueue, renderKeyEncode(pass, pipeline, material, depth), &draw);
+  }
+}
+
+static int compareItems(const void *a, const void *b) {
+  u64 ka = ((const RenderQueueItem*)a)->key;
+  u64 kb = ((const RenderQueueItem*)b)->key;
+  return (ka > kb) - (ka < kb);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+static double median(double *samples, u32 count) {
+  qsort(samples, count, sizeof(double), compareDoubles);
+  return samples[count / 2];
+}
+
+int main(void) {
+  const u32 sizes[] = { 10000, 100000, 1000000 };
+  const RenderQueueCallbacks counting = {0};
+
+  RenderQueue queue;
+  renderQueueInit(&queue, 1024);
+
+  printf("%10s %12s %12s %10s %10s %12s %12s\n",
+    "draws", "radix ms", "qsort ms", "ns/draw", "binds", "unsorted", "sorted");
+
+  for (u32 s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    u32 count = sizes[s];
+    double radixSamples[RUNS];
+    double qsortSamples[RUNS];
+
+    fillQueue(&queue, count);
+    RenderQueueStats unsorted = renderQueueReplay(&queue, &counting);
+
+    for (u32 run = 0; run < RUNS; run++) {
+      fillQueue(&queue, count);
+      double start = nowMs();
+      renderQueueSort(&queue);
+      radixSamples[run] = nowMs() - start;
+
+      fillQueue(&queue, count);
+      start = nowMs();
+      qsort(queue.items, queue.count, sizeof(RenderQueueItem), compareItems);
+      qsortSamples[run] = nowMs() - start;
+    }
+
+    fillQueue(&queue, count);
+    renderQueueSort(&queue);
+    RenderQueueStats sorted = renderQueueReplay(&queue, &counting);
+
+    double radixMs = median(radixSamples, RUNS);
+    u32 unsortedBinds = unsorted.pipelineChanges + unsorted.materialChanges;
+    u32 sortedBinds = sorted.pipelineChanges + sorted.materialChanges;
+    printf("%10u %12.3f %12.3f %10.2f %10s %12u %12u\n",
+      count, radixMs, median(qsortSamples, RUNS), radixMs * 1e6 / count, "", unsortedBinds, sortedBinds);
+    printf("%10s %12s %12s %10s %10s %12u %12u\n", "", "", "", "", "pipeline", unsorted.pipelineChanges, sorted.pipelineChanges);
+    printf("%10s %12s %12s %10s %10s %12u %12u\n", "", "", "", "", "material", unsorted.materialChanges, sorted.materialChanges);
+  }
+
+  renderQueueDestroy(&queue);
+  return 0;
+}
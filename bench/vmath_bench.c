@@ -0,0 +1,149 @@
+// Math library micro-benchmarks: SIMD kernels against the scalar reference.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vmath.h"
+
+#define MATRIX_COUNT 4096
+#define BATCH_COUNT 50000
+#define RUNS 9
+
+static double nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static u32 rngState = 0x12345678u;
+static float nextFloat(float min, float max) {
+  rngState ^= rngState << 13;
+  rngState ^= rngState >> 17;
+  rngState ^= rngState << 5;
+  return min + (max - min) * ((rngState & 0xFFFFFF) / (float)0xFFFFFF);
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double da = *(const double*)a;
+  double db = *(const double*)b;
+  return (da > db) - (da < db);
+}
+
+static double median(double *samples) {
+  qsort(samples, RUNS, sizeof(double), compareDoubles);
+  return samples[RUNS / 2];
+}
+
+// Keeps the compiler from discarding results
+static volatile float sink;
+
+static Mat4 *matrices;
+static Mat4 *results;
+
+static void multiplyScalar(void) {
+  for (u32 i = 0; i + 1 < MATRIX_COUNT; i++) {
+    mat4MultiplyScalar(&results[i], &matrices[i], &matrices[i + 1]);
+  }
+}
+
+static void multiplySimd(void) {
+  for (u32 i = 0; i + 1 < MATRIX_COUNT; i++) {
+    mat4Multiply(&results[i], &matrices[i], &matrices[i + 1]);
+  }
+}
+
+static void inverseScalar(void) {
+  for (u32 i = 0; i < MATRIX_COUNT; i++) {
+    mat4InverseScalar(&results[i], &matrices[i]);
+  }
+}
+
+static void inverseSimd(void) {
+  for (u32 i = 0; i < MATRIX_COUNT; i++) {
+    mat4Inverse(&results[i], &matrices[i]);
+  }
+}
+
+static double timeLoop(void (*function)(void), u32 operations) {
+  double samples[RUNS];
+  for (u32 run = 0; run < RUNS; run++) {
+    double start = nowMs();
+    function();
+    samples[run] = nowMs() - start;
+    sink = results[run].m[0];
+  }
+  return median(samples) * 1000000.0 / operations;
+}
+
+int main(void) {
+  matrices = aligned_alloc(32, sizeof(Mat4) * BATCH_COUNT);
+  results = aligned_alloc(32, sizeof(Mat4) * BATCH_COUNT);
+  Vec4 *points = aligned_alloc(32, sizeof(Vec4) * BATCH_COUNT);
+  Vec4 *transformed = aligned_alloc(32, sizeof(Vec4) * BATCH_COUNT);
+  Vec3 *translations = aligned_alloc(32, sizeof(Vec3) * BATCH_COUNT);
+  Quat *rotations = aligned_alloc(32, sizeof(Quat) * BATCH_COUNT);
+  Vec3 *scales = aligned_alloc(32, sizeof(Vec3) * BATCH_COUNT);
+
+  for (u32 i = 0; i < BATCH_COUNT; i++) {
+    translations[i] = vec3(nextFloat(-100.0f, 100.0f), nextFloat(-100.0f, 100.0f), nextFloat(-100.0f, 100.0f));
+    rotations[i] = quatNormalize((Quat){ nextFloat(-1.0f, 1.0f), nextFloat(-1.0f, 1.0f), nextFloat(-1.0f, 1.0f), nextFloat(-1.0f, 1.0f) });
+    scales[i] = vec3(nextFloat(0.5f, 2.0f), nextFloat(0.5f, 2.0f), nextFloat(0.5f, 2.0f));
+    matrices[i] = mat4Compose(translations[i], rotations[i], scales[i]);
+    points[i] = vec4(nextFloat(-10.0f, 10.0f), nextFloat(-10.0f, 10.0f), nextFloat(-10.0f, 10.0f), 1.0f);
+  }
+
+  Mat4 view = mat4LookAt(vec3(0.0f, 50.0f, 200.0f), vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+  Mat4 projection = mat4Perspective(1.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+  Mat4 viewProjection;
+  mat4Multiply(&viewProjection, &projection, &view);
+
+  printf("detected kernel: %s\n\n", vmathImplName(vmathDetectImpl()));
+  printf("%-24s %10s %10s\n", "single op (ns)", "scalar", "simd");
+  printf("%-24s %10.2f %10.2f\n", "mat4Multiply", timeLoop(multiplyScalar, MATRIX_COUNT - 1), timeLoop(multiplySimd, MATRIX_COUNT - 1));
+  printf("%-24s %10.2f %10.2f\n", "mat4Inverse", timeLoop(inverseScalar, MATRIX_COUNT), timeLoop(inverseSimd, MATRIX_COUNT));
+
+  printf("\n%u objects (ms)         ", BATCH_COUNT);
+  for (u32 impl = 0; impl < VMATH_IMPL_COUNT; impl++) {
+    printf(" %10s", vmathImplName((VmathImpl)impl));
+  }
+  printf("\n");
+
+  const char *names[3] = { "mat4MultiplyBatch", "mat4TransformBatch", "compose + multiply" };
+  for (u32 test = 0; test < 3; test++) {
+    printf("%-24s", names[test]);
+    for (u32 impl = 0; impl < VMATH_IMPL_COUNT; impl++) {
+      if (!vmathSetImpl((VmathImpl)impl)) {
+        printf(" %10s", "-");
+        continue;
+      }
+
+      double samples[RUNS];
+      for (u32 run = 0; run < RUNS; run++) {
+        double start = nowMs();
+        if (test == 0) {
+          mat4MultiplyBatch(results, &viewProjection, matrices, BATCH_COUNT);
+        } else if (test == 1) {
+          mat4TransformBatch(transformed, &viewProjection, points, BATCH_COUNT);
+        } else {
+          // What a frame pays to update every object's transform and MVP
+          mat4ComposeBatch(matrices, translations, rotations, scales, BATCH_COUNT);
+          mat4MultiplyBatch(results, &viewProjection, matrices, BATCH_COUNT);
+        }
+        samples[run] = nowMs() - start;
+      }
+      sink = results[0].m[0] + transformed[0].x;
+      printf(" %10.3f", median(samples));
+    }
+    printf("\n");
+  }
+
+  free(matrices);
+  free(results);
+  free(points);
+  free(transformed);
+  free(translations);
+  free(rotations);
+  free(scales);
+  return 0;
+}
@@ -0,0 +1,337 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "device.h"
+#include "log.h"
+#include "memtrack.h"
+#include "trace.h"
+
+bool captureFormatSupported(VkFormat format) {
+  switch (format) {
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+    case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool isBgra(VkFormat format) {
+  return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+}
+
+// Host cached memory makes the worker's reads fast; plain coherent memory
+// is uncached on many GPUs
+static u32 findReadbackMemory(VkPhysicalDevice physicalDevice, u32 typeBits, bool *pCoherent) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+  VkMemoryPropertyFlags preferred[] = {
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+  };
+  for (u32 p = 0; p < sizeof(preferred) / sizeof(preferred[0]); p++) {
+    for (u32 i = 0; i < memoryProperties.memoryTypeCount; i++) {
+      VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+      if ((typeBits & (1u << i)) && (flags & preferred[p]) == preferred[p]) {
+        *pCoherent = (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+        return i;
+      }
+    }
+  }
+  return UINT32_MAX;
+}
+
+static void destroySlotBuffer(Capture *pCapture, CaptureSlot *pSlot) {
+  if (pSlot->buffer == VK_NULL_HANDLE) return;
+  vkUnmapMemory(pCapture->device, pSlot->memory);
+  vkDestroyBuffer(pCapture->device, pSlot->buffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pCapture->device, pSlot->memory);
+  pSlot->buffer = VK_NULL_HANDLE;
+  pSlot->memory = VK_NULL_HANDLE;
+  pSlot->pMapped = NULL;
+  pSlot->size = 0;
+}
+
+static void createSlotBuffer(Capture *pCapture, CaptureSlot *pSlot, VkDeviceSize size) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  if (vkCreateBuffer(pCapture->device, &bufferInfo, &memoryVulkanCallbacks, &pSlot->buffer) != VK_SUCCESS) {
+    printf("Failed to create capture buffer!\n");
+    exit(24);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pCapture->device, pSlot->buffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = findReadbackMemory(pCapture->physicalDevice, requirements.memoryTypeBits, &pSlot->coherent)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pCapture->device, pCapture->physicalDevice, &allocInfo, MEMORY_TAG_CAPTURE, &pSlot->memory) != VK_SUCCESS ||
+      vkBindBufferMemory(pCapture->device, pSlot->buffer, pSlot->memory, 0) != VK_SUCCESS ||
+      vkMapMemory(pCapture->device, pSlot->memory, 0, VK_WHOLE_SIZE, 0, &pSlot->pMapped) != VK_SUCCESS) {
+    printf("Failed to allocate capture buffer memory!\n");
+    exit(24);
+  }
+  pSlot->size = size;
+}
+
+// Converts one frame to RGB8 a row at a time
+static void writePixels(FILE *file, const CaptureSlot *pSlot, u8 *row) {
+  const u8 *pixels = pSlot->pMapped;
+  bool bgra = isBgra(pSlot->format);
+  for (u32 y = 0; y < pSlot->height; y++) {
+    const u8 *src = pixels + (size_t)y * pSlot->width * 4;
+    for (u32 x = 0; x < pSlot->width; x++) {
+      row[x * 3 + 0] = src[x * 4 + (bgra ? 2 : 0)];
+      row[x * 3 + 1] = src[x * 4 + 1];
+      row[x * 3 + 2] = src[x * 4 + (bgra ? 0 : 2)];
+    }
+    fwrite(row, 3, pSlot->width, file);
+  }
+}
+
+static void writeSlot(Capture *pCapture, const CaptureSlot *pSlot, u8 **pRow, u32 *pRowCapacity) {
+  if (*pRowCapacity < pSlot->width) {
+    memoryFree(*pRow);
+    *pRow = memoryAlloc((size_t)pSlot->width * 3, MEMORY_TAG_CAPTURE);
+    *pRowCapacity = pSlot->width;
+    if (*pRow == NULL) {
+      printf("Failed to allocate capture row!\n");
+      exit(24);
+    }
+  }
+
+  if (pCapture->output == CAPTURE_OUTPUT_RAW) {
+    writePixels(pCapture->pStream, pSlot, *pRow);
+    pCapture->written++;
+    return;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), pCapture->path, pSlot->frame);
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    LOG_ERROR(LOG_CATEGORY_ENGINE, "Failed to open %s for capture", path);
+    return;
+  }
+  fprintf(file, "P6\n%u %u\n255\n", pSlot->width, pSlot->height);
+  writePixels(file, pSlot, *pRow);
+  fclose(file);
+  pCapture->written++;
+}
+
+static void *captureWorker(void *pArg) {
+  Capture *pCapture = pArg;
+  TRACE_THREAD_NAME("capture worker");
+  u8 *row = NULL;
+  u32 rowCapacity = 0;
+
+  for (;;) {
+    pthread_mutex_lock(&pCapture->mutex);
+    while (pCapture->queueHead == pCapture->queueTail && !pCapture->shuttingDown) {
+      pthread_cond_wait(&pCapture->cond, &pCapture->mutex);
+    }
+    // Drain the queue before exiting so no captured frame is lost
+    if (pCapture->queueHead == pCapture->queueTail) {
+      pthread_mutex_unlock(&pCapture->mutex);
+      break;
+    }
+    CaptureSlot *pSlot = &pCapture->slots[pCapture->queue[pCapture->queueHead % CAPTURE_MAX_SLOTS]];
+    pCapture->queueHead++;
+    pthread_mutex_unlock(&pCapture->mutex);
+
+    TRACE_BEGIN("writeCapture");
+    writeSlot(pCapture, pSlot, &row, &rowCapacity);
+    TRACE_END();
+
+    pthread_mutex_lock(&pCapture->mutex);
+    pSlot->state = CAPTURE_SLOT_FREE;
+    pthread_cond_broadcast(&pCapture->cond);
+    pthread_mutex_unlock(&pCapture->mutex);
+  }
+
+  memoryFree(row);
+  return NULL;
+}
+
+void captureInit(Capture *pCapture, const CaptureCreateInfo *pInfo) {
+  memset(pCapture, 0, sizeof(Capture));
+  pCapture->device = pInfo->device;
+  pCapture->physicalDevice = pInfo->physicalDevice;
+  pCapture->slotCount = pInfo->slotCount < CAPTURE_MAX_SLOTS ? pInfo->slotCount : CAPTURE_MAX_SLOTS;
+  pCapture->output = pInfo->output;
+  pCapture->path = pInfo->path;
+  pCapture->firstFrame = pInfo->firstFrame;
+  pCapture->frameCount = pInfo->frameCount;
+
+  if (pCapture->output == CAPTURE_OUTPUT_RAW) {
+    if (strcmp(pCapture->path, "-") == 0) {
+      // Frames get their own copy of stdout, and everything else printed,
+      // the log included, goes to stderr so it can't corrupt the video
+      fflush(stdout);
+      int fd = dup(STDOUT_FILENO);
+      if (fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        printf("Failed to move stdout for capture!\n");
+        exit(24);
+      }
+      pCapture->pStream = fdopen(fd, "wb");
+    } else if (pCapture->path[0] == '|') {
+      pCapture->pStream = popen(pCapture->path + 1, "w");
+      pCapture->streamIsPipe = true;
+    } else {
+      pCapture->pStream = fopen(pCapture->path, "wb");
+    }
+    if (pCapture->pStream == NULL) {
+      printf("Failed to open capture output %s!\n", pCapture->path);
+      exit(24);
+    }
+  }
+
+  pthread_mutex_init(&pCapture->mutex, NULL);
+  pthread_cond_init(&pCapture->cond, NULL);
+  if (pthread_create(&pCapture->worker, NULL, captureWorker, pCapture) != 0) {
+    printf("Failed to start capture thread!\n");
+    exit(24);
+  }
+}
+
+void captureDestroy(Capture *pCapture) {
+  // The device is idle, so every recorded copy has landed
+  for (u32 i = 0; i < pCapture->slotCount; i++) {
+    captureCollect(pCapture, i);
+  }
+
+  pthread_mutex_lock(&pCapture->mutex);
+  pCapture->shuttingDown = true;
+  pthread_cond_broadcast(&pCapture->cond);
+  pthread_mutex_unlock(&pCapture->mutex);
+  pthread_join(pCapture->worker, NULL);
+  pthread_cond_destroy(&pCapture->cond);
+  pthread_mutex_destroy(&pCapture->mutex);
+
+  for (u32 i = 0; i < pCapture->slotCount; i++) {
+    destroySlotBuffer(pCapture, &pCapture->slots[i]);
+  }
+
+  if (pCapture->streamIsPipe) {
+    pclose(pCapture->pStream);
+  } else if (pCapture->pStream != NULL) {
+    fclose(pCapture->pStream);
+  }
+
+  LOG_INFO(LOG_CATEGORY_ENGINE, "Captured %u frames, waited on the writer %u times", pCapture->written, pCapture->stalls);
+}
+
+bool captureWants(const Capture *pCapture, u32 frame) {
+  if (frame < pCapture->firstFrame) return false;
+  return pCapture->frameCount == 0 || frame - pCapture->firstFrame < pCapture->frameCount;
+}
+
+void captureRecord(Capture *pCapture, VkCommandBuffer commandBuffer, u32 slot, VkImage image, VkExtent2D extent, VkFormat format, u32 frame) {
+  CaptureSlot *pSlot = &pCapture->slots[slot];
+
+  pthread_mutex_lock(&pCapture->mutex);
+  if (pSlot->state != CAPTURE_SLOT_FREE) {
+    pCapture->stalls++;
+    while (pSlot->state != CAPTURE_SLOT_FREE) {
+      pthread_cond_wait(&pCapture->cond, &pCapture->mutex);
+    }
+  }
+  pthread_mutex_unlock(&pCapture->mutex);
+
+  // The slot's previous copy has been read, so its buffer can be replaced
+  VkDeviceSize size = (VkDeviceSize)extent.width * extent.height * 4;
+  if (pSlot->size < size) {
+    destroySlotBuffer(pCapture, pSlot);
+    createSlotBuffer(pCapture, pSlot, size);
+  }
+  pSlot->width = extent.width;
+  pSlot->height = extent.height;
+  pSlot->format = format;
+  pSlot->frame = frame;
+
+  VkImageMemoryBarrier toTransfer = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+  };
+  vkCmdPipelineBarrier(
+    commandBuffer,
+    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+    0, 0, NULL, 0, NULL, 1, &toTransfer);
+
+  VkBufferImageCopy region = {
+    .bufferOffset = 0,
+    .bufferRowLength = 0, // Tightly packed
+    .bufferImageHeight = 0,
+    .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+    .imageOffset = { 0, 0, 0 },
+    .imageExtent = { extent.width, extent.height, 1 }
+  };
+  vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, pSlot->buffer, 1, &region);
+
+  VkImageMemoryBarrier toPresent = toTransfer;
+  toPresent.srcAccessMask = 0;
+  toPresent.dstAccessMask = 0;
+  toPresent.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  toPresent.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  VkBufferMemoryBarrier toHost = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = pSlot->buffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE
+  };
+  vkCmdPipelineBarrier(
+    commandBuffer,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+    0, 0, NULL, 1, &toHost, 1, &toPresent);
+
+  pthread_mutex_lock(&pCapture->mutex);
+  pSlot->state = CAPTURE_SLOT_RECORDED;
+  pthread_mutex_unlock(&pCapture->mutex);
+}
+
+void captureCollect(Capture *pCapture, u32 slot) {
+  CaptureSlot *pSlot = &pCapture->slots[slot];
+
+  pthread_mutex_lock(&pCapture->mutex);
+  if (pSlot->state == CAPTURE_SLOT_RECORDED) {
+    if (!pSlot->coherent) {
+      VkMappedMemoryRange range = {
+        .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+        .memory = pSlot->memory,
+        .offset = 0,
+        .size = VK_WHOLE_SIZE
+      };
+      vkInvalidateMappedMemoryRanges(pCapture->device, 1, &range);
+    }
+    pSlot->state = CAPTURE_SLOT_QUEUED;
+    pCapture->queue[pCapture->queueTail % CAPTURE_MAX_SLOTS] = slot;
+    pCapture->queueTail++;
+    pthread_cond_broadcast(&pCapture->cond);
+  }
+  pthread_mutex_unlock(&pCapture->mutex);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+
+#define CAPTURE_MAX_SLOTS 4
+
+typedef enum CaptureOutput {
+  CAPTURE_OUTPUT_PPM = 0, // One image file per frame
+  CAPTURE_OUTPUT_RAW // Tightly packed RGB8 frames back to back, e.g. for ffmpeg -f rawvideo
+} CaptureOutput;
+
+typedef enum CaptureSlotState {
+  CAPTURE_SLOT_FREE = 0,
+  CAPTURE_SLOT_RECORDED, // Copy recorded, its fence not waited on yet
+  CAPTURE_SLOT_QUEUED // Handed to the worker
+} CaptureSlotState;
+
+// A host-visible buffer the frame is copied into, mapped for its lifetime
+typedef struct CaptureSlot {
+  VkBuffer buffer;
+  VkDeviceMemory memory;
+  void *pMapped;
+  VkDeviceSize size;
+  bool coherent;
+  u32 width;
+  u32 height;
+  VkFormat format;
+  u32 frame;
+  CaptureSlotState state; // Guarded by Capture.mutex
+} CaptureSlot;
+
+typedef struct CaptureCreateInfo {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  u32 slotCount; // One per frame in flight
+  CaptureOutput output;
+  // PPM: printf pattern given the frame number, e.g. "frame%05u.ppm".
+  // Raw: a file or FIFO, "-" for stdout or "|command" to pipe into.
+  const char *path;
+  u32 firstFrame;
+  u32 frameCount; // 0 captures every frame from firstFrame on
+} CaptureCreateInfo;
+
+typedef struct Capture {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  CaptureSlot slots[CAPTURE_MAX_SLOTS];
+  u32 slotCount;
+  CaptureOutput output;
+  const char *path;
+  FILE *pStream; // Raw output only
+  bool streamIsPipe;
+  u32 firstFrame;
+  u32 frameCount;
+  u32 stalls; // Times recording waited for the worker to free a slot
+  u32 written;
+
+  // Slots waiting for the worker, in frame order
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  u32 queue[CAPTURE_MAX_SLOTS];
+  u32 queueHead;
+  u32 queueTail;
+  bool shuttingDown;
+  pthread_t worker;
+} Capture;
+
+// 8-bit RGBA and BGRA formats, the ones swap chains use in practice
+bool captureFormatSupported(VkFormat format);
+
+void captureInit(Capture *pCapture, const CaptureCreateInfo *pInfo);
+// The device must be idle. Writes out whatever is still pending first.
+void captureDestroy(Capture *pCapture);
+
+bool captureWants(const Capture *pCapture, u32 frame);
+
+// Records a copy of image into the slot's buffer. The image must be in
+// VK_IMAGE_LAYOUT_PRESENT_SRC_KHR and is left there. Only waits if the
+// worker is still writing the frame this slot held last time.
+void captureRecord(Capture *pCapture, VkCommandBuffer commandBuffer, u32 slot, VkImage image, VkExtent2D extent, VkFormat format, u32 frame);
+
+// Call once the slot's fence has signaled. Hands the copy to the worker.
+void captureCollect(Capture *pCapture, u32 slot);
@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "clusters.h"
+#include "device.h"
+
+static void createBuffer(ClusteredLighting *pLighting, VkPhysicalDevice physicalDevice, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *pBuffer, VkDeviceMemory *pMemory) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  if (vkCreateBuffer(pLighting->device, &bufferInfo, &memoryVulkanCallbacks, pBuffer) != VK_SUCCESS) {
+    printf("Failed to create light buffer!\n");
+    exit(28);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pLighting->device, *pBuffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(physicalDevice, requirements.memoryTypeBits, properties)
+  };
+  if (deviceAllocateMemory(pLighting->device, physicalDevice, &allocInfo, MEMORY_TAG_LIGHTING, pMemory) != VK_SUCCESS ||
+      vkBindBufferMemory(pLighting->device, *pBuffer, *pMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate light buffer memory!\n");
+    exit(28);
+  }
+}
+
+static void createDescriptors(ClusteredLighting *pLighting) {
+  VkDescriptorSetLayoutBinding bindings[4];
+  for (u32 i = 0; i < 4; i++) {
+    bindings[i] = (VkDescriptorSetLayoutBinding){
+      .binding = i,
+      .descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+    };
+  }
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = 4,
+    .pBindings = bindings
+  };
+  if (vkCreateDescriptorSetLayout(pLighting->device, &layoutInfo, &memoryVulkanCallbacks, &pLighting->setLayout) != VK_SUCCESS) {
+    printf("Failed to create light descriptor set layout!\n");
+    exit(28);
+  }
+
+  VkDescriptorPoolSize poolSizes[] = {
+    { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, pLighting->frameCount },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * pLighting->frameCount }
+  };
+  VkDescriptorPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = pLighting->frameCount,
+    .poolSizeCount = 2,
+    .pPoolSizes = poolSizes
+  };
+  if (vkCreateDescriptorPool(pLighting->device, &poolInfo, &memoryVulkanCallbacks, &pLighting->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create light descriptor pool!\n");
+    exit(28);
+  }
+
+  for (u32 i = 0; i < pLighting->frameCount; i++) {
+    ClusterFrame *pFrame = &pLighting->frames[i];
+    VkDescriptorSetAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = pLighting->descriptorPool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &pLighting->setLayout
+    };
+    if (vkAllocateDescriptorSets(pLighting->device, &allocInfo, &pFrame->descriptorSet) != VK_SUCCESS) {
+      printf("Failed to allocate light descriptor set!\n");
+      exit(28);
+    }
+
+    VkDescriptorBufferInfo bufferInfos[4] = {
+      { pFrame->paramsBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->lightBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->clusterBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->indexBuffer, 0, VK_WHOLE_SIZE }
+    };
+    VkWriteDescriptorSet writes[4];
+    for (u32 b = 0; b < 4; b++) {
+      writes[b] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pFrame->descriptorSet,
+        .dstBinding = b,
+        .descriptorCount = 1,
+        .descriptorType = bindings[b].descriptorType,
+        .pBufferInfo = &bufferInfos[b]
+      };
+    }
+    vkUpdateDescriptorSets(pLighting->device, 4, writes, 0, NULL);
+  }
+}
+
+static void createBinningPipeline(ClusteredLighting *pLighting, const ShaderCode *pCode) {
+  VkPipelineLayoutCreateInfo layoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &pLighting->setLayout
+  };
+  if (vkCreatePipelineLayout(pLighting->device, &layoutInfo, &memoryVulkanCallbacks, &pLighting->pipelineLayout) != VK_SUCCESS) {
+    printf("Failed to create light binning pipeline layout!\n");
+    exit(28);
+  }
+
+  VkShaderModuleCreateInfo moduleInfo = {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = pCode->size,
+    .pCode = pCode->words
+  };
+  VkShaderModule module;
+  if (vkCreateShaderModule(pLighting->device, &moduleInfo, &memoryVulkanCallbacks, &module) != VK_SUCCESS) {
+    printf("Failed to create light binning shader module!\n");
+    exit(28);
+  }
+
+  VkComputePipelineCreateInfo pipelineInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = module,
+      .pName = "main"
+    },
+    .layout = pLighting->pipelineLayout
+  };
+  if (vkCreateComputePipelines(pLighting->device, VK_NULL_HANDLE, 1, &pipelineInfo, &memoryVulkanCallbacks, &pLighting->pipeline) != VK_SUCCESS) {
+    printf("Failed to create light binning pipeline!\n");
+    exit(28);
+  }
+  vkDestroyShaderModule(pLighting->device, module, &memoryVulkanCallbacks);
+}
+
+void clusteredLightingInit(ClusteredLighting *pLighting, const ClusteredLightingCreateInfo *pInfo) {
+  memset(pLighting, 0, sizeof(ClusteredLighting));
+  pLighting->device = pInfo->device;
+  pLighting->frameCount = pInfo->frameCount < CLUSTER_MAX_FRAMES ? pInfo->frameCount : CLUSTER_MAX_FRAMES;
+  pLighting->maxLights = pInfo->maxLights > 0 ? pInfo->maxLights : 1;
+
+  VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (u32 i = 0; i < pLighting->frameCount; i++) {
+    ClusterFrame *pFrame = &pLighting->frames[i];
+    createBuffer(pLighting, pInfo->physicalDevice, sizeof(ClusterParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                 hostVisible, &pFrame->paramsBuffer, &pFrame->paramsMemory);
+    createBuffer(pLighting, pInfo->physicalDevice, sizeof(Light) * pLighting->maxLights, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 hostVisible, &pFrame->lightBuffer, &pFrame->lightMemory);
+    createBuffer(pLighting, pInfo->physicalDevice, sizeof(u32) * 2 * CLUSTER_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pFrame->clusterBuffer, &pFrame->clusterMemory);
+    // Every cluster owns CLUSTER_MAX_LIGHTS slots, so there is no counter to
+    // reset with a transfer that would wait for the swap chain image
+    createBuffer(pLighting, pInfo->physicalDevice, sizeof(u32) * CLUSTER_COUNT * CLUSTER_MAX_LIGHTS, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pFrame->indexBuffer, &pFrame->indexMemory);
+
+    void *pParams, *pLights;
+    if (vkMapMemory(pLighting->device, pFrame->paramsMemory, 0, VK_WHOLE_SIZE, 0, &pParams) != VK_SUCCESS ||
+        vkMapMemory(pLighting->device, pFrame->lightMemory, 0, VK_WHOLE_SIZE, 0, &pLights) != VK_SUCCESS) {
+      printf("Failed to map light buffers!\n");
+      exit(28);
+    }
+    pFrame->pParams = pParams;
+    pFrame->pLights = pLights;
+    memset(pFrame->pParams, 0, sizeof(ClusterParams));
+  }
+
+  createDescriptors(pLighting);
+  createBinningPipeline(pLighting, pInfo->pBinningShader);
+}
+
+void clusteredLightingDestroy(ClusteredLighting *pLighting) {
+  vkDestroyPipeline(pLighting->device, pLighting->pipeline, &memoryVulkanCallbacks);
+  vkDestroyPipelineLayout(pLighting->device, pLighting->pipelineLayout, &memoryVulkanCallbacks);
+  vkDestroyDescriptorPool(pLighting->device, pLighting->descriptorPool, &memoryVulkanCallbacks);
+  vkDestroyDescriptorSetLayout(pLighting->device, pLighting->setLayout, &memoryVulkanCallbacks);
+  for (u32 i = 0; i < pLighting->frameCount; i++) {
+    ClusterFrame *pFrame = &pLighting->frames[i];
+    vkUnmapMemory(pLighting->device, pFrame->paramsMemory);
+    vkUnmapMemory(pLighting->device, pFrame->lightMemory);
+    vkDestroyBuffer(pLighting->device, pFrame->paramsBuffer, &memoryVulkanCallbacks);
+    vkDestroyBuffer(pLighting->device, pFrame->lightBuffer, &memoryVulkanCallbacks);
+    vkDestroyBuffer(pLighting->device, pFrame->clusterBuffer, &memoryVulkanCallbacks);
+    vkDestroyBuffer(pLighting->device, pFrame->indexBuffer, &memoryVulkanCallbacks);
+    deviceFreeMemory(pLighting->device, pFrame->paramsMemory);
+    deviceFreeMemory(pLighting->device, pFrame->lightMemory);
+    deviceFreeMemory(pLighting->device, pFrame->clusterMemory);
+    deviceFreeMemory(pLighting->device, pFrame->indexMemory);
+  }
+  memset(pLighting, 0, sizeof(ClusteredLighting));
+}
+
+void clusteredLightingUpdate(ClusteredLighting *pLighting, u32 frame, const Light *lights, u32 lightCount, const Mat4 *pView, const Mat4 *pProjection, VkExtent2D extent, float zNear, float zFar) {
+  ClusterFrame *pFrame = &pLighting->frames[frame];
+  if (lightCount > pLighting->maxLights) lightCount = pLighting->maxLights;
+  memcpy(pFrame->pLights, lights, sizeof(Light) * lightCount);
+
+  ClusterParams params = {0};
+  params.view = *pView;
+  mat4Inverse(&params.inverseProjection, pProjection);
+  params.screen[0] = (float)extent.width;
+  params.screen[1] = (float)extent.height;
+  params.screen[2] = zNear;
+  params.screen[3] = zFar;
+  float logRange = logf(zFar / zNear);
+  params.slicing[0] = CLUSTER_GRID_Z / logRange;
+  params.slicing[1] = CLUSTER_GRID_Z * logf(zNear) / logRange;
+  params.lightCount = lightCount;
+  memcpy(pFrame->pParams, &params, sizeof(ClusterParams));
+}
+
+void clusteredLightingRecord(ClusteredLighting *pLighting, VkCommandBuffer commandBuffer, u32 frame) {
+  ClusterFrame *pFrame = &pLighting->frames[frame];
+
+  // The frame's previous shading finished before its fence signaled, so
+  // overwriting its lists needs no barrier
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pLighting->pipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pLighting->pipelineLayout, 0, 1,
+                          &pFrame->descriptorSet, 0, NULL);
+  vkCmdDispatch(commandBuffer, (CLUSTER_COUNT + CLUSTER_WORKGROUP_SIZE - 1) / CLUSTER_WORKGROUP_SIZE, 1, 1);
+
+  VkMemoryBarrier binnedBarrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                       1, &binnedBarrier, 0, NULL, 0, NULL);
+}
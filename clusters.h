@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+#include "vmath.h"
+#include "shadercode.h"
+
+// The view frustum is cut into a grid of clusters, tiles across the screen
+// and exponential slices in depth. A compute pass lists the lights touching
+// each cluster so the fragment shader only shades those. Sizes match
+// shaders/clusters.glsl.
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define CLUSTER_MAX_LIGHTS 64 // Per cluster, further lights are dropped
+#define CLUSTER_WORKGROUP_SIZE 128
+#define CLUSTER_MAX_FRAMES 4
+
+// Matches Light in shaders/clusters.glsl
+typedef struct Light {
+  float position[3]; // World space
+  float radius; // No contribution beyond it
+  float color[3];
+  float padding;
+} Light;
+
+// Matches the ClusterParams uniform block
+typedef struct ClusterParams {
+  Mat4 view;
+  Mat4 inverseProjection;
+  float screen[4]; // Render width, height, near, far
+  float slicing[4]; // Slice = log(depth) * slicing[0] - slicing[1]
+  u32 lightCount;
+} ClusterParams;
+
+// Everything one frame in flight reads and writes
+typedef struct ClusterFrame {
+  VkBuffer paramsBuffer;
+  VkDeviceMemory paramsMemory;
+  ClusterParams *pParams; // Mapped
+  VkBuffer lightBuffer;
+  VkDeviceMemory lightMemory;
+  Light *pLights; // Mapped
+  VkBuffer clusterBuffer;
+  VkDeviceMemory clusterMemory;
+  VkBuffer indexBuffer; // Every cluster's light indices
+  VkDeviceMemory indexMemory;
+  VkDescriptorSet descriptorSet;
+} ClusterFrame;
+
+typedef struct ClusteredLightingCreateInfo {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  u32 frameCount; // One per frame in flight
+  u32 maxLights;
+  const ShaderCode *pBinningShader;
+} ClusteredLightingCreateInfo;
+
+typedef struct ClusteredLighting {
+  VkDevice device;
+  VkDescriptorSetLayout setLayout; // Set 0 of pipelines that shade with the lights
+  VkDescriptorPool descriptorPool;
+  VkPipelineLayout pipelineLayout;
+  VkPipeline pipeline;
+  ClusterFrame frames[CLUSTER_MAX_FRAMES];
+  u32 frameCount;
+  u32 maxLights;
+} ClusteredLighting;
+
+void clusteredLightingInit(ClusteredLighting *pLighting, const ClusteredLightingCreateInfo *pInfo);
+// The device must be idle
+void clusteredLightingDestroy(ClusteredLighting *pLighting);
+
+// Writes the frame's lights and camera. The frame's previous submission
+// must have completed. Lights beyond maxLights are ignored.
+void clusteredLightingUpdate(ClusteredLighting *pLighting, u32 frame, const Light *lights, u32 lightCount, const Mat4 *pView, const Mat4 *pProjection, VkExtent2D extent, float zNear, float zFar);
+
+// Records the binning pass. Call outside a render pass, before the draws
+// that use the frame's descriptor set.
+void clusteredLightingRecord(ClusteredLighting *pLighting, VkCommandBuffer commandBuffer, u32 frame);
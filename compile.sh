@@ -1,2 +0,0 @@
-/home/moosch/bin/vulkan/1.3.224.1/x86_64/bin/glslc shaders/shader.vert -o shaders/vert.spv
-/home/moosch/bin/vulkan/1.3.224.1/x86_64/bin/glslc shaders/shader.frag -o shaders/frag.spv
@@ -0,0 +1,160 @@
+// Converts OBJ and glTF meshes into the engine's cooked mesh format: LODs,
+// triangles ordered for the vertex cache and overdraw, vertices in fetch
+// order and quantized.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "import.h"
+#include "mesh.h"
+#include "meshopt.h"
+#include "meshfile.h"
+
+u32 importAddVertex(ImportedMesh *pMesh, const MeshVertex *pVertex) {
+  if (pMesh->vertexCount == pMesh->vertexCapacity) {
+    pMesh->vertexCapacity = pMesh->vertexCapacity > 0 ? pMesh->vertexCapacity * 2 : 1024;
+    pMesh->vertices = realloc(pMesh->vertices, sizeof(MeshVertex) * pMesh->vertexCapacity);
+    if (pMesh->vertices == NULL) {
+      printf("Out of memory\n");
+      exit(2);
+    }
+  }
+  pMesh->vertices[pMesh->vertexCount] = *pVertex;
+  return pMesh->vertexCount++;
+}
+
+void importAddIndex(ImportedMesh *pMesh, u32 index) {
+  if (pMesh->indexCount == pMesh->indexCapacity) {
+    pMesh->indexCapacity = pMesh->indexCapacity > 0 ? pMesh->indexCapacity * 2 : 3072;
+    pMesh->indices = realloc(pMesh->indices, sizeof(u32) * pMesh->indexCapacity);
+    if (pMesh->indices == NULL) {
+      printf("Out of memory\n");
+      exit(2);
+    }
+  }
+  pMesh->indices[pMesh->indexCount++] = index;
+}
+
+void importedMeshDestroy(ImportedMesh *pMesh) {
+  free(pMesh->vertices);
+  free(pMesh->indices);
+  memset(pMesh, 0, sizeof(ImportedMesh));
+}
+
+char *importReadFile(const char *path, size_t *pSize) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+  char *bytes = malloc(size + 1);
+  if (bytes == NULL || fread(bytes, 1, size, file) != (size_t)size) {
+    free(bytes);
+    fclose(file);
+    return NULL;
+  }
+  bytes[size] = '\0';
+  fclose(file);
+  *pSize = size;
+  return bytes;
+}
+
+// Area weighted, shared by every corner that uses a vertex
+static void generateNormals(ImportedMesh *pMesh) {
+  for (u32 v = 0; v < pMesh->vertexCount; v++) {
+    memset(pMesh->vertices[v].normal, 0, sizeof(pMesh->vertices[v].normal));
+  }
+  for (u32 i = 0; i + 2 < pMesh->indexCount; i += 3) {
+    const float *p0 = pMesh->vertices[pMesh->indices[i]].position;
+    const float *p1 = pMesh->vertices[pMesh->indices[i + 1]].position;
+    const float *p2 = pMesh->vertices[pMesh->indices[i + 2]].position;
+    float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+    for (u32 k = 0; k < 3; k++) {
+      float *normal = pMesh->vertices[pMesh->indices[i + k]].normal;
+      normal[0] += n[0];
+      normal[1] += n[1];
+      normal[2] += n[2];
+    }
+  }
+}
+
+static bool hasSuffix(const char *s, const char *suffix) {
+  size_t length = strlen(s), suffixLength = strlen(suffix);
+  return length >= suffixLength && strcasecmp(s + length - suffixLength, suffix) == 0;
+}
+
+static void usage(const char *program) {
+  printf("Usage: %s [--lods n] [--float-positions] input.obj|input.gltf|input.glb output.mesh\n", program);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  u32 maxLods = MESH_MAX_LODS;
+  bool allowHalfPositions = true;
+  const char *inputPath = NULL;
+  const char *outputPath = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--lods") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+      maxLods = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--float-positions") == 0) {
+      allowHalfPositions = false;
+    } else if (inputPath == NULL) {
+      inputPath = argv[i];
+    } else if (outputPath == NULL) {
+      outputPath = argv[i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (inputPath == NULL || outputPath == NULL) {
+    usage(argv[0]);
+  }
+
+  ImportedMesh imported = {0};
+  bool ok;
+  if (hasSuffix(inputPath, ".obj")) {
+    ok = importObj(inputPath, &imported);
+  } else if (hasSuffix(inputPath, ".gltf") || hasSuffix(inputPath, ".glb")) {
+    ok = importGltf(inputPath, &imported);
+  } else {
+    printf("%s: unknown file type\n", inputPath);
+    ok = false;
+  }
+  if (!ok) {
+    return 2;
+  }
+  if (imported.indexCount == 0) {
+    printf("%s: no triangles\n", inputPath);
+    return 2;
+  }
+  if (!imported.hasNormals) {
+    generateNormals(&imported);
+  }
+
+  float missRatioBefore = meshCacheMissRatio(imported.indices, imported.indexCount, imported.vertexCount);
+  MeshData data;
+  meshBuild(imported.vertices, imported.vertexCount, imported.indices, imported.indexCount, maxLods, allowHalfPositions, &data);
+  const MeshLod *pFull = &data.lods[0];
+  float missRatioAfter = meshCacheMissRatio(data.indices + pFull->firstIndex, pFull->indexCount, data.vertexCount);
+
+  printf("%s: %u vertices, %u triangles\n", inputPath, imported.vertexCount, imported.indexCount / 3);
+  printf("  vertices: %u used, %u bytes each (was %zu), %s positions\n", data.vertexCount, meshVertexStride(data.vertexFormat),
+    sizeof(MeshVertex), data.vertexFormat == MESH_VERTEX_FORMAT_PACKED ? "half float" : "float");
+  printf("  cache misses per triangle: %.3f -> %.3f\n", missRatioBefore, missRatioAfter);
+  for (u32 i = 0; i < data.lodCount; i++) {
+    printf("  lod %u: %u triangles, error %g\n", i, data.lods[i].indexCount / 3, data.lods[i].error);
+  }
+
+  bool written = meshFileWrite(outputPath, &data);
+  meshDataDestroy(&data);
+  importedMeshDestroy(&imported);
+  if (!written) {
+    printf("Failed to write %s\n", outputPath);
+    return 3;
+  }
+  return 0;
+}
@@ -0,0 +1,577 @@
+// glTF 2.0, as .gltf with external or base64 embedded buffers or as .glb.
+// Every triangle primitive of every mesh in the default scene is merged,
+// with node transforms applied. Sparse accessors aren't supported.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "import.h"
+
+#define GLB_MAGIC 0x46546C67 // "glTF"
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+#define GLTF_MAX_DEPTH 64 // Node hierarchy, guards against cycles
+
+typedef enum JsonType {
+  JSON_NULL = 0,
+  JSON_BOOL,
+  JSON_NUMBER,
+  JSON_STRING,
+  JSON_ARRAY,
+  JSON_OBJECT
+} JsonType;
+
+// Values are stored depth first. An object's children alternate key and
+// value; next skips a value and everything inside it.
+typedef struct JsonToken {
+  JsonType type;
+  u32 start; // Strings exclude the quotes and aren't unescaped
+  u32 end;
+  u32 size; // Array elements or object members
+  u32 next;
+} JsonToken;
+
+typedef struct Json {
+  const char *text;
+  u32 length;
+  u32 position;
+  JsonToken *tokens;
+  u32 count;
+  u32 capacity;
+} Json;
+
+static void jsonSkipSpace(Json *pJson) {
+  while (pJson->position < pJson->length && strchr(" \t\r\n", pJson->text[pJson->position]) != NULL) {
+    pJson->position++;
+  }
+}
+
+static u32 jsonAddToken(Json *pJson, JsonType type) {
+  if (pJson->count == pJson->capacity) {
+    pJson->capacity = pJson->capacity > 0 ? pJson->capacity * 2 : 1024;
+    pJson->tokens = realloc(pJson->tokens, sizeof(JsonToken) * pJson->capacity);
+    if (pJson->tokens == NULL) {
+      printf("Out of memory\n");
+      exit(2);
+    }
+  }
+  pJson->tokens[pJson->count] = (JsonToken){ .type = type, .start = pJson->position };
+  return pJson->count++;
+}
+
+static bool jsonParseValue(Json *pJson, u32 depth);
+
+static bool jsonParseString(Json *pJson) {
+  u32 token = jsonAddToken(pJson, JSON_STRING);
+  pJson->position++;
+  pJson->tokens[token].start = pJson->position;
+  while (pJson->position < pJson->length && pJson->text[pJson->position] != '"') {
+    pJson->position += pJson->text[pJson->position] == '\\' ? 2 : 1;
+  }
+  if (pJson->position >= pJson->length) return false;
+  pJson->tokens[token].end = pJson->position++;
+  pJson->tokens[token].next = pJson->count;
+  return true;
+}
+
+static bool jsonParseContainer(Json *pJson, JsonType type, u32 depth) {
+  char close = type == JSON_OBJECT ? '}' : ']';
+  u32 token = jsonAddToken(pJson, type);
+  u32 size = 0;
+  pJson->position++;
+  jsonSkipSpace(pJson);
+  if (pJson->position < pJson->length && pJson->text[pJson->position] == close) {
+    pJson->position++;
+  } else {
+    for (;;) {
+      if (type == JSON_OBJECT) {
+        jsonSkipSpace(pJson);
+        if (pJson->position >= pJson->length || pJson->text[pJson->position] != '"' || !jsonParseString(pJson)) return false;
+        jsonSkipSpace(pJson);
+        if (pJson->position >= pJson->length || pJson->text[pJson->position++] != ':') return false;
+      }
+      if (!jsonParseValue(pJson, depth + 1)) return false;
+      size++;
+      jsonSkipSpace(pJson);
+      if (pJson->position >= pJson->length) return false;
+      char c = pJson->text[pJson->position++];
+      if (c == close) break;
+      if (c != ',') return false;
+    }
+  }
+  pJson->tokens[token].size = size;
+  pJson->tokens[token].end = pJson->position;
+  pJson->tokens[token].next = pJson->count;
+  return true;
+}
+
+static bool jsonParseValue(Json *pJson, u32 depth) {
+  jsonSkipSpace(pJson);
+  if (pJson->position >= pJson->length || depth > GLTF_MAX_DEPTH) return false;
+  char c = pJson->text[pJson->position];
+  if (c == '{') return jsonParseContainer(pJson, JSON_OBJECT, depth);
+  if (c == '[') return jsonParseContainer(pJson, JSON_ARRAY, depth);
+  if (c == '"') return jsonParseString(pJson);
+
+  JsonType type = JSON_NUMBER;
+  if (c == 't' || c == 'f') type = JSON_BOOL;
+  else if (c == 'n') type = JSON_NULL;
+  else if (c != '-' && (c < '0' || c > '9')) return false;
+  u32 token = jsonAddToken(pJson, type);
+  while (pJson->position < pJson->length && strchr(",]} \t\r\n", pJson->text[pJson->position]) == NULL) {
+    pJson->position++;
+  }
+  pJson->tokens[token].end = pJson->position;
+  pJson->tokens[token].next = pJson->count;
+  return true;
+}
+
+// Member of an object, or UINT32_MAX
+static u32 jsonMember(const Json *pJson, u32 object, const char *key) {
+  if (object == UINT32_MAX || pJson->tokens[object].type != JSON_OBJECT) return UINT32_MAX;
+  size_t keyLength = strlen(key);
+  u32 t = object + 1;
+  for (u32 i = 0; i < pJson->tokens[object].size; i++) {
+    const JsonToken *pKey = &pJson->tokens[t];
+    if (pKey->end - pKey->start == keyLength && memcmp(pJson->text + pKey->start, key, keyLength) == 0) {
+      return t + 1;
+    }
+    t = pJson->tokens[t + 1].next;
+  }
+  return UINT32_MAX;
+}
+
+// Element of an array, or UINT32_MAX
+static u32 jsonElement(const Json *pJson, u32 array, u32 index) {
+  if (array == UINT32_MAX || pJson->tokens[array].type != JSON_ARRAY || index >= pJson->tokens[array].size) return UINT32_MAX;
+  u32 t = array + 1;
+  for (u32 i = 0; i < index; i++) {
+    t = pJson->tokens[t].next;
+  }
+  return t;
+}
+
+static double jsonNumber(const Json *pJson, u32 token, double fallback) {
+  if (token == UINT32_MAX || pJson->tokens[token].type != JSON_NUMBER) return fallback;
+  return strtod(pJson->text + pJson->tokens[token].start, NULL);
+}
+
+static bool jsonStringEquals(const Json *pJson, u32 token, const char *s) {
+  if (token == UINT32_MAX || pJson->tokens[token].type != JSON_STRING) return false;
+  size_t length = strlen(s);
+  return pJson->tokens[token].end - pJson->tokens[token].start == length && memcmp(pJson->text + pJson->tokens[token].start, s, length) == 0;
+}
+
+static u32 jsonCount(const Json *pJson, u32 token) {
+  return token == UINT32_MAX ? 0 : pJson->tokens[token].size;
+}
+
+typedef struct Buffer {
+  u8 *bytes;
+  size_t size;
+} Buffer;
+
+typedef struct Gltf {
+  const char *path;
+  Json json;
+  Buffer *buffers;
+  u32 bufferCount;
+} Gltf;
+
+static int base64Value(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '+') return 62;
+  if (c == '/') return 63;
+  return -1;
+}
+
+static bool decodeBase64(const char *text, u32 length, Buffer *pBuffer) {
+  pBuffer->bytes = malloc(length / 4 * 3 + 3);
+  pBuffer->size = 0;
+  if (pBuffer->bytes == NULL) return false;
+  u32 bits = 0, bitCount = 0;
+  for (u32 i = 0; i < length && text[i] != '='; i++) {
+    int value = base64Value(text[i]);
+    if (value < 0) return false;
+    bits = (bits << 6) | (u32)value;
+    bitCount += 6;
+    if (bitCount >= 8) {
+      bitCount -= 8;
+      pBuffer->bytes[pBuffer->size++] = (u8)(bits >> bitCount);
+    }
+  }
+  return true;
+}
+
+// uri is relative to the .gltf and may be percent encoded
+static bool loadExternalBuffer(const Gltf *pGltf, const char *uri, u32 length, Buffer *pBuffer) {
+  const char *slash = strrchr(pGltf->path, '/');
+  size_t directoryLength = slash != NULL ? (size_t)(slash - pGltf->path + 1) : 0;
+  char *path = malloc(directoryLength + length + 1);
+  if (path == NULL) return false;
+  memcpy(path, pGltf->path, directoryLength);
+  size_t n = directoryLength;
+  for (u32 i = 0; i < length; i++) {
+    unsigned hex;
+    if (uri[i] == '%' && i + 2 < length && sscanf(uri + i + 1, "%2x", &hex) == 1) {
+      path[n++] = (char)hex;
+      i += 2;
+    } else {
+      path[n++] = uri[i];
+    }
+  }
+  path[n] = '\0';
+  pBuffer->bytes = (u8*)importReadFile(path, &pBuffer->size);
+  if (pBuffer->bytes == NULL) {
+    printf("%s: can't read buffer %s\n", pGltf->path, path);
+  }
+  free(path);
+  return pBuffer->bytes != NULL;
+}
+
+static bool loadBuffers(Gltf *pGltf, u8 *glbBinary, size_t glbBinarySize) {
+  const Json *pJson = &pGltf->json;
+  u32 buffers = jsonMember(pJson, 0, "buffers");
+  pGltf->bufferCount = jsonCount(pJson, buffers);
+  pGltf->buffers = calloc(pGltf->bufferCount + 1, sizeof(Buffer));
+  if (pGltf->buffers == NULL) return false;
+
+  for (u32 i = 0; i < pGltf->bufferCount; i++) {
+    u32 buffer = jsonElement(pJson, buffers, i);
+    u32 uri = jsonMember(pJson, buffer, "uri");
+    double byteLength = jsonNumber(pJson, jsonMember(pJson, buffer, "byteLength"), 0.0);
+    Buffer *pBuffer = &pGltf->buffers[i];
+    if (uri == UINT32_MAX) {
+      // Only the first buffer of a .glb may leave out its uri
+      if (i != 0 || glbBinary == NULL) return false;
+      pBuffer->bytes = glbBinary;
+      pBuffer->size = glbBinarySize;
+    } else {
+      const char *text = pJson->text + pJson->tokens[uri].start;
+      u32 length = pJson->tokens[uri].end - pJson->tokens[uri].start;
+      const char *base64 = strncmp(text, "data:", 5) == 0 ? strstr(text, ";base64,") : NULL;
+      bool loaded = base64 != NULL && base64 < text + length
+        ? decodeBase64(base64 + 8, length - (u32)(base64 + 8 - text), pBuffer)
+        : loadExternalBuffer(pGltf, text, length, pBuffer);
+      if (!loaded) return false;
+    }
+    if (pBuffer->size < (size_t)byteLength) return false;
+  }
+  return true;
+}
+
+typedef struct Accessor {
+  const u8 *bytes;
+  u32 count;
+  u32 components;
+  u32 componentType;
+  u32 componentSize;
+  u32 stride;
+  bool normalized;
+} Accessor;
+
+static u32 componentSize(u32 componentType) {
+  switch (componentType) {
+    case 5120: case 5121: return 1; // byte, unsigned byte
+    case 5122: case 5123: return 2; // short, unsigned short
+    case 5125: case 5126: return 4; // unsigned int, float
+    default: return 0;
+  }
+}
+
+static u32 typeComponents(const Json *pJson, u32 type) {
+  if (jsonStringEquals(pJson, type, "SCALAR")) return 1;
+  if (jsonStringEquals(pJson, type, "VEC2")) return 2;
+  if (jsonStringEquals(pJson, type, "VEC3")) return 3;
+  if (jsonStringEquals(pJson, type, "VEC4")) return 4;
+  return 0;
+}
+
+static bool resolveAccessor(const Gltf *pGltf, double index, Accessor *pAccessor) {
+  const Json *pJson = &pGltf->json;
+  u32 accessor = jsonElement(pJson, jsonMember(pJson, 0, "accessors"), index >= 0.0 ? (u32)index : UINT32_MAX);
+  if (accessor == UINT32_MAX || jsonMember(pJson, accessor, "sparse") != UINT32_MAX) return false;
+  u32 view = jsonElement(pJson, jsonMember(pJson, 0, "bufferViews"), (u32)jsonNumber(pJson, jsonMember(pJson, accessor, "bufferView"), -1.0));
+  if (view == UINT32_MAX) return false;
+  u32 buffer = (u32)jsonNumber(pJson, jsonMember(pJson, view, "buffer"), -1.0);
+  if (buffer >= pGltf->bufferCount) return false;
+
+  pAccessor->count = (u32)jsonNumber(pJson, jsonMember(pJson, accessor, "count"), 0.0);
+  pAccessor->components = typeComponents(pJson, jsonMember(pJson, accessor, "type"));
+  pAccessor->componentType = (u32)jsonNumber(pJson, jsonMember(pJson, accessor, "componentType"), 0.0);
+  pAccessor->componentSize = componentSize(pAccessor->componentType);
+  u32 normalized = jsonMember(pJson, accessor, "normalized");
+  pAccessor->normalized = normalized != UINT32_MAX && pJson->text[pJson->tokens[normalized].start] == 't';
+  u32 elementSize = pAccessor->components * pAccessor->componentSize;
+  pAccessor->stride = (u32)jsonNumber(pJson, jsonMember(pJson, view, "byteStride"), elementSize);
+  if (elementSize == 0 || pAccessor->stride < elementSize) return false;
+
+  size_t viewOffset = (size_t)jsonNumber(pJson, jsonMember(pJson, view, "byteOffset"), 0.0);
+  size_t viewLength = (size_t)jsonNumber(pJson, jsonMember(pJson, view, "byteLength"), 0.0);
+  size_t offset = (size_t)jsonNumber(pJson, jsonMember(pJson, accessor, "byteOffset"), 0.0);
+  size_t used = pAccessor->count > 0 ? offset + (size_t)pAccessor->stride * (pAccessor->count - 1) + elementSize : 0;
+  if (viewOffset + viewLength > pGltf->buffers[buffer].size || used > viewLength) return false;
+  pAccessor->bytes = pGltf->buffers[buffer].bytes + viewOffset + offset;
+  return true;
+}
+
+static float readComponent(const Accessor *pAccessor, u32 element, u32 component) {
+  const u8 *p = pAccessor->bytes + (size_t)pAccessor->stride * element + pAccessor->componentSize * component;
+  float value, scale;
+  switch (pAccessor->componentType) {
+    case 5120: { i8 v; memcpy(&v, p, 1); value = v; scale = 127.0f; break; }
+    case 5121: { u8 v; memcpy(&v, p, 1); value = v; scale = 255.0f; break; }
+    case 5122: { i16 v; memcpy(&v, p, 2); value = v; scale = 32767.0f; break; }
+    case 5123: { u16 v; memcpy(&v, p, 2); value = v; scale = 65535.0f; break; }
+    case 5125: { u32 v; memcpy(&v, p, 4); value = (float)v; scale = 1.0f; break; }
+    default: memcpy(&value, p, 4); scale = 1.0f; break;
+  }
+  if (pAccessor->normalized && scale != 1.0f) {
+    value = fmaxf(value / scale, -1.0f);
+  }
+  return value;
+}
+
+// Indices are unsigned bytes, shorts or ints, exact past a float's 2^24
+static u32 readIndex(const Accessor *pAccessor, u32 element) {
+  const u8 *p = pAccessor->bytes + (size_t)pAccessor->stride * element;
+  switch (pAccessor->componentType) {
+    case 5121: return *p;
+    case 5123: { u16 v; memcpy(&v, p, 2); return v; }
+    default: { u32 v; memcpy(&v, p, 4); return v; }
+  }
+}
+
+// Column major, as glTF stores them
+typedef struct Transform {
+  double m[16];
+} Transform;
+
+static Transform transformMultiply(const Transform *pA, const Transform *pB) {
+  Transform result;
+  for (u32 c = 0; c < 4; c++) {
+    for (u32 r = 0; r < 4; r++) {
+      double sum = 0.0;
+      for (u32 k = 0; k < 4; k++) sum += pA->m[k * 4 + r] * pB->m[c * 4 + k];
+      result.m[c * 4 + r] = sum;
+    }
+  }
+  return result;
+}
+
+static Transform nodeTransform(const Json *pJson, u32 node) {
+  Transform t = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 } };
+  u32 matrix = jsonMember(pJson, node, "matrix");
+  if (jsonCount(pJson, matrix) == 16) {
+    for (u32 i = 0; i < 16; i++) t.m[i] = jsonNumber(pJson, jsonElement(pJson, matrix, i), t.m[i]);
+    return t;
+  }
+
+  double translation[3] = { 0, 0, 0 }, rotation[4] = { 0, 0, 0, 1 }, scale[3] = { 1, 1, 1 };
+  u32 member = jsonMember(pJson, node, "translation");
+  for (u32 i = 0; i < 3; i++) translation[i] = jsonNumber(pJson, jsonElement(pJson, member, i), translation[i]);
+  member = jsonMember(pJson, node, "rotation");
+  for (u32 i = 0; i < 4; i++) rotation[i] = jsonNumber(pJson, jsonElement(pJson, member, i), rotation[i]);
+  member = jsonMember(pJson, node, "scale");
+  for (u32 i = 0; i < 3; i++) scale[i] = jsonNumber(pJson, jsonElement(pJson, member, i), scale[i]);
+
+  double x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+  double r[9] = {
+    1 - 2 * (y * y + z * z), 2 * (x * y + z * w), 2 * (x * z - y * w),
+    2 * (x * y - z * w), 1 - 2 * (x * x + z * z), 2 * (y * z + x * w),
+    2 * (x * z + y * w), 2 * (y * z - x * w), 1 - 2 * (x * x + y * y)
+  };
+  for (u32 c = 0; c < 3; c++) {
+    for (u32 k = 0; k < 3; k++) t.m[c * 4 + k] = r[c * 3 + k] * scale[c];
+  }
+  t.m[12] = translation[0];
+  t.m[13] = translation[1];
+  t.m[14] = translation[2];
+  return t;
+}
+
+static bool importPrimitive(const Gltf *pGltf, u32 primitive, const Transform *pTransform, ImportedMesh *pMesh) {
+  const Json *pJson = &pGltf->json;
+  if (jsonNumber(pJson, jsonMember(pJson, primitive, "mode"), 4.0) != 4.0) {
+    return true; // Points and lines have no triangles to cook
+  }
+  u32 attributes = jsonMember(pJson, primitive, "attributes");
+  Accessor positions, normals, uvs, indices;
+  if (!resolveAccessor(pGltf, jsonNumber(pJson, jsonMember(pJson, attributes, "POSITION"), -1.0), &positions) || positions.components != 3) {
+    return false;
+  }
+  bool hasNormals = resolveAccessor(pGltf, jsonNumber(pJson, jsonMember(pJson, attributes, "NORMAL"), -1.0), &normals) &&
+    normals.components == 3 && normals.count == positions.count;
+  bool hasUvs = resolveAccessor(pGltf, jsonNumber(pJson, jsonMember(pJson, attributes, "TEXCOORD_0"), -1.0), &uvs) &&
+    uvs.components == 2 && uvs.count == positions.count;
+  double indicesAccessor = jsonNumber(pJson, jsonMember(pJson, primitive, "indices"), -1.0);
+  bool indexed = indicesAccessor >= 0.0;
+  if (indexed && (!resolveAccessor(pGltf, indicesAccessor, &indices) || indices.components != 1 ||
+                  (indices.componentType != 5121 && indices.componentType != 5123 && indices.componentType != 5125))) {
+    return false;
+  }
+  if (!hasNormals) {
+    pMesh->hasNormals = false;
+  }
+
+  // Normals go through the inverse transpose, scaled by the determinant:
+  // its columns are the cross products of the transform's columns.
+  // Mirroring transforms also flip the winding.
+  const double *m = pTransform->m;
+  const double *a = &m[0], *b = &m[4], *c = &m[8];
+  double cofactor[9] = {
+    b[1] * c[2] - b[2] * c[1], b[2] * c[0] - b[0] * c[2], b[0] * c[1] - b[1] * c[0],
+    c[1] * a[2] - c[2] * a[1], c[2] * a[0] - c[0] * a[2], c[0] * a[1] - c[1] * a[0],
+    a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]
+  };
+  double determinant = a[0] * cofactor[0] + a[1] * cofactor[1] + a[2] * cofactor[2];
+  bool mirrored = determinant < 0.0;
+
+  u32 base = pMesh->vertexCount;
+  for (u32 v = 0; v < positions.count; v++) {
+    MeshVertex vertex = {0};
+    double p[3], n[3] = { 0, 0, 0 };
+    for (u32 k = 0; k < 3; k++) p[k] = readComponent(&positions, v, k);
+    for (u32 k = 0; k < 3; k++) {
+      vertex.position[k] = (float)(m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k]);
+    }
+    if (hasNormals) {
+      for (u32 k = 0; k < 3; k++) n[k] = readComponent(&normals, v, k);
+      double length = 0.0;
+      for (u32 k = 0; k < 3; k++) {
+        double t = cofactor[k] * n[0] + cofactor[3 + k] * n[1] + cofactor[6 + k] * n[2];
+        vertex.normal[k] = (float)(mirrored ? -t : t);
+        length += t * t;
+      }
+      for (u32 k = 0; k < 3 && length > 0.0; k++) vertex.normal[k] /= (float)sqrt(length);
+    }
+    if (hasUvs) {
+      vertex.uv[0] = readComponent(&uvs, v, 0);
+      vertex.uv[1] = readComponent(&uvs, v, 1);
+    }
+    importAddVertex(pMesh, &vertex);
+  }
+
+  u32 indexCount = indexed ? indices.count : positions.count;
+  for (u32 i = 0; i + 2 < indexCount; i += 3) {
+    u32 triangle[3];
+    for (u32 k = 0; k < 3; k++) {
+      triangle[k] = indexed ? readIndex(&indices, i + k) : i + k;
+      if (triangle[k] >= positions.count) return false;
+    }
+    importAddIndex(pMesh, base + triangle[0]);
+    importAddIndex(pMesh, base + triangle[mirrored ? 2 : 1]);
+    importAddIndex(pMesh, base + triangle[mirrored ? 1 : 2]);
+  }
+  return true;
+}
+
+static bool importNode(const Gltf *pGltf, u32 node, const Transform *pParent, u32 depth, ImportedMesh *pMesh) {
+  const Json *pJson = &pGltf->json;
+  if (node == UINT32_MAX || depth > GLTF_MAX_DEPTH) return false;
+  Transform local = nodeTransform(pJson, node);
+  Transform world = transformMultiply(pParent, &local);
+
+  double meshIndex = jsonNumber(pJson, jsonMember(pJson, node, "mesh"), -1.0);
+  if (meshIndex >= 0.0) {
+    u32 mesh = jsonElement(pJson, jsonMember(pJson, 0, "meshes"), (u32)meshIndex);
+    u32 primitives = jsonMember(pJson, mesh, "primitives");
+    if (mesh == UINT32_MAX) return false;
+    for (u32 i = 0; i < jsonCount(pJson, primitives); i++) {
+      if (!importPrimitive(pGltf, jsonElement(pJson, primitives, i), &world, pMesh)) return false;
+    }
+  }
+
+  u32 children = jsonMember(pJson, node, "children");
+  u32 nodes = jsonMember(pJson, 0, "nodes");
+  for (u32 i = 0; i < jsonCount(pJson, children); i++) {
+    u32 child = jsonElement(pJson, nodes, (u32)jsonNumber(pJson, jsonElement(pJson, children, i), -1.0));
+    if (!importNode(pGltf, child, &world, depth + 1, pMesh)) return false;
+  }
+  return true;
+}
+
+static bool importScene(const Gltf *pGltf, ImportedMesh *pMesh) {
+  const Json *pJson = &pGltf->json;
+  Transform identity = { { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 } };
+  u32 scenes = jsonMember(pJson, 0, "scenes");
+
+  // Without scenes, meshes are drawn as they are
+  if (jsonCount(pJson, scenes) == 0) {
+    u32 meshes = jsonMember(pJson, 0, "meshes");
+    for (u32 m = 0; m < jsonCount(pJson, meshes); m++) {
+      u32 primitives = jsonMember(pJson, jsonElement(pJson, meshes, m), "primitives");
+      for (u32 i = 0; i < jsonCount(pJson, primitives); i++) {
+        if (!importPrimitive(pGltf, jsonElement(pJson, primitives, i), &identity, pMesh)) return false;
+      }
+    }
+    return true;
+  }
+
+  u32 scene = jsonElement(pJson, scenes, (u32)jsonNumber(pJson, jsonMember(pJson, 0, "scene"), 0.0));
+  u32 roots = jsonMember(pJson, scene, "nodes");
+  u32 nodes = jsonMember(pJson, 0, "nodes");
+  for (u32 i = 0; i < jsonCount(pJson, roots); i++) {
+    u32 node = jsonElement(pJson, nodes, (u32)jsonNumber(pJson, jsonElement(pJson, roots, i), -1.0));
+    if (!importNode(pGltf, node, &identity, 0, pMesh)) return false;
+  }
+  return true;
+}
+
+bool importGltf(const char *path, ImportedMesh *pMesh) {
+  size_t size;
+  u8 *file = (u8*)importReadFile(path, &size);
+  if (file == NULL) {
+    printf("%s: can't read\n", path);
+    return false;
+  }
+
+  // A .glb is a header, a JSON chunk and an optional binary chunk
+  const char *jsonText = (const char*)file;
+  size_t jsonLength = size;
+  u8 *binary = NULL;
+  size_t binarySize = 0;
+  u32 header[5];
+  if (size >= sizeof(header) && memcpy(header, file, sizeof(header)) && header[0] == GLB_MAGIC) {
+    if (header[1] != 2 || header[4] != GLB_CHUNK_JSON || (size_t)header[3] + 20 > size) {
+      printf("%s: not a glTF 2.0 binary\n", path);
+      free(file);
+      return false;
+    }
+    jsonText = (const char*)file + 20;
+    jsonLength = header[3];
+    size_t binaryChunk = 20 + (((size_t)jsonLength + 3) & ~(size_t)3);
+    u32 chunk[2];
+    if (binaryChunk + 8 <= size && memcpy(chunk, file + binaryChunk, 8) && chunk[1] == GLB_CHUNK_BIN &&
+        binaryChunk + 8 + chunk[0] <= size) {
+      binary = file + binaryChunk + 8;
+      binarySize = chunk[0];
+    }
+  }
+
+  Gltf gltf = { .path = path, .json = { .text = jsonText, .length = (u32)jsonLength } };
+  memset(pMesh, 0, sizeof(ImportedMesh));
+  pMesh->hasNormals = true;
+  bool ok = jsonParseValue(&gltf.json, 0) && gltf.json.tokens[0].type == JSON_OBJECT;
+  if (!ok) {
+    printf("%s: invalid JSON\n", path);
+  } else if (!(ok = loadBuffers(&gltf, binary, binarySize))) {
+    printf("%s: invalid buffers\n", path);
+  } else if (!(ok = importScene(&gltf, pMesh))) {
+    printf("%s: invalid or unsupported mesh data\n", path);
+  }
+
+  for (u32 i = 0; i < gltf.bufferCount; i++) {
+    if (gltf.buffers[i].bytes != binary) free(gltf.buffers[i].bytes);
+  }
+  free(gltf.buffers);
+  free(gltf.json.tokens);
+  free(file);
+  if (!ok) {
+    importedMeshDestroy(pMesh);
+  }
+  return ok;
+}
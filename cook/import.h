@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+#include "mesh.h"
+
+// Triangles read from a source asset, every primitive merged into one list
+typedef struct ImportedMesh {
+  MeshVertex *vertices;
+  u32 vertexCount;
+  u32 vertexCapacity;
+  u32 *indices;
+  u32 indexCount;
+  u32 indexCapacity;
+  bool hasNormals; // The cooker generates smooth normals otherwise
+} ImportedMesh;
+
+// Both print what went wrong and return false on failure
+bool importObj(const char *path, ImportedMesh *pMesh);
+bool importGltf(const char *path, ImportedMesh *pMesh); // .gltf or .glb
+
+u32 importAddVertex(ImportedMesh *pMesh, const MeshVertex *pVertex);
+void importAddIndex(ImportedMesh *pMesh, u32 index);
+void importedMeshDestroy(ImportedMesh *pMesh);
+
+char *importReadFile(const char *path, size_t *pSize);
@@ -0,0 +1,224 @@
+// Wavefront OBJ: v, vt, vn and f records. Polygons are fanned into
+// triangles; groups, materials and smoothing groups are ignored.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "import.h"
+
+typedef struct FloatArray {
+  float *values;
+  u32 count; // Floats, not elements
+  u32 capacity;
+} FloatArray;
+
+static void floatArrayPush(FloatArray *pArray, const float *values, u32 count) {
+  if (pArray->count + count > pArray->capacity) {
+    pArray->capacity = pArray->capacity > 0 ? pArray->capacity * 2 : 3072;
+    pArray->values = realloc(pArray->values, sizeof(float) * pArray->capacity);
+    if (pArray->values == NULL) {
+      printf("Out of memory\n");
+      exit(2);
+    }
+  }
+  memcpy(pArray->values + pArray->count, values, sizeof(float) * count);
+  pArray->count += count;
+}
+
+// A face corner: position, uv and normal numbers, 0 when absent
+typedef struct Corner {
+  u32 position;
+  u32 uv;
+  u32 normal;
+} Corner;
+
+// Open addressed map from corners to imported vertices, so corners that
+// repeat share a vertex
+typedef struct CornerMap {
+  Corner *keys;
+  u32 *vertices;
+  u32 capacity; // Power of two
+  u32 count;
+} CornerMap;
+
+static u32 cornerHash(const Corner *pCorner) {
+  u32 h = pCorner->position * 73856093u ^ pCorner->uv * 19349663u ^ pCorner->normal * 83492791u;
+  return h ^ (h >> 15);
+}
+
+static void cornerMapInit(CornerMap *pMap, u32 capacity) {
+  pMap->capacity = capacity;
+  pMap->count = 0;
+  pMap->keys = calloc(capacity, sizeof(Corner));
+  pMap->vertices = malloc(sizeof(u32) * capacity);
+  if (pMap->keys == NULL || pMap->vertices == NULL) {
+    printf("Out of memory\n");
+    exit(2);
+  }
+}
+
+static void cornerMapInsert(CornerMap *pMap, const Corner *pCorner, u32 vertex) {
+  u32 mask = pMap->capacity - 1;
+  u32 slot = cornerHash(pCorner) & mask;
+  while (pMap->keys[slot].position != 0) slot = (slot + 1) & mask;
+  pMap->keys[slot] = *pCorner;
+  pMap->vertices[slot] = vertex;
+  pMap->count++;
+}
+
+static bool cornerMapFind(const CornerMap *pMap, const Corner *pCorner, u32 *pVertex) {
+  u32 mask = pMap->capacity - 1;
+  for (u32 slot = cornerHash(pCorner) & mask; pMap->keys[slot].position != 0; slot = (slot + 1) & mask) {
+    if (memcmp(&pMap->keys[slot], pCorner, sizeof(Corner)) == 0) {
+      *pVertex = pMap->vertices[slot];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Keeps the load under a half
+static void cornerMapReserve(CornerMap *pMap) {
+  if ((pMap->count + 1) * 2 <= pMap->capacity) return;
+  CornerMap grown;
+  cornerMapInit(&grown, pMap->capacity * 2);
+  for (u32 slot = 0; slot < pMap->capacity; slot++) {
+    if (pMap->keys[slot].position != 0) {
+      cornerMapInsert(&grown, &pMap->keys[slot], pMap->vertices[slot]);
+    }
+  }
+  free(pMap->keys);
+  free(pMap->vertices);
+  *pMap = grown;
+}
+
+// OBJ numbers from 1, negative numbers count back from the latest element
+static bool resolveNumber(long number, u32 count, u32 *pResolved) {
+  if (number > 0 && (u32)number <= count) {
+    *pResolved = (u32)number;
+    return true;
+  }
+  if (number < 0 && (u32)-number <= count) {
+    *pResolved = count + 1 - (u32)-number;
+    return true;
+  }
+  return false;
+}
+
+// Parses "v", "v/vt", "v//vn" or "v/vt/vn"
+static bool parseCorner(char **pCursor, const FloatArray *pPositions, const FloatArray *pUvs, const FloatArray *pNormals, Corner *pCorner) {
+  char *cursor = *pCursor;
+  char *end;
+  memset(pCorner, 0, sizeof(Corner));
+  if (!resolveNumber(strtol(cursor, &end, 10), pPositions->count / 3, &pCorner->position) || end == cursor) return false;
+  cursor = end;
+  if (*cursor == '/') {
+    cursor++;
+    if (*cursor != '/') {
+      if (!resolveNumber(strtol(cursor, &end, 10), pUvs->count / 2, &pCorner->uv) || end == cursor) return false;
+      cursor = end;
+    }
+    if (*cursor == '/') {
+      cursor++;
+      if (!resolveNumber(strtol(cursor, &end, 10), pNormals->count / 3, &pCorner->normal) || end == cursor) return false;
+      cursor = end;
+    }
+  }
+  *pCursor = cursor;
+  return true;
+}
+
+static u32 cornerVertex(ImportedMesh *pMesh, CornerMap *pMap, const Corner *pCorner, const FloatArray *pPositions, const FloatArray *pUvs, const FloatArray *pNormals) {
+  u32 vertex;
+  if (cornerMapFind(pMap, pCorner, &vertex)) return vertex;
+
+  MeshVertex v = {0};
+  memcpy(v.position, &pPositions->values[(pCorner->position - 1) * 3], sizeof(v.position));
+  if (pCorner->normal != 0) {
+    memcpy(v.normal, &pNormals->values[(pCorner->normal - 1) * 3], sizeof(v.normal));
+  }
+  if (pCorner->uv != 0) {
+    // OBJ puts v = 0 at the bottom of the image, Vulkan at the top
+    v.uv[0] = pUvs->values[(pCorner->uv - 1) * 2];
+    v.uv[1] = 1.0f - pUvs->values[(pCorner->uv - 1) * 2 + 1];
+  }
+  vertex = importAddVertex(pMesh, &v);
+  cornerMapReserve(pMap);
+  cornerMapInsert(pMap, pCorner, vertex);
+  return vertex;
+}
+
+bool importObj(const char *path, ImportedMesh *pMesh) {
+  size_t size;
+  char *text = importReadFile(path, &size);
+  if (text == NULL) {
+    printf("%s: can't read\n", path);
+    return false;
+  }
+
+  memset(pMesh, 0, sizeof(ImportedMesh));
+  FloatArray positions = {0}, uvs = {0}, normals = {0};
+  CornerMap map;
+  cornerMapInit(&map, 4096);
+  bool everyCornerHasNormal = true;
+  bool ok = true;
+  u32 lineNumber = 0;
+
+  for (char *line = text; line != NULL && ok;) {
+    char *next = strchr(line, '\n');
+    if (next != NULL) *next++ = '\0';
+    lineNumber++;
+    while (*line == ' ' || *line == '\t') line++;
+
+    float values[3] = { 0.0f, 0.0f, 0.0f };
+    if (strncmp(line, "v ", 2) == 0) {
+      ok = sscanf(line + 2, "%f %f %f", &values[0], &values[1], &values[2]) == 3;
+      floatArrayPush(&positions, values, 3);
+    } else if (strncmp(line, "vt ", 3) == 0) {
+      ok = sscanf(line + 3, "%f %f", &values[0], &values[1]) >= 1;
+      floatArrayPush(&uvs, values, 2);
+    } else if (strncmp(line, "vn ", 3) == 0) {
+      ok = sscanf(line + 3, "%f %f %f", &values[0], &values[1], &values[2]) == 3;
+      floatArrayPush(&normals, values, 3);
+    } else if (strncmp(line, "f ", 2) == 0) {
+      char *cursor = line + 2;
+      u32 first = 0, previous = 0;
+      u32 cornerCount = 0;
+      while (ok) {
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r') cursor++;
+        if (*cursor == '\0') break;
+        Corner corner;
+        ok = parseCorner(&cursor, &positions, &uvs, &normals, &corner);
+        if (!ok) break;
+        everyCornerHasNormal &= corner.normal != 0;
+        u32 vertex = cornerVertex(pMesh, &map, &corner, &positions, &uvs, &normals);
+        if (cornerCount == 0) {
+          first = vertex;
+        } else if (cornerCount >= 2) {
+          importAddIndex(pMesh, first);
+          importAddIndex(pMesh, previous);
+          importAddIndex(pMesh, vertex);
+        }
+        previous = vertex;
+        cornerCount++;
+      }
+      ok = ok && cornerCount >= 3;
+    }
+    line = next;
+  }
+  if (!ok) {
+    printf("%s:%u: can't parse\n", path, lineNumber);
+  }
+
+  pMesh->hasNormals = everyCornerHasNormal;
+  free(map.keys);
+  free(map.vertices);
+  free(positions.values);
+  free(uvs.values);
+  free(normals.values);
+  free(text);
+  if (!ok) {
+    importedMeshDestroy(pMesh);
+  }
+  return ok;
+}
@@ -0,0 +1,529 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CULL_X86 1
+#include <immintrin.h>
+#endif
+
+#include "cull.h"
+#include "memtrack.h"
+
+// Below this many objects per thread, spawning costs more than it saves
+#define CULL_MIN_OBJECTS_PER_THREAD 16384
+
+static CullImpl cullImpl = CULL_IMPL_SCALAR;
+static pthread_once_t cullDetectOnce = PTHREAD_ONCE_INIT;
+
+static void normalizePlane(Frustum *pFrustum, u32 plane, float a, float b, float c, float d) {
+  float length = sqrtf(a * a + b * b + c * c);
+  float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+  pFrustum->x[plane] = a * inverse;
+  pFrustum->y[plane] = b * inverse;
+  pFrustum->z[plane] = c * inverse;
+  pFrustum->w[plane] = d * inverse;
+}
+
+// Gribb/Hartmann plane extraction. Row i of the column-major matrix is
+// (m[i], m[4 + i], m[8 + i], m[12 + i]). Vulkan clips depth to 0 <= z <= w,
+// so the near plane is row 2 alone rather than row 3 + row 2.
+void frustumFromViewProjection(Frustum *pFrustum, const float m[16]) {
+  float r0[4] = { m[0], m[4], m[8], m[12] };
+  float r1[4] = { m[1], m[5], m[9], m[13] };
+  float r2[4] = { m[2], m[6], m[10], m[14] };
+  float r3[4] = { m[3], m[7], m[11], m[15] };
+
+  normalizePlane(pFrustum, 0, r3[0] + r0[0], r3[1] + r0[1], r3[2] + r0[2], r3[3] + r0[3]); // Left
+  normalizePlane(pFrustum, 1, r3[0] - r0[0], r3[1] - r0[1], r3[2] - r0[2], r3[3] - r0[3]); // Right
+  normalizePlane(pFrustum, 2, r3[0] + r1[0], r3[1] + r1[1], r3[2] + r1[2], r3[3] + r1[3]); // Top (Vulkan Y points down)
+  normalizePlane(pFrustum, 3, r3[0] - r1[0], r3[1] - r1[1], r3[2] - r1[2], r3[3] - r1[3]); // Bottom
+  normalizePlane(pFrustum, 4, r2[0], r2[1], r2[2], r2[3]); // Near
+  normalizePlane(pFrustum, 5, r3[0] - r2[0], r3[1] - r2[1], r3[2] - r2[2], r3[3] - r2[3]); // Far
+}
+
+static float *growArray(float *array, u32 count, u32 capacity) {
+  float *grown = memoryAlignedAlloc(CULL_ALIGNMENT, sizeof(float) * capacity, MEMORY_TAG_SCENE);
+  if (grown == NULL) {
+    printf("Failed to allocate cull arrays!\n");
+    exit(18);
+  }
+  if (array != NULL) {
+    memcpy(grown, array, sizeof(float) * count);
+    memoryFree(array);
+  }
+  return grown;
+}
+
+// Capacity stays a multiple of 8 so arrays fill whole SIMD registers
+static u32 roundCapacity(u32 capacity) {
+  capacity = capacity < 8 ? 8 : capacity;
+  return (capacity + 7) & ~7u;
+}
+
+void cullSpheresInit(CullSpheres *pSpheres, u32 capacity) {
+  memset(pSpheres, 0, sizeof(CullSpheres));
+  capacity = roundCapacity(capacity);
+  pSpheres->centerX = growArray(NULL, 0, capacity);
+  pSpheres->centerY = growArray(NULL, 0, capacity);
+  pSpheres->centerZ = growArray(NULL, 0, capacity);
+  pSpheres->radius = growArray(NULL, 0, capacity);
+  pSpheres->capacity = capacity;
+}
+
+void cullSpheresDestroy(CullSpheres *pSpheres) {
+  memoryFree(pSpheres->centerX);
+  memoryFree(pSpheres->centerY);
+  memoryFree(pSpheres->centerZ);
+  memoryFree(pSpheres->radius);
+  memset(pSpheres, 0, sizeof(CullSpheres));
+}
+
+u32 cullSpheresAdd(CullSpheres *pSpheres, float x, float y, float z, float radius) {
+  if (pSpheres->count == pSpheres->capacity) {
+    u32 capacity = roundCapacity(pSpheres->capacity * 2);
+    pSpheres->centerX = growArray(pSpheres->centerX, pSpheres->count, capacity);
+    pSpheres->centerY = growArray(pSpheres->centerY, pSpheres->count, capacity);
+    pSpheres->centerZ = growArray(pSpheres->centerZ, pSpheres->count, capacity);
+    pSpheres->radius = growArray(pSpheres->radius, pSpheres->count, capacity);
+    pSpheres->capacity = capacity;
+  }
+
+  u32 index = pSpheres->count++;
+  pSpheres->centerX[index] = x;
+  pSpheres->centerY[index] = y;
+  pSpheres->centerZ[index] = z;
+  pSpheres->radius[index] = radius;
+  return index;
+}
+
+void cullAabbsInit(CullAabbs *pAabbs, u32 capacity) {
+  memset(pAabbs, 0, sizeof(CullAabbs));
+  capacity = roundCapacity(capacity);
+  pAabbs->minX = growArray(NULL, 0, capacity);
+  pAabbs->minY = growArray(NULL, 0, capacity);
+  pAabbs->minZ = growArray(NULL, 0, capacity);
+  pAabbs->maxX = growArray(NULL, 0, capacity);
+  pAabbs->maxY = growArray(NULL, 0, capacity);
+  pAabbs->maxZ = growArray(NULL, 0, capacity);
+  pAabbs->capacity = capacity;
+}
+
+void cullAabbsDestroy(CullAabbs *pAabbs) {
+  memoryFree(pAabbs->minX);
+  memoryFree(pAabbs->minY);
+  memoryFree(pAabbs->minZ);
+  memoryFree(pAabbs->maxX);
+  memoryFree(pAabbs->maxY);
+  memoryFree(pAabbs->maxZ);
+  memset(pAabbs, 0, sizeof(CullAabbs));
+}
+
+u32 cullAabbsAdd(CullAabbs *pAabbs, const float min[3], const float max[3]) {
+  if (pAabbs->count == pAabbs->capacity) {
+    u32 count = pAabbs->count;
+    u32 capacity = roundCapacity(pAabbs->capacity * 2);
+    pAabbs->minX = growArray(pAabbs->minX, count, capacity);
+    pAabbs->minY = growArray(pAabbs->minY, count, capacity);
+    pAabbs->minZ = growArray(pAabbs->minZ, count, capacity);
+    pAabbs->maxX = growArray(pAabbs->maxX, count, capacity);
+    pAabbs->maxY = growArray(pAabbs->maxY, count, capacity);
+    pAabbs->maxZ = growArray(pAabbs->maxZ, count, capacity);
+    pAabbs->capacity = capacity;
+  }
+
+  u32 index = pAabbs->count++;
+  pAabbs->minX[index] = min[0];
+  pAabbs->minY[index] = min[1];
+  pAabbs->minZ[index] = min[2];
+  pAabbs->maxX[index] = max[0];
+  pAabbs->maxY[index] = max[1];
+  pAabbs->maxZ[index] = max[2];
+  return index;
+}
+
+// Scalar kernels. The index is always written and the count only advances
+// when visible, which keeps the loop free of unpredictable branches.
+
+static u32 cullSpheresScalar(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  u32 visibleCount = 0;
+  for (u32 i = begin; i < end; i++) {
+    float x = pSpheres->centerX[i];
+    float y = pSpheres->centerY[i];
+    float z = pSpheres->centerZ[i];
+    float negRadius = -pSpheres->radius[i];
+
+    bool inside = true;
+    for (u32 p = 0; p < 6; p++) {
+      float distance = pFrustum->x[p] * x + pFrustum->y[p] * y + pFrustum->z[p] * z + pFrustum->w[p];
+      inside &= distance >= negRadius;
+    }
+    pVisible[visibleCount] = i;
+    visibleCount += inside;
+  }
+  return visibleCount;
+}
+
+// An AABB is outside a plane when its most positive corner along the plane
+// normal is. That corner only depends on the plane, so pick it per plane.
+typedef struct AabbPlaneSelect {
+  const float *x[6];
+  const float *y[6];
+  const float *z[6];
+} AabbPlaneSelect;
+
+static void selectAabbCorners(const CullAabbs *pAabbs, const Frustum *pFrustum, AabbPlaneSelect *pSelect) {
+  for (u32 p = 0; p < 6; p++) {
+    pSelect->x[p] = pFrustum->x[p] >= 0.0f ? pAabbs->maxX : pAabbs->minX;
+    pSelect->y[p] = pFrustum->y[p] >= 0.0f ? pAabbs->maxY : pAabbs->minY;
+    pSelect->z[p] = pFrustum->z[p] >= 0.0f ? pAabbs->maxZ : pAabbs->minZ;
+  }
+}
+
+static u32 cullAabbsScalar(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  AabbPlaneSelect select;
+  selectAabbCorners(pAabbs, pFrustum, &select);
+
+  u32 visibleCount = 0;
+  for (u32 i = begin; i < end; i++) {
+    bool inside = true;
+    for (u32 p = 0; p < 6; p++) {
+      float distance = pFrustum->x[p] * select.x[p][i] + pFrustum->y[p] * select.y[p][i] + pFrustum->z[p] * select.z[p][i] + pFrustum->w[p];
+      inside &= distance >= 0.0f;
+    }
+    pVisible[visibleCount] = i;
+    visibleCount += inside;
+  }
+  return visibleCount;
+}
+
+#ifdef CULL_X86
+
+// SSE2 is part of x86-64, so these need no target attribute
+
+static inline u32 compactMask(u32 mask, u32 base, u32 *pVisible, u32 visibleCount) {
+  while (mask) {
+    pVisible[visibleCount++] = base + (u32)__builtin_ctz(mask);
+    mask &= mask - 1;
+  }
+  return visibleCount;
+}
+
+static u32 cullSpheresSse(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  __m128 px[6], py[6], pz[6], pw[6];
+  for (u32 p = 0; p < 6; p++) {
+    px[p] = _mm_set1_ps(pFrustum->x[p]);
+    py[p] = _mm_set1_ps(pFrustum->y[p]);
+    pz[p] = _mm_set1_ps(pFrustum->z[p]);
+    pw[p] = _mm_set1_ps(pFrustum->w[p]);
+  }
+  const __m128 zero = _mm_setzero_ps();
+
+  u32 visibleCount = 0;
+  u32 i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 x = _mm_loadu_ps(pSpheres->centerX + i);
+    __m128 y = _mm_loadu_ps(pSpheres->centerY + i);
+    __m128 z = _mm_loadu_ps(pSpheres->centerZ + i);
+    __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(pSpheres->radius + i));
+
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (u32 p = 0; p < 6; p++) {
+      __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)), _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+    }
+    visibleCount = compactMask((u32)_mm_movemask_ps(inside), i, pVisible, visibleCount);
+  }
+
+  return visibleCount + cullSpheresScalar(pSpheres, pFrustum, i, end, pVisible + visibleCount);
+}
+
+static u32 cullAabbsSse(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  AabbPlaneSelect select;
+  selectAabbCorners(pAabbs, pFrustum, &select);
+
+  __m128 px[6], py[6], pz[6], pw[6];
+  for (u32 p = 0; p < 6; p++) {
+    px[p] = _mm_set1_ps(pFrustum->x[p]);
+    py[p] = _mm_set1_ps(pFrustum->y[p]);
+    pz[p] = _mm_set1_ps(pFrustum->z[p]);
+    pw[p] = _mm_set1_ps(pFrustum->w[p]);
+  }
+  const __m128 zero = _mm_setzero_ps();
+
+  u32 visibleCount = 0;
+  u32 i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (u32 p = 0; p < 6; p++) {
+      __m128 x = _mm_loadu_ps(select.x[p] + i);
+      __m128 y = _mm_loadu_ps(select.y[p] + i);
+      __m128 z = _mm_loadu_ps(select.z[p] + i);
+      __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)), _mm_add_ps(_mm_mul_ps(pz[p], z), pw[p]));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+    }
+    visibleCount = compactMask((u32)_mm_movemask_ps(inside), i, pVisible, visibleCount);
+  }
+
+  return visibleCount + cullAabbsScalar(pAabbs, pFrustum, i, end, pVisible + visibleCount);
+}
+
+// AVX2 compacts 8 lanes at once: a permutation moves the visible lanes to the
+// front and a masked store writes exactly that many, so neighbouring threads'
+// output ranges are never touched.
+// Plain ints so building them doesn't need AVX
+static _Alignas(32) i32 compactPermutations[256][8];
+static _Alignas(32) i32 compactStoreMasks[9][8];
+
+static void initCompactTables(void) {
+  for (u32 mask = 0; mask < 256; mask++) {
+    u32 count = 0;
+    for (u32 lane = 0; lane < 8; lane++) {
+      if (mask & (1u << lane)) {
+        compactPermutations[mask][count++] = (i32)lane;
+      }
+    }
+    while (count < 8) {
+      compactPermutations[mask][count++] = 0;
+    }
+  }
+  for (u32 count = 0; count <= 8; count++) {
+    for (u32 lane = 0; lane < 8; lane++) {
+      compactStoreMasks[count][lane] = lane < count ? -1 : 0;
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+static inline u32 compactMaskAvx2(u32 mask, u32 base, u32 *pVisible, u32 visibleCount) {
+  __m256i permutation = _mm256_load_si256((const __m256i*)compactPermutations[mask]);
+  __m256i indices = _mm256_add_epi32(_mm256_set1_epi32((int)base), permutation);
+  u32 count = (u32)__builtin_popcount(mask);
+  __m256i storeMask = _mm256_load_si256((const __m256i*)compactStoreMasks[count]);
+  _mm256_maskstore_epi32((int*)(pVisible + visibleCount), storeMask, indices);
+  return visibleCount + count;
+}
+
+__attribute__((target("avx2")))
+static u32 cullSpheresAvx2(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  __m256 px[6], py[6], pz[6], pw[6];
+  for (u32 p = 0; p < 6; p++) {
+    px[p] = _mm256_set1_ps(pFrustum->x[p]);
+    py[p] = _mm256_set1_ps(pFrustum->y[p]);
+    pz[p] = _mm256_set1_ps(pFrustum->z[p]);
+    pw[p] = _mm256_set1_ps(pFrustum->w[p]);
+  }
+  const __m256 zero = _mm256_setzero_ps();
+
+  u32 visibleCount = 0;
+  u32 i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 x = _mm256_loadu_ps(pSpheres->centerX + i);
+    __m256 y = _mm256_loadu_ps(pSpheres->centerY + i);
+    __m256 z = _mm256_loadu_ps(pSpheres->centerZ + i);
+    __m256 negRadius = _mm256_sub_ps(zero, _mm256_loadu_ps(pSpheres->radius + i));
+
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (u32 p = 0; p < 6; p++) {
+      __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], x), _mm256_mul_ps(py[p], y)), _mm256_add_ps(_mm256_mul_ps(pz[p], z), pw[p]));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+    }
+    visibleCount = compactMaskAvx2((u32)_mm256_movemask_ps(inside), i, pVisible, visibleCount);
+  }
+
+  return visibleCount + cullSpheresSse(pSpheres, pFrustum, i, end, pVisible + visibleCount);
+}
+
+__attribute__((target("avx2")))
+static u32 cullAabbsAvx2(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  AabbPlaneSelect select;
+  selectAabbCorners(pAabbs, pFrustum, &select);
+
+  __m256 px[6], py[6], pz[6], pw[6];
+  for (u32 p = 0; p < 6; p++) {
+    px[p] = _mm256_set1_ps(pFrustum->x[p]);
+    py[p] = _mm256_set1_ps(pFrustum->y[p]);
+    pz[p] = _mm256_set1_ps(pFrustum->z[p]);
+    pw[p] = _mm256_set1_ps(pFrustum->w[p]);
+  }
+  const __m256 zero = _mm256_setzero_ps();
+
+  u32 visibleCount = 0;
+  u32 i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (u32 p = 0; p < 6; p++) {
+      __m256 x = _mm256_loadu_ps(select.x[p] + i);
+      __m256 y = _mm256_loadu_ps(select.y[p] + i);
+      __m256 z = _mm256_loadu_ps(select.z[p] + i);
+      __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], x), _mm256_mul_ps(py[p], y)), _mm256_add_ps(_mm256_mul_ps(pz[p], z), pw[p]));
+      inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, zero, _CMP_GE_OQ));
+    }
+    visibleCount = compactMaskAvx2((u32)_mm256_movemask_ps(inside), i, pVisible, visibleCount);
+  }
+
+  return visibleCount + cullAabbsSse(pAabbs, pFrustum, i, end, pVisible + visibleCount);
+}
+
+#endif // CULL_X86
+
+static bool cpuSupports(CullImpl impl) {
+  switch (impl) {
+    case CULL_IMPL_SCALAR:
+      return true;
+#ifdef CULL_X86
+    case CULL_IMPL_SSE:
+      return __builtin_cpu_supports("sse2");
+    case CULL_IMPL_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return false;
+  }
+}
+
+static void detectImpl(void) {
+#ifdef CULL_X86
+  __builtin_cpu_init();
+  initCompactTables();
+#endif
+  cullImpl = CULL_IMPL_SCALAR;
+  for (int impl = CULL_IMPL_COUNT - 1; impl > CULL_IMPL_SCALAR; impl--) {
+    if (cpuSupports((CullImpl)impl)) {
+      cullImpl = (CullImpl)impl;
+      break;
+    }
+  }
+}
+
+CullImpl cullDetectImpl(void) {
+  pthread_once(&cullDetectOnce, detectImpl);
+  return cullImpl;
+}
+
+bool cullSetImpl(CullImpl impl) {
+  cullDetectImpl();
+  if (!cpuSupports(impl)) {
+    return false;
+  }
+  cullImpl = impl;
+  return true;
+}
+
+CullImpl cullGetImpl(void) {
+  return cullDetectImpl();
+}
+
+const char *cullImplName(CullImpl impl) {
+  switch (impl) {
+    case CULL_IMPL_SCALAR: return "scalar";
+    case CULL_IMPL_SSE: return "sse";
+    case CULL_IMPL_AVX2: return "avx2";
+    default: return "unknown";
+  }
+}
+
+u32 cullSpheres(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  switch (cullDetectImpl()) {
+#ifdef CULL_X86
+    case CULL_IMPL_AVX2:
+      return cullSpheresAvx2(pSpheres, pFrustum, begin, end, pVisible);
+    case CULL_IMPL_SSE:
+      return cullSpheresSse(pSpheres, pFrustum, begin, end, pVisible);
+#endif
+    default:
+      return cullSpheresScalar(pSpheres, pFrustum, begin, end, pVisible);
+  }
+}
+
+u32 cullAabbs(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible) {
+  switch (cullDetectImpl()) {
+#ifdef CULL_X86
+    case CULL_IMPL_AVX2:
+      return cullAabbsAvx2(pAabbs, pFrustum, begin, end, pVisible);
+    case CULL_IMPL_SSE:
+      return cullAabbsSse(pAabbs, pFrustum, begin, end, pVisible);
+#endif
+    default:
+      return cullAabbsScalar(pAabbs, pFrustum, begin, end, pVisible);
+  }
+}
+
+typedef struct CullJob {
+  const CullSpheres *pSpheres; // One of pSpheres/pAabbs is set
+  const CullAabbs *pAabbs;
+  const Frustum *pFrustum;
+  u32 begin;
+  u32 end;
+  u32 *pVisible; // Points at the job's own range of the output
+  u32 visibleCount;
+} CullJob;
+
+static void *cullJobRun(void *pArg) {
+  CullJob *pJob = pArg;
+  if (pJob->pSpheres != NULL) {
+    pJob->visibleCount = cullSpheres(pJob->pSpheres, pJob->pFrustum, pJob->begin, pJob->end, pJob->pVisible);
+  } else {
+    pJob->visibleCount = cullAabbs(pJob->pAabbs, pJob->pFrustum, pJob->begin, pJob->end, pJob->pVisible);
+  }
+  return NULL;
+}
+
+static u32 cullParallel(const CullSpheres *pSpheres, const CullAabbs *pAabbs, u32 count, const Frustum *pFrustum, u32 threadCount, u32 *pVisible) {
+  u32 maxThreads = count / CULL_MIN_OBJECTS_PER_THREAD;
+  if (threadCount > maxThreads) threadCount = maxThreads;
+  if (threadCount > CULL_MAX_THREADS) threadCount = CULL_MAX_THREADS;
+  if (threadCount < 1) threadCount = 1;
+
+  // Chunk boundaries on multiples of 8 keep every thread on the wide kernel
+  u32 chunk = ((count + threadCount - 1) / threadCount + 7) & ~7u;
+
+  CullJob jobs[CULL_MAX_THREADS];
+  pthread_t threads[CULL_MAX_THREADS];
+  bool started[CULL_MAX_THREADS] = {0};
+
+  for (u32 t = 0; t < threadCount; t++) {
+    u32 begin = t * chunk < count ? t * chunk : count;
+    u32 end = begin + chunk < count ? begin + chunk : count;
+    jobs[t] = (CullJob){
+      .pSpheres = pSpheres,
+      .pAabbs = pAabbs,
+      .pFrustum = pFrustum,
+      .begin = begin,
+      .end = end,
+      .pVisible = pVisible + begin
+    };
+  }
+
+  cullDetectImpl();
+  for (u32 t = 1; t < threadCount; t++) {
+    started[t] = pthread_create(&threads[t], NULL, cullJobRun, &jobs[t]) == 0;
+  }
+  // The calling thread takes the first chunk, and any chunk that failed to start
+  cullJobRun(&jobs[0]);
+  for (u32 t = 1; t < threadCount; t++) {
+    if (started[t]) {
+      pthread_join(threads[t], NULL);
+    } else {
+      cullJobRun(&jobs[t]);
+    }
+  }
+
+  // Each job compacted in place at its own offset; close the gaps
+  u32 visibleCount = jobs[0].visibleCount;
+  for (u32 t = 1; t < threadCount; t++) {
+    memmove(pVisible + visibleCount, jobs[t].pVisible, sizeof(u32) * jobs[t].visibleCount);
+    visibleCount += jobs[t].visibleCount;
+  }
+  return visibleCount;
+}
+
+u32 cullSpheresParallel(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 threadCount, u32 *pVisible) {
+  return cullParallel(pSpheres, NULL, pSpheres->count, pFrustum, threadCount, pVisible);
+}
+
+u32 cullAabbsParallel(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 threadCount, u32 *pVisible) {
+  return cullParallel(NULL, pAabbs, pAabbs->count, pFrustum, threadCount, pVisible);
+}
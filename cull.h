@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+// Kernels read 8 lanes at a time; arrays are padded and aligned to this
+#define CULL_ALIGNMENT 32
+#define CULL_MAX_THREADS 16
+
+typedef enum CullImpl {
+  CULL_IMPL_SCALAR = 0,
+  CULL_IMPL_SSE,
+  CULL_IMPL_AVX2,
+  CULL_IMPL_COUNT
+} CullImpl;
+
+// Planes point inwards: a point is inside when dot(plane.xyz, p) + plane.w >= 0.
+// Stored as SoA so kernels broadcast one component at a time.
+typedef struct Frustum {
+  float x[6];
+  float y[6];
+  float z[6];
+  float w[6];
+} Frustum;
+
+typedef struct CullSpheres {
+  float *centerX;
+  float *centerY;
+  float *centerZ;
+  float *radius;
+  u32 count;
+  u32 capacity;
+} CullSpheres;
+
+typedef struct CullAabbs {
+  float *minX;
+  float *minY;
+  float *minZ;
+  float *maxX;
+  float *maxY;
+  float *maxZ;
+  u32 count;
+  u32 capacity;
+} CullAabbs;
+
+// viewProjection is column-major and maps to Vulkan clip space (0..w depth)
+void frustumFromViewProjection(Frustum *pFrustum, const float viewProjection[16]);
+
+void cullSpheresInit(CullSpheres *pSpheres, u32 capacity);
+void cullSpheresDestroy(CullSpheres *pSpheres);
+u32 cullSpheresAdd(CullSpheres *pSpheres, float x, float y, float z, float radius);
+
+void cullAabbsInit(CullAabbs *pAabbs, u32 capacity);
+void cullAabbsDestroy(CullAabbs *pAabbs);
+u32 cullAabbsAdd(CullAabbs *pAabbs, const float min[3], const float max[3]);
+
+// Picks the widest kernel the CPU supports. Called lazily by the cull functions.
+CullImpl cullDetectImpl(void);
+// Forces a kernel, for benchmarks. Returns false if the CPU can't run it.
+bool cullSetImpl(CullImpl impl);
+CullImpl cullGetImpl(void);
+const char *cullImplName(CullImpl impl);
+
+// Writes the indices of visible objects in [begin, end) to pVisible in
+// ascending order and returns how many there were. pVisible needs room for
+// end - begin indices.
+u32 cullSpheres(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible);
+u32 cullAabbs(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 begin, u32 end, u32 *pVisible);
+
+// Splits the set across up to threadCount threads and compacts the results
+// into one list. Small sets stay on the calling thread.
+u32 cullSpheresParallel(const CullSpheres *pSpheres, const Frustum *pFrustum, u32 threadCount, u32 *pVisible);
+u32 cullAabbsParallel(const CullAabbs *pAabbs, const Frustum *pFrustum, u32 threadCount, u32 *pVisible);
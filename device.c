@@ -0,0 +1,395 @@
+#include <string.h>
+
+#include "device.h"
+#include "log.h"
+
+#define FEATURE_COUNT (sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32))
+
+// VkPhysicalDeviceFeatures is nothing but VkBool32 members, so it can be
+// walked as an array
+static const VkBool32 *featureArray(const VkPhysicalDeviceFeatures *pFeatures) {
+  return (const VkBool32*)pFeatures;
+}
+
+static bool hasFeatures(const VkPhysicalDeviceFeatures *pAvailable, const VkPhysicalDeviceFeatures *pRequired) {
+  const VkBool32 *available = featureArray(pAvailable);
+  const VkBool32 *required = featureArray(pRequired);
+  for (u32 i = 0; i < FEATURE_COUNT; i++) {
+    if (required[i] && !available[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool deviceHasExtension(VkPhysicalDevice device, const char *extensionName) {
+  u32 extensionCount;
+  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
+  VkExtensionProperties availableExtensions[extensionCount];
+  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, availableExtensions);
+
+  for (u32 i = 0; i < extensionCount; i++) {
+    if (strcmp(extensionName, availableExtensions[i].extensionName) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface, QueueFamilies *pFamilies) {
+  u32 familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, NULL);
+  VkQueueFamilyProperties families[familyCount];
+  vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families);
+
+  bool hasGraphics = false, hasPresent = false, combined = false;
+  bool hasCompute = false, hasTransfer = false;
+  memset(pFamilies, 0, sizeof(QueueFamilies));
+
+  for (u32 i = 0; i < familyCount; i++) {
+    VkQueueFlags flags = families[i].queueFlags;
+    // Headless, nothing is presented and the graphics family stands in
+    VkBool32 presentSupport = surface == VK_NULL_HANDLE && (flags & VK_QUEUE_GRAPHICS_BIT);
+    if (surface != VK_NULL_HANDLE) {
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+    }
+
+    // One family for both saves a queue ownership transfer per frame
+    bool graphics = (flags & VK_QUEUE_GRAPHICS_BIT) != 0;
+    if (graphics && presentSupport && !combined) {
+      pFamilies->graphics = i;
+      pFamilies->present = i;
+      hasGraphics = hasPresent = combined = true;
+    }
+    if (graphics && !hasGraphics) {
+      pFamilies->graphics = i;
+      hasGraphics = true;
+    }
+    if (presentSupport && !hasPresent) {
+      pFamilies->present = i;
+      hasPresent = true;
+    }
+
+    if ((flags & VK_QUEUE_COMPUTE_BIT) && !graphics && !hasCompute) {
+      pFamilies->compute = i;
+      hasCompute = true;
+    }
+    // Transfer-only families are usually backed by copy engines
+    if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) && !hasTransfer) {
+      pFamilies->transfer = i;
+      hasTransfer = true;
+    }
+  }
+
+  if (!hasGraphics || !hasPresent) {
+    return false;
+  }
+  pFamilies->dedicatedCompute = hasCompute;
+  pFamilies->dedicatedTransfer = hasTransfer;
+  pFamilies->graphicsTimestampBits = families[pFamilies->graphics].timestampValidBits;
+  if (!hasCompute) pFamilies->compute = pFamilies->graphics;
+  if (!hasTransfer) pFamilies->transfer = pFamilies->graphics;
+  return true;
+}
+
+// Dynamic rendering is core in 1.3. On 1.2 devices it is available through
+// VK_KHR_dynamic_rendering, whose dependencies were promoted to core in 1.2.
+static bool checkDynamicRendering(VkPhysicalDevice device, u32 apiVersion, bool *pIsCore) {
+  if (apiVersion >= VK_API_VERSION_1_3) {
+    *pIsCore = true;
+  } else if (apiVersion >= VK_API_VERSION_1_2 && deviceHasExtension(device, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME)) {
+    *pIsCore = false;
+  } else {
+    return false;
+  }
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR
+  };
+  VkPhysicalDeviceFeatures2 features = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+    .pNext = &dynamicRenderingFeatures
+  };
+  vkGetPhysicalDeviceFeatures2(device, &features);
+
+  return dynamicRenderingFeatures.dynamicRendering == VK_TRUE;
+}
+
+// Lets cull mode and topology move out of the pipeline key, which collapses
+// pipeline permutations. Core (without a feature bit) in 1.3.
+static bool checkExtendedDynamicState(VkPhysicalDevice device, u32 apiVersion, bool *pIsCore) {
+  if (apiVersion >= VK_API_VERSION_1_3) {
+    *pIsCore = true;
+    return true;
+  }
+  if (apiVersion < VK_API_VERSION_1_1 || !deviceHasExtension(device, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME)) {
+    return false;
+  }
+  *pIsCore = false;
+
+  VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT
+  };
+  VkPhysicalDeviceFeatures2 features = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+    .pNext = &extendedDynamicStateFeatures
+  };
+  vkGetPhysicalDeviceFeatures2(device, &features);
+
+  return extendedDynamicStateFeatures.extendedDynamicState == VK_TRUE;
+}
+
+static void addExtension(DeviceSelection *pSelection, const char *extensionName) {
+  if (pSelection->enabledExtensionCount < DEVICE_MAX_EXTENSIONS) {
+    pSelection->enabledExtensions[pSelection->enabledExtensionCount++] = extensionName;
+  }
+}
+
+// Fills pCandidate and returns its score, or 0 if the device can't be used
+static u32 evaluateDevice(VkPhysicalDevice device, VkSurfaceKHR surface, u32 instanceApiVersion, const DeviceRequirements *pRequirements, DeviceSelection *pCandidate) {
+  memset(pCandidate, 0, sizeof(DeviceSelection));
+  pCandidate->physicalDevice = device;
+  vkGetPhysicalDeviceProperties(device, &pCandidate->properties);
+  const char *name = pCandidate->properties.deviceName;
+
+  // Features and functions beyond the instance version can't be used
+  u32 apiVersion = pCandidate->properties.apiVersion < instanceApiVersion ? pCandidate->properties.apiVersion : instanceApiVersion;
+  if (apiVersion < pRequirements->minApiVersion) {
+    LOG_INFO(LOG_CATEGORY_DEVICE, "%s: Vulkan version too old", name);
+    return 0;
+  }
+
+  VkPhysicalDeviceFeatures availableFeatures;
+  vkGetPhysicalDeviceFeatures(device, &availableFeatures);
+  if (!hasFeatures(&availableFeatures, &pRequirements->features)) {
+    LOG_INFO(LOG_CATEGORY_DEVICE, "%s: required features not supported", name);
+    return 0;
+  }
+
+  for (u32 i = 0; i < pRequirements->extensionCount; i++) {
+    if (!deviceHasExtension(device, pRequirements->extensions[i])) {
+      LOG_INFO(LOG_CATEGORY_DEVICE, "%s: %s not supported", name, pRequirements->extensions[i]);
+      return 0;
+    }
+    addExtension(pCandidate, pRequirements->extensions[i]);
+  }
+
+  if (!findQueueFamilies(device, surface, &pCandidate->queueFamilies)) {
+    LOG_INFO(LOG_CATEGORY_DEVICE, "%s: no graphics or present queue", name);
+    return 0;
+  }
+
+  u32 formatCount = 0, presentModeCount = 0;
+  if (surface != VK_NULL_HANDLE) {
+    vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, NULL);
+    vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, NULL);
+  }
+  if (surface != VK_NULL_HANDLE && (formatCount == 0 || presentModeCount == 0)) {
+    LOG_INFO(LOG_CATEGORY_DEVICE, "%s: swap chain not adequately supported", name);
+    return 0;
+  }
+
+  u32 score = 1;
+
+  switch (pCandidate->properties.deviceType) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 1000; break;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 400; break;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 100; break;
+    default: break;
+  }
+
+  QueueFamilies *pFamilies = &pCandidate->queueFamilies;
+  if (pFamilies->graphics == pFamilies->present) score += 200;
+  if (pFamilies->dedicatedCompute) score += 100;
+  if (pFamilies->dedicatedTransfer) score += 100;
+
+  // 20 points per GiB of device-local memory, capped at 16 GiB
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+  VkDeviceSize deviceLocal = 0;
+  for (u32 i = 0; i < memoryProperties.memoryHeapCount; i++) {
+    if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      deviceLocal += memoryProperties.memoryHeaps[i].size;
+    }
+  }
+  u32 gibibytes = (u32)(deviceLocal >> 30);
+  score += 20 * (gibibytes < 16 ? gibibytes : 16);
+
+  // Enable only what was asked for, plus the optional bits the device has
+  VkBool32 *enabled = (VkBool32*)&pCandidate->enabledFeatures;
+  const VkBool32 *required = featureArray(&pRequirements->features);
+  const VkBool32 *optional = featureArray(&pRequirements->optionalFeatures);
+  const VkBool32 *available = featureArray(&availableFeatures);
+  for (u32 i = 0; i < FEATURE_COUNT; i++) {
+    enabled[i] = required[i] || (optional[i] && available[i]);
+    if (optional[i] && available[i]) score += 10;
+  }
+
+  for (u32 i = 0; i < pRequirements->optionalExtensionCount; i++) {
+    if (deviceHasExtension(device, pRequirements->optionalExtensions[i])) {
+      addExtension(pCandidate, pRequirements->optionalExtensions[i]);
+      score += 10;
+    }
+  }
+
+  if (pRequirements->dynamicRendering && apiVersion >= VK_API_VERSION_1_1) {
+    pCandidate->dynamicRendering = checkDynamicRendering(device, apiVersion, &pCandidate->dynamicRenderingIsCore);
+    if (pCandidate->dynamicRendering && !pCandidate->dynamicRenderingIsCore) {
+      addExtension(pCandidate, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    }
+  }
+  if (pRequirements->extendedDynamicState) {
+    pCandidate->extendedDynamicState = checkExtendedDynamicState(device, apiVersion, &pCandidate->extendedDynamicStateIsCore);
+    if (pCandidate->extendedDynamicState && !pCandidate->extendedDynamicStateIsCore) {
+      addExtension(pCandidate, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+    }
+  }
+
+  if (pRequirements->memoryBudget && apiVersion >= VK_API_VERSION_1_1 && deviceHasExtension(device, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME)) {
+    pCandidate->memoryBudget = true;
+    addExtension(pCandidate, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+  }
+
+  return score;
+}
+
+bool deviceSelect(VkInstance instance, VkSurfaceKHR surface, u32 instanceApiVersion, const DeviceRequirements *pRequirements, DeviceSelection *pSelection) {
+  u32 deviceCount = 0;
+  vkEnumeratePhysicalDevices(instance, &deviceCount, NULL);
+  if (deviceCount == 0) {
+    return false;
+  }
+
+  VkPhysicalDevice devices[deviceCount];
+  vkEnumeratePhysicalDevices(instance, &deviceCount, devices);
+
+  memset(pSelection, 0, sizeof(DeviceSelection));
+  for (u32 i = 0; i < deviceCount; i++) {
+    DeviceSelection candidate;
+    candidate.score = evaluateDevice(devices[i], surface, instanceApiVersion, pRequirements, &candidate);
+    if (candidate.score > pSelection->score) {
+      *pSelection = candidate;
+    }
+  }
+
+  return pSelection->score > 0;
+}
+
+VkDevice deviceCreate(const DeviceSelection *pSelection, u32 layerCount, const char **layers, DeviceQueues *pQueues) {
+  const QueueFamilies *pFamilies = &pSelection->queueFamilies;
+  u32 wanted[DEVICE_MAX_QUEUE_FAMILIES] = { pFamilies->graphics, pFamilies->present, pFamilies->compute, pFamilies->transfer };
+
+  static const float queuePriority = 1.0f;
+  VkDeviceQueueCreateInfo queueInfos[DEVICE_MAX_QUEUE_FAMILIES];
+  u32 queueInfoCount = 0;
+  for (u32 i = 0; i < DEVICE_MAX_QUEUE_FAMILIES; i++) {
+    bool seen = false;
+    for (u32 j = 0; j < queueInfoCount; j++) {
+      seen = seen || queueInfos[j].queueFamilyIndex == wanted[i];
+    }
+    if (seen) continue;
+
+    queueInfos[queueInfoCount++] = (VkDeviceQueueCreateInfo){
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = wanted[i],
+      .queueCount = 1,
+      .pQueuePriorities = &queuePriority
+    };
+  }
+
+  VkDeviceCreateInfo createInfo = {
+    .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+    .queueCreateInfoCount = queueInfoCount,
+    .pQueueCreateInfos = queueInfos,
+    .enabledExtensionCount = pSelection->enabledExtensionCount,
+    .ppEnabledExtensionNames = pSelection->enabledExtensions,
+    .enabledLayerCount = layerCount,
+    .ppEnabledLayerNames = layers,
+    .pEnabledFeatures = &pSelection->enabledFeatures
+  };
+
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+    .dynamicRendering = VK_TRUE
+  };
+  if (pSelection->dynamicRendering) {
+    dynamicRenderingFeatures.pNext = (void*)createInfo.pNext;
+    createInfo.pNext = &dynamicRenderingFeatures;
+  }
+
+  VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+    .extendedDynamicState = VK_TRUE
+  };
+  if (pSelection->extendedDynamicState && !pSelection->extendedDynamicStateIsCore) {
+    extendedDynamicStateFeatures.pNext = (void*)createInfo.pNext;
+    createInfo.pNext = &extendedDynamicStateFeatures;
+  }
+
+  VkDevice device;
+  if (vkCreateDevice(pSelection->physicalDevice, &createInfo, &memoryVulkanCallbacks, &device) != VK_SUCCESS) {
+    return VK_NULL_HANDLE;
+  }
+
+  vkGetDeviceQueue(device, pFamilies->graphics, 0, &pQueues->graphics);
+  vkGetDeviceQueue(device, pFamilies->present, 0, &pQueues->present);
+  vkGetDeviceQueue(device, pFamilies->compute, 0, &pQueues->compute);
+  vkGetDeviceQueue(device, pFamilies->transfer, 0, &pQueues->transfer);
+  return device;
+}
+
+u32 deviceFindMemoryType(VkPhysicalDevice device, u32 typeBits, VkMemoryPropertyFlags properties) {
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memoryProperties);
+  for (u32 i = 0; i < memoryProperties.memoryTypeCount; i++) {
+    if ((typeBits & (1u << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+      return i;
+    }
+  }
+  return UINT32_MAX;
+}
+
+VkResult deviceAllocateMemory(VkDevice device, VkPhysicalDevice physicalDevice, const VkMemoryAllocateInfo *pInfo, MemoryTag tag, VkDeviceMemory *pMemory) {
+  VkResult result = vkAllocateMemory(device, pInfo, &memoryVulkanCallbacks, pMemory);
+  if (result == VK_SUCCESS) {
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+    u32 heap = pInfo->memoryTypeIndex < memoryProperties.memoryTypeCount ? memoryProperties.memoryTypes[pInfo->memoryTypeIndex].heapIndex : 0;
+    memoryTrackDevice(*pMemory, pInfo->allocationSize, heap, tag);
+  }
+  return result;
+}
+
+void deviceFreeMemory(VkDevice device, VkDeviceMemory memory) {
+  if (memory == VK_NULL_HANDLE) return;
+  memoryUntrackDevice(memory);
+  vkFreeMemory(device, memory, &memoryVulkanCallbacks);
+}
+
+void deviceUpdateMemoryBudget(VkPhysicalDevice device, bool memoryBudget) {
+  VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+  };
+  VkPhysicalDeviceMemoryProperties2 properties = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+    .pNext = &budget
+  };
+  if (memoryBudget) {
+    vkGetPhysicalDeviceMemoryProperties2(device, &properties);
+  } else {
+    vkGetPhysicalDeviceMemoryProperties(device, &properties.memoryProperties);
+  }
+
+  MemoryHeapStats heaps[MEMORY_MAX_HEAPS];
+  u32 heapCount = properties.memoryProperties.memoryHeapCount;
+  for (u32 i = 0; i < heapCount; i++) {
+    const VkMemoryHeap *pHeap = &properties.memoryProperties.memoryHeaps[i];
+    heaps[i] = (MemoryHeapStats){
+      .size = pHeap->size,
+      .usage = memoryBudget ? budget.heapUsage[i] : memoryDeviceHeapBytes(i),
+      .budget = memoryBudget ? budget.heapBudget[i] : pHeap->size,
+      .deviceLocal = (pHeap->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0
+    };
+  }
+  memorySetHeaps(heaps, heapCount);
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdbool.h>
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+#include "memtrack.h"
+
+#define DEVICE_MAX_EXTENSIONS 16
+#define DEVICE_MAX_QUEUE_FAMILIES 4
+
+// What the engine needs from a GPU. Only features and extensions listed
+// here are enabled on the logical device.
+typedef struct DeviceRequirements {
+  u32 minApiVersion;
+  VkPhysicalDeviceFeatures features; // Devices without these are rejected
+  VkPhysicalDeviceFeatures optionalFeatures; // Enabled when supported
+  const char **extensions;
+  u32 extensionCount;
+  const char **optionalExtensions;
+  u32 optionalExtensionCount;
+  bool dynamicRendering; // Use dynamic rendering when supported
+  bool extendedDynamicState; // Use extended dynamic state when supported
+  bool memoryBudget; // Enable VK_EXT_memory_budget when supported
+} DeviceRequirements;
+
+typedef struct QueueFamilies {
+  u32 graphics;
+  u32 present; // Same as graphics when one family can do both
+  u32 compute; // A family without graphics when there is one, else graphics
+  u32 transfer; // A transfer-only family when there is one, else graphics
+  bool dedicatedCompute;
+  bool dedicatedTransfer;
+  u32 graphicsTimestampBits; // 0 when the graphics family can't write timestamps
+} QueueFamilies;
+
+typedef struct DeviceQueues {
+  VkQueue graphics;
+  VkQueue present;
+  VkQueue compute;
+  VkQueue transfer;
+} DeviceQueues;
+
+typedef struct DeviceSelection {
+  VkPhysicalDevice physicalDevice;
+  VkPhysicalDeviceProperties properties;
+  QueueFamilies queueFamilies;
+  VkPhysicalDeviceFeatures enabledFeatures;
+  const char *enabledExtensions[DEVICE_MAX_EXTENSIONS];
+  u32 enabledExtensionCount;
+  bool dynamicRendering;
+  bool dynamicRenderingIsCore;
+  bool extendedDynamicState;
+  bool extendedDynamicStateIsCore; // Core in 1.3, no feature bit to enable
+  bool memoryBudget;
+  u32 score;
+} DeviceSelection;
+
+// Rejects devices missing a requirement and scores the rest by device type,
+// queue topology and device-local memory. Returns false if none qualify.
+// With a VK_NULL_HANDLE surface nothing is checked for presenting.
+bool deviceSelect(VkInstance instance, VkSurfaceKHR surface, u32 instanceApiVersion, const DeviceRequirements *pRequirements, DeviceSelection *pSelection);
+
+// Creates one queue per distinct family in the selection
+VkDevice deviceCreate(const DeviceSelection *pSelection, u32 layerCount, const char **layers, DeviceQueues *pQueues);
+
+bool deviceHasExtension(VkPhysicalDevice device, const char *extensionName);
+
+// Index of a memory type allowed by typeBits with all of properties, or
+// UINT32_MAX if there is none
+u32 deviceFindMemoryType(VkPhysicalDevice device, u32 typeBits, VkMemoryPropertyFlags properties);
+
+// vkAllocateMemory and vkFreeMemory through memoryVulkanCallbacks, with
+// the memory counted against tag
+VkResult deviceAllocateMemory(VkDevice device, VkPhysicalDevice physicalDevice, const VkMemoryAllocateInfo *pInfo, MemoryTag tag, VkDeviceMemory *pMemory);
+void deviceFreeMemory(VkDevice device, VkDeviceMemory memory);
+
+// Refreshes the heap usage and budgets memoryGetStats reports. Without
+// VK_EXT_memory_budget usage is only what deviceAllocateMemory handed out
+// and the budget is the heap size.
+void deviceUpdateMemoryBudget(VkPhysicalDevice device, bool memoryBudget);
@@ -0,0 +1,515 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+
+#include "fileio.h"
+#include "memtrack.h"
+#include "log.h"
+
+#define MAX_READ (1u << 30) // Per read, io_uring lengths are 32 bit
+
+static FileIoHandle handleOf(const FileIo *pIo, const FileIoRequest *pRequest) {
+  return pRequest->generation << 16 | (u32)(pRequest - pIo->requests);
+}
+
+static FileIoRequest *lookup(FileIo *pIo, FileIoHandle handle) {
+  u32 index = handle & 0xFFFF;
+  if (index >= FILE_IO_MAX_REQUESTS) return NULL;
+  FileIoRequest *pRequest = &pIo->requests[index];
+  if (pRequest->state == FILE_IO_STATE_FREE || pRequest->generation != handle >> 16) return NULL;
+  return pRequest;
+}
+
+static void queuePush(FileIoQueue *pQueue, FileIoHandle handle) {
+  pQueue->handles[pQueue->tail % FILE_IO_MAX_REQUESTS] = handle;
+  pQueue->tail++;
+}
+
+static bool queuePop(FileIoQueue *pQueue, FileIoHandle *pHandle) {
+  if (pQueue->head == pQueue->tail) return false;
+  *pHandle = pQueue->handles[pQueue->head % FILE_IO_MAX_REQUESTS];
+  pQueue->head++;
+  return true;
+}
+
+static void queueRemove(FileIoQueue *pQueue, FileIoHandle handle) {
+  u32 kept = pQueue->head;
+  for (u32 i = pQueue->head; i != pQueue->tail; i++) {
+    FileIoHandle queued = pQueue->handles[i % FILE_IO_MAX_REQUESTS];
+    if (queued != handle) {
+      pQueue->handles[kept++ % FILE_IO_MAX_REQUESTS] = queued;
+    }
+  }
+  pQueue->tail = kept;
+}
+
+// The next request to start, highest priority first. Caller holds the mutex.
+static FileIoRequest *popQueued(FileIo *pIo) {
+  if (pIo->inFlight >= FILE_IO_QUEUE_DEPTH) return NULL;
+  for (u32 priority = 0; priority < FILE_IO_PRIORITY_COUNT; priority++) {
+    FileIoHandle handle;
+    if (queuePop(&pIo->queues[priority], &handle)) {
+      pIo->inFlight++;
+      return lookup(pIo, handle);
+    }
+  }
+  return NULL;
+}
+
+// Hands the request to fileIoPoll. Caller holds the mutex.
+static void finish(FileIo *pIo, FileIoRequest *pRequest, FileIoStatus status) {
+  if (pRequest->fd >= 0) {
+    close(pRequest->fd);
+    pRequest->fd = -1;
+  }
+  if (pRequest->state != FILE_IO_STATE_QUEUED) {
+    pIo->inFlight--;
+  }
+  pRequest->status = pRequest->cancelled ? FILE_IO_CANCELLED : status;
+  if (pRequest->status != FILE_IO_OK) {
+    memoryFree(pRequest->bytes);
+    pRequest->bytes = NULL;
+  }
+  pRequest->state = FILE_IO_STATE_DONE;
+  queuePush(&pIo->completed, handleOf(pIo, pRequest));
+  pthread_cond_broadcast(&pIo->doneCond);
+}
+
+// Sizes the buffer from the open file
+static bool allocateBuffer(FileIoRequest *pRequest) {
+  struct stat info;
+  if (fstat(pRequest->fd, &info) != 0 || info.st_size < 0) return false;
+  pRequest->size = (size_t)info.st_size;
+  pRequest->capacity = (pRequest->size + FILE_IO_ALIGNMENT - 1) & ~(size_t)(FILE_IO_ALIGNMENT - 1);
+  if (pRequest->capacity == 0) pRequest->capacity = FILE_IO_ALIGNMENT;
+  pRequest->bytes = memoryAlignedAlloc(FILE_IO_ALIGNMENT, pRequest->capacity, MEMORY_TAG_IO);
+  return pRequest->bytes != NULL;
+}
+
+static int openFlags(const FileIoRequest *pRequest) {
+  return O_RDONLY | O_CLOEXEC | (pRequest->direct ? O_DIRECT : 0);
+}
+
+// io_uring
+
+static bool ringInit(FileIoRing *pRing) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  memset(pRing, 0, sizeof(FileIoRing));
+  pRing->fd = (int)syscall(__NR_io_uring_setup, FILE_IO_QUEUE_DEPTH, &params);
+  if (pRing->fd < 0) return false;
+
+  pRing->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(u32);
+  pRing->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (singleMmap) {
+    if (pRing->cqRingSize > pRing->sqRingSize) pRing->sqRingSize = pRing->cqRingSize;
+    pRing->cqRingSize = 0;
+  }
+  pRing->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  pRing->pSqRing = mmap(NULL, pRing->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQ_RING);
+  pRing->pCqRing = singleMmap ? pRing->pSqRing : mmap(NULL, pRing->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_CQ_RING);
+  void *pSqes = mmap(NULL, pRing->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->fd, IORING_OFF_SQES);
+  if (pRing->pSqRing == MAP_FAILED || pRing->pCqRing == MAP_FAILED || pSqes == MAP_FAILED) {
+    if (pRing->pSqRing != MAP_FAILED) munmap(pRing->pSqRing, pRing->sqRingSize);
+    if (!singleMmap && pRing->pCqRing != MAP_FAILED) munmap(pRing->pCqRing, pRing->cqRingSize);
+    if (pSqes != MAP_FAILED) munmap(pSqes, pRing->sqesSize);
+    close(pRing->fd);
+    return false;
+  }
+  pRing->sqes = pSqes;
+
+  u8 *pSq = pRing->pSqRing;
+  pRing->sqHead = (u32*)(pSq + params.sq_off.head);
+  pRing->sqTail = (u32*)(pSq + params.sq_off.tail);
+  pRing->sqMask = *(u32*)(pSq + params.sq_off.ring_mask);
+  pRing->sqArray = (u32*)(pSq + params.sq_off.array);
+  u8 *pCq = pRing->pCqRing;
+  pRing->cqHead = (u32*)(pCq + params.cq_off.head);
+  pRing->cqTail = (u32*)(pCq + params.cq_off.tail);
+  pRing->cqMask = *(u32*)(pCq + params.cq_off.ring_mask);
+  pRing->cqes = (struct io_uring_cqe*)(pCq + params.cq_off.cqes);
+  return true;
+}
+
+static void ringDestroy(FileIoRing *pRing) {
+  munmap(pRing->sqes, pRing->sqesSize);
+  if (pRing->pCqRing != pRing->pSqRing) munmap(pRing->pCqRing, pRing->cqRingSize);
+  munmap(pRing->pSqRing, pRing->sqRingSize);
+  close(pRing->fd);
+}
+
+// Older kernels have io_uring without the opcodes used here
+static bool ringSupportsReads(FileIoRing *pRing) {
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *pProbe = memoryCalloc(1, size, MEMORY_TAG_IO);
+  if (pProbe == NULL) return false;
+  bool supported = syscall(__NR_io_uring_register, pRing->fd, IORING_REGISTER_PROBE, pProbe, 256) == 0 &&
+    pProbe->last_op >= IORING_OP_READ &&
+    (pProbe->ops[IORING_OP_OPENAT].flags & IO_URING_OP_SUPPORTED) &&
+    (pProbe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+  memoryFree(pProbe);
+  return supported;
+}
+
+static void ringEnter(FileIoRing *pRing, u32 minComplete) {
+  u32 flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  if (pRing->unsubmitted == 0 && minComplete == 0) return;
+  int submitted = (int)syscall(__NR_io_uring_enter, pRing->fd, pRing->unsubmitted, minComplete, flags, NULL, 0);
+  if (submitted > 0) {
+    pRing->unsubmitted -= (u32)submitted;
+  } else if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+    LOG_ERROR(LOG_CATEGORY_ENGINE, "io_uring_enter failed: %s", strerror(errno));
+  }
+}
+
+// Each request has at most one operation in flight and the ring holds
+// FILE_IO_QUEUE_DEPTH, so there is always room
+static struct io_uring_sqe *ringPush(FileIoRing *pRing, u8 opcode, int fd, u64 address, u32 length, u64 offset, FileIoHandle handle) {
+  u32 tail = *pRing->sqTail;
+  u32 index = tail & pRing->sqMask;
+  struct io_uring_sqe *pSqe = &pRing->sqes[index];
+  memset(pSqe, 0, sizeof(*pSqe));
+  pSqe->opcode = opcode;
+  pSqe->fd = fd;
+  pSqe->addr = address;
+  pSqe->len = length;
+  pSqe->off = offset;
+  pSqe->user_data = handle;
+  pRing->sqArray[index] = index;
+  __atomic_store_n(pRing->sqTail, tail + 1, __ATOMIC_RELEASE);
+  pRing->unsubmitted++;
+  return pSqe;
+}
+
+static void ringOpen(FileIo *pIo, FileIoRequest *pRequest) {
+  pRequest->state = FILE_IO_STATE_OPENING;
+  struct io_uring_sqe *pSqe = ringPush(&pIo->ring, IORING_OP_OPENAT, AT_FDCWD, (u64)(uintptr_t)pRequest->path, 0, 0, handleOf(pIo, pRequest));
+  pSqe->open_flags = (u32)openFlags(pRequest);
+}
+
+static void ringReadNext(FileIo *pIo, FileIoRequest *pRequest) {
+  size_t remaining = pRequest->capacity - pRequest->offset;
+  u32 length = remaining < MAX_READ ? (u32)remaining : MAX_READ;
+  ringPush(&pIo->ring, IORING_OP_READ, pRequest->fd, (u64)(uintptr_t)(pRequest->bytes + pRequest->offset), length, pRequest->offset, handleOf(pIo, pRequest));
+}
+
+// The file system doesn't do O_DIRECT, so the file is opened again and read
+// through the page cache from the start. Some refuse it at open, others
+// only fail the reads.
+static void ringReopenBuffered(FileIo *pIo, FileIoRequest *pRequest) {
+  if (pRequest->fd >= 0) {
+    close(pRequest->fd);
+    pRequest->fd = -1;
+  }
+  memoryFree(pRequest->bytes);
+  pRequest->bytes = NULL;
+  pRequest->offset = 0;
+  pRequest->direct = false;
+  ringOpen(pIo, pRequest);
+}
+
+// Advances the request whose operation completed with result. Caller
+// holds the mutex.
+static void ringComplete(FileIo *pIo, FileIoRequest *pRequest, int result) {
+  if (pRequest->cancelled) {
+    if (pRequest->state == FILE_IO_STATE_OPENING && result >= 0) {
+      pRequest->fd = result;
+    }
+    finish(pIo, pRequest, FILE_IO_CANCELLED);
+    return;
+  }
+  if (result == -EINVAL && pRequest->direct) {
+    ringReopenBuffered(pIo, pRequest);
+    return;
+  }
+
+  if (pRequest->state == FILE_IO_STATE_OPENING) {
+    if (result < 0) {
+      finish(pIo, pRequest, FILE_IO_FAILED);
+      return;
+    }
+    pRequest->fd = result;
+    if (!allocateBuffer(pRequest)) {
+      finish(pIo, pRequest, FILE_IO_FAILED);
+      return;
+    }
+    pRequest->state = FILE_IO_STATE_READING;
+  } else {
+    if (result == -EINTR || result == -EAGAIN) {
+      ringReadNext(pIo, pRequest);
+      return;
+    }
+    if (result < 0 || (result == 0 && pRequest->offset < pRequest->size)) {
+      finish(pIo, pRequest, FILE_IO_FAILED);
+      return;
+    }
+    pRequest->offset += (size_t)result;
+  }
+
+  if (pRequest->offset >= pRequest->size) {
+    finish(pIo, pRequest, FILE_IO_OK);
+  } else {
+    ringReadNext(pIo, pRequest);
+  }
+}
+
+static void ringReap(FileIo *pIo) {
+  FileIoRing *pRing = &pIo->ring;
+  u32 head = *pRing->cqHead;
+  u32 tail = __atomic_load_n(pRing->cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe *pCqe = &pRing->cqes[head & pRing->cqMask];
+    FileIoRequest *pRequest = lookup(pIo, (FileIoHandle)pCqe->user_data);
+    if (pRequest != NULL) {
+      ringComplete(pIo, pRequest, pCqe->res);
+    }
+  }
+  __atomic_store_n(pRing->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// Thread pool
+
+// O_DIRECT reads may come back short before the end, keep going until
+// the whole file is in. File systems without O_DIRECT refuse it at open or
+// only fail the reads, either way the file is read through the page cache.
+static FileIoStatus readWhole(FileIoRequest *pRequest) {
+  pRequest->fd = open(pRequest->path, openFlags(pRequest));
+  if (pRequest->fd < 0 && errno == EINVAL && pRequest->direct) {
+    pRequest->direct = false;
+    pRequest->fd = open(pRequest->path, openFlags(pRequest));
+  }
+  if (pRequest->fd < 0 || !allocateBuffer(pRequest)) return FILE_IO_FAILED;
+
+  while (pRequest->offset < pRequest->size) {
+    size_t remaining = pRequest->capacity - pRequest->offset;
+    ssize_t result = pread(pRequest->fd, pRequest->bytes + pRequest->offset, remaining < MAX_READ ? remaining : MAX_READ, (off_t)pRequest->offset);
+    if (result < 0 && errno == EINTR) continue;
+    if (result < 0 && errno == EINVAL && pRequest->direct) {
+      close(pRequest->fd);
+      pRequest->direct = false;
+      pRequest->fd = open(pRequest->path, openFlags(pRequest));
+      if (pRequest->fd < 0) return FILE_IO_FAILED;
+      continue;
+    }
+    if (result <= 0) return FILE_IO_FAILED;
+    pRequest->offset += (size_t)result;
+  }
+  return FILE_IO_OK;
+}
+
+static void *fileIoWorker(void *pArg) {
+  FileIo *pIo = pArg;
+  pthread_mutex_lock(&pIo->mutex);
+  for (;;) {
+    FileIoRequest *pRequest = NULL;
+    while (!pIo->shuttingDown && (pRequest = popQueued(pIo)) == NULL) {
+      pthread_cond_wait(&pIo->workCond, &pIo->mutex);
+    }
+    if (pRequest == NULL) break;
+    pRequest->state = FILE_IO_STATE_READING;
+    pthread_mutex_unlock(&pIo->mutex);
+
+    FileIoStatus status = readWhole(pRequest);
+
+    pthread_mutex_lock(&pIo->mutex);
+    finish(pIo, pRequest, status);
+  }
+  pthread_mutex_unlock(&pIo->mutex);
+  return NULL;
+}
+
+void fileIoInit(FileIo *pIo) {
+  memset(pIo, 0, sizeof(FileIo));
+  pthread_mutex_init(&pIo->mutex, NULL);
+  pthread_cond_init(&pIo->workCond, NULL);
+  pthread_cond_init(&pIo->doneCond, NULL);
+  for (u32 i = 0; i < FILE_IO_MAX_REQUESTS; i++) {
+    pIo->requests[i].fd = -1;
+    pIo->requests[i].generation = 1;
+    pIo->freeRequests[i] = FILE_IO_MAX_REQUESTS - 1 - i;
+  }
+  pIo->freeCount = FILE_IO_MAX_REQUESTS;
+
+  if (ringInit(&pIo->ring)) {
+    pIo->uring = ringSupportsReads(&pIo->ring);
+    if (!pIo->uring) ringDestroy(&pIo->ring);
+  }
+  if (pIo->uring) {
+    LOG_INFO(LOG_CATEGORY_ENGINE, "File reads go through io_uring");
+    return;
+  }
+
+  LOG_INFO(LOG_CATEGORY_ENGINE, "io_uring unavailable, file reads go through %u threads", FILE_IO_WORKERS);
+  for (u32 i = 0; i < FILE_IO_WORKERS; i++) {
+    if (pthread_create(&pIo->workers[i], NULL, fileIoWorker, pIo) != 0) {
+      printf("Failed to start file I/O threads!\n");
+      exit(31);
+    }
+    pIo->workerCount++;
+  }
+}
+
+void fileIoDestroy(FileIo *pIo) {
+  pthread_mutex_lock(&pIo->mutex);
+  pIo->shuttingDown = true;
+  for (u32 i = 0; i < FILE_IO_MAX_REQUESTS; i++) {
+    pIo->requests[i].cancelled = true;
+  }
+  pthread_cond_broadcast(&pIo->workCond);
+  pthread_mutex_unlock(&pIo->mutex);
+  for (u32 i = 0; i < pIo->workerCount; i++) {
+    pthread_join(pIo->workers[i], NULL);
+  }
+
+  // The kernel may still be writing into buffers of reads in flight
+  if (pIo->uring) {
+    pthread_mutex_lock(&pIo->mutex);
+    while (pIo->inFlight > 0) {
+      ringEnter(&pIo->ring, 1);
+      ringReap(pIo);
+    }
+    pthread_mutex_unlock(&pIo->mutex);
+    ringDestroy(&pIo->ring);
+  }
+
+  for (u32 i = 0; i < FILE_IO_MAX_REQUESTS; i++) {
+    memoryFree(pIo->requests[i].bytes);
+  }
+  pthread_cond_destroy(&pIo->doneCond);
+  pthread_cond_destroy(&pIo->workCond);
+  pthread_mutex_destroy(&pIo->mutex);
+}
+
+FileIoHandle fileIoRead(FileIo *pIo, const char *path, FileIoPriority priority, u32 flags, FileIoCallback callback, void *pUserData) {
+  if (strlen(path) >= FILE_IO_MAX_PATH || priority >= FILE_IO_PRIORITY_COUNT) return 0;
+  pthread_mutex_lock(&pIo->mutex);
+  if (pIo->freeCount == 0) {
+    pthread_mutex_unlock(&pIo->mutex);
+    return 0;
+  }
+  FileIoRequest *pRequest = &pIo->requests[pIo->freeRequests[--pIo->freeCount]];
+  strcpy(pRequest->path, path);
+  pRequest->priority = priority;
+  pRequest->flags = flags;
+  pRequest->callback = callback;
+  pRequest->pUserData = pUserData;
+  pRequest->state = FILE_IO_STATE_QUEUED;
+  pRequest->cancelled = false;
+  pRequest->direct = (flags & FILE_IO_DIRECT) != 0;
+  pRequest->fd = -1;
+  pRequest->bytes = NULL;
+  pRequest->size = 0;
+  pRequest->capacity = 0;
+  pRequest->offset = 0;
+  FileIoHandle handle = handleOf(pIo, pRequest);
+  queuePush(&pIo->queues[priority], handle);
+  pthread_mutex_unlock(&pIo->mutex);
+  return handle;
+}
+
+// Caller holds the mutex
+static void startQueued(FileIo *pIo) {
+  FileIoRequest *pRequest;
+  while ((pRequest = popQueued(pIo)) != NULL) {
+    ringOpen(pIo, pRequest);
+  }
+}
+
+void fileIoSubmit(FileIo *pIo) {
+  pthread_mutex_lock(&pIo->mutex);
+  if (pIo->uring) {
+    startQueued(pIo);
+    ringEnter(&pIo->ring, 0);
+  } else {
+    pthread_cond_broadcast(&pIo->workCond);
+  }
+  pthread_mutex_unlock(&pIo->mutex);
+}
+
+void fileIoCancel(FileIo *pIo, FileIoHandle handle) {
+  pthread_mutex_lock(&pIo->mutex);
+  FileIoRequest *pRequest = lookup(pIo, handle);
+  if (pRequest != NULL && pRequest->state != FILE_IO_STATE_DONE) {
+    pRequest->cancelled = true;
+    if (pRequest->state == FILE_IO_STATE_QUEUED) {
+      queueRemove(&pIo->queues[pRequest->priority], handle);
+      finish(pIo, pRequest, FILE_IO_CANCELLED);
+    }
+  }
+  pthread_mutex_unlock(&pIo->mutex);
+}
+
+u32 fileIoPoll(FileIo *pIo) {
+  pthread_mutex_lock(&pIo->mutex);
+  if (pIo->uring) {
+    ringReap(pIo);
+    startQueued(pIo);
+    ringEnter(&pIo->ring, 0);
+  }
+
+  // Callbacks run unlocked, they may queue more reads
+  u32 count = 0;
+  FileIoHandle handle;
+  while (queuePop(&pIo->completed, &handle)) {
+    FileIoRequest *pRequest = lookup(pIo, handle);
+    FileIoResult result = {
+      .status = pRequest->status,
+      .path = pRequest->path,
+      .bytes = pRequest->bytes,
+      .size = pRequest->size
+    };
+    pRequest->bytes = NULL;
+    pthread_mutex_unlock(&pIo->mutex);
+    if (pRequest->callback != NULL) {
+      pRequest->callback(pRequest->pUserData, &result);
+    } else {
+      memoryFree(result.bytes);
+    }
+    pthread_mutex_lock(&pIo->mutex);
+
+    pRequest->state = FILE_IO_STATE_FREE;
+    pRequest->generation = (pRequest->generation + 1) & 0xFFFF;
+    if (pRequest->generation == 0) pRequest->generation = 1;
+    pIo->freeRequests[pIo->freeCount++] = (u32)(pRequest - pIo->requests);
+    count++;
+  }
+  pthread_mutex_unlock(&pIo->mutex);
+  return count;
+}
+
+void fileIoWait(FileIo *pIo, FileIoHandle handle) {
+  for (;;) {
+    fileIoPoll(pIo);
+    pthread_mutex_lock(&pIo->mutex);
+    if (lookup(pIo, handle) == NULL) {
+      pthread_mutex_unlock(&pIo->mutex);
+      return;
+    }
+    if (pIo->uring) {
+      if (pIo->inFlight > 0) {
+        ringEnter(&pIo->ring, 1);
+      }
+    } else {
+      while (pIo->completed.head == pIo->completed.tail) {
+        pthread_cond_wait(&pIo->doneCond, &pIo->mutex);
+      }
+    }
+    pthread_mutex_unlock(&pIo->mutex);
+  }
+}
+
+u32 fileIoPending(FileIo *pIo) {
+  pthread_mutex_lock(&pIo->mutex);
+  u32 pending = FILE_IO_MAX_REQUESTS - pIo->freeCount;
+  pthread_mutex_unlock(&pIo->mutex);
+  return pending;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "types.h"
+
+// Asynchronous whole-file reads. Requests wait in one queue per priority
+// and at most FILE_IO_QUEUE_DEPTH are read at once, highest priority
+// first, through io_uring when the kernel has it and a pread thread pool
+// otherwise. Completions are handed back by fileIoPoll on the thread that
+// drives the FileIo, so callbacks can go straight on to upload.
+#define FILE_IO_MAX_REQUESTS 256 // Queued and in flight
+#define FILE_IO_QUEUE_DEPTH 64 // Read at once
+#define FILE_IO_WORKERS 4 // Without io_uring
+#define FILE_IO_ALIGNMENT 4096 // Of buffers and read sizes, as O_DIRECT needs
+#define FILE_IO_MAX_PATH 256
+
+typedef enum FileIoPriority {
+  FILE_IO_PRIORITY_VISIBLE = 0, // Needed for what is on screen now
+  FILE_IO_PRIORITY_PREFETCH, // Likely needed soon
+  FILE_IO_PRIORITY_BACKGROUND,
+  FILE_IO_PRIORITY_COUNT
+} FileIoPriority;
+
+#define FILE_IO_DIRECT 1u // Bypass the page cache where the file system allows, for data read once
+
+typedef enum FileIoStatus {
+  FILE_IO_OK = 0,
+  FILE_IO_FAILED,
+  FILE_IO_CANCELLED
+} FileIoStatus;
+
+typedef struct FileIoResult {
+  FileIoStatus status;
+  const char *path;
+  // FILE_IO_ALIGNMENT aligned. The callback owns it and releases it with
+  // memoryFree; NULL unless status is FILE_IO_OK.
+  u8 *bytes;
+  size_t size;
+} FileIoResult;
+
+typedef void (*FileIoCallback)(void *pUserData, FileIoResult *pResult);
+
+typedef u32 FileIoHandle; // 0 is never a valid request
+
+typedef enum FileIoState {
+  FILE_IO_STATE_FREE = 0,
+  FILE_IO_STATE_QUEUED, // Waiting for a slot in the queue depth
+  FILE_IO_STATE_OPENING, // io_uring only, the openat is in flight
+  FILE_IO_STATE_READING,
+  FILE_IO_STATE_DONE // Waiting for fileIoPoll to run its callback
+} FileIoState;
+
+typedef struct FileIoRequest {
+  char path[FILE_IO_MAX_PATH];
+  FileIoPriority priority;
+  u32 flags;
+  FileIoCallback callback;
+  void *pUserData;
+  u32 generation; // Bumped on reuse so stale handles miss
+  FileIoState state; // Guarded by FileIo.mutex
+  bool cancelled; // Reported as cancelled once its read stops
+  bool direct; // Opened with O_DIRECT
+  int fd;
+  u8 *bytes;
+  size_t size; // Of the file
+  size_t capacity; // size rounded up to FILE_IO_ALIGNMENT
+  size_t offset; // Read so far
+  FileIoStatus status;
+} FileIoRequest;
+
+// Handles in the order they were queued
+typedef struct FileIoQueue {
+  FileIoHandle handles[FILE_IO_MAX_REQUESTS];
+  u32 head;
+  u32 tail;
+} FileIoQueue;
+
+// The submission and completion rings shared with the kernel
+typedef struct FileIoRing {
+  int fd;
+  void *pSqRing;
+  size_t sqRingSize;
+  void *pCqRing;
+  size_t cqRingSize;
+  struct io_uring_sqe *sqes;
+  size_t sqesSize;
+  u32 *sqHead;
+  u32 *sqTail;
+  u32 sqMask;
+  u32 *sqArray;
+  u32 *cqHead;
+  u32 *cqTail;
+  u32 cqMask;
+  struct io_uring_cqe *cqes;
+  u32 unsubmitted; // Queued on the ring since the last io_uring_enter
+} FileIoRing;
+
+typedef struct FileIo {
+  bool uring; // Otherwise the thread pool reads
+  FileIoRing ring;
+  FileIoRequest requests[FILE_IO_MAX_REQUESTS];
+  FileIoQueue queues[FILE_IO_PRIORITY_COUNT];
+  FileIoQueue completed;
+  u32 freeRequests[FILE_IO_MAX_REQUESTS];
+  u32 freeCount;
+  u32 inFlight;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t workCond; // Workers wait here for queued requests
+  pthread_cond_t doneCond; // fileIoWait waits here without io_uring
+  bool shuttingDown;
+  pthread_t workers[FILE_IO_WORKERS];
+  u32 workerCount;
+} FileIo;
+
+// Uses io_uring when the kernel supports the reads, else starts the workers
+void fileIoInit(FileIo *pIo);
+// Drops whatever hasn't completed without running its callback
+void fileIoDestroy(FileIo *pIo);
+
+// Queues a read of the whole file. With io_uring nothing is read before
+// the next fileIoSubmit or fileIoPoll, so a batch goes to the kernel at once.
+// Returns 0 when the path is too long or too many requests are pending.
+FileIoHandle fileIoRead(FileIo *pIo, const char *path, FileIoPriority priority, u32 flags, FileIoCallback callback, void *pUserData);
+void fileIoSubmit(FileIo *pIo);
+
+// The callback still runs, with FILE_IO_CANCELLED. Reads already in flight
+// are dropped when they finish.
+void fileIoCancel(FileIo *pIo, FileIoHandle handle);
+
+// Collects finished reads, starts queued ones in their place and runs the
+// finished reads' callbacks. Never blocks. Returns the callbacks run.
+u32 fileIoPoll(FileIo *pIo);
+// Polls until the request's callback has run
+void fileIoWait(FileIo *pIo, FileIoHandle handle);
+// Requests whose callbacks haven't run yet
+u32 fileIoPending(FileIo *pIo);
@@ -0,0 +1,578 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hiz.h"
+#include "device.h"
+#include "shadercode.h"
+
+#define CULL_GROUP 64 // Matches shaders/hiz_cull.comp
+#define BUILD_TILE 32 // Level 0 texels per build workgroup and axis, matches shaders/hiz_build.comp
+#define BUILD_LEVELS 6 // Written by every build workgroup
+
+// Push constant blocks of the shaders
+typedef struct CullParams {
+  Mat4 viewProjection;
+  float pyramidScale[2]; // Level 0 texels across the render area the pyramid was built from
+  u32 objectCount;
+  u32 phase;
+  u32 levelCount;
+  u32 pyramidValid;
+  u32 secondPhaseOffset; // Slot of the second phase's first command
+} CullParams;
+
+typedef struct BuildParams {
+  i32 depthSize[2]; // Rendered part of the depth buffer
+  u32 levelCount;
+  u32 groupCount;
+} BuildParams;
+
+static u32 dispatchCount(u32 size, u32 groupSize) {
+  return (size + groupSize - 1) / groupSize;
+}
+
+static void createBuffer(HizCulling *pHiz, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *pBuffer, VkDeviceMemory *pMemory) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  if (vkCreateBuffer(pHiz->device, &bufferInfo, &memoryVulkanCallbacks, pBuffer) != VK_SUCCESS) {
+    printf("Failed to create occlusion buffer!\n");
+    exit(32);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pHiz->device, *pBuffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pHiz->physicalDevice, requirements.memoryTypeBits, properties)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pHiz->device, pHiz->physicalDevice, &allocInfo, MEMORY_TAG_OCCLUSION, pMemory) != VK_SUCCESS ||
+      vkBindBufferMemory(pHiz->device, *pBuffer, *pMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate occlusion buffer memory!\n");
+    exit(32);
+  }
+}
+
+static void *mapBuffer(HizCulling *pHiz, VkDeviceMemory memory) {
+  void *pData;
+  if (vkMapMemory(pHiz->device, memory, 0, VK_WHOLE_SIZE, 0, &pData) != VK_SUCCESS) {
+    printf("Failed to map occlusion buffer!\n");
+    exit(32);
+  }
+  return pData;
+}
+
+static VkPipeline createComputePipeline(HizCulling *pHiz, const char *name, const char *shaderDir, VkPipelineLayout layout) {
+  ShaderCode code;
+  shaderCodeLoad(name, shaderDir, &code);
+  VkShaderModuleCreateInfo moduleInfo = {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = code.size,
+    .pCode = code.words
+  };
+  VkShaderModule module;
+  if (vkCreateShaderModule(pHiz->device, &moduleInfo, &memoryVulkanCallbacks, &module) != VK_SUCCESS) {
+    printf("Failed to create %s shader module!\n", name);
+    exit(32);
+  }
+  shaderCodeFree(&code);
+
+  VkComputePipelineCreateInfo pipelineInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = module,
+      .pName = "main"
+    },
+    .layout = layout
+  };
+  VkPipeline pipeline;
+  if (vkCreateComputePipelines(pHiz->device, VK_NULL_HANDLE, 1, &pipelineInfo, &memoryVulkanCallbacks, &pipeline) != VK_SUCCESS) {
+    printf("Failed to create %s pipeline!\n", name);
+    exit(32);
+  }
+  vkDestroyShaderModule(pHiz->device, module, &memoryVulkanCallbacks);
+  return pipeline;
+}
+
+static VkPipelineLayout createPipelineLayout(HizCulling *pHiz, VkDescriptorSetLayout setLayout, u32 pushSize) {
+  VkPushConstantRange pushConstantRange = {
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = pushSize
+  };
+  VkPipelineLayoutCreateInfo layoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &setLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange
+  };
+  VkPipelineLayout layout;
+  if (vkCreatePipelineLayout(pHiz->device, &layoutInfo, &memoryVulkanCallbacks, &layout) != VK_SUCCESS) {
+    printf("Failed to create occlusion pipeline layout!\n");
+    exit(32);
+  }
+  return layout;
+}
+
+static void createPipelines(HizCulling *pHiz, const char *shaderDir) {
+  VkDescriptorSetLayoutBinding cullBindings[4] = {
+    { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL }
+  };
+  VkDescriptorSetLayoutBinding buildBindings[3] = {
+    { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, HIZ_MAX_LEVELS, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL }
+  };
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = 4,
+    .pBindings = cullBindings
+  };
+  if (vkCreateDescriptorSetLayout(pHiz->device, &setLayoutInfo, &memoryVulkanCallbacks, &pHiz->cullSetLayout) != VK_SUCCESS) {
+    printf("Failed to create occlusion descriptor set layout!\n");
+    exit(32);
+  }
+  setLayoutInfo.bindingCount = 3;
+  setLayoutInfo.pBindings = buildBindings;
+  if (vkCreateDescriptorSetLayout(pHiz->device, &setLayoutInfo, &memoryVulkanCallbacks, &pHiz->buildSetLayout) != VK_SUCCESS) {
+    printf("Failed to create occlusion descriptor set layout!\n");
+    exit(32);
+  }
+
+  pHiz->cullLayout = createPipelineLayout(pHiz, pHiz->cullSetLayout, sizeof(CullParams));
+  pHiz->buildLayout = createPipelineLayout(pHiz, pHiz->buildSetLayout, sizeof(BuildParams));
+  pHiz->cullPipeline = createComputePipeline(pHiz, "hiz_cull.comp", shaderDir, pHiz->cullLayout);
+  pHiz->buildPipeline = createComputePipeline(pHiz, "hiz_build.comp", shaderDir, pHiz->buildLayout);
+}
+
+static void createFrames(HizCulling *pHiz) {
+  VkMemoryPropertyFlags hostVisible = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  for (u32 i = 0; i < pHiz->frameCount; i++) {
+    HizFrame *pFrame = &pHiz->frames[i];
+    createBuffer(pHiz, sizeof(HizObject) * pHiz->maxObjects, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible,
+                 &pFrame->objectBuffer, &pFrame->objectMemory);
+    pFrame->pObjects = mapBuffer(pHiz, pFrame->objectMemory);
+    // Only ever written by the cull, so it can live on the device
+    createBuffer(pHiz, sizeof(VkDrawIndexedIndirectCommand) * HIZ_PHASE_COUNT * pHiz->maxObjects,
+                 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 &pFrame->commandBuffer, &pFrame->commandMemory);
+    createBuffer(pHiz, sizeof(HizStats), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, hostVisible, &pFrame->statsBuffer, &pFrame->statsMemory);
+    pFrame->pStats = mapBuffer(pHiz, pFrame->statsMemory);
+    memset(pFrame->pStats, 0, sizeof(HizStats));
+    pFrame->objectCount = 0;
+    pFrame->statsPending = false;
+  }
+}
+
+static void createDescriptorPool(HizCulling *pHiz) {
+  u32 frames = pHiz->frameCount;
+  VkDescriptorPoolSize poolSizes[] = {
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 * frames },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, HIZ_MAX_LEVELS * frames },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4 * frames }
+  };
+  VkDescriptorPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = 2 * frames,
+    .poolSizeCount = 3,
+    .pPoolSizes = poolSizes
+  };
+  if (vkCreateDescriptorPool(pHiz->device, &poolInfo, &memoryVulkanCallbacks, &pHiz->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create occlusion descriptor pool!\n");
+    exit(32);
+  }
+
+  VkDescriptorSetLayout layouts[2] = { pHiz->cullSetLayout, pHiz->buildSetLayout };
+  for (u32 i = 0; i < frames; i++) {
+    HizFrame *pFrame = &pHiz->frames[i];
+    VkDescriptorSet sets[2];
+    VkDescriptorSetAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = pHiz->descriptorPool,
+      .descriptorSetCount = 2,
+      .pSetLayouts = layouts
+    };
+    if (vkAllocateDescriptorSets(pHiz->device, &allocInfo, sets) != VK_SUCCESS) {
+      printf("Failed to allocate occlusion descriptor sets!\n");
+      exit(32);
+    }
+    pFrame->cullSet = sets[0];
+    pFrame->buildSet = sets[1];
+
+    // The buffers never change, the images are written by createPyramid
+    VkDescriptorBufferInfo bufferInfos[4] = {
+      { pFrame->objectBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->commandBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->statsBuffer, 0, VK_WHOLE_SIZE },
+      { pFrame->statsBuffer, 0, VK_WHOLE_SIZE }
+    };
+    VkWriteDescriptorSet writes[4];
+    for (u32 b = 0; b < 4; b++) {
+      writes[b] = (VkWriteDescriptorSet){
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = b < 3 ? pFrame->cullSet : pFrame->buildSet,
+        .dstBinding = b < 3 ? b + 1 : 2,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &bufferInfos[b]
+      };
+    }
+    vkUpdateDescriptorSets(pHiz->device, 4, writes, 0, NULL);
+  }
+}
+
+// Level 0 is half the depth buffer, rounded up to a square power of two so
+// every level halves the one below exactly
+static void createPyramid(HizCulling *pHiz, VkExtent2D extent, VkImageView depthView) {
+  pHiz->extent = extent;
+  u32 half = (extent.width > extent.height ? extent.width : extent.height) / 2;
+  pHiz->size = HIZ_MIN_SIZE;
+  while (pHiz->size < half && pHiz->size < HIZ_MAX_SIZE) {
+    pHiz->size *= 2;
+  }
+  pHiz->available = half <= HIZ_MAX_SIZE;
+  pHiz->levelCount = 1;
+  while ((pHiz->size >> pHiz->levelCount) > 0) {
+    pHiz->levelCount++;
+  }
+  pHiz->pyramidInitialized = false;
+  pHiz->historyValid = false;
+
+  VkImageCreateInfo imageInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = HIZ_FORMAT,
+    .extent = { pHiz->size, pHiz->size, 1 },
+    .mipLevels = pHiz->levelCount,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  if (vkCreateImage(pHiz->device, &imageInfo, &memoryVulkanCallbacks, &pHiz->pyramid) != VK_SUCCESS) {
+    printf("Failed to create depth pyramid!\n");
+    exit(32);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(pHiz->device, pHiz->pyramid, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pHiz->physicalDevice, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pHiz->device, pHiz->physicalDevice, &allocInfo, MEMORY_TAG_OCCLUSION, &pHiz->pyramidMemory) != VK_SUCCESS ||
+      vkBindImageMemory(pHiz->device, pHiz->pyramid, pHiz->pyramidMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate depth pyramid memory!\n");
+    exit(32);
+  }
+
+  VkImageViewCreateInfo viewInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = pHiz->pyramid,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = HIZ_FORMAT,
+    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pHiz->levelCount, 0, 1 }
+  };
+  if (vkCreateImageView(pHiz->device, &viewInfo, &memoryVulkanCallbacks, &pHiz->pyramidView) != VK_SUCCESS) {
+    printf("Failed to create depth pyramid view!\n");
+    exit(32);
+  }
+  for (u32 i = 0; i < pHiz->levelCount; i++) {
+    viewInfo.subresourceRange.baseMipLevel = i;
+    viewInfo.subresourceRange.levelCount = 1;
+    if (vkCreateImageView(pHiz->device, &viewInfo, &memoryVulkanCallbacks, &pHiz->levelViews[i]) != VK_SUCCESS) {
+      printf("Failed to create depth pyramid view!\n");
+      exit(32);
+    }
+  }
+
+  // Levels the pyramid doesn't have point at its last and are never written
+  VkDescriptorImageInfo levelInfos[HIZ_MAX_LEVELS];
+  for (u32 i = 0; i < HIZ_MAX_LEVELS; i++) {
+    levelInfos[i] = (VkDescriptorImageInfo){ VK_NULL_HANDLE, pHiz->levelViews[i < pHiz->levelCount ? i : pHiz->levelCount - 1], VK_IMAGE_LAYOUT_GENERAL };
+  }
+  VkDescriptorImageInfo pyramidInfo = { pHiz->sampler, pHiz->pyramidView, VK_IMAGE_LAYOUT_GENERAL };
+  VkDescriptorImageInfo depthInfo = { pHiz->sampler, depthView, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+  for (u32 i = 0; i < pHiz->frameCount; i++) {
+    HizFrame *pFrame = &pHiz->frames[i];
+    VkWriteDescriptorSet writes[3] = {
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pFrame->cullSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &pyramidInfo
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pFrame->buildSet,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &depthInfo
+      },
+      {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = pFrame->buildSet,
+        .dstBinding = 1,
+        .descriptorCount = HIZ_MAX_LEVELS,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+        .pImageInfo = levelInfos
+      }
+    };
+    vkUpdateDescriptorSets(pHiz->device, 3, writes, 0, NULL);
+  }
+}
+
+static void destroyPyramid(HizCulling *pHiz) {
+  for (u32 i = 0; i < pHiz->levelCount; i++) {
+    vkDestroyImageView(pHiz->device, pHiz->levelViews[i], &memoryVulkanCallbacks);
+  }
+  vkDestroyImageView(pHiz->device, pHiz->pyramidView, &memoryVulkanCallbacks);
+  vkDestroyImage(pHiz->device, pHiz->pyramid, &memoryVulkanCallbacks);
+  deviceFreeMemory(pHiz->device, pHiz->pyramidMemory);
+}
+
+void hizInit(HizCulling *pHiz, const HizCreateInfo *pInfo) {
+  memset(pHiz, 0, sizeof(HizCulling));
+  pHiz->device = pInfo->device;
+  pHiz->physicalDevice = pInfo->physicalDevice;
+  pHiz->frameCount = pInfo->frameCount < HIZ_MAX_FRAMES ? pInfo->frameCount : HIZ_MAX_FRAMES;
+  pHiz->maxObjects = pInfo->maxObjects > 0 ? pInfo->maxObjects : 1;
+
+  // Only ever read with texelFetch
+  VkSamplerCreateInfo samplerInfo = {
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_NEAREST,
+    .minFilter = VK_FILTER_NEAREST,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .maxLod = (float)HIZ_MAX_LEVELS
+  };
+  if (vkCreateSampler(pHiz->device, &samplerInfo, &memoryVulkanCallbacks, &pHiz->sampler) != VK_SUCCESS) {
+    printf("Failed to create occlusion sampler!\n");
+    exit(32);
+  }
+
+  createPipelines(pHiz, pInfo->shaderDir);
+  createFrames(pHiz);
+  createDescriptorPool(pHiz);
+  createPyramid(pHiz, pInfo->extent, pInfo->depthView);
+}
+
+void hizDestroy(HizCulling *pHiz) {
+  destroyPyramid(pHiz);
+  for (u32 i = 0; i < pHiz->frameCount; i++) {
+    HizFrame *pFrame = &pHiz->frames[i];
+    vkDestroyBuffer(pHiz->device, pFrame->objectBuffer, &memoryVulkanCallbacks);
+    deviceFreeMemory(pHiz->device, pFrame->objectMemory);
+    vkDestroyBuffer(pHiz->device, pFrame->commandBuffer, &memoryVulkanCallbacks);
+    deviceFreeMemory(pHiz->device, pFrame->commandMemory);
+    vkDestroyBuffer(pHiz->device, pFrame->statsBuffer, &memoryVulkanCallbacks);
+    deviceFreeMemory(pHiz->device, pFrame->statsMemory);
+  }
+  vkDestroyPipeline(pHiz->device, pHiz->cullPipeline, &memoryVulkanCallbacks);
+  vkDestroyPipeline(pHiz->device, pHiz->buildPipeline, &memoryVulkanCallbacks);
+  vkDestroyPipelineLayout(pHiz->device, pHiz->cullLayout, &memoryVulkanCallbacks);
+  vkDestroyPipelineLayout(pHiz->device, pHiz->buildLayout, &memoryVulkanCallbacks);
+  vkDestroyDescriptorPool(pHiz->device, pHiz->descriptorPool, &memoryVulkanCallbacks);
+  vkDestroyDescriptorSetLayout(pHiz->device, pHiz->cullSetLayout, &memoryVulkanCallbacks);
+  vkDestroyDescriptorSetLayout(pHiz->device, pHiz->buildSetLayout, &memoryVulkanCallbacks);
+  vkDestroySampler(pHiz->device, pHiz->sampler, &memoryVulkanCallbacks);
+  memset(pHiz, 0, sizeof(HizCulling));
+}
+
+void hizResize(HizCulling *pHiz, VkExtent2D extent, VkImageView depthView) {
+  destroyPyramid(pHiz);
+  createPyramid(pHiz, extent, depthView);
+}
+
+void hizBeginFrame(HizCulling *pHiz, u32 frame) {
+  HizFrame *pFrame = &pHiz->frames[frame];
+  pFrame->objectCount = 0;
+  memset(pFrame->pStats, 0, sizeof(HizStats));
+}
+
+u32 hizAddDraw(HizCulling *pHiz, u32 frame, const RenderDraw *pDraw, const float sphere[4]) {
+  HizFrame *pFrame = &pHiz->frames[frame];
+  if (pFrame->objectCount >= pHiz->maxObjects) {
+    printf("Too many draws to cull!\n");
+    exit(32);
+  }
+  u32 slot = pFrame->objectCount++;
+  HizObject *pObject = &pFrame->pObjects[slot];
+  memcpy(pObject->sphere, sphere, sizeof(pObject->sphere));
+  pObject->indexCount = pDraw->indexCount;
+  pObject->instanceCount = pDraw->instanceCount;
+  pObject->firstIndex = pDraw->firstIndex;
+  pObject->vertexOffset = pDraw->vertexOffset;
+  pObject->firstInstance = pDraw->firstInstance;
+  return slot;
+}
+
+VkDeviceSize hizCommandOffset(const HizCulling *pHiz, HizPhase phase, u32 slot) {
+  return ((VkDeviceSize)phase * pHiz->maxObjects + slot) * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+void hizRecordCull(HizCulling *pHiz, VkCommandBuffer commandBuffer, u32 frame, HizPhase phase, const Mat4 *pViewProjection) {
+  HizFrame *pFrame = &pHiz->frames[frame];
+
+  // Cleared once, so levels past the render area hold no garbage. Later
+  // builds leave them as they are, which can only cull less.
+  if (!pHiz->pyramidInitialized) {
+    VkImageMemoryBarrier clearBarrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = 0,
+      .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = pHiz->pyramid,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pHiz->levelCount, 0, 1 }
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, NULL, 0, NULL, 1, &clearBarrier);
+    VkClearColorValue zero = {{ 0.0f, 0.0f, 0.0f, 0.0f }};
+    vkCmdClearColorImage(commandBuffer, pHiz->pyramid, VK_IMAGE_LAYOUT_GENERAL, &zero, 1, &clearBarrier.subresourceRange);
+    VkMemoryBarrier clearedBarrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                         1, &clearedBarrier, 0, NULL, 0, NULL);
+    pHiz->pyramidInitialized = true;
+  }
+
+  if (pFrame->objectCount > 0) {
+    bool pyramidValid = phase == HIZ_PHASE_FIRST ? pHiz->historyValid : pHiz->available;
+    CullParams params = {
+      .viewProjection = *pViewProjection,
+      .pyramidScale = { pHiz->historyExtent.width * 0.5f, pHiz->historyExtent.height * 0.5f },
+      .objectCount = pFrame->objectCount,
+      .phase = (u32)phase,
+      .levelCount = pHiz->levelCount,
+      .pyramidValid = pyramidValid,
+      .secondPhaseOffset = pHiz->maxObjects
+    };
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pHiz->cullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pHiz->cullLayout, 0, 1, &pFrame->cullSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, pHiz->cullLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer, dispatchCount(pFrame->objectCount, CULL_GROUP), 1, 1);
+  }
+
+  VkMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                       1, &barrier, 0, NULL, 0, NULL);
+
+  // The counts are final after the second phase and read on the host
+  if (phase == HIZ_PHASE_SECOND) {
+    VkBufferMemoryBarrier toHost = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = pFrame->statsBuffer,
+      .offset = 0,
+      .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         0, NULL, 1, &toHost, 0, NULL);
+    pFrame->statsPending = true;
+  }
+}
+
+void hizRecordBuild(HizCulling *pHiz, VkCommandBuffer commandBuffer, u32 frame, VkImage depthImage, VkExtent2D renderExtent) {
+  HizFrame *pFrame = &pHiz->frames[frame];
+
+  // The first phase's cull has read the old pyramid by now
+  VkImageMemoryBarrier depthBarrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = depthImage,
+    .subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 }
+  };
+  // Nothing to build, the second phase only has to wait for the depth
+  if (!pHiz->available) {
+    depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                         VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0,
+                         0, NULL, 0, NULL, 1, &depthBarrier);
+    return;
+  }
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 1, &depthBarrier);
+
+  // Only the tiles covering the render area. The rest keep older depth.
+  u32 tiles = pHiz->size / BUILD_TILE;
+  u32 groupsX = dispatchCount(renderExtent.width, 2 * BUILD_TILE);
+  u32 groupsY = dispatchCount(renderExtent.height, 2 * BUILD_TILE);
+  groupsX = groupsX < tiles ? groupsX : tiles;
+  groupsY = groupsY < tiles ? groupsY : tiles;
+  BuildParams params = {
+    .depthSize = { (i32)renderExtent.width, (i32)renderExtent.height },
+    .levelCount = pHiz->levelCount,
+    .groupCount = groupsX * groupsY
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pHiz->buildPipeline);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pHiz->buildLayout, 0, 1, &pFrame->buildSet, 0, NULL);
+  vkCmdPushConstants(commandBuffer, pHiz->buildLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+  vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+  // The second phase reads the pyramid, then draws into the depth again
+  depthBarrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  depthBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  VkMemoryBarrier pyramidBarrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, 0,
+                       1, &pyramidBarrier, 0, NULL, 1, &depthBarrier);
+  pHiz->historyValid = true;
+  pHiz->historyExtent = renderExtent;
+}
+
+bool hizCollectStats(HizCulling *pHiz, u32 frame) {
+  HizFrame *pFrame = &pHiz->frames[frame];
+  if (!pFrame->statsPending) {
+    return false;
+  }
+  pFrame->statsPending = false;
+  pHiz->lastStats = *pFrame->pStats;
+  return true;
+}
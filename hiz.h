@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdbool.h>
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+#include "vmath.h"
+#include "renderqueue.h"
+
+// Hierarchical-Z occlusion culling in two phases. The first tests every
+// draw against the depth pyramid the previous frame built and draws the
+// survivors. Their depth is reduced into a new pyramid by a single compute
+// dispatch, and the second phase retests only what the first rejected
+// against it, drawing whatever turns out visible. Objects that come into
+// view therefore never pop in a frame late. Draws are indirect, the
+// compute passes write each one's instance count.
+#define HIZ_FORMAT VK_FORMAT_R32_SFLOAT
+#define HIZ_MAX_LEVELS 12 // Matches shaders/hiz_build.comp
+#define HIZ_MIN_SIZE 32 // One build workgroup's tile, so it always writes levels 0 to 5
+#define HIZ_MAX_SIZE 2048 // Level 0 is half the render resolution
+#define HIZ_MAX_FRAMES 4
+
+typedef enum HizPhase {
+  HIZ_PHASE_FIRST = 0, // Against last frame's pyramid
+  HIZ_PHASE_SECOND, // Only what the first rejected, against this frame's
+  HIZ_PHASE_COUNT
+} HizPhase;
+
+// Matches Object in shaders/hiz_cull.comp
+typedef struct HizObject {
+  float sphere[4]; // World space center and radius
+  u32 indexCount;
+  u32 instanceCount;
+  u32 firstIndex;
+  i32 vertexOffset;
+  u32 firstInstance;
+  u32 padding[3];
+} HizObject;
+
+// Matches the Stats buffer. The counts are of the frame's draws.
+typedef struct HizStats {
+  u32 tested;
+  u32 firstPhaseVisible;
+  u32 secondPhaseVisible;
+  u32 finishedGroups; // The build's, back at 0 once it is done
+} HizStats;
+
+typedef struct HizCreateInfo {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  u32 frameCount; // One per frame in flight
+  u32 maxObjects; // Draws per frame
+  VkExtent2D extent; // Of the depth buffer
+  VkImageView depthView; // Sampled by the build
+  const char *shaderDir; // Passed to shaderCodeLoad
+} HizCreateInfo;
+
+// Everything one frame in flight reads and writes besides the pyramid
+typedef struct HizFrame {
+  VkBuffer objectBuffer;
+  VkDeviceMemory objectMemory;
+  HizObject *pObjects; // Mapped
+  VkBuffer commandBuffer; // VkDrawIndexedIndirectCommand per object, the first phase's then the second's
+  VkDeviceMemory commandMemory;
+  VkBuffer statsBuffer;
+  VkDeviceMemory statsMemory;
+  HizStats *pStats; // Mapped
+  VkDescriptorSet cullSet;
+  VkDescriptorSet buildSet;
+  u32 objectCount;
+  bool statsPending;
+} HizFrame;
+
+typedef struct HizCulling {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  u32 maxObjects;
+  VkExtent2D extent;
+  u32 size; // Of level 0, square and a power of two
+  u32 levelCount;
+  bool available; // False when the depth buffer is too large to cull against
+  VkImage pyramid; // Stays in VK_IMAGE_LAYOUT_GENERAL once the first frame has used it
+  VkDeviceMemory pyramidMemory;
+  VkImageView levelViews[HIZ_MAX_LEVELS]; // Storage, one per level
+  VkImageView pyramidView; // Sampled, every level
+  bool pyramidInitialized;
+  bool historyValid; // The pyramid holds a previous frame's depth
+  VkExtent2D historyExtent; // Render extent of the frame it was built from
+  VkSampler sampler;
+  VkDescriptorSetLayout cullSetLayout;
+  VkDescriptorSetLayout buildSetLayout;
+  VkDescriptorPool descriptorPool;
+  VkPipelineLayout cullLayout;
+  VkPipelineLayout buildLayout;
+  VkPipeline cullPipeline;
+  VkPipeline buildPipeline;
+  HizFrame frames[HIZ_MAX_FRAMES];
+  u32 frameCount;
+  HizStats lastStats; // Of the last frame collected
+} HizCulling;
+
+void hizInit(HizCulling *pHiz, const HizCreateInfo *pInfo);
+// The device must be idle
+void hizDestroy(HizCulling *pHiz);
+// Rebuilds the pyramid for a new depth buffer and drops the history. The
+// device must be idle.
+void hizResize(HizCulling *pHiz, VkExtent2D extent, VkImageView depthView);
+
+// Starts the frame's list of draws. The frame's previous submission must
+// have completed.
+void hizBeginFrame(HizCulling *pHiz, u32 frame);
+// Appends a draw, returning its slot in the indirect commands. Only
+// indexed draws can be culled.
+u32 hizAddDraw(HizCulling *pHiz, u32 frame, const RenderDraw *pDraw, const float sphere[4]);
+// Where a slot's indirect command is in the frame's command buffer
+VkDeviceSize hizCommandOffset(const HizCulling *pHiz, HizPhase phase, u32 slot);
+
+// Records one phase's culling of the frame's draws against the pyramid.
+// Call outside a render pass; the indirect commands are ready for the
+// draws recorded after it. Without a previous pyramid the first phase
+// keeps everything.
+void hizRecordCull(HizCulling *pHiz, VkCommandBuffer commandBuffer, u32 frame, HizPhase phase, const Mat4 *pViewProjection);
+// Builds the pyramid from the first phase's depth, which is in
+// VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL and returned to it.
+void hizRecordBuild(HizCulling *pHiz, VkCommandBuffer commandBuffer, u32 frame, VkImage depthImage, VkExtent2D renderExtent);
+
+// Reads the frame's counts into lastStats once its fence has signaled.
+// Returns false when there were none.
+bool hizCollectStats(HizCulling *pHiz, u32 frame);
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "log.h"
+
+#define LOG_RING_SIZE 1024 // Power of two
+#define LOG_MESSAGE_SIZE 480
+#define LOG_RATE_TABLE_SIZE 256 // Power of two
+#define LOG_RATE_LIMIT 5 // Repeats of one message ID per window
+#define LOG_RATE_WINDOW_MS 1000
+
+typedef struct LogRecord {
+  _Atomic u64 sequence;
+  double timeMs;
+  u32 threadId;
+  i32 messageId;
+  u8 level;
+  u8 category;
+  char message[LOG_MESSAGE_SIZE];
+} LogRecord;
+
+typedef struct LogRateEntry {
+  _Atomic i32 messageId;
+  _Atomic u32 window;
+  _Atomic u32 count;
+} LogRateEntry;
+
+// Bounded MPSC ring in the style of Vyukov's queue: a slot is free for the
+// producer whose ticket equals its sequence, and readable once the sequence
+// is ticket + 1.
+static LogRecord ring[LOG_RING_SIZE];
+static _Atomic u64 writeTicket;
+static u64 readTicket;
+
+// Bumped after every publish. The idle writer waits on it as a futex, and
+// producers only make the wake call while it says it is waiting.
+static _Atomic u32 publishCount;
+static _Atomic bool writerWaiting;
+
+static LogRateEntry rateTable[LOG_RATE_TABLE_SIZE];
+static _Atomic u8 minLevels[LOG_CATEGORY_COUNT];
+static _Atomic u32 droppedCount;
+static _Atomic u32 suppressedCount;
+
+static LogFormat logFormat;
+static double startMs;
+static pthread_t writerThread;
+static _Atomic bool running;
+static _Atomic bool initialized;
+static _Thread_local u32 threadId;
+
+static const char *levelNames[LOG_LEVEL_COUNT] = { "debug", "info", "warn", "error" };
+static const char *categoryNames[LOG_CATEGORY_COUNT] = { "engine", "device", "pipeline", "validation", "memory" };
+
+static double nowMs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void writeJsonString(FILE *file, const char *text) {
+  fputc('"', file);
+  for (const char *p = text; *p; p++) {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"' || c == '\\') {
+      fputc('\\', file);
+      fputc(c, file);
+    } else if (c == '\n') {
+      fputs("\\n", file);
+    } else if (c < 0x20) {
+      fprintf(file, "\\u%04x", c);
+    } else {
+      fputc(c, file);
+    }
+  }
+  fputc('"', file);
+}
+
+static void writeRecord(const LogRecord *pRecord) {
+  if (logFormat == LOG_FORMAT_JSON) {
+    printf("{\"time_ms\":%.3f,\"level\":\"%s\",\"category\":\"%s\",\"thread\":%u",
+      pRecord->timeMs, levelNames[pRecord->level], categoryNames[pRecord->category], pRecord->threadId);
+    if (pRecord->messageId != 0) {
+      printf(",\"id\":%d", pRecord->messageId);
+    }
+    printf(",\"message\":");
+    writeJsonString(stdout, pRecord->message);
+    printf("}\n");
+  } else if (pRecord->messageId != 0) {
+    printf("[%10.3f] %-5s %-10s [0x%08x] %s\n", pRecord->timeMs / 1000.0, levelNames[pRecord->level],
+      categoryNames[pRecord->category], (u32)pRecord->messageId, pRecord->message);
+  } else {
+    printf("[%10.3f] %-5s %-10s %s\n", pRecord->timeMs / 1000.0, levelNames[pRecord->level],
+      categoryNames[pRecord->category], pRecord->message);
+  }
+}
+
+// Only the writer thread (or shutdown, after joining it) calls this
+static u32 drain(void) {
+  u32 written = 0;
+  for (;;) {
+    LogRecord *pRecord = &ring[readTicket & (LOG_RING_SIZE - 1)];
+    if (atomic_load_explicit(&pRecord->sequence, memory_order_acquire) != readTicket + 1) {
+      break;
+    }
+    writeRecord(pRecord);
+    atomic_store_explicit(&pRecord->sequence, readTicket + LOG_RING_SIZE, memory_order_release);
+    readTicket++;
+    written++;
+  }
+  if (written > 0) {
+    fflush(stdout);
+  }
+  return written;
+}
+
+static void wakeWriter(void) {
+  atomic_fetch_add(&publishCount, 1);
+  if (atomic_load(&writerWaiting)) {
+    syscall(SYS_futex, &publishCount, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
+
+static void *logWriter(void *pArg) {
+  (void)pArg;
+  for (;;) {
+    // Read before draining, so a publish after the drain fails the wait
+    u32 seen = atomic_load(&publishCount);
+    if (!atomic_load(&running)) {
+      break;
+    }
+    if (drain() == 0) {
+      atomic_store(&writerWaiting, true);
+      syscall(SYS_futex, &publishCount, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+      atomic_store(&writerWaiting, false);
+    }
+  }
+  return NULL;
+}
+
+void logInit(LogFormat format) {
+  if (initialized) return;
+
+  logFormat = format;
+  startMs = nowMs();
+  for (u64 i = 0; i < LOG_RING_SIZE; i++) {
+    atomic_init(&ring[i].sequence, i);
+  }
+  for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+    atomic_init(&minLevels[i], LOG_LEVEL_INFO);
+  }
+
+  atomic_store(&running, true);
+  if (pthread_create(&writerThread, NULL, logWriter, NULL) != 0) {
+    printf("Failed to start log writer thread!\n");
+    exit(21);
+  }
+  initialized = true;
+  atexit(logShutdown);
+}
+
+void logShutdown(void) {
+  if (!initialized) return;
+  initialized = false;
+
+  atomic_store(&running, false);
+  wakeWriter();
+  pthread_join(writerThread, NULL);
+  drain();
+
+  u32 dropped = atomic_load(&droppedCount);
+  u32 suppressed = atomic_load(&suppressedCount);
+  if (dropped > 0 || suppressed > 0) {
+    printf("Log: %u messages dropped (ring full), %u suppressed as repeats\n", dropped, suppressed);
+  }
+}
+
+void logSetLevel(LogCategory category, LogLevel level) {
+  atomic_store_explicit(&minLevels[category], (u8)level, memory_order_relaxed);
+}
+
+void logSetLevelAll(LogLevel level) {
+  for (int i = 0; i < LOG_CATEGORY_COUNT; i++) {
+    logSetLevel((LogCategory)i, level);
+  }
+}
+
+bool logParseLevel(const char *name, LogLevel *pLevel) {
+  for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+    if (strcmp(name, levelNames[i]) == 0) {
+      *pLevel = (LogLevel)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Lock-free per-ID counter. Hash collisions simply aren't limited.
+static bool rateLimited(i32 messageId, double timeMs) {
+  u32 hash = (u32)messageId * 2654435761u;
+  LogRateEntry *pEntry = &rateTable[(hash >> 24) & (LOG_RATE_TABLE_SIZE - 1)];
+
+  i32 expected = 0;
+  if (!atomic_compare_exchange_strong(&pEntry->messageId, &expected, messageId) && expected != messageId) {
+    return false;
+  }
+
+  u32 window = (u32)(timeMs / LOG_RATE_WINDOW_MS);
+  u32 entryWindow = atomic_load_explicit(&pEntry->window, memory_order_relaxed);
+  if (entryWindow != window && atomic_compare_exchange_strong(&pEntry->window, &entryWindow, window)) {
+    atomic_store_explicit(&pEntry->count, 0, memory_order_relaxed);
+  }
+  return atomic_fetch_add_explicit(&pEntry->count, 1, memory_order_relaxed) >= LOG_RATE_LIMIT;
+}
+
+// Ends a message cut off at LOG_MESSAGE_SIZE with "...", backing up to the
+// start of a UTF-8 sequence so the JSON output stays valid
+static void markTruncated(char *message) {
+  size_t end = LOG_MESSAGE_SIZE - 4;
+  while (end > 0 && ((u8)message[end] & 0xC0) == 0x80) {
+    end--;
+  }
+  memcpy(message + end, "...", 4);
+}
+
+void logWrite(LogLevel level, LogCategory category, i32 messageId, const char *format, ...) {
+  if ((u8)level < atomic_load_explicit(&minLevels[category], memory_order_relaxed)) {
+    return;
+  }
+
+  double timeMs = nowMs() - startMs;
+  if (messageId != 0 && rateLimited(messageId, timeMs)) {
+    atomic_fetch_add_explicit(&suppressedCount, 1, memory_order_relaxed);
+    return;
+  }
+
+  // Before logInit, or after shutdown, write straight through
+  if (!initialized) {
+    va_list args;
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+    return;
+  }
+
+  u64 ticket = atomic_load_explicit(&writeTicket, memory_order_relaxed);
+  LogRecord *pRecord;
+  for (;;) {
+    pRecord = &ring[ticket & (LOG_RING_SIZE - 1)];
+    u64 sequence = atomic_load_explicit(&pRecord->sequence, memory_order_acquire);
+    if (sequence == ticket) {
+      if (atomic_compare_exchange_weak_explicit(&writeTicket, &ticket, ticket + 1, memory_order_relaxed, memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < ticket) {
+      // The writer hasn't freed this slot yet: the ring is full
+      atomic_fetch_add_explicit(&droppedCount, 1, memory_order_relaxed);
+      return;
+    } else {
+      ticket = atomic_load_explicit(&writeTicket, memory_order_relaxed);
+    }
+  }
+
+  pRecord->timeMs = timeMs;
+  if (threadId == 0) {
+    threadId = (u32)syscall(SYS_gettid);
+  }
+  pRecord->threadId = threadId;
+  pRecord->messageId = messageId;
+  pRecord->level = (u8)level;
+  pRecord->category = (u8)category;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(pRecord->message, LOG_MESSAGE_SIZE, format, args);
+  va_end(args);
+  if (length >= LOG_MESSAGE_SIZE) {
+    markTruncated(pRecord->message);
+  }
+
+  atomic_store_explicit(&pRecord->sequence, ticket + 1, memory_order_release);
+  wakeWriter();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+// Messages are formatted on the calling thread into a lock-free ring and
+// written to stdout by a background thread. Producers never block: when the
+// ring is full the message is dropped and counted.
+
+typedef enum LogLevel {
+  LOG_LEVEL_DEBUG = 0,
+  LOG_LEVEL_INFO,
+  LOG_LEVEL_WARN,
+  LOG_LEVEL_ERROR,
+  LOG_LEVEL_COUNT
+} LogLevel;
+
+typedef enum LogCategory {
+  LOG_CATEGORY_ENGINE = 0,
+  LOG_CATEGORY_DEVICE,
+  LOG_CATEGORY_PIPELINE,
+  LOG_CATEGORY_VALIDATION, // Vulkan debug messenger
+  LOG_CATEGORY_MEMORY,
+  LOG_CATEGORY_COUNT
+} LogCategory;
+
+typedef enum LogFormat {
+  LOG_FORMAT_TEXT = 0,
+  LOG_FORMAT_JSON // One JSON object per line
+} LogFormat;
+
+void logInit(LogFormat format);
+// Drains the ring and stops the writer. Also runs at exit, so messages
+// logged before a fatal exit() still reach stdout.
+void logShutdown(void);
+
+// Messages below the level are discarded before formatting
+void logSetLevel(LogCategory category, LogLevel level);
+void logSetLevelAll(LogLevel level);
+bool logParseLevel(const char *name, LogLevel *pLevel);
+
+// messageId groups repeats for rate limiting; 0 disables it for the call
+void logWrite(LogLevel level, LogCategory category, i32 messageId, const char *format, ...) __attribute__((format(printf, 4, 5)));
+
+#define LOG_DEBUG(category, ...) logWrite(LOG_LEVEL_DEBUG, category, 0, __VA_ARGS__)
+#define LOG_INFO(category, ...) logWrite(LOG_LEVEL_INFO, category, 0, __VA_ARGS__)
+#define LOG_WARN(category, ...) logWrite(LOG_LEVEL_WARN, category, 0, __VA_ARGS__)
+#define LOG_ERROR(category, ...) logWrite(LOG_LEVEL_ERROR, category, 0, __VA_ARGS__)
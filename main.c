@@ -2,17 +2,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <math.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
-typedef uint8_t u8;
-typedef uint16_t u16;
-typedef uint32_t u32;
-typedef int8_t i8;
-typedef int16_t i16;
-typedef int32_t i32;
+#include "types.h"
+#include "device.h"
+#include "pipelines.h"
+#include "renderqueue.h"
+#include "cull.h"
+#include "vmath.h"
+#include "bench.h"
+#include "trace.h"
+#include "log.h"
+#include "triplebuffer.h"
+#include "resolution.h"
+#include "capture.h"
+#include "clusters.h"
+#include "post.h"
+#include "memtrack.h"
+#include "mesh.h"
+#include "meshfile.h"
+#include "shadercode.h"
+#include "replayfile.h"
+#include "fileio.h"
+#include "hiz.h"
 
 const char* WIN_TITLE = "SeEngine";
 const u32 WIN_WIDTH = 800;
@@ -20,8 +40,36 @@ const u32 WIN_HEIGHT = 600;
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
-u32 currentFrame = 0;
-bool framebufferResized = false;
+#define MAX_SCENE_PIPELINES 16
+#define MAX_CULL_THREADS 4
+#define BENCH_OBJECT_COUNT 10000
+#define BENCH_RESIZE_INTERVAL 10
+#define SIMULATION_HZ 240.0
+#define SIMULATION_SPIN_SPEED 0.5f // Radians per second
+#define ON_DEMAND_HZ 60.0 // Redraw rate while something animates with --on-demand
+#define RENDER_SCALE_MIN 0.5f
+#define RENDER_SCALE_MAX 1.0f
+#define MAX_SCENE_MESHES 4
+#define CAMERA_FOV 0.785f
+#define CAMERA_NEAR 0.1f
+#define CAMERA_FAR 100.0f
+#define LOD_SPHERE_RINGS 48
+#define LOD_SPHERE_SEGMENTS 96
+#define LOD_FIELD_WIDTH 16
+#define LOD_FIELD_HEIGHT 8
+#define LOD_FIELD_DEPTH 30
+#define LOD_FIELD_SPACING 2.5f
+#define OCCLUSION_WALL_WIDTH 10
+#define OCCLUSION_WALL_HEIGHT 8
+#define OCCLUSION_WALL_SPACING 0.3f
+#define OCCLUSION_WALL_Z 0.5f
+#define OCCLUSION_LOG_ID 0x48697a00 // Rate limits the per-frame counts
+#define MAX_LIGHTS 65536
+#define LIGHT_OVERLAP 4.0f // Lights reaching an average point of the scene
+#define LIGHT_ORBIT_SPEED 1.0f // Radians per second
+#define MEMORY_BUDGET_WARNING 0.9 // Fraction of a heap's budget that gets a warning
+
+u32 currentFrame = 0; // Only touched by the render thread
 
 
 const u32 validationLayerCount = 1;
@@ -43,12 +91,12 @@ typedef struct SwapChainSupportDetails {
   VkPresentModeKHR *presentModes;
 } SwapChainSupportDetails;
 
-typedef struct QueueFamilyIndices {
-  u32 graphicsFamily;
-  bool isGraphicsFamilySet;
-  u32 presentFamily;
-  bool isPresentFamilySet;
-} QueueFamilyIndices;
+// One simulation step, handed to the render thread through a TripleBuffer
+typedef struct FrameSnapshot {
+  double simulationMs; // benchNowMs() when the step ran
+  double animationMs; // Since the simulation started, less the time animation was paused
+  Mat4 *objectTransforms; // Model matrices, indexed like objectBounds
+} FrameSnapshot;
 
 typedef struct App {
   GLFWwindow *window;
@@ -56,27 +104,138 @@ typedef struct App {
   VkDebugUtilsMessengerEXT debugMessenger;
   VkSurfaceKHR surface;
   VkPhysicalDevice physicalDevice;
-  QueueFamilyIndices queueFamilyIndices;
+  DeviceSelection deviceSelection;
+  QueueFamilies queueFamilies;
   VkDevice device; // Logical device
   VkQueue graphicsQueue;
   VkQueue presentQueue;
+  VkQueue computeQueue;
+  VkQueue transferQueue;
   VkSwapchainKHR swapChain;
   u32 swapChainImageCount;
   VkImage *swapChainImages;
   VkFormat swapChainImageFormat;
   VkExtent2D swapChainExtent;
   VkImageView *swapChainImageViews;
-  VkRenderPass renderPass;
+  bool swapChainTransferDst; // Swap chain images can be blitted to
+  bool dynamicResolution; // Render offscreen at a scaled extent and blit to the swap chain
+  bool fixedResolution; // --fixed-resolution
+  bool postRequested; // Cleared by --no-post
+  bool postProcessing; // Render in HDR and finish the frame with compute passes
+  bool renderOffscreen; // With dynamicResolution or postProcessing
+  VkFormat renderFormat; // What the scene renders into
+  PostProcessing post;
+  double postSimulationMs; // Simulation time of the last post processed frame, for adaptation
+  float gpuBudgetMs;
+  ResolutionController resolution;
+  VkExtent2D renderExtent; // What this frame renders at, swapChainExtent without dynamicResolution
+  VkFilter upscaleFilter;
+  VkImage *offscreenImages; // One per frame in flight, sized to the swap chain, in renderFormat
+  VkDeviceMemory *offscreenMemory;
+  VkImageView *offscreenImageViews;
+  bool swapChainTransferSrc; // Swap chain images can be copied from
+  const char *capturePath; // NULL when not capturing
+  CaptureOutput captureOutput;
+  u32 captureFirst;
+  u32 captureCount;
+  bool captureEnabled;
+  Capture capture;
+  const char *recordPath; // --record, NULL when not recording
+  ReplayWriter replay;
+  ClusteredLighting lighting;
+  u32 lightCount; // --lights
+  Light *lightBases; // Where each light orbits
+  Light *lights; // This frame's, copied to the GPU
+  VkQueryPool timestampPool; // Start and end of each frame in flight
+  bool timestampsPending[2]; // Indexed by currentFrame
+  double timestampPeriodNs;
+  u64 timestampMask;
+  VkRenderPass renderPass; // VK_NULL_HANDLE when useDynamicRendering
+  VkRenderPass secondPhasePass; // Continues renderPass's attachments, only with occlusionCulling
+  VkFormat depthFormat;
+  VkImage depthImage; // Sized to the swap chain, shared by the frames in flight
+  VkDeviceMemory depthMemory;
+  VkImageView depthImageView;
+  bool occlusionCulling; // Draw in two phases against a depth pyramid, cleared by --no-occlusion
+  HizCulling hiz;
   VkPipelineLayout pipelineLayout;
-  VkPipeline graphicsPipeline;
-  VkFramebuffer *swapChainFramebuffers;
+  PipelineManager pipelines;
+  PipelineKey pipelineKeys[MAX_SCENE_PIPELINES]; // Indexed by the pipeline field of render keys
+  u32 pipelineKeyCount;
+  RenderQueue renderQueue;
+  CullSpheres objectBounds; // World space bounds, one per scene object
+  RenderDraw *objectDraws; // Indexed like objectBounds
+  u32 *objectMeshes; // Indexed like objectBounds
+  u8 *objectLods; // Chosen last frame, kept while it stays good enough
+  MeshBuffers meshData; // Every mesh and its LODs, uploaded once by createScene
+  Mesh meshes[MAX_SCENE_MESHES];
+  u32 meshCount;
+  VkBuffer vertexBuffers[MESH_VERTEX_FORMAT_COUNT]; // VK_NULL_HANDLE for formats no mesh uses
+  VkDeviceMemory vertexMemory[MESH_VERTEX_FORMAT_COUNT];
+  VkBuffer indexBuffer;
+  VkDeviceMemory indexMemory;
+  Vec4 *instances; // Offset in xyz and scale in w, in model space. Entry 0 leaves a mesh as it is.
+  u32 instanceCount;
+  VkBuffer instanceBuffer; // Vertex binding 1, advanced per instance
+  VkDeviceMemory instanceMemory;
+  float lodThreshold; // Screen space error in pixels, 0 always draws the full mesh
+  const char *meshPath; // Cooked mesh replacing the scenario's own, may be NULL
+  FileIo fileIo;
+  FileIoHandle meshRead; // Of meshPath, queued before the window and device are created
+  MeshData cookedMesh;
+  bool cookedMeshLoaded;
+  const char *shaderDir; // Read SPIR-V from here instead of the embedded copies, may be NULL
+  Vec3 cameraEye;
+  Vec3 *objectTranslations; // Indexed like objectBounds, read by the simulation
+  Quat *objectRotations;
+  Vec3 *objectScales;
+  FrameSnapshot snapshots[3];
+  TripleBuffer snapshotBuffer;
+  const FrameSnapshot *pSnapshot; // The step the render thread is drawing
+  double simulationStartMs;
+  Mat4 *objectMvps; // Pushed to the vertex shader per draw
+  u32 *visibleObjects;
+  u32 objectCount;
+  Mat4 view;
+  Mat4 projection;
+  Mat4 viewProjection;
+  VkFramebuffer *swapChainFramebuffers; // Over the offscreen images with renderOffscreen
+  u32 framebufferCount;
   VkCommandPool commandPool;
   VkCommandBuffer *commandBuffers;
   VkSemaphore *imageAvailableSemaphores;
   VkSemaphore *renderFinishedSemaphores;
   VkFence *inFlightFences;
+  u32 apiVersion; // Instance API version, capped at 1.3
+  bool memoryBudget; // VK_EXT_memory_budget is enabled
+  u32 heapsNearBudget; // Bit per heap, so each crossing is logged once
+  bool dynamicRenderingRequested;
+  bool useDynamicRendering; // Render without VkRenderPass/VkFramebuffer objects
+  bool dynamicRenderingIsCore;
+  bool extendedDynamicState; // Cull mode and topology set at record time
+  bool extendedDynamicStateIsCore;
+  PFN_vkCmdBeginRenderingKHR cmdBeginRendering;
+  PFN_vkCmdEndRenderingKHR cmdEndRendering;
+  Bench bench;
+  LogFormat logFormat;
+  LogLevel logLevel;
+  bool singleThreaded; // Simulate and render on the main thread, for comparison
+  bool onDemand; // Render only when something changed
+  bool redrawRequested; // Main thread only
+  bool drawsSkipped; // Last frame left out draws whose pipelines are still compiling
+  bool settling; // Keep redrawing until exposure has adapted to a change
+  u32 settleFrames; // Drawn before the exposure read back can reflect it
+  bool animationPaused;
+  double animationPausedMs; // Total, up to animationPauseStartMs while paused
+  double animationPauseStartMs;
+  pthread_t renderThread;
+  _Atomic bool quit;
+  _Atomic u32 framesRendered;
+  _Atomic bool framebufferResized; // Set by GLFW callbacks on the main thread
+  _Atomic u64 framebufferSize; // Width in the high half, height in the low
 } App;
 
+void parseArgs(App *pApp, int argc, char **argv, double processStartMs);
 void initWindow(App *pApp);
 void initVulkan(App *pApp);
 void mainLoop(App *pApp);
@@ -88,6 +247,8 @@ void createSurface(App *app);
 
 bool checkValidationLayerSupport(void);
 
+u32 queryInstanceVersion(void);
+
 VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
     VkDebugUtilsMessageTypeFlagsEXT messageType,
@@ -110,17 +271,15 @@ void setupDebugMessenger(App *pApp);
 
 void pickPhysicalDevice(App *pApp);
 
-u32 rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface);
-
-QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface);
-
 void createLogicalDevice(App *pApp);
 
+void loadDynamicRenderingFunctions(App *pApp);
+
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface);
 
-VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes);
+VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes, bool preferImmediate);
 VkSurfaceFormatKHR chooseSwapSurfaceFormat(u32 formatCount, VkSurfaceFormatKHR *availableFormats);
-VkExtent2D chooseSwapExtent(GLFWwindow *window, VkSurfaceCapabilitiesKHR capabilities);
+VkExtent2D chooseSwapExtent(VkExtent2D framebufferExtent, VkSurfaceCapabilitiesKHR capabilities);
 
 void cleanupSwapChain(App *pApp);
 void createSwapChain(App *pApp);
@@ -131,6 +290,7 @@ void createImageViews(App *pApp);
 void createRenderPass(App *pApp);
 
 void createGraphicsPipeline(App *pApp);
+PipelineKey trianglePipelineKey(App *pApp);
 
 void createFramebuffers(App *pApp);
 
@@ -139,24 +299,181 @@ void createCommandBuffers(App *pApp);
 
 void createSyncObjects(App *pApp);
 
+void configureDynamicResolution(App *pApp);
+void configurePostProcessing(App *pApp);
+void createOffscreenTargets(App *pApp);
+void destroyOffscreenTargets(App *pApp);
+VkFormat chooseDepthFormat(App *pApp);
+void createDepthTarget(App *pApp);
+void destroyDepthTarget(App *pApp);
+void createTimestampQueries(App *pApp);
+void configureCapture(App *pApp);
+void startRecording(App *pApp);
+
+void createScene(App *pApp);
+void destroyScene(App *pApp);
+void createLights(App *pApp);
+void updateLights(App *pApp);
+void simulate(App *pApp, double nowMs);
+void updateCamera(App *pApp);
+void buildRenderQueue(App *pApp);
+void renderFrame(App *pApp);
+void startAssetReads(App *pApp);
+void updateMemoryBudget(App *pApp);
 void drawFrame(App *pApp);
 
 u32 clamp_u32(u32 n, u32 min, u32 max);
 
-int main(void) {
+int main(int argc, char **argv) {
+  double processStartMs = benchNowMs();
   App app = {0};
 
+  TRACE_INIT();
+
+  parseArgs(&app, argc, argv, processStartMs);
+  logInit(app.logFormat);
+  logSetLevelAll(app.logLevel);
+  fileIoInit(&app.fileIo);
+  startAssetReads(&app);
   initWindow(&app);
   initVulkan(&app);
   mainLoop(&app);
   cleanup(&app);
+  memoryReport();
 
+  TRACE_SHUTDOWN("trace.json");
+  logShutdown();
   return 0;
 }
 
+void parseArgs(App *pApp, int argc, char **argv, double processStartMs) {
+  BenchScenario benchScenario = BENCH_SCENARIO_NONE;
+  u32 benchFrames = 600;
+  const char *benchOutput = NULL;
+  pApp->logLevel = LOG_LEVEL_INFO;
+  pApp->gpuBudgetMs = 14.0f;
+  pApp->postRequested = true;
+  pApp->lodThreshold = 1.0f;
+  pApp->occlusionCulling = true;
+  i32 lightCount = -1;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--dynamic-rendering") == 0) {
+      pApp->dynamicRenderingRequested = true;
+    } else if (strcmp(argv[i], "--bench") == 0 && hasValue && benchParseScenario(argv[i + 1], &benchScenario) &&
+               benchScenario != BENCH_SCENARIO_REPLAY) {
+      i++;
+    } else if (strcmp(argv[i], "--bench-frames") == 0 && hasValue && atoi(argv[i + 1]) > 0) {
+      benchFrames = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--bench-output") == 0 && hasValue) {
+      benchOutput = argv[++i];
+    } else if (strcmp(argv[i], "--log-level") == 0 && hasValue && logParseLevel(argv[i + 1], &pApp->logLevel)) {
+      i++;
+    } else if (strcmp(argv[i], "--log-json") == 0) {
+      pApp->logFormat = LOG_FORMAT_JSON;
+    } else if (strcmp(argv[i], "--single-thread") == 0) {
+      pApp->singleThreaded = true;
+    } else if (strcmp(argv[i], "--on-demand") == 0) {
+      pApp->onDemand = true;
+    } else if (strcmp(argv[i], "--fixed-resolution") == 0) {
+      pApp->fixedResolution = true;
+    } else if (strcmp(argv[i], "--no-post") == 0) {
+      pApp->postRequested = false;
+    } else if (strcmp(argv[i], "--no-occlusion") == 0) {
+      pApp->occlusionCulling = false;
+    } else if (strcmp(argv[i], "--gpu-budget") == 0 && hasValue && atof(argv[i + 1]) > 0.0) {
+      pApp->gpuBudgetMs = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--lod-threshold") == 0 && hasValue && atof(argv[i + 1]) >= 0.0) {
+      pApp->lodThreshold = (float)atof(argv[++i]);
+    } else if (strcmp(argv[i], "--lights") == 0 && hasValue && atoi(argv[i + 1]) >= 0 && atoi(argv[i + 1]) <= MAX_LIGHTS) {
+      lightCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--mesh") == 0 && hasValue) {
+      pApp->meshPath = argv[++i];
+    } else if (strcmp(argv[i], "--shader-dir") == 0 && hasValue) {
+      pApp->shaderDir = argv[++i];
+    } else if (strcmp(argv[i], "--capture") == 0 && hasValue) {
+      pApp->capturePath = argv[++i];
+      pApp->captureOutput = CAPTURE_OUTPUT_PPM;
+    } else if (strcmp(argv[i], "--capture-raw") == 0 && hasValue) {
+      pApp->capturePath = argv[++i];
+      pApp->captureOutput = CAPTURE_OUTPUT_RAW;
+    } else if (strcmp(argv[i], "--capture-first") == 0 && hasValue && atoi(argv[i + 1]) >= 0) {
+      pApp->captureFirst = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--capture-count") == 0 && hasValue && atoi(argv[i + 1]) > 0) {
+      pApp->captureCount = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--record") == 0 && hasValue) {
+      pApp->recordPath = argv[++i];
+    } else {
+      printf("Unknown argument: %s\n", argv[i]);
+      printf("Usage: %s [--dynamic-rendering] [--bench empty|draws|instances|resize|lod|lights|occlusion|startup] [--bench-frames n] [--bench-output file] [--log-level debug|info|warn|error] [--log-json] [--single-thread] [--on-demand] [--fixed-resolution] [--no-post] [--no-occlusion] [--gpu-budget ms] [--lod-threshold px] [--lights n] [--mesh file] [--shader-dir dir] [--capture pattern | --capture-raw path] [--capture-first n] [--capture-count n] [--record file]\n", argv[0]);
+      exit(1);
+    }
+  }
+
+  // Benchmarks measure back to back frames
+  if (pApp->onDemand && benchScenario != BENCH_SCENARIO_NONE) {
+    printf("--on-demand can't be used with --bench!\n");
+    exit(1);
+  }
+  // Frames are drawn as events are handled, on the main thread. The scene
+  // holds still until Space starts it.
+  pApp->singleThreaded |= pApp->onDemand;
+  pApp->animationPaused = pApp->onDemand;
+
+  benchInit(&pApp->bench, benchScenario, benchFrames, benchOutput, processStartMs);
+  pApp->lightCount = lightCount >= 0 ? (u32)lightCount : benchScenario == BENCH_SCENARIO_LIGHTS ? 1024 : 16;
+  pApp->bench.lightCount = pApp->lightCount;
+}
+
+// GLFW may only be queried on the main thread, so the render thread reads
+// the framebuffer size from here
+void storeFramebufferSize(App *pApp, int width, int height) {
+  atomic_store(&pApp->framebufferSize, (u64)(u32)width << 32 | (u32)height);
+}
+
+VkExtent2D loadFramebufferSize(App *pApp) {
+  u64 size = atomic_load(&pApp->framebufferSize);
+  return (VkExtent2D){ (u32)(size >> 32), (u32)size };
+}
+
+// With --on-demand, marks the window for a new frame. Main thread only.
+void requestRedraw(App *pApp) {
+  pApp->redrawRequested = true;
+}
+
 void framebufferResizeCallback(GLFWwindow *window, int width, int height) {
-  // App *app = glfwGetWindowUserPointer(window);
-  framebufferResized = true;
+  App *pApp = glfwGetWindowUserPointer(window);
+  storeFramebufferSize(pApp, width, height);
+  atomic_store(&pApp->framebufferResized, true);
+  requestRedraw(pApp);
+}
+
+// Uncovered or damaged by the window system
+void windowRefreshCallback(GLFWwindow *window) {
+  requestRedraw(glfwGetWindowUserPointer(window));
+}
+
+void keyCallback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+  App *pApp = glfwGetWindowUserPointer(window);
+  if (key == GLFW_KEY_SPACE && action == GLFW_PRESS && pApp->onDemand) {
+    double now = benchNowMs();
+    if (pApp->animationPaused) {
+      pApp->animationPausedMs += now - pApp->animationPauseStartMs;
+    } else {
+      pApp->animationPauseStartMs = now;
+    }
+    pApp->animationPaused = !pApp->animationPaused;
+  }
+  requestRedraw(pApp);
+}
+
+void mouseButtonCallback(GLFWwindow *window, int button, int action, int mods) {
+  requestRedraw(glfwGetWindowUserPointer(window));
+}
+
+void scrollCallback(GLFWwindow *window, double x, double y) {
+  requestRedraw(glfwGetWindowUserPointer(window));
 }
 
 void initWindow(App *pApp) {
@@ -165,57 +482,285 @@ void initWindow(App *pApp) {
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
 
   pApp->window = glfwCreateWindow(WIN_WIDTH, WIN_HEIGHT, WIN_TITLE, NULL, NULL);
-  // glfwSetWindowUserPointer(pApp->window, pApp);
+  glfwSetWindowUserPointer(pApp->window, pApp);
   glfwSetFramebufferSizeCallback(pApp->window, framebufferResizeCallback);
+  glfwSetWindowRefreshCallback(pApp->window, windowRefreshCallback);
+  glfwSetKeyCallback(pApp->window, keyCallback);
+  glfwSetMouseButtonCallback(pApp->window, mouseButtonCallback);
+  glfwSetScrollCallback(pApp->window, scrollCallback);
+
+  int width, height;
+  glfwGetFramebufferSize(pApp->window, &width, &height);
+  storeFramebufferSize(pApp, width, height);
 }
 
 void initVulkan(App *pApp) {
+  TRACE_ZONE("initVulkan");
   createInstance(pApp);
   setupDebugMessenger(pApp);
   createSurface(pApp);
   pickPhysicalDevice(pApp);
   createLogicalDevice(pApp);
   createSwapChain(pApp);
+  configureDynamicResolution(pApp);
+  configurePostProcessing(pApp);
+  configureCapture(pApp);
   createImageViews(pApp);
-  createRenderPass(pApp);
+  if (pApp->renderOffscreen) {
+    createOffscreenTargets(pApp);
+  }
+  pApp->depthFormat = chooseDepthFormat(pApp);
+  createDepthTarget(pApp);
+  if (pApp->postProcessing) {
+    PostCreateInfo postInfo = {
+      .device = pApp->device,
+      .physicalDevice = pApp->physicalDevice,
+      .apiVersion = pApp->apiVersion,
+      .frameCount = MAX_FRAMES_IN_FLIGHT,
+      .extent = pApp->swapChainExtent,
+      .targetViews = pApp->offscreenImageViews,
+      .shaderDir = pApp->shaderDir,
+      .timestampBits = pApp->queueFamilies.graphicsTimestampBits,
+      .timestampPeriodNs = pApp->deviceSelection.properties.limits.timestampPeriod
+    };
+    postInit(&pApp->post, &postInfo);
+  }
+  if (!pApp->useDynamicRendering) {
+    createRenderPass(pApp);
+  }
+  ShaderCode binningShader;
+  shaderCodeLoad("cluster.comp", pApp->shaderDir, &binningShader);
+  ClusteredLightingCreateInfo lightingInfo = {
+    .device = pApp->device,
+    .physicalDevice = pApp->physicalDevice,
+    .frameCount = MAX_FRAMES_IN_FLIGHT,
+    .maxLights = pApp->lightCount,
+    .pBinningShader = &binningShader
+  };
+  clusteredLightingInit(&pApp->lighting, &lightingInfo);
+  shaderCodeFree(&binningShader);
   createGraphicsPipeline(pApp);
-  createFramebuffers(pApp);
+  if (!pApp->useDynamicRendering) {
+    createFramebuffers(pApp);
+  }
   createCommandPool(pApp);
   createCommandBuffers(pApp);
   createSyncObjects(pApp);
+  if (pApp->dynamicResolution) {
+    createTimestampQueries(pApp);
+  }
+  if (pApp->captureEnabled) {
+    CaptureCreateInfo captureInfo = {
+      .device = pApp->device,
+      .physicalDevice = pApp->physicalDevice,
+      .slotCount = MAX_FRAMES_IN_FLIGHT,
+      .output = pApp->captureOutput,
+      .path = pApp->capturePath,
+      .firstFrame = pApp->captureFirst,
+      .frameCount = pApp->captureCount
+    };
+    captureInit(&pApp->capture, &captureInfo);
+  }
+
+  renderQueueInit(&pApp->renderQueue, 1024);
+  createScene(pApp);
+  if (pApp->occlusionCulling) {
+    HizCreateInfo hizInfo = {
+      .device = pApp->device,
+      .physicalDevice = pApp->physicalDevice,
+      .frameCount = MAX_FRAMES_IN_FLIGHT,
+      .maxObjects = pApp->objectCount,
+      .extent = pApp->swapChainExtent,
+      .depthView = pApp->depthImageView,
+      .shaderDir = pApp->shaderDir
+    };
+    hizInit(&pApp->hiz, &hizInfo);
+  }
+  createLights(pApp);
+  if (pApp->recordPath != NULL) {
+    startRecording(pApp);
+  }
 }
 
-void mainLoop(App *pApp) {
+// Cycles through window sizes so every few frames rebuild the swap chain
+void resizeStorm(App *pApp) {
+  static const int sizes[][2] = { { 800, 600 }, { 1280, 720 }, { 640, 480 }, { 1024, 768 } };
+  static u32 lastResize = 0;
+  u32 resize = atomic_load(&pApp->framesRendered) / BENCH_RESIZE_INTERVAL;
+  if (resize != lastResize) {
+    u32 size = resize % (sizeof(sizes) / sizeof(sizes[0]));
+    glfwSetWindowSize(pApp->window, sizes[size][0], sizes[size][1]);
+    lastResize = resize;
+  }
+}
+
+void *renderThreadMain(void *pArg) {
+  App *pApp = pArg;
+  TRACE_THREAD_NAME("render");
+  while (!atomic_load(&pApp->quit)) {
+    renderFrame(pApp);
+    if (benchFinished(&pApp->bench)) {
+      atomic_store(&pApp->quit, true);
+      glfwPostEmptyEvent(); // Wake the main thread
+    }
+  }
+  return NULL;
+}
+
+// Sleeps in GLFW until input, a resize, an arriving asset or an animation
+// needs a frame, then steps the simulation and draws it, so a still window
+// costs no CPU or GPU time.
+void mainLoopOnDemand(App *pApp) {
+  double frameMs = 1000.0 / ON_DEMAND_HZ;
+  double nextFrameMs = 0.0;
+  requestRedraw(pApp);
   while (!glfwWindowShouldClose(pApp->window)) {
-    glfwPollEvents();
-    drawFrame(pApp);
+    double now = benchNowMs();
+    // Nothing wakes GLFW when a read completes or a pipeline compiles, so
+    // check back every frame until they are done
+    bool animating = !pApp->animationPaused || pApp->settling || pApp->drawsSkipped;
+    bool polling = animating || fileIoPending(&pApp->fileIo) > 0;
+    if (pApp->redrawRequested) {
+      glfwPollEvents();
+    } else if (polling) {
+      glfwWaitEventsTimeout(nextFrameMs > now ? (nextFrameMs - now) / 1000.0 : 0.0);
+    } else {
+      glfwWaitEvents();
+    }
+    if (fileIoPoll(&pApp->fileIo) > 0) {
+      requestRedraw(pApp);
+    }
+
+    now = benchNowMs();
+    if (!pApp->redrawRequested && !(animating && now >= nextFrameMs)) {
+      if (polling && now >= nextFrameMs) nextFrameMs = now + frameMs;
+      continue;
+    }
+    // Exposure adapts over the frames after a change. The first one meters
+    // the new image, the next adapts to it, and the read back lags the
+    // frames in flight.
+    if (pApp->redrawRequested && pApp->postProcessing) {
+      pApp->settling = true;
+      pApp->settleFrames = MAX_FRAMES_IN_FLIGHT + 1;
+    }
+    pApp->redrawRequested = false;
+    simulate(pApp, now);
+    renderFrame(pApp);
+    nextFrameMs = now + frameMs;
+    if (pApp->settling) {
+      if (pApp->settleFrames > 0) {
+        pApp->settleFrames--;
+      } else {
+        pApp->settling = !postExposureSettled(&pApp->post);
+      }
+    }
+  }
+}
+
+// The main thread handles events and steps the simulation at a fixed rate
+// while the render thread draws the newest step it has been handed.
+void mainLoop(App *pApp) {
+  double stepMs = 1000.0 / SIMULATION_HZ;
+  pApp->simulationStartMs = benchNowMs();
+  pApp->animationPauseStartMs = pApp->simulationStartMs;
+  simulate(pApp, pApp->simulationStartMs);
+
+  if (pApp->onDemand) {
+    mainLoopOnDemand(pApp);
+  } else if (pApp->singleThreaded) {
+    while (!glfwWindowShouldClose(pApp->window) && !benchFinished(&pApp->bench)) {
+      if (pApp->bench.scenario == BENCH_SCENARIO_RESIZE) {
+        resizeStorm(pApp);
+      }
+      glfwPollEvents();
+      fileIoPoll(&pApp->fileIo);
+      // Captures step the simulation once per frame so they are reproducible
+      double simulationMs = pApp->captureEnabled ? pApp->simulationStartMs + atomic_load(&pApp->framesRendered) * stepMs : benchNowMs();
+      simulate(pApp, simulationMs);
+      renderFrame(pApp);
+    }
+  } else {
+    if (pthread_create(&pApp->renderThread, NULL, renderThreadMain, pApp) != 0) {
+      printf("Failed to create render thread!\n");
+      exit(22);
+    }
+
+    double nextStepMs = pApp->simulationStartMs + stepMs;
+    while (!glfwWindowShouldClose(pApp->window) && !atomic_load(&pApp->quit)) {
+      double now = benchNowMs();
+      if (now >= nextStepMs) {
+        simulate(pApp, now);
+        nextStepMs += stepMs;
+        // Don't try to catch up after a stall
+        if (nextStepMs < now) nextStepMs = now + stepMs;
+      }
+      if (pApp->bench.scenario == BENCH_SCENARIO_RESIZE) {
+        resizeStorm(pApp);
+      }
+      fileIoPoll(&pApp->fileIo);
+      double waitMs = nextStepMs - benchNowMs();
+      glfwWaitEventsTimeout(waitMs > 0.0 ? waitMs / 1000.0 : 0.0);
+    }
+
+    atomic_store(&pApp->quit, true);
+    pthread_join(pApp->renderThread, NULL);
   }
 
   vkDeviceWaitIdle(pApp->device);
+
+  if (benchFinished(&pApp->bench)) {
+    benchWriteReport(&pApp->bench);
+  }
 }
 
 void cleanup(App *pApp) {
+  if (pApp->captureEnabled) {
+    captureDestroy(&pApp->capture);
+  }
+  if (pApp->recordPath != NULL && !replayWriterClose(&pApp->replay)) {
+    LOG_ERROR(LOG_CATEGORY_ENGINE, "Failed to write recording %s", pApp->recordPath);
+  }
   cleanupSwapChain(pApp);
 
+  renderQueueDestroy(&pApp->renderQueue);
+  destroyScene(pApp);
+  fileIoDestroy(&pApp->fileIo);
+  benchDestroy(&pApp->bench);
+
   for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    vkDestroySemaphore(pApp->device, pApp->imageAvailableSemaphores[i], NULL);
-    vkDestroySemaphore(pApp->device, pApp->renderFinishedSemaphores[i], NULL);
-    vkDestroyFence(pApp->device, pApp->inFlightFences[i], NULL);
+    vkDestroySemaphore(pApp->device, pApp->imageAvailableSemaphores[i], &memoryVulkanCallbacks);
+    vkDestroySemaphore(pApp->device, pApp->renderFinishedSemaphores[i], &memoryVulkanCallbacks);
+    vkDestroyFence(pApp->device, pApp->inFlightFences[i], &memoryVulkanCallbacks);
+  }
+  memoryFree(pApp->imageAvailableSemaphores);
+  memoryFree(pApp->renderFinishedSemaphores);
+  memoryFree(pApp->inFlightFences);
+
+  vkDestroyCommandPool(pApp->device, pApp->commandPool, &memoryVulkanCallbacks);
+  memoryFree(pApp->commandBuffers);
+  if (pApp->timestampPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(pApp->device, pApp->timestampPool, &memoryVulkanCallbacks);
   }
 
-  vkDestroyCommandPool(pApp->device, pApp->commandPool, NULL);
-
-  vkDestroyPipeline(pApp->device, pApp->graphicsPipeline, NULL);
-  vkDestroyPipelineLayout(pApp->device, pApp->pipelineLayout, NULL);
-  vkDestroyRenderPass(pApp->device, pApp->renderPass, NULL);
+  pipelineManagerDestroy(&pApp->pipelines);
+  vkDestroyPipelineLayout(pApp->device, pApp->pipelineLayout, &memoryVulkanCallbacks);
+  clusteredLightingDestroy(&pApp->lighting);
+  if (pApp->postProcessing) {
+    postDestroy(&pApp->post);
+  }
+  if (pApp->occlusionCulling) {
+    hizDestroy(&pApp->hiz);
+  }
+  vkDestroyRenderPass(pApp->device, pApp->renderPass, &memoryVulkanCallbacks);
+  vkDestroyRenderPass(pApp->device, pApp->secondPhasePass, &memoryVulkanCallbacks);
 
   if (enableValidationLayers) {
-    DestroyDebugUtilsMessengerEXT(pApp->instance, pApp->debugMessenger, NULL);
+    DestroyDebugUtilsMessengerEXT(pApp->instance, pApp->debugMessenger, &memoryVulkanCallbacks);
   }
-  vkDestroyDevice(pApp->device, NULL);
+  vkDestroyDevice(pApp->device, &memoryVulkanCallbacks);
 
-  vkDestroySurfaceKHR(pApp->instance, pApp->surface, NULL);
-  vkDestroyInstance(pApp->instance, NULL);
+  vkDestroySurfaceKHR(pApp->instance, pApp->surface, &memoryVulkanCallbacks);
+  vkDestroyInstance(pApp->instance, &memoryVulkanCallbacks);
 
   glfwDestroyWindow(pApp->window);
 
@@ -244,19 +789,37 @@ bool verfityExtensionSupport(
   return true;
 }
 
+// vkEnumerateInstanceVersion only exists on 1.1+ loaders
+u32 queryInstanceVersion(void) {
+  PFN_vkEnumerateInstanceVersion func = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+  u32 version = VK_API_VERSION_1_0;
+  if (func != NULL && func(&version) != VK_SUCCESS) {
+    version = VK_API_VERSION_1_0;
+  }
+
+  // Nothing above 1.3 is used, so don't ask for it
+  if (version > VK_API_VERSION_1_3) {
+    version = VK_API_VERSION_1_3;
+  }
+  return version;
+}
+
 void createInstance(App *pApp) {
+  TRACE_ZONE("createInstance");
   if (enableValidationLayers && !checkValidationLayerSupport()) {
     printf("Validation layers requested but not available!\n");
     exit(1);
   }
 
+  pApp->apiVersion = queryInstanceVersion();
+
   VkApplicationInfo appInfo = {
     .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
     .pApplicationName = WIN_TITLE,
     .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
     .pEngineName = "No Engine",
     .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-    .apiVersion = VK_API_VERSION_1_0,
+    .apiVersion = pApp->apiVersion,
     .pNext = NULL
   };
 
@@ -294,7 +857,7 @@ void createInstance(App *pApp) {
     createInfo.pNext = NULL;
   }
 
-  if (vkCreateInstance(&createInfo, NULL, &pApp->instance) != VK_SUCCESS) {
+  if (vkCreateInstance(&createInfo, &memoryVulkanCallbacks, &pApp->instance) != VK_SUCCESS) {
     printf("Failed to create Vulkan Instance\n");
     exit(1);
   }
@@ -317,109 +880,87 @@ void createInstance(App *pApp) {
 }
 
 void createSurface(App *pApp) {
-  if (glfwCreateWindowSurface(pApp->instance, pApp->window, NULL, &pApp->surface) != VK_SUCCESS) {
+  TRACE_ZONE("createSurface");
+  if (glfwCreateWindowSurface(pApp->instance, pApp->window, &memoryVulkanCallbacks, &pApp->surface) != VK_SUCCESS) {
     printf("Failed to create window surface!\n");
     exit(5);
   }
 }
 
 void pickPhysicalDevice(App *pApp) {
-  u32 deviceCount = 0;
-  vkEnumeratePhysicalDevices(pApp->instance, &deviceCount, NULL);
+  TRACE_ZONE("pickPhysicalDevice");
+
+  // Everything the engine uses; nothing else gets enabled
+  DeviceRequirements requirements = {
+    .minApiVersion = VK_API_VERSION_1_0,
+    .extensions = deviceExtensions,
+    .extensionCount = deviceExtensionCount,
+    .dynamicRendering = pApp->dynamicRenderingRequested,
+    .extendedDynamicState = true,
+    .memoryBudget = true
+  };
 
-  if (deviceCount == 0) {
-    printf("Failed to find a GPU with Vulkan support!\n");
+  if (!deviceSelect(pApp->instance, pApp->surface, pApp->apiVersion, &requirements, &pApp->deviceSelection)) {
+    printf("Failed to find a suitable GPU!\n");
     exit(3);
   }
 
-  VkPhysicalDevice devices[deviceCount];
-  vkEnumeratePhysicalDevices(pApp->instance, &deviceCount, devices);
-
-  VkPhysicalDevice device;
-  u32 deviceScore = 0;
-  for (u32 i = 0; i < deviceCount; i++) {
-    u32 score = rateDeviceSuitability(devices[i], pApp->surface);
-    if (score > deviceScore) {
-      deviceScore = score;
-      device = devices[i];
-    }
-  }
+  DeviceSelection *pSelection = &pApp->deviceSelection;
+  pApp->physicalDevice = pSelection->physicalDevice;
+  pApp->queueFamilies = pSelection->queueFamilies;
+  LOG_INFO(LOG_CATEGORY_DEVICE, "Selected GPU: %s", pSelection->properties.deviceName);
 
-  if (device == NULL) {
-    printf("Failed to find a stuitable GPU!\n");
-    exit(3);
+  pApp->useDynamicRendering = pSelection->dynamicRendering;
+  pApp->dynamicRenderingIsCore = pSelection->dynamicRenderingIsCore;
+  if (pApp->dynamicRenderingRequested && !pApp->useDynamicRendering) {
+    LOG_WARN(LOG_CATEGORY_DEVICE, "Dynamic rendering not supported, falling back to render passes");
   }
-  pApp->physicalDevice = device;
-  printf("GPU selected\n");
 
-  pApp->queueFamilyIndices = findQueueFamilies(device, pApp->surface);
+  pApp->extendedDynamicState = pSelection->extendedDynamicState;
+  pApp->extendedDynamicStateIsCore = pSelection->extendedDynamicStateIsCore;
+  pApp->memoryBudget = pSelection->memoryBudget;
 }
 
-void getFamilyDeviceQueues(VkDeviceQueueCreateInfo *queues, QueueFamilyIndices indices) {
-  // GraphicsQueue
-  VkDeviceQueueCreateInfo graphicsQueueCreateInfo = {
-    .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-    .queueFamilyIndex = indices.graphicsFamily,
-    .queueCount = 1
-  };
-
-  float graphicsQueuePriority = 1.0f;
-  graphicsQueueCreateInfo.pQueuePriorities = &graphicsQueuePriority;
-  queues[0] = graphicsQueueCreateInfo;
+void loadDynamicRenderingFunctions(App *pApp) {
+  const char *beginName = pApp->dynamicRenderingIsCore ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR";
+  const char *endName = pApp->dynamicRenderingIsCore ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR";
 
-  // PresentQueue
-  VkDeviceQueueCreateInfo presentQueueCreateInfo = {
-    .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-    .queueFamilyIndex = indices.presentFamily,
-    .queueCount = 1
-  };
+  pApp->cmdBeginRendering = (PFN_vkCmdBeginRenderingKHR) vkGetDeviceProcAddr(pApp->device, beginName);
+  pApp->cmdEndRendering = (PFN_vkCmdEndRenderingKHR) vkGetDeviceProcAddr(pApp->device, endName);
 
-  float presentQueuePriority = 1.0f;
-  graphicsQueueCreateInfo.pQueuePriorities = &presentQueuePriority;
-  queues[1] = presentQueueCreateInfo;
+  if (pApp->cmdBeginRendering == NULL || pApp->cmdEndRendering == NULL) {
+    printf("Failed to load dynamic rendering functions!\n");
+    exit(4);
+  }
 }
 
 void createLogicalDevice(App *pApp) {
-  QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
-
-  VkPhysicalDeviceFeatures deviceFeatures;
-  vkGetPhysicalDeviceFeatures(pApp->physicalDevice, &deviceFeatures);
-
-  VkDeviceQueueCreateInfo queues[2];
-  getFamilyDeviceQueues(queues, indices);
-
-  VkDeviceCreateInfo createInfo = {
-    .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-    //.pQueueCreateInfos = &queueCreateInfo,
-    .pQueueCreateInfos = queues,
-    .queueCreateInfoCount = 1,
-    .pEnabledFeatures = &deviceFeatures,
-    .enabledExtensionCount = deviceExtensionCount,
-    .ppEnabledExtensionNames = deviceExtensions
-  };
-
-  if (enableValidationLayers) {
-    createInfo.enabledLayerCount = validationLayerCount;
-    createInfo.ppEnabledLayerNames = validationLayers;
-  } else {
-    createInfo.enabledLayerCount = 0;
-  }
-
-  if (vkCreateDevice(pApp->physicalDevice, &createInfo, NULL, &pApp->device) != VK_SUCCESS) {
+  TRACE_ZONE("createLogicalDevice");
+  DeviceQueues queues;
+  u32 layerCount = enableValidationLayers ? validationLayerCount : 0;
+  pApp->device = deviceCreate(&pApp->deviceSelection, layerCount, validationLayers, &queues);
+  if (pApp->device == VK_NULL_HANDLE) {
     printf("Failed to create logical device!\n");
     exit(4);
   }
 
-  vkGetDeviceQueue(pApp->device, pApp->queueFamilyIndices.graphicsFamily, 0, &pApp->graphicsQueue);
-  vkGetDeviceQueue(pApp->device, pApp->queueFamilyIndices.presentFamily, 0, &pApp->presentQueue);
+  pApp->graphicsQueue = queues.graphics;
+  pApp->presentQueue = queues.present;
+  pApp->computeQueue = queues.compute;
+  pApp->transferQueue = queues.transfer;
+
+  if (pApp->useDynamicRendering) {
+    loadDynamicRenderingFunctions(pApp);
+  }
 }
 
 void createSwapChain(App *pApp) {
+  TRACE_ZONE("createSwapChain");
   SwapChainSupportDetails swapChainSupport = querySwapChainSupport(pApp->physicalDevice, pApp->surface);
 
   VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formatCount, swapChainSupport.formats);
-  VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModeCount, swapChainSupport.presentModes);
-  VkExtent2D extent = chooseSwapExtent(pApp->window, swapChainSupport.capabilities);
+  VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModeCount, swapChainSupport.presentModes, benchEnabled(&pApp->bench));
+  VkExtent2D extent = chooseSwapExtent(loadFramebufferSize(pApp), swapChainSupport.capabilities);
 
   u32 imageCount = swapChainSupport.capabilities.minImageCount + 1;
   if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
@@ -437,10 +978,22 @@ void createSwapChain(App *pApp) {
     .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT
   };
 
-  QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
-  u32 queueFamilyIndices[] = { indices.graphicsFamily, indices.presentFamily };
+  // Dynamic resolution and post-processing blit their offscreen target into the swap chain
+  VkImageUsageFlags supportedUsage = swapChainSupport.capabilities.supportedUsageFlags;
+  pApp->swapChainTransferDst = (!pApp->fixedResolution || pApp->postRequested) && (supportedUsage & VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+  if (pApp->swapChainTransferDst) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  }
+  // Capture copies the presented image out
+  pApp->swapChainTransferSrc = pApp->capturePath != NULL && (supportedUsage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  if (pApp->swapChainTransferSrc) {
+    createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  }
+
+  QueueFamilies *pFamilies = &pApp->queueFamilies;
+  u32 queueFamilyIndices[] = { pFamilies->graphics, pFamilies->present };
 
-  if (indices.graphicsFamily != indices.presentFamily) {
+  if (pFamilies->graphics != pFamilies->present) {
     createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
     createInfo.queueFamilyIndexCount = 2;
     createInfo.pQueueFamilyIndices = queueFamilyIndices;
@@ -456,13 +1009,13 @@ void createSwapChain(App *pApp) {
   createInfo.clipped = VK_TRUE;
   createInfo.oldSwapchain = VK_NULL_HANDLE;
 
-  if (vkCreateSwapchainKHR(pApp->device, &createInfo, NULL, &pApp->swapChain) != VK_SUCCESS) {
+  if (vkCreateSwapchainKHR(pApp->device, &createInfo, &memoryVulkanCallbacks, &pApp->swapChain) != VK_SUCCESS) {
     printf("Failed to create Swap Chain!\n");
     exit(5);
   }
 
   vkGetSwapchainImagesKHR(pApp->device, pApp->swapChain, &imageCount, NULL);
-  pApp->swapChainImages = (VkImage*)malloc(sizeof(VkImage) * imageCount);
+  pApp->swapChainImages = memoryAlloc(sizeof(VkImage) * imageCount, MEMORY_TAG_SWAPCHAIN);
 
   vkGetSwapchainImagesKHR(pApp->device, pApp->swapChain, &imageCount, pApp->swapChainImages);
   pApp->swapChainImageCount = imageCount;
@@ -472,23 +1025,48 @@ void createSwapChain(App *pApp) {
 }
 
 void cleanupSwapChain(App *pApp) {
-  for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
-    vkDestroyFramebuffer(pApp->device, pApp->swapChainFramebuffers[i], NULL);
+  if (!pApp->useDynamicRendering) {
+    for (u32 i = 0; i < pApp->framebufferCount; i++) {
+      vkDestroyFramebuffer(pApp->device, pApp->swapChainFramebuffers[i], &memoryVulkanCallbacks);
+    }
+    memoryFree(pApp->swapChainFramebuffers);
   }
 
+  if (pApp->renderOffscreen) {
+    destroyOffscreenTargets(pApp);
+  }
+  destroyDepthTarget(pApp);
+
   for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
-    vkDestroyImageView(pApp->device, pApp->swapChainImageViews[i], NULL);
+    vkDestroyImageView(pApp->device, pApp->swapChainImageViews[i], &memoryVulkanCallbacks);
   }
+  memoryFree(pApp->swapChainImageViews);
+
+  vkDestroySwapchainKHR(pApp->device, pApp->swapChain, &memoryVulkanCallbacks);
+  memoryFree(pApp->swapChainImages);
+}
 
-  vkDestroySwapchainKHR(pApp->device, pApp->swapChain, NULL);
+// Blocks while the window is minimized. Returns false if the app quit meanwhile.
+bool waitForFramebuffer(App *pApp) {
+  VkExtent2D extent = loadFramebufferSize(pApp);
+  while (extent.width == 0 || extent.height == 0) {
+    if (pApp->singleThreaded) {
+      glfwWaitEvents();
+      if (glfwWindowShouldClose(pApp->window)) return false;
+    } else {
+      if (atomic_load(&pApp->quit)) return false;
+      struct timespec delay = { 0, 10 * 1000 * 1000 };
+      nanosleep(&delay, NULL);
+    }
+    extent = loadFramebufferSize(pApp);
+  }
+  return true;
 }
 
 void recreateSwapChain(App *pApp) {
-  int width = 0, height = 0;
-  glfwGetFramebufferSize(pApp->window, &width, &height);
-  while (width == 0 || height == 0) {
-    glfwGetFramebufferSize(pApp->window, &width, &height);
-    glfwWaitEvents();
+  TRACE_ZONE("recreateSwapChain");
+  if (!waitForFramebuffer(pApp)) {
+    return;
   }
 
   vkDeviceWaitIdle(pApp->device);
@@ -497,11 +1075,257 @@ void recreateSwapChain(App *pApp) {
 
   createSwapChain(pApp);
   createImageViews(pApp);
-  createFramebuffers(pApp);
+  if (pApp->renderOffscreen) {
+    createOffscreenTargets(pApp);
+  }
+  createDepthTarget(pApp);
+  if (pApp->postProcessing) {
+    postResize(&pApp->post, pApp->swapChainExtent, pApp->offscreenImageViews);
+  }
+  if (pApp->occlusionCulling) {
+    hizResize(&pApp->hiz, pApp->swapChainExtent, pApp->depthImageView);
+  }
+  // Dynamic rendering binds image views at record time, nothing to rebuild
+  if (!pApp->useDynamicRendering) {
+    createFramebuffers(pApp);
+  }
+}
+
+// Dynamic resolution needs GPU timestamps to measure with and blits to
+// upscale. Without either, render straight into the swap chain as before.
+void configureDynamicResolution(App *pApp) {
+  pApp->dynamicResolution = false;
+  if (pApp->fixedResolution) {
+    return;
+  }
+
+  VkFormatProperties formatProperties;
+  vkGetPhysicalDeviceFormatProperties(pApp->physicalDevice, pApp->swapChainImageFormat, &formatProperties);
+  VkFormatFeatureFlags features = formatProperties.optimalTilingFeatures;
+  VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+
+  if (pApp->queueFamilies.graphicsTimestampBits == 0) {
+    LOG_WARN(LOG_CATEGORY_ENGINE, "GPU timestamps not supported, rendering at full resolution");
+    return;
+  }
+  if (!pApp->swapChainTransferDst || (features & required) != required) {
+    LOG_WARN(LOG_CATEGORY_ENGINE, "Swap chain can't be blitted to, rendering at full resolution");
+    return;
+  }
+
+  pApp->dynamicResolution = true;
+  pApp->upscaleFilter = (features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+  resolutionInit(&pApp->resolution, pApp->gpuBudgetMs, RENDER_SCALE_MIN, RENDER_SCALE_MAX);
+}
+
+// Post-processing needs an HDR target it can sample and write from compute,
+// and a swap chain to blit the result into. Without it, render offscreen
+// only for dynamic resolution.
+void configurePostProcessing(App *pApp) {
+  pApp->postProcessing = false;
+  if (pApp->postRequested) {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(pApp->physicalDevice, pApp->swapChainImageFormat, &formatProperties);
+    VkFormatProperties hdrProperties;
+    vkGetPhysicalDeviceFormatProperties(pApp->physicalDevice, POST_HDR_FORMAT, &hdrProperties);
+    VkFormatFeatureFlags hdrRequired = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT |
+                                       VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+    if (!pApp->swapChainTransferDst || !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+      LOG_WARN(LOG_CATEGORY_ENGINE, "Swap chain can't be blitted to, post-processing disabled");
+    } else if ((hdrProperties.optimalTilingFeatures & hdrRequired) != hdrRequired) {
+      LOG_WARN(LOG_CATEGORY_ENGINE, "HDR target format not supported, post-processing disabled");
+    } else {
+      pApp->postProcessing = true;
+    }
+  }
+
+  pApp->renderOffscreen = pApp->dynamicResolution || pApp->postProcessing;
+  pApp->renderFormat = pApp->postProcessing ? POST_HDR_FORMAT : pApp->swapChainImageFormat;
+}
+
+// Full swap chain size, so changing the scale never reallocates; frames
+// render into the top-left corner
+void createOffscreenTargets(App *pApp) {
+  TRACE_ZONE("createOffscreenTargets");
+  pApp->offscreenImages = memoryAlloc(sizeof(VkImage) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
+  pApp->offscreenMemory = memoryAlloc(sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
+  pApp->offscreenImageViews = memoryAlloc(sizeof(VkImageView) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
+
+  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    VkImageCreateInfo imageInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = pApp->renderFormat,
+      .extent = { pApp->swapChainExtent.width, pApp->swapChainExtent.height, 1 },
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    if (pApp->postProcessing) {
+      imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+    if (vkCreateImage(pApp->device, &imageInfo, &memoryVulkanCallbacks, &pApp->offscreenImages[i]) != VK_SUCCESS) {
+      printf("Failed to create offscreen image!\n");
+      exit(23);
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(pApp->device, pApp->offscreenImages[i], &requirements);
+    VkMemoryAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = requirements.size,
+      .memoryTypeIndex = deviceFindMemoryType(pApp->physicalDevice, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    };
+    if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+        deviceAllocateMemory(pApp->device, pApp->physicalDevice, &allocInfo, MEMORY_TAG_FRAME, &pApp->offscreenMemory[i]) != VK_SUCCESS ||
+        vkBindImageMemory(pApp->device, pApp->offscreenImages[i], pApp->offscreenMemory[i], 0) != VK_SUCCESS) {
+      printf("Failed to allocate offscreen image memory!\n");
+      exit(23);
+    }
+
+    VkImageViewCreateInfo viewInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = pApp->offscreenImages[i],
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = pApp->renderFormat,
+      .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+      .subresourceRange.baseMipLevel = 0,
+      .subresourceRange.levelCount = 1,
+      .subresourceRange.baseArrayLayer = 0,
+      .subresourceRange.layerCount = 1
+    };
+    if (vkCreateImageView(pApp->device, &viewInfo, &memoryVulkanCallbacks, &pApp->offscreenImageViews[i]) != VK_SUCCESS) {
+      printf("Failed to create offscreen image view!\n");
+      exit(23);
+    }
+  }
+}
+
+void destroyOffscreenTargets(App *pApp) {
+  for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vkDestroyImageView(pApp->device, pApp->offscreenImageViews[i], &memoryVulkanCallbacks);
+    vkDestroyImage(pApp->device, pApp->offscreenImages[i], &memoryVulkanCallbacks);
+    deviceFreeMemory(pApp->device, pApp->offscreenMemory[i]);
+  }
+  memoryFree(pApp->offscreenImageViews);
+  memoryFree(pApp->offscreenImages);
+  memoryFree(pApp->offscreenMemory);
+}
+
+// The occlusion pyramid is built by sampling the depth buffer. D16 can
+// always be rendered to and sampled, the others are more precise.
+VkFormat chooseDepthFormat(App *pApp) {
+  static const VkFormat candidates[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_X8_D24_UNORM_PACK32, VK_FORMAT_D16_UNORM };
+  VkFormatFeatureFlags required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+  for (u32 i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(pApp->physicalDevice, candidates[i], &formatProperties);
+    if ((formatProperties.optimalTilingFeatures & required) == required) {
+      return candidates[i];
+    }
+  }
+  printf("Failed to find a depth format!\n");
+  exit(23);
+}
+
+// Full swap chain size like the offscreen targets. Frames in flight take
+// turns with it, the render passes order their use.
+void createDepthTarget(App *pApp) {
+  TRACE_ZONE("createDepthTarget");
+  VkImageCreateInfo imageInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = pApp->depthFormat,
+    .extent = { pApp->swapChainExtent.width, pApp->swapChainExtent.height, 1 },
+    .mipLevels = 1,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  if (pApp->occlusionCulling) {
+    imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  }
+  if (vkCreateImage(pApp->device, &imageInfo, &memoryVulkanCallbacks, &pApp->depthImage) != VK_SUCCESS) {
+    printf("Failed to create depth image!\n");
+    exit(23);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(pApp->device, pApp->depthImage, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pApp->physicalDevice, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pApp->device, pApp->physicalDevice, &allocInfo, MEMORY_TAG_FRAME, &pApp->depthMemory) != VK_SUCCESS ||
+      vkBindImageMemory(pApp->device, pApp->depthImage, pApp->depthMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate depth image memory!\n");
+    exit(23);
+  }
+
+  VkImageViewCreateInfo viewInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = pApp->depthImage,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = pApp->depthFormat,
+    .subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+    .subresourceRange.baseMipLevel = 0,
+    .subresourceRange.levelCount = 1,
+    .subresourceRange.baseArrayLayer = 0,
+    .subresourceRange.layerCount = 1
+  };
+  if (vkCreateImageView(pApp->device, &viewInfo, &memoryVulkanCallbacks, &pApp->depthImageView) != VK_SUCCESS) {
+    printf("Failed to create depth image view!\n");
+    exit(23);
+  }
+}
+
+void destroyDepthTarget(App *pApp) {
+  vkDestroyImageView(pApp->device, pApp->depthImageView, &memoryVulkanCallbacks);
+  vkDestroyImage(pApp->device, pApp->depthImage, &memoryVulkanCallbacks);
+  deviceFreeMemory(pApp->device, pApp->depthMemory);
+}
+
+void configureCapture(App *pApp) {
+  pApp->captureEnabled = false;
+  if (pApp->capturePath == NULL) {
+    return;
+  }
+  if (!pApp->swapChainTransferSrc || !captureFormatSupported(pApp->swapChainImageFormat)) {
+    LOG_WARN(LOG_CATEGORY_ENGINE, "Swap chain images can't be captured, capture disabled");
+    return;
+  }
+  pApp->captureEnabled = true;
+}
+
+void createTimestampQueries(App *pApp) {
+  TRACE_ZONE("createTimestampQueries");
+  VkQueryPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+    .queryType = VK_QUERY_TYPE_TIMESTAMP,
+    .queryCount = 2 * MAX_FRAMES_IN_FLIGHT
+  };
+  if (vkCreateQueryPool(pApp->device, &poolInfo, &memoryVulkanCallbacks, &pApp->timestampPool) != VK_SUCCESS) {
+    printf("Failed to create timestamp query pool!\n");
+    exit(23);
+  }
+
+  u32 bits = pApp->queueFamilies.graphicsTimestampBits;
+  pApp->timestampMask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+  pApp->timestampPeriodNs = pApp->deviceSelection.properties.limits.timestampPeriod;
 }
 
   void createImageViews(App *pApp) {
-  pApp->swapChainImageViews = (VkImageView*)malloc(sizeof(VkImageView) * pApp->swapChainImageCount);
+  TRACE_ZONE("createImageViews");
+  pApp->swapChainImageViews = memoryAlloc(sizeof(VkImageView) * pApp->swapChainImageCount, MEMORY_TAG_SWAPCHAIN);
 
   for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
     VkImageViewCreateInfo createInfo = {
@@ -520,27 +1344,22 @@ void recreateSwapChain(App *pApp) {
       .subresourceRange.layerCount = 1
     };
 
-    if (vkCreateImageView(pApp->device, &createInfo, NULL, &pApp->swapChainImageViews[i]) != VK_SUCCESS) {
+    if (vkCreateImageView(pApp->device, &createInfo, &memoryVulkanCallbacks, &pApp->swapChainImageViews[i]) != VK_SUCCESS) {
       printf("Failed to create image views!\n");
       exit(6);
     }
   }
 }
 
-typedef struct ShaderFile {
-  size_t size;
-  char *code;
-} ShaderFile;
-
-VkShaderModule createShaderModule(App *pApp, ShaderFile *shaderFile) {
+VkShaderModule createShaderModule(App *pApp, const ShaderCode *pCode) {
   VkShaderModuleCreateInfo createInfo = {
     .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-    .codeSize = shaderFile->size,
-    .pCode = (u32*)shaderFile->code
+    .codeSize = pCode->size,
+    .pCode = pCode->words
   };
 
   VkShaderModule shaderModule;
-  if (vkCreateShaderModule(pApp->device, &createInfo, NULL, &shaderModule) != VK_SUCCESS) {
+  if (vkCreateShaderModule(pApp->device, &createInfo, &memoryVulkanCallbacks, &shaderModule) != VK_SUCCESS) {
     printf("failed to create shader module!\n");
     exit(7);
   }
@@ -548,286 +1367,983 @@ VkShaderModule createShaderModule(App *pApp, ShaderFile *shaderFile) {
   return shaderModule;
 }
 
-void readFile(const char *filename, ShaderFile *shader) {
-  FILE *pFile;
-
-  pFile = fopen(filename, "rb");
-  if (pFile == NULL) {
-    printf("Failed to open %s\n", filename);
-    exit(7);
-  }
-
-  fseek(pFile, 0L, SEEK_END);
-  shader->size = ftell(pFile);
-
-  fseek(pFile, 0L, SEEK_SET);
-
-  shader->code = (char*)malloc(sizeof(char) * shader->size);
-  size_t readCount = fread(shader->code, shader->size, sizeof(char), pFile);
-  printf("ReadCount: %ld\n", readCount);
-
-  fclose(pFile);
-}
-
-void createRenderPass(App *pApp) {
-  VkAttachmentDescription colorAttachment = {};
-  colorAttachment.format = pApp->swapChainImageFormat;
-  colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-  colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-  colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+// Clears both attachments, or with load continues from the first
+// occlusion phase, which leaves them in their attachment layouts
+VkRenderPass createScenePass(App *pApp, bool load, bool last) {
+  VkAttachmentDescription attachments[2] = {};
+  VkAttachmentDescription *pColor = &attachments[0];
+  pColor->format = pApp->renderFormat;
+  pColor->samples = VK_SAMPLE_COUNT_1_BIT;
+  pColor->loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  pColor->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  pColor->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  pColor->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  pColor->initialLayout = load ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  // Offscreen targets are transitioned for post and the blit by hand, like dynamic rendering does
+  pColor->finalLayout = pApp->renderOffscreen || !last ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+  // Kept only for the pyramid build and the second phase
+  VkAttachmentDescription *pDepth = &attachments[1];
+  pDepth->format = pApp->depthFormat;
+  pDepth->samples = VK_SAMPLE_COUNT_1_BIT;
+  pDepth->loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+  pDepth->storeOp = last ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+  pDepth->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  pDepth->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  pDepth->initialLayout = load ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  pDepth->finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
   VkAttachmentReference colorAttachmentRef = {};
   colorAttachmentRef.attachment = 0;
   colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  VkAttachmentReference depthAttachmentRef = {};
+  depthAttachmentRef.attachment = 1;
+  depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
   VkSubpassDescription subpass = {};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subpass.colorAttachmentCount = 1;
   subpass.pColorAttachments = &colorAttachmentRef;
+  subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
+  // The depth buffer is shared, so also wait for the last frame's tests
   VkSubpassDependency dependency = {};
   dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
   dependency.dstSubpass = 0;
-  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.srcAccessMask = 0;
-  dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+  dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  dependency.dstStageMask = dependency.srcStageMask;
+  dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  if (load) {
+    dependency.dstAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+  }
 
   VkRenderPassCreateInfo renderPassInfo = {};
   renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  renderPassInfo.attachmentCount = 1;
-  renderPassInfo.pAttachments = &colorAttachment;
+  renderPassInfo.attachmentCount = 2;
+  renderPassInfo.pAttachments = attachments;
   renderPassInfo.subpassCount = 1;
   renderPassInfo.pSubpasses = &subpass;
   renderPassInfo.dependencyCount = 1;
   renderPassInfo.pDependencies = &dependency;
 
-  if (vkCreateRenderPass(pApp->device, &renderPassInfo, NULL, &pApp->renderPass) != VK_SUCCESS) {
+  VkRenderPass renderPass;
+  if (vkCreateRenderPass(pApp->device, &renderPassInfo, &memoryVulkanCallbacks, &renderPass) != VK_SUCCESS) {
     printf("failed to create render pass!\n");
     exit(8);
   }
+  return renderPass;
 }
 
-void createGraphicsPipeline(App *pApp) {
-  ShaderFile vertShader = {0};
-  ShaderFile fragShader = {0};
-  readFile("shaders/vert.spv", &vertShader);
-  readFile("shaders/frag.spv", &fragShader);
-
-  VkShaderModule vertShaderModule = createShaderModule(pApp, &vertShader);
-  VkShaderModule fragShaderModule = createShaderModule(pApp, &fragShader);
-
-  VkPipelineShaderStageCreateInfo vertShaderStageInfo = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-    .stage = VK_SHADER_STAGE_VERTEX_BIT,
-    .module = vertShaderModule,
-    .pName = "main"
-    //.pSpecializationInfo = NULL
+// The passes only differ in load and store ops and layouts, so they share
+// framebuffers and pipelines
+void createRenderPass(App *pApp) {
+  TRACE_ZONE("createRenderPass");
+  pApp->renderPass = createScenePass(pApp, false, !pApp->occlusionCulling);
+  if (pApp->occlusionCulling) {
+    pApp->secondPhasePass = createScenePass(pApp, true, true);
+  }
+}
+
+PipelineKey trianglePipelineKey(App *pApp) {
+  PipelineKey key = {
+    .shaderSet = SHADER_SET_TRIANGLE,
+    .blendMode = BLEND_MODE_OPAQUE,
+    .cullMode = VK_CULL_MODE_BACK_BIT,
+    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    .colorFormat = pApp->renderFormat,
+    .depthFormat = pApp->depthFormat
   };
+  return key;
+}
 
-  VkPipelineShaderStageCreateInfo fragShaderStageInfo = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-    .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-    .module = fragShaderModule,
-    .pName = "main"
+void createGraphicsPipeline(App *pApp) {
+  TRACE_ZONE("createGraphicsPipeline");
+  ShaderCode vertShader;
+  ShaderCode fragShader;
+  shaderCodeLoad("shader.vert", pApp->shaderDir, &vertShader);
+  shaderCodeLoad("shader.frag", pApp->shaderDir, &fragShader);
+
+  PipelineManagerCreateInfo managerInfo = {
+    .device = pApp->device,
+    .renderPass = pApp->renderPass,
+    .extendedDynamicState = pApp->extendedDynamicState,
+    .extendedDynamicStateIsCore = pApp->extendedDynamicStateIsCore,
+    .cachePath = "pipeline_cache.bin"
+  };
+  managerInfo.shaderSets[SHADER_SET_TRIANGLE].vert = createShaderModule(pApp, &vertShader);
+  managerInfo.shaderSets[SHADER_SET_TRIANGLE].frag = createShaderModule(pApp, &fragShader);
+  // One layout per mesh vertex format. The shader reads vec3s, which the
+  // half float and snorm formats expand to; UVs aren't read yet. Both take
+  // the scene's instances from binding 1.
+  managerInfo.vertexLayouts[MESH_VERTEX_FORMAT_PACKED] = (PipelineVertexLayout){
+    .stride = sizeof(MeshPackedVertex),
+    .instanceStride = sizeof(Vec4),
+    .attributeCount = 3,
+    .attributes = {
+      { .location = 0, .binding = 0, .format = VK_FORMAT_R16G16B16A16_SFLOAT, .offset = offsetof(MeshPackedVertex, position) },
+      { .location = 1, .binding = 0, .format = VK_FORMAT_R8G8B8A8_SNORM, .offset = offsetof(MeshPackedVertex, normal) },
+      { .location = 2, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 0 }
+    }
+  };
+  managerInfo.vertexLayouts[MESH_VERTEX_FORMAT_WIDE] = (PipelineVertexLayout){
+    .stride = sizeof(MeshWideVertex),
+    .instanceStride = sizeof(Vec4),
+    .attributeCount = 3,
+    .attributes = {
+      { .location = 0, .binding = 0, .format = VK_FORMAT_R32G32B32_SFLOAT, .offset = offsetof(MeshWideVertex, position) },
+      { .location = 1, .binding = 0, .format = VK_FORMAT_R8G8B8A8_SNORM, .offset = offsetof(MeshWideVertex, normal) },
+      { .location = 2, .binding = 1, .format = VK_FORMAT_R32G32B32A32_SFLOAT, .offset = 0 }
+    }
   };
 
-  VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+  shaderCodeFree(&vertShader);
+  shaderCodeFree(&fragShader);
 
-  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-    .vertexBindingDescriptionCount = 0,
-    .pVertexBindingDescriptions = NULL, // Optional
-    .vertexAttributeDescriptionCount = 0,
-    .pVertexAttributeDescriptions = NULL // Optional
+  // The object's model-view-projection and model matrices
+  VkPushConstantRange transformRange = {
+    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+    .offset = 0,
+    .size = 2 * sizeof(Mat4)
   };
 
-  u32 dynamicStatesSize = 2;
-  VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-
-  VkPipelineDynamicStateCreateInfo dynamicState = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-    .dynamicStateCount = dynamicStatesSize,
-    .pDynamicStates = dynamicStates
+  // Set 0 is the clustered light lists the fragment shader reads
+  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &pApp->lighting.setLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &transformRange
   };
 
-  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-    .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-    .primitiveRestartEnable = VK_FALSE
+  if (vkCreatePipelineLayout(pApp->device, &pipelineLayoutInfo, &memoryVulkanCallbacks, &pApp->pipelineLayout) != VK_SUCCESS) {
+    printf("failed to create pipeline layout!");
+    exit(7);
+  }
+  managerInfo.layout = pApp->pipelineLayout;
+
+  // Other permutations compile in the background on first use
+  PipelineKey fallbackKey = trianglePipelineKey(pApp);
+  pipelineManagerInit(&pApp->pipelines, &managerInfo, &fallbackKey);
+
+  // The pipeline field of render keys is the mesh's vertex format
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    pApp->pipelineKeys[format] = fallbackKey;
+    pApp->pipelineKeys[format].vertexLayout = (u8)format;
+  }
+  pApp->pipelineKeyCount = MESH_VERTEX_FORMAT_COUNT;
+}
+
+void createFramebuffers(App *pApp) {
+  TRACE_ZONE("createFramebuffers");
+  // Rendering offscreen, the render pass draws into the offscreen targets
+  pApp->framebufferCount = pApp->renderOffscreen ? (u32)MAX_FRAMES_IN_FLIGHT : pApp->swapChainImageCount;
+  pApp->swapChainFramebuffers = memoryAlloc(pApp->framebufferCount * sizeof(VkFramebuffer), MEMORY_TAG_SWAPCHAIN);
+
+  for (u32 i = 0; i < pApp->framebufferCount; i++) {
+    VkImageView attachments[] = {
+      pApp->renderOffscreen ? pApp->offscreenImageViews[i] : pApp->swapChainImageViews[i],
+      pApp->depthImageView
+    };
+
+    VkFramebufferCreateInfo framebufferInfo = {};
+    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebufferInfo.renderPass = pApp->renderPass;
+    framebufferInfo.attachmentCount = 2;
+    framebufferInfo.pAttachments = attachments;
+    framebufferInfo.width = pApp->swapChainExtent.width;
+    framebufferInfo.height = pApp->swapChainExtent.height;
+    framebufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(pApp->device, &framebufferInfo, &memoryVulkanCallbacks, &pApp->swapChainFramebuffers[i]) != VK_SUCCESS) {
+      printf("failed to create framebuffer!\n");
+      exit(10);
+    }
+  }
+}
+
+void transitionImageAspect(
+  VkCommandBuffer commandBuffer,
+  VkImage image,
+  VkImageAspectFlags aspectMask,
+  VkImageLayout oldLayout,
+  VkImageLayout newLayout,
+  VkAccessFlags srcAccessMask,
+  VkAccessFlags dstAccessMask,
+  VkPipelineStageFlags srcStageMask,
+  VkPipelineStageFlags dstStageMask) {
+
+  VkImageMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = srcAccessMask,
+    .dstAccessMask = dstAccessMask,
+    .oldLayout = oldLayout,
+    .newLayout = newLayout,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange.aspectMask = aspectMask,
+    .subresourceRange.baseMipLevel = 0,
+    .subresourceRange.levelCount = 1,
+    .subresourceRange.baseArrayLayer = 0,
+    .subresourceRange.layerCount = 1
   };
 
-  VkViewport viewport = {
-    .x = 0.0f,
-    .y = 0.0f,
-    .width = (float)pApp->swapChainExtent.width,
-    .height = (float)pApp->swapChainExtent.height,
-    .minDepth = 0.0f,
-    .maxDepth = 1.0f
+  vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+void transitionImage(
+  VkCommandBuffer commandBuffer,
+  VkImage image,
+  VkImageLayout oldLayout,
+  VkImageLayout newLayout,
+  VkAccessFlags srcAccessMask,
+  VkAccessFlags dstAccessMask,
+  VkPipelineStageFlags srcStageMask,
+  VkPipelineStageFlags dstStageMask) {
+  transitionImageAspect(commandBuffer, image, VK_IMAGE_ASPECT_COLOR_BIT, oldLayout, newLayout,
+                        srcAccessMask, dstAccessMask, srcStageMask, dstStageMask);
+}
+
+// Without a render pass the layout transitions and the external dependency
+// from createRenderPass have to be recorded by hand. With load the second
+// occlusion phase draws over the first's attachments.
+void beginDynamicRendering(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex, const VkClearValue *pClearValues, bool load) {
+  VkImage image = pApp->renderOffscreen ? pApp->offscreenImages[currentFrame] : pApp->swapChainImages[imageIndex];
+  VkImageView imageView = pApp->renderOffscreen ? pApp->offscreenImageViews[currentFrame] : pApp->swapChainImageViews[imageIndex];
+  if (load) {
+    // hizRecordBuild orders the depth
+    transitionImage(
+      commandBuffer, image,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  } else {
+    transitionImage(
+      commandBuffer, image,
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      0, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    transitionImageAspect(
+      commandBuffer, pApp->depthImage, VK_IMAGE_ASPECT_DEPTH_BIT,
+      VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+  }
+
+  VkRenderingAttachmentInfoKHR colorAttachment = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+    .imageView = imageView,
+    .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    .resolveMode = VK_RESOLVE_MODE_NONE,
+    .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    .clearValue = pClearValues[0]
+  };
+  VkRenderingAttachmentInfoKHR depthAttachment = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+    .imageView = pApp->depthImageView,
+    .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+    .resolveMode = VK_RESOLVE_MODE_NONE,
+    .loadOp = load ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR,
+    .storeOp = pApp->occlusionCulling && !load ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+    .clearValue = pClearValues[1]
   };
 
-  VkRect2D scissor = {
-    .offset = {0, 0},
-    .extent = pApp->swapChainExtent
+  VkRenderingInfoKHR renderingInfo = {
+    .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+    .renderArea.offset = {0, 0},
+    .renderArea.extent = pApp->renderExtent,
+    .layerCount = 1,
+    .colorAttachmentCount = 1,
+    .pColorAttachments = &colorAttachment,
+    .pDepthAttachment = &depthAttachment
   };
 
-  VkPipelineViewportStateCreateInfo viewportState = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-    .viewportCount = 1,
-    .pViewports = &viewport,
-    .scissorCount = 1,
-    .pScissors = &scissor
+  pApp->cmdBeginRendering(commandBuffer, &renderingInfo);
+}
+
+void endDynamicRendering(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex, bool last) {
+  pApp->cmdEndRendering(commandBuffer);
+
+  // Post-processing or blitToSwapChain takes the offscreen target from
+  // here, and the second occlusion phase draws on
+  if (pApp->renderOffscreen || !last) return;
+
+  transitionImage(
+    commandBuffer, pApp->swapChainImages[imageIndex],
+    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, 0,
+    VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
+
+// Upscales the scaled render in the offscreen target to the whole swap
+// chain image, converting from HDR after post-processing. The swap chain is
+// first touched here, so submission waits for the acquire at the transfer
+// stage.
+void blitToSwapChain(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex) {
+  VkImage source = pApp->offscreenImages[currentFrame];
+  VkImage destination = pApp->swapChainImages[imageIndex];
+
+  // postRecord leaves the target ready to blit from
+  if (!pApp->postProcessing) {
+    transitionImage(
+      commandBuffer, source,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  }
+  transitionImage(
+    commandBuffer, destination,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    0, VK_ACCESS_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  VkImageBlit region = {
+    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+    .srcOffsets = { { 0, 0, 0 }, { (i32)pApp->renderExtent.width, (i32)pApp->renderExtent.height, 1 } },
+    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+    .dstOffsets = { { 0, 0, 0 }, { (i32)pApp->swapChainExtent.width, (i32)pApp->swapChainExtent.height, 1 } }
   };
+  vkCmdBlitImage(
+    commandBuffer,
+    source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    1, &region, pApp->upscaleFilter);
+
+  transitionImage(
+    commandBuffer, destination,
+    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    VK_ACCESS_TRANSFER_WRITE_BIT, 0,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+}
 
-  VkPipelineRasterizationStateCreateInfo rasterizer = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-    .depthClampEnable = VK_FALSE,
-    .rasterizerDiscardEnable = VK_FALSE,
-    .polygonMode = VK_POLYGON_MODE_FILL,
-    .lineWidth = 1.0f,
-    .cullMode = VK_CULL_MODE_BACK_BIT,
-    .frontFace = VK_FRONT_FACE_CLOCKWISE,
-    .depthBiasEnable = VK_FALSE,
-    .depthBiasConstantFactor = 0.0f, // Optional
-    .depthBiasClamp = 0.0f, // Optional
-    .depthBiasSlopeFactor = 0.0f // Optional
+typedef struct RecordContext {
+  App *pApp;
+  VkCommandBuffer commandBuffer;
+  bool skipDraws; // The bound key's pipeline isn't compiled and nothing can stand in
+  HizPhase phase; // HIZ_PHASE_FIRST without occlusionCulling
+  u32 cullSlot; // Of the next indexed draw, in the order addCullDraw saw them
+} RecordContext;
+
+void recordBindPipeline(void *pUserData, u32 pipeline) {
+  RecordContext *pContext = pUserData;
+  App *pApp = pContext->pApp;
+  pContext->skipDraws = !pipelineManagerBind(&pApp->pipelines, pContext->commandBuffer, &pApp->pipelineKeys[pipeline]);
+  pApp->drawsSkipped |= pContext->skipDraws;
+  // Draws skipped here aren't recorded either. The recording has every
+  // draw in the first phase, unculled.
+  if (pApp->recordPath != NULL && !pContext->skipDraws && pContext->phase == HIZ_PHASE_FIRST) {
+    replayBindPipeline(&pApp->replay, pipeline);
+  }
+  if (!pContext->skipDraws) {
+    VkBuffer buffers[2] = { pApp->vertexBuffers[pipeline], pApp->instanceBuffer };
+    VkDeviceSize offsets[2] = { 0, 0 };
+    vkCmdBindVertexBuffers(pContext->commandBuffer, 0, 2, buffers, offsets);
+  }
+}
+
+void recordDraw(void *pUserData, const RenderDraw *pDraw) {
+  RecordContext *pContext = pUserData;
+  App *pApp = pContext->pApp;
+  bool culled = pApp->occlusionCulling && pDraw->indexCount > 0;
+  u32 slot = culled ? pContext->cullSlot++ : 0;
+  if (pContext->skipDraws) return;
+  // Draws that can't be culled go in the first phase
+  if (!culled && pContext->phase != HIZ_PHASE_FIRST) return;
+  const Mat4 *pTransform = &pApp->objectMvps[pDraw->objectIndex];
+  const Mat4 *pModel = &pApp->pSnapshot->objectTransforms[pDraw->objectIndex];
+  if (pApp->recordPath != NULL && pContext->phase == HIZ_PHASE_FIRST) {
+    replayDraw(&pApp->replay, pDraw, pTransform, pModel);
+  }
+  vkCmdPushConstants(pContext->commandBuffer, pApp->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Mat4), pTransform);
+  vkCmdPushConstants(pContext->commandBuffer, pApp->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(Mat4), sizeof(Mat4), pModel);
+  if (culled) {
+    // The cull wrote the instance count, 0 when hidden or drawn already
+    vkCmdDrawIndexedIndirect(pContext->commandBuffer, pApp->hiz.frames[currentFrame].commandBuffer,
+                             hizCommandOffset(&pApp->hiz, pContext->phase, slot), 1, sizeof(VkDrawIndexedIndirectCommand));
+  } else if (pDraw->indexCount > 0) {
+    vkCmdDrawIndexed(pContext->commandBuffer, pDraw->indexCount, pDraw->instanceCount, pDraw->firstIndex, pDraw->vertexOffset, pDraw->firstInstance);
+  } else {
+    vkCmdDraw(pContext->commandBuffer, pDraw->vertexCount, pDraw->instanceCount, pDraw->firstVertex, pDraw->firstInstance);
+  }
+}
+
+// Hands the frame's indexed draws to the occlusion cull, in queue order
+void addCullDraw(void *pUserData, const RenderDraw *pDraw) {
+  App *pApp = pUserData;
+  if (pDraw->indexCount == 0) return;
+  const CullSpheres *pBounds = &pApp->objectBounds;
+  u32 object = pDraw->objectIndex;
+  float sphere[4] = { pBounds->centerX[object], pBounds->centerY[object], pBounds->centerZ[object], pBounds->radius[object] };
+  hizAddDraw(&pApp->hiz, currentFrame, pDraw, sphere);
+}
+
+// The triangle the vertex shader used to hardcode, facing the camera
+static const MeshVertex triangleVertices[3] = {
+  { { 0.0f, 0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.5f, 0.0f } },
+  { { -0.5f, -0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f } },
+  { { 0.5f, -0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f } }
+};
+static const u32 triangleIndices[3] = { 0, 1, 2 };
+
+u32 addMeshData(App *pApp, const MeshData *pData) {
+  u32 mesh = pApp->meshCount++;
+  meshAdd(&pApp->meshData, pData, &pApp->meshes[mesh]);
+  const Mesh *pMesh = &pApp->meshes[mesh];
+  LOG_DEBUG(LOG_CATEGORY_ENGINE, "Mesh %u has %u LODs, %u to %u triangles, %u byte vertices", mesh, pMesh->lodCount,
+    pMesh->lods[0].indexCount / 3, pMesh->lods[pMesh->lodCount - 1].indexCount / 3, meshVertexStride(pMesh->vertexFormat));
+  return mesh;
+}
+
+// Builds LODs and packs at load, what the cooker does offline
+u32 addMesh(App *pApp, const MeshVertex *vertices, u32 vertexCount, const u32 *indices, u32 indexCount) {
+  TRACE_ZONE("addMesh");
+  MeshData data;
+  meshBuild(vertices, vertexCount, indices, indexCount, MESH_MAX_LODS, true, &data);
+  u32 mesh = addMeshData(pApp, &data);
+  meshDataDestroy(&data);
+  return mesh;
+}
+
+void cookedMeshRead(void *pUserData, FileIoResult *pResult) {
+  App *pApp = pUserData;
+  pApp->cookedMeshLoaded = pResult->status == FILE_IO_OK && meshFileParse(pResult->bytes, pResult->size, &pApp->cookedMesh);
+  memoryFree(pResult->bytes);
+}
+
+// Reads run while the window and device are created
+void startAssetReads(App *pApp) {
+  if (pApp->meshPath != NULL) {
+    // Parsed once into MeshData, caching the file would only take memory
+    pApp->meshRead = fileIoRead(&pApp->fileIo, pApp->meshPath, FILE_IO_PRIORITY_VISIBLE, FILE_IO_DIRECT, cookedMeshRead, pApp);
+  }
+  fileIoSubmit(&pApp->fileIo);
+}
+
+u32 addCookedMesh(App *pApp) {
+  TRACE_ZONE("addCookedMesh");
+  if (pApp->meshRead != 0) {
+    fileIoWait(&pApp->fileIo, pApp->meshRead);
+  }
+  if (!pApp->cookedMeshLoaded) {
+    printf("Failed to load mesh %s!\n", pApp->meshPath);
+    exit(27);
+  }
+  u32 mesh = addMeshData(pApp, &pApp->cookedMesh);
+  meshDataDestroy(&pApp->cookedMesh);
+  pApp->cookedMeshLoaded = false;
+  return mesh;
+}
+
+u32 addSphereMesh(App *pApp) {
+  u32 vertexCount, indexCount;
+  meshGenerateSphere(LOD_SPHERE_RINGS, LOD_SPHERE_SEGMENTS, NULL, &vertexCount, NULL, &indexCount);
+  MeshVertex *vertices = memoryAlloc(sizeof(MeshVertex) * vertexCount, MEMORY_TAG_GEOMETRY);
+  u32 *indices = memoryAlloc(sizeof(u32) * indexCount, MEMORY_TAG_GEOMETRY);
+  if (vertices == NULL || indices == NULL) {
+    printf("Failed to allocate scene!\n");
+    exit(19);
+  }
+  meshGenerateSphere(LOD_SPHERE_RINGS, LOD_SPHERE_SEGMENTS, vertices, &vertexCount, indices, &indexCount);
+  u32 mesh = addMesh(pApp, vertices, vertexCount, indices, indexCount);
+  memoryFree(vertices);
+  memoryFree(indices);
+  return mesh;
+}
+
+void createGeometryBuffer(App *pApp, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *pBuffer, VkDeviceMemory *pMemory) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
   };
+  if (vkCreateBuffer(pApp->device, &bufferInfo, &memoryVulkanCallbacks, pBuffer) != VK_SUCCESS) {
+    printf("Failed to create geometry buffer!\n");
+    exit(26);
+  }
 
-  VkPipelineMultisampleStateCreateInfo multisampling = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-    .sampleShadingEnable = VK_FALSE,
-    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-    .minSampleShading = 1.0f, // Optional
-    .pSampleMask = NULL, // Optional
-    .alphaToCoverageEnable = VK_FALSE, // Optional
-    .alphaToOneEnable = VK_FALSE // Optional
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pApp->device, *pBuffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pApp->physicalDevice, requirements.memoryTypeBits, properties)
   };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pApp->device, pApp->physicalDevice, &allocInfo, MEMORY_TAG_GEOMETRY, pMemory) != VK_SUCCESS ||
+      vkBindBufferMemory(pApp->device, *pBuffer, *pMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate geometry buffer memory!\n");
+    exit(26);
+  }
+}
 
-  VkPipelineColorBlendAttachmentState colorBlendAttachment = {
-    .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-    .blendEnable = VK_FALSE,
-    .srcColorBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
-    .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO, // Optional
-    .colorBlendOp = VK_BLEND_OP_ADD, // Optional
-    .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE, // Optional
-    .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, // Optional
-    .alphaBlendOp = VK_BLEND_OP_ADD // Optional
+// Copies every mesh into device local vertex and index buffers. Runs once
+// at load, so it simply waits for the copy.
+void uploadMeshes(App *pApp) {
+  TRACE_ZONE("uploadMeshes");
+  const MeshBuffers *pData = &pApp->meshData;
+  VkDeviceSize vertexSizes[MESH_VERTEX_FORMAT_COUNT];
+  VkDeviceSize vertexSize = 0;
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    vertexSizes[format] = (VkDeviceSize)meshVertexStride(format) * pData->vertexCount[format];
+    vertexSize += vertexSizes[format];
+  }
+  VkDeviceSize indexSize = sizeof(u32) * pData->indexCount;
+
+  VkBuffer staging;
+  VkDeviceMemory stagingMemory;
+  createGeometryBuffer(pApp, vertexSize + indexSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, &stagingMemory);
+  void *pMapped;
+  if (vkMapMemory(pApp->device, stagingMemory, 0, VK_WHOLE_SIZE, 0, &pMapped) != VK_SUCCESS) {
+    printf("Failed to map geometry staging buffer!\n");
+    exit(26);
+  }
+  VkDeviceSize stagingOffset = 0;
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    if (vertexSizes[format] > 0) {
+      memcpy((u8*)pMapped + stagingOffset, pData->vertices[format], vertexSizes[format]);
+    }
+    stagingOffset += vertexSizes[format];
+  }
+  memcpy((u8*)pMapped + vertexSize, pData->indices, indexSize);
+  vkUnmapMemory(pApp->device, stagingMemory);
+
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    pApp->vertexBuffers[format] = VK_NULL_HANDLE;
+    pApp->vertexMemory[format] = VK_NULL_HANDLE;
+    if (vertexSizes[format] > 0) {
+      createGeometryBuffer(pApp, vertexSizes[format], VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pApp->vertexBuffers[format], &pApp->vertexMemory[format]);
+    }
+  }
+  createGeometryBuffer(pApp, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pApp->indexBuffer, &pApp->indexMemory);
+
+  VkCommandBufferAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = pApp->commandPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1
+  };
+  VkCommandBuffer commandBuffer;
+  VkCommandBufferBeginInfo beginInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
   };
+  if (vkAllocateCommandBuffers(pApp->device, &allocInfo, &commandBuffer) != VK_SUCCESS ||
+      vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("Failed to record geometry upload!\n");
+    exit(26);
+  }
+  stagingOffset = 0;
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    if (vertexSizes[format] > 0) {
+      VkBufferCopy vertexCopy = { .srcOffset = stagingOffset, .dstOffset = 0, .size = vertexSizes[format] };
+      vkCmdCopyBuffer(commandBuffer, staging, pApp->vertexBuffers[format], 1, &vertexCopy);
+    }
+    stagingOffset += vertexSizes[format];
+  }
+  VkBufferCopy indexCopy = { .srcOffset = vertexSize, .dstOffset = 0, .size = indexSize };
+  vkCmdCopyBuffer(commandBuffer, staging, pApp->indexBuffer, 1, &indexCopy);
 
-  VkPipelineColorBlendStateCreateInfo colorBlending = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-    .logicOpEnable = VK_FALSE,
-    .logicOp = VK_LOGIC_OP_COPY, // Optional
-    .attachmentCount = 1,
-    .pAttachments = &colorBlendAttachment,
-    .blendConstants[0] = 0.0f, // Optional
-    .blendConstants[1] = 0.0f, // Optional
-    .blendConstants[2] = 0.0f, // Optional
-    .blendConstants[3] = 0.0f // Optional
+  VkSubmitInfo submitInfo = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &commandBuffer
   };
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS ||
+      vkQueueSubmit(pApp->graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS ||
+      vkQueueWaitIdle(pApp->graphicsQueue) != VK_SUCCESS) {
+    printf("Failed to upload geometry!\n");
+    exit(26);
+  }
 
-  VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-    .setLayoutCount = 0, // Optional
-    .pSetLayouts = NULL, // Optional
-    .pushConstantRangeCount = 0, // Optional
-    .pPushConstantRanges = NULL // Optional
+  vkFreeCommandBuffers(pApp->device, pApp->commandPool, 1, &commandBuffer);
+  vkDestroyBuffer(pApp->device, staging, &memoryVulkanCallbacks);
+  deviceFreeMemory(pApp->device, stagingMemory);
+}
+
+// The scene's instances are read straight from host visible memory. They
+// are written once and small next to the meshes.
+void uploadInstances(App *pApp) {
+  VkDeviceSize size = sizeof(Vec4) * pApp->instanceCount;
+  createGeometryBuffer(pApp, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &pApp->instanceBuffer, &pApp->instanceMemory);
+  void *pMapped;
+  if (vkMapMemory(pApp->device, pApp->instanceMemory, 0, VK_WHOLE_SIZE, 0, &pMapped) != VK_SUCCESS) {
+    printf("Failed to map instance buffer!\n");
+    exit(26);
+  }
+  memcpy(pMapped, pApp->instances, size);
+  vkUnmapMemory(pApp->device, pApp->instanceMemory);
+}
+
+// Adds an object drawing instanceCount instances of mesh, from firstInstance
+// of the scene's instances. The bounds are centered on its origin so they
+// hold however the simulation spins it.
+void addSceneObject(App *pApp, u32 mesh, Vec3 translation, float scale, u32 firstInstance, u32 instanceCount) {
+  const Mesh *pMesh = &pApp->meshes[mesh];
+  float radius = 0.0f;
+  for (u32 i = firstInstance; i < firstInstance + instanceCount; i++) {
+    const Vec4 *pInstance = &pApp->instances[i];
+    float reach = sqrtf(pInstance->x * pInstance->x + pInstance->y * pInstance->y + pInstance->z * pInstance->z) +
+                  pMesh->radius * pInstance->w;
+    radius = reach > radius ? reach : radius;
+  }
+  u32 object = cullSpheresAdd(&pApp->objectBounds, translation.x, translation.y, translation.z, radius * scale);
+  pApp->objectTranslations[object] = translation;
+  pApp->objectRotations[object] = quatIdentity();
+  pApp->objectScales[object] = vec3(scale, scale, scale);
+  pApp->objectMeshes[object] = mesh;
+  pApp->objectLods[object] = 0;
+  pApp->objectDraws[object] = (RenderDraw){
+    .instanceCount = instanceCount,
+    .firstInstance = firstInstance,
+    .objectIndex = object,
+    .indexCount = pMesh->lods[0].indexCount,
+    .firstIndex = pMesh->lods[0].firstIndex,
+    .vertexOffset = pMesh->vertexOffset
   };
+  pApp->objectCount++;
+}
 
-  if (vkCreatePipelineLayout(pApp->device, &pipelineLayoutInfo, NULL, &pApp->pipelineLayout) != VK_SUCCESS) {
-    printf("failed to create pipeline layout!");
-    exit(7);
+void createScene(App *pApp) {
+  TRACE_ZONE("createScene");
+  BenchScenario scenario = pApp->bench.scenario;
+  bool field = scenario == BENCH_SCENARIO_LOD || scenario == BENCH_SCENARIO_LIGHTS || scenario == BENCH_SCENARIO_OCCLUSION;
+  u32 capacity = scenario == BENCH_SCENARIO_DRAWS || field ? BENCH_OBJECT_COUNT : 1;
+  u32 instanceCapacity = 1 + (scenario == BENCH_SCENARIO_INSTANCES ? BENCH_OBJECT_COUNT : 0);
+  cullSpheresInit(&pApp->objectBounds, capacity);
+  pApp->objectDraws = memoryAlloc(sizeof(RenderDraw) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectMeshes = memoryAlloc(sizeof(u32) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectLods = memoryAlloc(sizeof(u8) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectTranslations = memoryAlloc(sizeof(Vec3) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectRotations = memoryAlloc(sizeof(Quat) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectScales = memoryAlloc(sizeof(Vec3) * capacity, MEMORY_TAG_SCENE);
+  pApp->objectMvps = memoryAlignedAlloc(_Alignof(Mat4), sizeof(Mat4) * capacity, MEMORY_TAG_SCENE);
+  pApp->visibleObjects = memoryAlloc(sizeof(u32) * capacity, MEMORY_TAG_SCENE);
+  pApp->instances = memoryAlignedAlloc(_Alignof(Vec4), sizeof(Vec4) * instanceCapacity, MEMORY_TAG_SCENE);
+  if (pApp->objectDraws == NULL || pApp->objectMeshes == NULL || pApp->objectLods == NULL ||
+      pApp->objectTranslations == NULL || pApp->objectRotations == NULL ||
+      pApp->objectScales == NULL || pApp->objectMvps == NULL || pApp->visibleObjects == NULL || pApp->instances == NULL) {
+    printf("Failed to allocate scene!\n");
+    exit(19);
   }
+  for (u32 i = 0; i < 3; i++) {
+    pApp->snapshots[i].simulationMs = 0.0;
+    pApp->snapshots[i].objectTransforms = memoryAlignedAlloc(_Alignof(Mat4), sizeof(Mat4) * capacity, MEMORY_TAG_SCENE);
+    if (pApp->snapshots[i].objectTransforms == NULL) {
+      printf("Failed to allocate scene!\n");
+      exit(19);
+    }
+  }
+  tripleBufferInit(&pApp->snapshotBuffer);
+  pApp->objectCount = 0;
+  pApp->instances[0] = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  pApp->instanceCount = 1;
+
+  meshBuffersInit(&pApp->meshData);
+  pApp->meshCount = 0;
+  u32 triangle = addMesh(pApp, triangleVertices, 3, triangleIndices, 3);
+  u32 sphere = field ? addSphereMesh(pApp) : triangle;
+  // A cooked mesh stands in for the sphere, or the single triangle, at the same size
+  u32 cooked = pApp->meshPath != NULL ? addCookedMesh(pApp) : triangle;
+  float cookedScale = pApp->meshes[cooked].radius > 0.0f ? 1.0f / pApp->meshes[cooked].radius : 1.0f;
+  if (pApp->meshPath != NULL && field) {
+    sphere = cooked;
+  }
+  uploadMeshes(pApp);
 
-  VkGraphicsPipelineCreateInfo pipelineInfo = {};
-  pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipelineInfo.stageCount = 2;
-  pipelineInfo.flags = 0;
-  pipelineInfo.pStages = shaderStages;
-  pipelineInfo.pVertexInputState = &vertexInputInfo;
-  pipelineInfo.pInputAssemblyState = &inputAssembly;
-  pipelineInfo.pViewportState = &viewportState;
-  pipelineInfo.pRasterizationState = &rasterizer;
-  pipelineInfo.pMultisampleState = &multisampling;
-  pipelineInfo.pDepthStencilState = NULL; // Optional
-  pipelineInfo.pColorBlendState = &colorBlending;
-  pipelineInfo.pDynamicState = &dynamicState;
-  pipelineInfo.layout = pApp->pipelineLayout;
-  pipelineInfo.renderPass = pApp->renderPass;
-  pipelineInfo.subpass = 0;
-  pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-  pipelineInfo.basePipelineIndex = -1; // Optional
-
-  if (vkCreateGraphicsPipelines(pApp->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &pApp->graphicsPipeline) != VK_SUCCESS) {
-    printf("Failed to create graphics pipeline!\n");
-    exit(9);
-  }
-
-  free(vertShader.code);
-  free(fragShader.code);
-  vkDestroyShaderModule(pApp->device, fragShaderModule, NULL);
-  vkDestroyShaderModule(pApp->device, vertShaderModule, NULL);
+  // Compile the pipeline of every vertex format in use now rather than
+  // skipping their draws for the first frames
+  for (u32 mesh = 0; mesh < pApp->meshCount; mesh++) {
+    pipelineManagerGet(&pApp->pipelines, &pApp->pipelineKeys[pApp->meshes[mesh].vertexFormat]);
+  }
+
+  if (scenario == BENCH_SCENARIO_EMPTY) {
+    // Clears and presents only
+  } else if (scenario == BENCH_SCENARIO_DRAWS) {
+    // A 100x100 grid of small triangles, all in view
+    u32 side = 100;
+    float spacing = 1.6f / side;
+    for (u32 y = 0; y < side; y++) {
+      for (u32 x = 0; x < side; x++) {
+        Vec3 translation = vec3((x + 0.5f) * spacing - 0.8f, (y + 0.5f) * spacing - 0.8f, 0.0f);
+        addSceneObject(pApp, triangle, translation, spacing * 0.8f, 0, 1);
+      }
+    }
+  } else if (scenario == BENCH_SCENARIO_INSTANCES) {
+    // The same grid as the draws scenario, as instances of one object
+    u32 side = 100;
+    float spacing = 1.6f / side;
+    u32 firstInstance = pApp->instanceCount;
+    for (u32 y = 0; y < side; y++) {
+      for (u32 x = 0; x < side; x++) {
+        pApp->instances[pApp->instanceCount++] = vec4((x + 0.5f) * spacing - 0.8f, (y + 0.5f) * spacing - 0.8f, 0.0f, spacing * 0.8f);
+      }
+    }
+    addSceneObject(pApp, triangle, vec3(0.0f, 0.0f, 0.0f), 1.0f, firstInstance, side * side);
+  } else if (field) {
+    // Rows of identical spheres going away from the camera. Only the
+    // nearest need their full detail, and lights spread through all of it.
+    for (u32 z = 0; z < LOD_FIELD_DEPTH; z++) {
+      for (u32 y = 0; y < LOD_FIELD_HEIGHT; y++) {
+        for (u32 x = 0; x < LOD_FIELD_WIDTH; x++) {
+          Vec3 translation = vec3((x - (LOD_FIELD_WIDTH - 1) * 0.5f) * LOD_FIELD_SPACING,
+            (y - (LOD_FIELD_HEIGHT - 1) * 0.5f) * LOD_FIELD_SPACING, -(float)z * LOD_FIELD_SPACING);
+          addSceneObject(pApp, sphere, translation, sphere == cooked ? 0.5f * cookedScale : 0.5f, 0, 1);
+        }
+      }
+    }
+    if (scenario == BENCH_SCENARIO_OCCLUSION) {
+      // Overlapping spheres between the camera and the field, covering the view
+      for (u32 y = 0; y < OCCLUSION_WALL_HEIGHT; y++) {
+        for (u32 x = 0; x < OCCLUSION_WALL_WIDTH; x++) {
+          Vec3 translation = vec3((x - (OCCLUSION_WALL_WIDTH - 1) * 0.5f) * OCCLUSION_WALL_SPACING,
+            (y - (OCCLUSION_WALL_HEIGHT - 1) * 0.5f) * OCCLUSION_WALL_SPACING, OCCLUSION_WALL_Z);
+          addSceneObject(pApp, sphere, translation, sphere == cooked ? 0.25f * cookedScale : 0.25f, 0, 1);
+        }
+      }
+    }
+  } else if (pApp->meshPath != NULL) {
+    addSceneObject(pApp, cooked, vec3(0.0f, 0.0f, 0.0f), cookedScale, 0, 1);
+  } else {
+    addSceneObject(pApp, triangle, vec3(0.0f, 0.0f, 0.0f), 1.0f, 0, 1);
+  }
+  uploadInstances(pApp);
 }
 
-void createFramebuffers(App *pApp) {
-  pApp->swapChainFramebuffers = (VkFramebuffer*)malloc(pApp->swapChainImageCount * sizeof(VkFramebuffer));
+void destroyScene(App *pApp) {
+  cullSpheresDestroy(&pApp->objectBounds);
+  memoryFree(pApp->objectDraws);
+  memoryFree(pApp->objectMeshes);
+  memoryFree(pApp->objectLods);
+  meshBuffersDestroy(&pApp->meshData);
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    vkDestroyBuffer(pApp->device, pApp->vertexBuffers[format], &memoryVulkanCallbacks);
+    deviceFreeMemory(pApp->device, pApp->vertexMemory[format]);
+  }
+  vkDestroyBuffer(pApp->device, pApp->indexBuffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pApp->device, pApp->indexMemory);
+  vkDestroyBuffer(pApp->device, pApp->instanceBuffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pApp->device, pApp->instanceMemory);
+  memoryFree(pApp->instances);
+  memoryFree(pApp->objectTranslations);
+  memoryFree(pApp->objectRotations);
+  memoryFree(pApp->objectScales);
+  memoryFree(pApp->objectMvps);
+  memoryFree(pApp->visibleObjects);
+  for (u32 i = 0; i < 3; i++) {
+    memoryFree(pApp->snapshots[i].objectTransforms);
+  }
+  memoryFree(pApp->lightBases);
+  memoryFree(pApp->lights);
+}
 
-  for (u32 i = 0; i < pApp->swapChainImageCount; i++) {
-    VkImageView attachments[] = { pApp->swapChainImageViews[i] };
+static float randomUnit(u32 *pState) {
+  u32 x = *pState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *pState = x;
+  return (x >> 8) * (1.0f / 16777216.0f);
+}
 
-    VkFramebufferCreateInfo framebufferInfo = {};
-    framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-    framebufferInfo.renderPass = pApp->renderPass;
-    framebufferInfo.attachmentCount = 1;
-    framebufferInfo.pAttachments = attachments;
-    framebufferInfo.width = pApp->swapChainExtent.width;
-    framebufferInfo.height = pApp->swapChainExtent.height;
-    framebufferInfo.layers = 1;
+// Scatters the lights through the scene's bounds, the same way every run.
+// Radii shrink as lights are added so each point stays in reach of about
+// LIGHT_OVERLAP of them, which keeps the cluster lists short at any count.
+void createLights(App *pApp) {
+  u32 count = pApp->lightCount;
+  pApp->lightBases = memoryAlloc(sizeof(Light) * (count > 0 ? count : 1), MEMORY_TAG_SCENE);
+  pApp->lights = memoryAlloc(sizeof(Light) * (count > 0 ? count : 1), MEMORY_TAG_SCENE);
+  if (pApp->lightBases == NULL || pApp->lights == NULL) {
+    printf("Failed to allocate lights!\n");
+    exit(19);
+  }
 
-    if (vkCreateFramebuffer(pApp->device, &framebufferInfo, NULL, &pApp->swapChainFramebuffers[i]) != VK_SUCCESS) {
-      printf("failed to create framebuffer!\n");
-      exit(10);
+  float low[3] = { -1.0f, -1.0f, -1.0f };
+  float high[3] = { 1.0f, 1.0f, 1.0f };
+  const CullSpheres *pBounds = &pApp->objectBounds;
+  for (u32 i = 0; i < pApp->objectCount; i++) {
+    float center[3] = { pBounds->centerX[i], pBounds->centerY[i], pBounds->centerZ[i] };
+    for (u32 axis = 0; axis < 3; axis++) {
+      low[axis] = fminf(low[axis], center[axis] - pBounds->radius[i]);
+      high[axis] = fmaxf(high[axis], center[axis] + pBounds->radius[i]);
+    }
+  }
+  float volume = (high[0] - low[0]) * (high[1] - low[1]) * (high[2] - low[2]);
+  float radius = cbrtf(3.0f * LIGHT_OVERLAP * volume / (4.0f * (float)M_PI * (count > 0 ? count : 1)));
+
+  u32 seed = 0x9e3779b9u;
+  for (u32 i = 0; i < count; i++) {
+    Light *pLight = &pApp->lightBases[i];
+    for (u32 axis = 0; axis < 3; axis++) {
+      pLight->position[axis] = low[axis] + randomUnit(&seed) * (high[axis] - low[axis]);
+    }
+    pLight->radius = radius;
+    float hue = randomUnit(&seed);
+    for (u32 channel = 0; channel < 3; channel++) {
+      pLight->color[channel] = 0.5f + 0.5f * cosf(2.0f * (float)M_PI * (hue + channel / 3.0f));
     }
+    pLight->padding = 0.0f;
   }
 }
 
-void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex) {
-  VkCommandBufferBeginInfo beginInfo = {};
-  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  beginInfo.flags = 0; // Optional
-  beginInfo.pInheritanceInfo = NULL; // Optional
+// Each light circles its base at its own phase, then the frame's set goes
+// to the GPU to be binned
+void updateLights(App *pApp) {
+  TRACE_ZONE("updateLights");
+  float time = (float)pApp->pSnapshot->animationMs * 0.001f * LIGHT_ORBIT_SPEED;
+  for (u32 i = 0; i < pApp->lightCount; i++) {
+    const Light *pBase = &pApp->lightBases[i];
+    Light *pLight = &pApp->lights[i];
+    float angle = time + i * 2.39996f; // Golden angle
+    float orbit = 0.5f * pBase->radius;
+    *pLight = *pBase;
+    pLight->position[0] += orbit * cosf(angle);
+    pLight->position[1] += orbit * sinf(angle);
+  }
+  clusteredLightingUpdate(&pApp->lighting, currentFrame, pApp->lights, pApp->lightCount, &pApp->view, &pApp->projection,
+                          pApp->renderExtent, CAMERA_NEAR, CAMERA_FAR);
+}
 
-  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
-    printf("failed to begin recording command buffer!\n");
-    exit(13);
+// Writes everything frames draw from that doesn't change between them, so
+// replay/replay can rebuild it without the window or the scene
+void startRecording(App *pApp) {
+  if (!replayWriterOpen(&pApp->replay, pApp->recordPath)) {
+    printf("Failed to open recording %s!\n", pApp->recordPath);
+    exit(30);
   }
 
-  VkRenderPassBeginInfo renderPassInfo = {};
-  renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  renderPassInfo.renderPass = pApp->renderPass;
-  renderPassInfo.framebuffer = pApp->swapChainFramebuffers[imageIndex];
-  renderPassInfo.renderArea.offset.x = 0;
-  renderPassInfo.renderArea.offset.y = 0;
-  renderPassInfo.renderArea.extent = pApp->swapChainExtent;
+  ReplaySetup setup;
+  memset(&setup, 0, sizeof(setup));
+  setup.swapChainFormat = pApp->swapChainImageFormat;
+  setup.renderFormat = pApp->renderFormat;
+  setup.flags = pApp->postProcessing ? REPLAY_FLAG_POST : 0;
+  setup.maxLights = pApp->lightCount;
+  setup.zNear = CAMERA_NEAR;
+  setup.zFar = CAMERA_FAR;
+  setup.vertexLayoutCount = MESH_VERTEX_FORMAT_COUNT;
+  setup.pipelineCount = pApp->pipelineKeyCount;
+  memcpy(setup.vertexLayouts, pApp->pipelines.vertexLayouts, sizeof(PipelineVertexLayout) * MESH_VERTEX_FORMAT_COUNT);
+  memcpy(setup.pipelines, pApp->pipelineKeys, sizeof(PipelineKey) * pApp->pipelineKeyCount);
+  replayWriteSetup(&pApp->replay, &setup);
+
+  const MeshBuffers *pData = &pApp->meshData;
+  for (u32 format = 0; format < MESH_VERTEX_FORMAT_COUNT; format++) {
+    if (pData->vertexCount[format] > 0) {
+      replayWriteVertices(&pApp->replay, format, pData->vertices[format], (size_t)pData->vertexCount[format] * meshVertexStride(format));
+    }
+  }
+  replayWriteIndices(&pApp->replay, pData->indices, pData->indexCount);
+  replayWriteInstances(&pApp->replay, pApp->instances, sizeof(Vec4) * pApp->instanceCount);
+}
 
-  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-  renderPassInfo.clearValueCount = 1;
-  renderPassInfo.pClearValues = &clearColor;
+// Spins every object in its own plane, so the triangles keep facing the
+// camera, and publishes the result to the render thread.
+void simulate(App *pApp, double nowMs) {
+  TRACE_ZONE("simulate");
+  FrameSnapshot *pSnapshot = &pApp->snapshots[tripleBufferWriteIndex(&pApp->snapshotBuffer)];
+  double pausedMs = pApp->animationPausedMs + (pApp->animationPaused ? nowMs - pApp->animationPauseStartMs : 0.0);
+  pSnapshot->animationMs = nowMs - pApp->simulationStartMs - pausedMs;
+  float angle = (float)pSnapshot->animationMs * 0.001f * SIMULATION_SPIN_SPEED;
+  Quat rotation = quatFromAxisAngle(vec3(0.0f, 0.0f, 1.0f), angle);
+  for (u32 i = 0; i < pApp->objectCount; i++) {
+    pApp->objectRotations[i] = rotation;
+  }
+  mat4ComposeBatch(pSnapshot->objectTransforms, pApp->objectTranslations, pApp->objectRotations, pApp->objectScales, pApp->objectCount);
+  pSnapshot->simulationMs = nowMs;
+  tripleBufferPublish(&pApp->snapshotBuffer);
+}
 
-  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+void updateCamera(App *pApp) {
+  float aspect = pApp->swapChainExtent.width / (float)pApp->swapChainExtent.height;
+  pApp->cameraEye = vec3(0.0f, 0.0f, 2.4f);
+  pApp->view = mat4LookAt(pApp->cameraEye, vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+  pApp->projection = mat4Perspective(CAMERA_FOV, aspect, CAMERA_NEAR, CAMERA_FAR);
+  mat4Multiply(&pApp->viewProjection, &pApp->projection, &pApp->view);
+}
+
+// Culls the scene against the camera, picks each survivor's LOD and sorts
+// them so recording binds each pipeline and material once.
+void buildRenderQueue(App *pApp) {
+  TRACE_ZONE("buildRenderQueue");
+  renderQueueReset(&pApp->renderQueue);
+
+  updateCamera(pApp);
+  updateLights(pApp);
+  mat4MultiplyBatch(pApp->objectMvps, &pApp->viewProjection, pApp->pSnapshot->objectTransforms, pApp->objectCount);
+
+  Frustum frustum;
+  frustumFromViewProjection(&frustum, pApp->viewProjection.m);
+  TRACE_BEGIN("cull");
+  u32 visibleCount = cullSpheresParallel(&pApp->objectBounds, &frustum, MAX_CULL_THREADS, pApp->visibleObjects);
+  TRACE_END();
+
+  // Projected size of one unit at a distance of one
+  float pixelsPerUnit = pApp->renderExtent.height / (2.0f * tanf(CAMERA_FOV * 0.5f));
+  u64 triangles = 0;
+
+  for (u32 i = 0; i < visibleCount; i++) {
+    u32 object = pApp->visibleObjects[i];
+    Vec3 center = vec3(pApp->objectBounds.centerX[object], pApp->objectBounds.centerY[object], pApp->objectBounds.centerZ[object]);
+    Vec4 clip = mat4TransformVec4(&pApp->viewProjection, vec4(center.x, center.y, center.z, 1.0f));
+    float depth = clip.w > 0.0f ? clip.z / clip.w : 0.0f;
+
+    const Mesh *pMesh = &pApp->meshes[pApp->objectMeshes[object]];
+    float distance = vec3Length(vec3Sub(center, pApp->cameraEye));
+    u32 lod = meshSelectLod(pMesh, pApp->objectScales[object].x, distance, pixelsPerUnit, pApp->lodThreshold, pApp->objectLods[object]);
+    pApp->objectLods[object] = (u8)lod;
+
+    RenderDraw draw = pApp->objectDraws[object];
+    draw.firstIndex = pMesh->lods[lod].firstIndex;
+    draw.indexCount = pMesh->lods[lod].indexCount;
+    triangles += (u64)(draw.indexCount / 3) * draw.instanceCount;
+    // Near to far within a vertex format, so the depth test rejects
+    // covered pixels before they are shaded
+    renderQueueSubmit(&pApp->renderQueue, renderKeyEncode(0, pMesh->vertexFormat, 0, depth), &draw);
+  }
+  benchCountTriangles(&pApp->bench, triangles);
+
+  renderQueueSort(&pApp->renderQueue);
+}
+
+// Starts drawing the scene, clearing it or with load going on from the
+// first occlusion phase. State is set again for each pass.
+void beginScenePass(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex, bool load) {
+  // Post-processing meters only what was drawn, told apart by alpha
+  VkClearValue clearValues[2] = {
+    { .color = {{0.0f, 0.0f, 0.0f, pApp->postProcessing ? 0.0f : 1.0f}} },
+    { .depthStencil = { 1.0f, 0 } }
+  };
 
-  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pApp->graphicsPipeline);
+  if (pApp->useDynamicRendering) {
+    beginDynamicRendering(pApp, commandBuffer, imageIndex, clearValues, load);
+  } else {
+    VkRenderPassBeginInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    renderPassInfo.renderPass = load ? pApp->secondPhasePass : pApp->renderPass;
+    renderPassInfo.framebuffer = pApp->swapChainFramebuffers[pApp->renderOffscreen ? currentFrame : imageIndex];
+    renderPassInfo.renderArea.offset.x = 0;
+    renderPassInfo.renderArea.offset.y = 0;
+    renderPassInfo.renderArea.extent = pApp->renderExtent;
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
+
+    vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  }
 
+  pipelineManagerBeginFrame(&pApp->pipelines);
 
   VkViewport viewport = {};
   viewport.x = 0.0f;
   viewport.y = 0.0f;
-  viewport.width = (float)pApp->swapChainExtent.width;
-  viewport.height = (float)pApp->swapChainExtent.height;
+  viewport.width = (float)pApp->renderExtent.width;
+  viewport.height = (float)pApp->renderExtent.height;
   viewport.minDepth = 0.0f;
   viewport.maxDepth = 1.0f;
   vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
@@ -835,12 +2351,115 @@ void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageInde
   VkRect2D scissor= {};
   scissor.offset.x = 0;
   scissor.offset.y = 0;
-  scissor.extent = pApp->swapChainExtent;
+  scissor.extent = pApp->renderExtent;
   vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-  vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+  vkCmdBindIndexBuffer(commandBuffer, pApp->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pApp->pipelineLayout, 0, 1,
+                          &pApp->lighting.frames[currentFrame].descriptorSet, 0, NULL);
+}
+
+// last is false between the occlusion phases
+void endScenePass(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex, bool last) {
+  if (pApp->useDynamicRendering) {
+    endDynamicRendering(pApp, commandBuffer, imageIndex, last);
+  } else {
+    vkCmdEndRenderPass(commandBuffer);
+  }
+}
+
+void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageIndex) {
+  TRACE_ZONE("recordCommandBuffer");
+  VkCommandBufferBeginInfo beginInfo = {};
+  beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  beginInfo.flags = 0; // Optional
+  beginInfo.pInheritanceInfo = NULL; // Optional
+
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("failed to begin recording command buffer!\n");
+    exit(13);
+  }
+
+  if (pApp->dynamicResolution) {
+    vkCmdResetQueryPool(commandBuffer, pApp->timestampPool, currentFrame * 2, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pApp->timestampPool, currentFrame * 2);
+  }
+
+  clusteredLightingRecord(&pApp->lighting, commandBuffer, currentFrame);
+
+  // Adapts over simulated time, so captures stay deterministic
+  float postDeltaSeconds = 0.0f;
+  if (pApp->postProcessing) {
+    double simulationMs = pApp->pSnapshot->simulationMs;
+    postDeltaSeconds = pApp->postSimulationMs > 0.0 ? (float)((simulationMs - pApp->postSimulationMs) / 1000.0) : 0.0f;
+    pApp->postSimulationMs = simulationMs;
+  }
+
+  if (pApp->recordPath != NULL) {
+    ReplayFrameHeader frame = {
+      .timeMs = benchNowMs(),
+      .targetWidth = pApp->swapChainExtent.width,
+      .targetHeight = pApp->swapChainExtent.height,
+      .renderWidth = pApp->renderExtent.width,
+      .renderHeight = pApp->renderExtent.height,
+      .view = pApp->view,
+      .projection = pApp->projection,
+      .postDeltaSeconds = postDeltaSeconds,
+      .lightCount = pApp->lightCount
+    };
+    replayBeginFrame(&pApp->replay, &frame, pApp->lights);
+  }
+
+  // The first phase draws what last frame's depth pyramid doesn't hide
+  if (pApp->occlusionCulling) {
+    hizBeginFrame(&pApp->hiz, currentFrame);
+    RenderQueueCallbacks cullCallbacks = { .pUserData = pApp, .draw = addCullDraw };
+    renderQueueReplay(&pApp->renderQueue, &cullCallbacks);
+    hizRecordCull(&pApp->hiz, commandBuffer, currentFrame, HIZ_PHASE_FIRST, &pApp->viewProjection);
+  }
+
+  beginScenePass(pApp, commandBuffer, imageIndex, false);
+  RecordContext context = { .pApp = pApp, .commandBuffer = commandBuffer, .phase = HIZ_PHASE_FIRST };
+  pApp->drawsSkipped = false;
+  RenderQueueCallbacks callbacks = {
+    .pUserData = &context,
+    .bindPipeline = recordBindPipeline,
+    .draw = recordDraw
+  };
+  renderQueueReplay(&pApp->renderQueue, &callbacks);
+  if (pApp->recordPath != NULL) {
+    replayEndFrame(&pApp->replay);
+  }
+
+  // The second draws what the pyramid of the first's depth no longer hides
+  if (pApp->occlusionCulling) {
+    endScenePass(pApp, commandBuffer, imageIndex, false);
+    hizRecordBuild(&pApp->hiz, commandBuffer, currentFrame, pApp->depthImage, pApp->renderExtent);
+    hizRecordCull(&pApp->hiz, commandBuffer, currentFrame, HIZ_PHASE_SECOND, &pApp->viewProjection);
+    beginScenePass(pApp, commandBuffer, imageIndex, true);
+    context.phase = HIZ_PHASE_SECOND;
+    context.cullSlot = 0;
+    context.skipDraws = false;
+    renderQueueReplay(&pApp->renderQueue, &callbacks);
+  }
+  endScenePass(pApp, commandBuffer, imageIndex, true);
+
+  if (pApp->postProcessing) {
+    postRecord(&pApp->post, commandBuffer, currentFrame, pApp->offscreenImages[currentFrame], pApp->renderExtent, postDeltaSeconds);
+  }
+  // Before the blit, which waits for the swap chain image, so the time
+  // only covers work the render scale affects
+  if (pApp->dynamicResolution) {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pApp->timestampPool, currentFrame * 2 + 1);
+  }
+  if (pApp->renderOffscreen) {
+    blitToSwapChain(pApp, commandBuffer, imageIndex);
+  }
 
-  vkCmdEndRenderPass(commandBuffer);
+  u32 frame = atomic_load(&pApp->framesRendered);
+  if (pApp->captureEnabled && captureWants(&pApp->capture, frame)) {
+    captureRecord(&pApp->capture, commandBuffer, currentFrame, pApp->swapChainImages[imageIndex], pApp->swapChainExtent, pApp->swapChainImageFormat, frame);
+  }
 
   if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
     printf("failed to record command buffer!\n");
@@ -849,21 +2468,21 @@ void recordCommandBuffer(App *pApp, VkCommandBuffer commandBuffer, u32 imageInde
 }
 
 void createCommandPool(App *pApp) {
-  QueueFamilyIndices indices = findQueueFamilies(pApp->physicalDevice, pApp->surface);
-
+  TRACE_ZONE("createCommandPool");
   VkCommandPoolCreateInfo poolInfo = {};
   poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
   poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-  poolInfo.queueFamilyIndex = indices.graphicsFamily;
+  poolInfo.queueFamilyIndex = pApp->queueFamilies.graphics;
 
-  if (vkCreateCommandPool(pApp->device, &poolInfo, NULL, &pApp->commandPool) != VK_SUCCESS) {
+  if (vkCreateCommandPool(pApp->device, &poolInfo, &memoryVulkanCallbacks, &pApp->commandPool) != VK_SUCCESS) {
     printf("failed to create command pool!\n");
     exit(11);
   }
 }
 
 void createCommandBuffers(App *pApp) {
-  pApp->commandBuffers = (VkCommandBuffer*)malloc(sizeof(VkCommandBuffer) * MAX_FRAMES_IN_FLIGHT);
+  TRACE_ZONE("createCommandBuffers");
+  pApp->commandBuffers = memoryAlloc(sizeof(VkCommandBuffer) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
 
   VkCommandBufferAllocateInfo allocInfo = {};
   allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -878,9 +2497,10 @@ void createCommandBuffers(App *pApp) {
 }
 
 void createSyncObjects(App *pApp) {
-  pApp->imageAvailableSemaphores = (VkSemaphore*)malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-  pApp->renderFinishedSemaphores = (VkSemaphore*)malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-  pApp->inFlightFences = (VkFence*)malloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT);
+  TRACE_ZONE("createSyncObjects");
+  pApp->imageAvailableSemaphores = memoryAlloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
+  pApp->renderFinishedSemaphores = memoryAlloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
+  pApp->inFlightFences = memoryAlloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT, MEMORY_TAG_FRAME);
 
   VkSemaphoreCreateInfo semaphoreInfo = {};
   semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -890,28 +2510,111 @@ void createSyncObjects(App *pApp) {
   fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
   for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->imageAvailableSemaphores[i]) != VK_SUCCESS) {
+    if (vkCreateSemaphore(pApp->device, &semaphoreInfo, &memoryVulkanCallbacks, &pApp->imageAvailableSemaphores[i]) != VK_SUCCESS) {
       printf("Failed to create imageAvailableSemaphore!\n");
       exit(15);
     }
-    if (vkCreateSemaphore(pApp->device, &semaphoreInfo, NULL, &pApp->renderFinishedSemaphores[i]) != VK_SUCCESS) {
+    if (vkCreateSemaphore(pApp->device, &semaphoreInfo, &memoryVulkanCallbacks, &pApp->renderFinishedSemaphores[i]) != VK_SUCCESS) {
       printf("Failed to create renderFinishedSemaphore!\n");
       exit(15);
     }
-    if (vkCreateFence(pApp->device, &fenceInfo, NULL, &pApp->inFlightFences[i]) != VK_SUCCESS) {
+    if (vkCreateFence(pApp->device, &fenceInfo, &memoryVulkanCallbacks, &pApp->inFlightFences[i]) != VK_SUCCESS) {
       printf("Failed to create fence!\n");
       exit(15);
     }
   }
 }
 
+// Draws the newest simulation step. Runs on the render thread unless --single-thread.
+void renderFrame(App *pApp) {
+  benchBeginFrame(&pApp->bench);
+  tripleBufferAcquire(&pApp->snapshotBuffer);
+  pApp->pSnapshot = &pApp->snapshots[tripleBufferReadIndex(&pApp->snapshotBuffer)];
+  drawFrame(pApp);
+  benchRecordLatency(&pApp->bench, benchNowMs() - pApp->pSnapshot->simulationMs);
+  benchEndFrame(&pApp->bench);
+  atomic_fetch_add(&pApp->framesRendered, 1);
+}
+
+// The fence for this frame slot has signaled, so its timestamps from the
+// last time around are ready. They decide the scale this frame renders at.
+void updateRenderExtent(App *pApp) {
+  if (!pApp->dynamicResolution) {
+    pApp->renderExtent = pApp->swapChainExtent;
+    return;
+  }
+
+  if (pApp->timestampsPending[currentFrame]) {
+    u64 timestamps[2];
+    VkResult result = vkGetQueryPoolResults(
+      pApp->device, pApp->timestampPool, currentFrame * 2, 2,
+      sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      float gpuMs = (float)(((timestamps[1] - timestamps[0]) & pApp->timestampMask) * pApp->timestampPeriodNs / 1e6);
+      if (resolutionUpdate(&pApp->resolution, gpuMs)) {
+        LOG_DEBUG(LOG_CATEGORY_ENGINE, "Render scale %.2f at %.2f ms GPU", pApp->resolution.scale, gpuMs);
+      }
+    }
+    pApp->timestampsPending[currentFrame] = false;
+  }
+
+  float scale = pApp->resolution.scale;
+  pApp->renderExtent.width = resolutionScaleDimension(pApp->swapChainExtent.width, scale);
+  pApp->renderExtent.height = resolutionScaleDimension(pApp->swapChainExtent.height, scale);
+}
+
+// Refreshes heap usage and budgets, warning once each time a heap gets
+// close to its budget
+void updateMemoryBudget(App *pApp) {
+  TRACE_ZONE("updateMemoryBudget");
+  deviceUpdateMemoryBudget(pApp->physicalDevice, pApp->memoryBudget);
+  MemoryStats stats;
+  memoryGetStats(&stats);
+  for (u32 heap = 0; heap < stats.heapCount; heap++) {
+    const MemoryHeapStats *pHeap = &stats.heaps[heap];
+    bool near = pHeap->usage > pHeap->budget * MEMORY_BUDGET_WARNING;
+    bool wasNear = (pApp->heapsNearBudget & (1u << heap)) != 0;
+    if (near && !wasNear) {
+      LOG_WARN(LOG_CATEGORY_MEMORY, "Heap %u uses %.1f of its %.1f MiB budget", heap,
+               pHeap->usage / (1024.0 * 1024.0), pHeap->budget / (1024.0 * 1024.0));
+    }
+    pApp->heapsNearBudget = near ? pApp->heapsNearBudget | (1u << heap) : pApp->heapsNearBudget & ~(1u << heap);
+  }
+}
+
 void drawFrame(App *pApp) {
+  TRACE_ZONE("drawFrame");
+  TRACE_BEGIN("waitForFence");
   vkWaitForFences(pApp->device, 1, &pApp->inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+  TRACE_END();
+  benchMark(&pApp->bench, BENCH_STAGE_WAIT);
 
-  vkResetFences(pApp->device, 1, &pApp->inFlightFences[currentFrame]);
+  // This slot's previous copy has landed, the worker can write it out
+  if (pApp->captureEnabled) {
+    captureCollect(&pApp->capture, currentFrame);
+  }
+  updateRenderExtent(pApp);
+  if (pApp->postProcessing && postCollectTimings(&pApp->post, currentFrame)) {
+    const char *names[POST_EFFECT_COUNT];
+    for (u32 effect = 0; effect < POST_EFFECT_COUNT; effect++) {
+      names[effect] = postEffectName(effect);
+    }
+    benchRecordGpuTimes(&pApp->bench, names, pApp->post.effectMs, POST_EFFECT_COUNT);
+  }
+  if (pApp->occlusionCulling && hizCollectStats(&pApp->hiz, currentFrame)) {
+    const HizStats *pStats = &pApp->hiz.lastStats;
+    u32 culled = pStats->tested - pStats->firstPhaseVisible - pStats->secondPhaseVisible;
+    benchCountOcclusion(&pApp->bench, pStats->tested, culled);
+    logWrite(LOG_LEVEL_DEBUG, LOG_CATEGORY_ENGINE, OCCLUSION_LOG_ID, "Occlusion: %u tested, %u culled (%u drawn late)",
+             pStats->tested, culled, pStats->secondPhaseVisible);
+  }
+  updateMemoryBudget(pApp);
 
   uint32_t imageIndex;
+  TRACE_BEGIN("acquire");
   VkResult result = vkAcquireNextImageKHR(pApp->device, pApp->swapChain, UINT64_MAX, pApp->imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+  TRACE_END();
+  benchMark(&pApp->bench, BENCH_STAGE_ACQUIRE);
 
   if (result == VK_ERROR_OUT_OF_DATE_KHR) {
     recreateSwapChain(pApp);
@@ -924,14 +2627,19 @@ void drawFrame(App *pApp) {
   // Only reset the fence if we are submitting work
   vkResetFences(pApp->device, 1, &pApp->inFlightFences[currentFrame]);
 
+  buildRenderQueue(pApp);
+  benchMark(&pApp->bench, BENCH_STAGE_BUILD);
+
   vkResetCommandBuffer(pApp->commandBuffers[currentFrame], 0);
   recordCommandBuffer(pApp, pApp->commandBuffers[currentFrame], imageIndex);
+  benchMark(&pApp->bench, BENCH_STAGE_RECORD);
 
   VkSubmitInfo submitInfo = {};
   submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
   VkSemaphore waitSemaphores[] = { pApp->imageAvailableSemaphores[currentFrame] };
-  VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+  // Rendering offscreen, the scene renders before the swap chain image is needed
+  VkPipelineStageFlags waitStages[] = { pApp->renderOffscreen ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
   submitInfo.waitSemaphoreCount = 1;
   submitInfo.pWaitSemaphores = waitSemaphores;
   submitInfo.pWaitDstStageMask = waitStages;
@@ -943,10 +2651,14 @@ void drawFrame(App *pApp) {
   submitInfo.signalSemaphoreCount = 1;
   submitInfo.pSignalSemaphores = signalSemaphores;
 
+  TRACE_BEGIN("submit");
   if (vkQueueSubmit(pApp->graphicsQueue, 1, &submitInfo, pApp->inFlightFences[currentFrame]) != VK_SUCCESS) {
     printf("Failed to submit draw command buffer!\n");
     exit(16);
   }
+  pApp->timestampsPending[currentFrame] = pApp->dynamicResolution;
+  TRACE_END();
+  benchMark(&pApp->bench, BENCH_STAGE_SUBMIT);
 
   VkPresentInfoKHR presentInfo = {};
   presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -961,10 +2673,12 @@ void drawFrame(App *pApp) {
 
   presentInfo.pResults = NULL; // Optional
 
+  TRACE_BEGIN("present");
   VkResult queueResult = vkQueuePresentKHR(pApp->presentQueue, &presentInfo);
+  TRACE_END();
+  benchMark(&pApp->bench, BENCH_STAGE_PRESENT);
 
-  if (queueResult == VK_ERROR_OUT_OF_DATE_KHR || queueResult == VK_SUBOPTIMAL_KHR || framebufferResized) {
-    framebufferResized = false;
+  if (queueResult == VK_ERROR_OUT_OF_DATE_KHR || queueResult == VK_SUBOPTIMAL_KHR || atomic_exchange(&pApp->framebufferResized, false)) {
     recreateSwapChain(pApp);
   } else if (queueResult != VK_SUCCESS) {
     printf("Failed to present swap chain image!\n");
@@ -974,28 +2688,6 @@ void drawFrame(App *pApp) {
   currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
-bool checkDeviceExtensionSupport(VkPhysicalDevice device) {
-  u32 extensionCount;
-  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, NULL);
-  VkExtensionProperties availableExtensions[extensionCount];
-  vkEnumerateDeviceExtensionProperties(device, NULL, &extensionCount, availableExtensions);
-
-  for (u32 i = 0; i < deviceExtensionCount; i++) {
-    bool extensionFound = false;
-    for (u32 j = 0; j < extensionCount; j++) {
-      if (strcmp(deviceExtensions[i], availableExtensions[j].extensionName) == 0) {
-        extensionFound = true;
-        break;
-      }
-    }
-    if (!extensionFound) {
-      return false;
-    }
-  }
-
-  return true;
-}
-
 SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface) {
   SwapChainSupportDetails details;
 
@@ -1031,7 +2723,15 @@ VkSurfaceFormatKHR chooseSwapSurfaceFormat(u32 formatCount, VkSurfaceFormatKHR *
   return availableFormats[0];
 }
 
-VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes) {
+// Benchmarks skip vsync when the driver allows it so frame times measure the CPU and GPU
+VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *availablePresentModes, bool preferImmediate) {
+  if (preferImmediate) {
+    for (u32 i = 0; i < presentModeCount; i++) {
+      if (availablePresentModes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+        return availablePresentModes[i];
+      }
+    }
+  }
   for (u32 i = 0; i < presentModeCount; i++) {
     if (availablePresentModes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
       return availablePresentModes[i];
@@ -1040,14 +2740,11 @@ VkPresentModeKHR chooseSwapPresentMode(u32 presentModeCount, VkPresentModeKHR *a
   return VK_PRESENT_MODE_FIFO_KHR;
 }
 
-VkExtent2D chooseSwapExtent(GLFWwindow *window, VkSurfaceCapabilitiesKHR capabilities) {
+VkExtent2D chooseSwapExtent(VkExtent2D framebufferExtent, VkSurfaceCapabilitiesKHR capabilities) {
   if (capabilities.currentExtent.width != UINT_MAX) {
     return capabilities.currentExtent;
   } else {
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
-
-    VkExtent2D actualExtent = { (u32)width, (u32)height };
+    VkExtent2D actualExtent = framebufferExtent;
 
     actualExtent.width = clamp_u32(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
     actualExtent.height = clamp_u32(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
@@ -1056,78 +2753,6 @@ VkExtent2D chooseSwapExtent(GLFWwindow *window, VkSurfaceCapabilitiesKHR capabil
   }
 }
 
-u32 rateDeviceSuitability(VkPhysicalDevice device, VkSurfaceKHR surface) {
-  VkPhysicalDeviceProperties deviceProperties;
-  VkPhysicalDeviceFeatures deviceFeatures;
-  vkGetPhysicalDeviceProperties(device, &deviceProperties);
-  vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
-
-  u32 score = 0;
-
-  // Discrete GPUs have a significant performance advantage
-  if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-    score += 1000;
-  }
-
-  // Maximum possible size of textures affects graphics quality
-  score += deviceProperties.limits.maxImageDimension2D;
-
-  // Applications can't function without geometry shaders
-  if (!deviceFeatures.geometryShader) {
-    return 0;
-  }
-
-  // Check device supports required queue families
-  // Note: to improve performance, we could favour queue families that have both graphcs and present support.
-  // We could check the returned indices and if they are the same, increase the score.
-  QueueFamilyIndices indices = findQueueFamilies(device, surface);
-  if (!indices.isGraphicsFamilySet) {
-    printf("Queue Family not supported!\n");
-    return 0;
-  }
-
-  bool extensionsSupported = checkDeviceExtensionSupport(device);
-  if (!extensionsSupported) {
-    printf("Required device extensions not supported!\n");
-    return 0;
-  }
-
-  SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
-  if (swapChainSupport.formatCount == 0 || swapChainSupport.presentModeCount == 0) {
-    printf("Swap chain not adequately supported!\n");
-    return 0;
-  }
-
-  return score;
-}
-
-QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface) {
-  QueueFamilyIndices indices = {0};
-
-  u32 queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
-
-  VkQueueFamilyProperties queueFamilyProperties[queueFamilyCount];
-  vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilyProperties);
-
-  for (u32 i = 0; i < queueFamilyCount; i++) {
-    if (queueFamilyProperties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-      indices.graphicsFamily = i;
-      indices.isGraphicsFamilySet = true;
-      break;
-    }
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-    if (presentSupport) {
-      indices.presentFamily = i;
-      indices.isPresentFamilySet = true;
-    }
-  }
-
-
-  return indices;
-}
-
 bool checkValidationLayerSupport() {
   u32 layerCount;
   vkEnumerateInstanceLayerProperties(&layerCount, NULL);
@@ -1152,13 +2777,14 @@ bool checkValidationLayerSupport() {
 }
 
 void setupDebugMessenger(App *pApp) {
+  TRACE_ZONE("setupDebugMessenger");
   if (!enableValidationLayers) return;
 
   VkDebugUtilsMessengerCreateInfoEXT createInfo = {0};
   populateDebugMessengerCreateInfo(&createInfo);
   // createInfo.pUserData = NULL;
 
-  if (CreateDebugUtilsMessengerEXT(pApp->instance, &createInfo, NULL, &pApp->debugMessenger) != VK_SUCCESS) {
+  if (CreateDebugUtilsMessengerEXT(pApp->instance, &createInfo, &memoryVulkanCallbacks, &pApp->debugMessenger) != VK_SUCCESS) {
     printf("Failed to setup debug messenger!\n");
     exit(2);
   }
@@ -1166,7 +2792,8 @@ void setupDebugMessenger(App *pApp) {
 
 void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT *createInfo) {
   createInfo->sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-  createInfo->messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+  // VERBOSE floods the log with loader chatter
+  createInfo->messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
   createInfo->messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
   createInfo->pfnUserCallback = debugCallback;
 }
@@ -1177,7 +2804,16 @@ VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
     const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
     void *pUserData) {
 
-  printf("validation layer: %s\n", pCallbackData->pMessage);
+  // Runs on whatever thread the driver calls from, so it must stay cheap
+  LogLevel level = LOG_LEVEL_DEBUG;
+  if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+    level = LOG_LEVEL_ERROR;
+  } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+    level = LOG_LEVEL_WARN;
+  } else if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+    level = LOG_LEVEL_INFO;
+  }
+  logWrite(level, LOG_CATEGORY_VALIDATION, pCallbackData->messageIdNumber, "%s", pCallbackData->pMessage);
 
   return VK_FALSE;
 }
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "memtrack.h"
+#include "log.h"
+
+#define ALLOCATION_MAGIC 0x6d656d74u
+
+// Sits right before every block the wrappers hand out
+typedef struct AllocationHeader {
+  void *pBase; // What malloc returned
+  size_t size;
+  u32 alignment;
+  u32 tag;
+  u32 magic;
+} AllocationHeader;
+
+typedef struct DeviceAllocation {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  u32 heap;
+  MemoryTag tag;
+} DeviceAllocation;
+
+static const char *tagNames[MEMORY_TAG_COUNT] = {
+  "swapchain",
+  "frame",
+  "scene",
+  "geometry",
+  "lighting",
+  "post",
+  "occlusion",
+  "capture",
+  "io",
+  "pipelines",
+  "shaders",
+  "vulkan"
+};
+
+static _Atomic size_t hostBytes[MEMORY_TAG_COUNT];
+static _Atomic size_t hostPeakBytes[MEMORY_TAG_COUNT];
+static _Atomic u32 hostAllocations[MEMORY_TAG_COUNT];
+static _Atomic size_t vulkanInternalBytes;
+
+// Device allocations are few and long lived, a list under a lock will do
+static pthread_mutex_t deviceMutex = PTHREAD_MUTEX_INITIALIZER;
+static DeviceAllocation *deviceAllocations;
+static u32 deviceAllocationCount;
+static u32 deviceAllocationCapacity;
+static VkDeviceSize deviceBytes[MEMORY_TAG_COUNT];
+static VkDeviceSize devicePeakBytes[MEMORY_TAG_COUNT];
+static VkDeviceSize deviceHeapBytes[MEMORY_MAX_HEAPS];
+static MemoryHeapStats heapStats[MEMORY_MAX_HEAPS];
+static u32 heapCount;
+
+const char *memoryTagName(MemoryTag tag) {
+  return tag < MEMORY_TAG_COUNT ? tagNames[tag] : "unknown";
+}
+
+static void raisePeak(_Atomic size_t *pPeak, size_t value) {
+  size_t peak = atomic_load_explicit(pPeak, memory_order_relaxed);
+  while (value > peak && !atomic_compare_exchange_weak_explicit(pPeak, &peak, value, memory_order_relaxed, memory_order_relaxed)) {
+  }
+}
+
+void *memoryAlignedAlloc(size_t alignment, size_t size, MemoryTag tag) {
+  if (alignment < _Alignof(max_align_t)) alignment = _Alignof(max_align_t);
+  u8 *pBase = malloc(sizeof(AllocationHeader) + alignment + size);
+  if (pBase == NULL) return NULL;
+
+  uintptr_t user = ((uintptr_t)(pBase + sizeof(AllocationHeader)) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+  AllocationHeader *pHeader = (AllocationHeader *)user - 1;
+  pHeader->pBase = pBase;
+  pHeader->size = size;
+  pHeader->alignment = (u32)alignment;
+  pHeader->tag = tag;
+  pHeader->magic = ALLOCATION_MAGIC;
+
+  size_t bytes = atomic_fetch_add_explicit(&hostBytes[tag], size, memory_order_relaxed) + size;
+  raisePeak(&hostPeakBytes[tag], bytes);
+  atomic_fetch_add_explicit(&hostAllocations[tag], 1, memory_order_relaxed);
+  return (void *)user;
+}
+
+void *memoryAlloc(size_t size, MemoryTag tag) {
+  return memoryAlignedAlloc(_Alignof(max_align_t), size, tag);
+}
+
+void *memoryCalloc(size_t count, size_t size, MemoryTag tag) {
+  if (size != 0 && count > SIZE_MAX / size) return NULL;
+  void *pMemory = memoryAlloc(count * size, tag);
+  if (pMemory != NULL) memset(pMemory, 0, count * size);
+  return pMemory;
+}
+
+static AllocationHeader *headerOf(void *pMemory) {
+  AllocationHeader *pHeader = (AllocationHeader *)pMemory - 1;
+  if (pHeader->magic != ALLOCATION_MAGIC) {
+    LOG_ERROR(LOG_CATEGORY_MEMORY, "%p was not allocated by memoryAlloc", pMemory);
+    abort();
+  }
+  return pHeader;
+}
+
+void memoryFree(void *pMemory) {
+  if (pMemory == NULL) return;
+  AllocationHeader *pHeader = headerOf(pMemory);
+  atomic_fetch_sub_explicit(&hostBytes[pHeader->tag], pHeader->size, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&hostAllocations[pHeader->tag], 1, memory_order_relaxed);
+  pHeader->magic = 0;
+  free(pHeader->pBase);
+}
+
+static void *reallocAligned(void *pMemory, size_t alignment, size_t size, MemoryTag tag) {
+  if (pMemory == NULL) return memoryAlignedAlloc(alignment, size, tag);
+  if (size == 0) {
+    memoryFree(pMemory);
+    return NULL;
+  }
+  AllocationHeader *pHeader = headerOf(pMemory);
+  void *pGrown = memoryAlignedAlloc(alignment, size, tag);
+  if (pGrown == NULL) return NULL;
+  memcpy(pGrown, pMemory, pHeader->size < size ? pHeader->size : size);
+  memoryFree(pMemory);
+  return pGrown;
+}
+
+void *memoryRealloc(void *pMemory, size_t size, MemoryTag tag) {
+  return reallocAligned(pMemory, pMemory != NULL ? headerOf(pMemory)->alignment : 0, size, tag);
+}
+
+static void *VKAPI_PTR vulkanAllocate(void *pUserData, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+  return memoryAlignedAlloc(alignment, size, MEMORY_TAG_VULKAN);
+}
+
+static void *VKAPI_PTR vulkanReallocate(void *pUserData, void *pOriginal, size_t size, size_t alignment, VkSystemAllocationScope scope) {
+  return reallocAligned(pOriginal, alignment, size, MEMORY_TAG_VULKAN);
+}
+
+static void VKAPI_PTR vulkanFree(void *pUserData, void *pMemory) {
+  memoryFree(pMemory);
+}
+
+static void VKAPI_PTR vulkanInternalAllocation(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+  atomic_fetch_add_explicit(&vulkanInternalBytes, size, memory_order_relaxed);
+}
+
+static void VKAPI_PTR vulkanInternalFree(void *pUserData, size_t size, VkInternalAllocationType type, VkSystemAllocationScope scope) {
+  atomic_fetch_sub_explicit(&vulkanInternalBytes, size, memory_order_relaxed);
+}
+
+const VkAllocationCallbacks memoryVulkanCallbacks = {
+  .pUserData = NULL,
+  .pfnAllocation = vulkanAllocate,
+  .pfnReallocation = vulkanReallocate,
+  .pfnFree = vulkanFree,
+  .pfnInternalAllocation = vulkanInternalAllocation,
+  .pfnInternalFree = vulkanInternalFree
+};
+
+void memoryTrackDevice(VkDeviceMemory memory, VkDeviceSize size, u32 heap, MemoryTag tag) {
+  pthread_mutex_lock(&deviceMutex);
+  if (deviceAllocationCount == deviceAllocationCapacity) {
+    u32 capacity = deviceAllocationCapacity > 0 ? deviceAllocationCapacity * 2 : 64;
+    DeviceAllocation *pGrown = realloc(deviceAllocations, sizeof(DeviceAllocation) * capacity);
+    if (pGrown == NULL) {
+      pthread_mutex_unlock(&deviceMutex);
+      LOG_ERROR(LOG_CATEGORY_MEMORY, "Out of memory tracking device allocations");
+      return;
+    }
+    deviceAllocations = pGrown;
+    deviceAllocationCapacity = capacity;
+  }
+  deviceAllocations[deviceAllocationCount++] = (DeviceAllocation){ memory, size, heap, tag };
+  deviceBytes[tag] += size;
+  if (deviceBytes[tag] > devicePeakBytes[tag]) devicePeakBytes[tag] = deviceBytes[tag];
+  if (heap < MEMORY_MAX_HEAPS) deviceHeapBytes[heap] += size;
+  pthread_mutex_unlock(&deviceMutex);
+}
+
+void memoryUntrackDevice(VkDeviceMemory memory) {
+  pthread_mutex_lock(&deviceMutex);
+  for (u32 i = 0; i < deviceAllocationCount; i++) {
+    DeviceAllocation *pAllocation = &deviceAllocations[i];
+    if (pAllocation->memory == memory) {
+      deviceBytes[pAllocation->tag] -= pAllocation->size;
+      if (pAllocation->heap < MEMORY_MAX_HEAPS) deviceHeapBytes[pAllocation->heap] -= pAllocation->size;
+      *pAllocation = deviceAllocations[--deviceAllocationCount];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&deviceMutex);
+}
+
+void memorySetHeaps(const MemoryHeapStats *heaps, u32 count) {
+  pthread_mutex_lock(&deviceMutex);
+  heapCount = count < MEMORY_MAX_HEAPS ? count : MEMORY_MAX_HEAPS;
+  memcpy(heapStats, heaps, sizeof(MemoryHeapStats) * heapCount);
+  pthread_mutex_unlock(&deviceMutex);
+}
+
+VkDeviceSize memoryDeviceHeapBytes(u32 heap) {
+  pthread_mutex_lock(&deviceMutex);
+  VkDeviceSize bytes = heap < MEMORY_MAX_HEAPS ? deviceHeapBytes[heap] : 0;
+  pthread_mutex_unlock(&deviceMutex);
+  return bytes;
+}
+
+void memoryGetStats(MemoryStats *pStats) {
+  memset(pStats, 0, sizeof(MemoryStats));
+  for (u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    MemoryTagStats *pTag = &pStats->tags[tag];
+    pTag->hostBytes = atomic_load_explicit(&hostBytes[tag], memory_order_relaxed);
+    pTag->hostPeakBytes = atomic_load_explicit(&hostPeakBytes[tag], memory_order_relaxed);
+    pTag->hostAllocations = atomic_load_explicit(&hostAllocations[tag], memory_order_relaxed);
+  }
+  pStats->vulkanInternalBytes = atomic_load_explicit(&vulkanInternalBytes, memory_order_relaxed);
+
+  pthread_mutex_lock(&deviceMutex);
+  for (u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    pStats->tags[tag].deviceBytes = deviceBytes[tag];
+    pStats->tags[tag].devicePeakBytes = devicePeakBytes[tag];
+  }
+  for (u32 i = 0; i < deviceAllocationCount; i++) {
+    pStats->tags[deviceAllocations[i].tag].deviceAllocations++;
+  }
+  memcpy(pStats->heaps, heapStats, sizeof(MemoryHeapStats) * heapCount);
+  pStats->heapCount = heapCount;
+  pthread_mutex_unlock(&deviceMutex);
+}
+
+u32 memoryReport(void) {
+  MemoryStats stats;
+  memoryGetStats(&stats);
+
+  for (u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    const MemoryTagStats *pTag = &stats.tags[tag];
+    if (pTag->hostPeakBytes > 0 || pTag->devicePeakBytes > 0) {
+      LOG_INFO(LOG_CATEGORY_MEMORY, "%s: peak %.1f KiB host, %.1f MiB device", tagNames[tag],
+               pTag->hostPeakBytes / 1024.0, pTag->devicePeakBytes / (1024.0 * 1024.0));
+    }
+  }
+
+  u32 leaks = 0;
+  for (u32 tag = 0; tag < MEMORY_TAG_COUNT; tag++) {
+    const MemoryTagStats *pTag = &stats.tags[tag];
+    if (pTag->hostAllocations > 0) {
+      LOG_WARN(LOG_CATEGORY_MEMORY, "Leaked %u host allocations (%zu bytes) tagged %s", pTag->hostAllocations, pTag->hostBytes, tagNames[tag]);
+      leaks += pTag->hostAllocations;
+    }
+  }
+
+  pthread_mutex_lock(&deviceMutex);
+  for (u32 i = 0; i < deviceAllocationCount; i++) {
+    LOG_WARN(LOG_CATEGORY_MEMORY, "Leaked %llu bytes of device memory tagged %s",
+             (unsigned long long)deviceAllocations[i].size, tagNames[deviceAllocations[i].tag]);
+    leaks++;
+  }
+  free(deviceAllocations);
+  deviceAllocations = NULL;
+  deviceAllocationCount = 0;
+  deviceAllocationCapacity = 0;
+  pthread_mutex_unlock(&deviceMutex);
+
+  if (leaks == 0) {
+    LOG_INFO(LOG_CATEGORY_MEMORY, "No leaks");
+  }
+  return leaks;
+}
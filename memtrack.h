@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+
+#define MEMORY_MAX_HEAPS VK_MAX_MEMORY_HEAPS
+
+// What an allocation is for. Host allocations are tagged through the
+// memoryAlloc wrappers, device memory through deviceAllocateMemory.
+typedef enum MemoryTag {
+  MEMORY_TAG_SWAPCHAIN = 0, // Per swap chain image arrays and framebuffers, rebuilt on resize
+  MEMORY_TAG_FRAME, // Per frame in flight: command buffers, sync objects, offscreen targets
+  MEMORY_TAG_SCENE, // Objects, transforms, lights, the render queue and culling arrays
+  MEMORY_TAG_GEOMETRY, // Vertex and index buffers and their staging
+  MEMORY_TAG_LIGHTING, // Light lists and cluster buffers
+  MEMORY_TAG_POST, // Bloom chains and exposure
+  MEMORY_TAG_OCCLUSION, // Depth pyramid and indirect draw buffers
+  MEMORY_TAG_CAPTURE, // Readback buffers and rows
+  MEMORY_TAG_IO, // File read buffers until their callback takes them
+  MEMORY_TAG_PIPELINES, // Pipeline cache data
+  MEMORY_TAG_SHADERS, // SPIR-V read from disk
+  MEMORY_TAG_VULKAN, // The driver's host allocations, through memoryVulkanCallbacks
+  MEMORY_TAG_COUNT
+} MemoryTag;
+
+typedef struct MemoryTagStats {
+  size_t hostBytes;
+  size_t hostPeakBytes;
+  u32 hostAllocations; // Live
+  VkDeviceSize deviceBytes;
+  VkDeviceSize devicePeakBytes;
+  u32 deviceAllocations; // Live
+} MemoryTagStats;
+
+typedef struct MemoryHeapStats {
+  VkDeviceSize size;
+  VkDeviceSize usage; // Whole process, or only this engine's without VK_EXT_memory_budget
+  VkDeviceSize budget; // What the process can use without trouble, the heap size without the extension
+  bool deviceLocal;
+} MemoryHeapStats;
+
+typedef struct MemoryStats {
+  MemoryTagStats tags[MEMORY_TAG_COUNT];
+  MemoryHeapStats heaps[MEMORY_MAX_HEAPS];
+  u32 heapCount;
+  size_t vulkanInternalBytes; // Driver allocations it only notifies us of
+} MemoryStats;
+
+// Routes the driver's host allocations through the tracked allocator. Pass
+// to every vkCreate*, vkDestroy*, vkAllocateMemory and vkFreeMemory call.
+extern const VkAllocationCallbacks memoryVulkanCallbacks;
+
+const char *memoryTagName(MemoryTag tag);
+
+// malloc, aligned_alloc, calloc and realloc that count against tag.
+// Blocks must be released with memoryFree, which accepts NULL.
+void *memoryAlloc(size_t size, MemoryTag tag);
+void *memoryAlignedAlloc(size_t alignment, size_t size, MemoryTag tag);
+void *memoryCalloc(size_t count, size_t size, MemoryTag tag);
+void *memoryRealloc(void *pMemory, size_t size, MemoryTag tag);
+void memoryFree(void *pMemory);
+
+// Device memory bookkeeping for deviceAllocateMemory and deviceFreeMemory
+void memoryTrackDevice(VkDeviceMemory memory, VkDeviceSize size, u32 heap, MemoryTag tag);
+void memoryUntrackDevice(VkDeviceMemory memory);
+// Heap sizes, usage and budgets, refreshed once a frame
+void memorySetHeaps(const MemoryHeapStats *heaps, u32 heapCount);
+// Bytes deviceAllocateMemory has handed out from heap
+VkDeviceSize memoryDeviceHeapBytes(u32 heap);
+
+// Thread safe; the totals may be a moment apart from each other
+void memoryGetStats(MemoryStats *pStats);
+
+// Logs peak usage per tag, then every allocation still live as a leak.
+// Call after everything has been released. Returns the number of leaks.
+u32 memoryReport(void);
@@ -0,0 +1,754 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mesh.h"
+#include "meshopt.h"
+
+// Below this a mesh isn't worth another LOD
+#define MESH_MIN_LOD_TRIANGLES 32
+// Fraction of the threshold an LOD has to clear before switching to it
+#define MESH_LOD_HYSTERESIS 0.25f
+// Cache miss ratio the overdraw pass may give up, relative to the cache order
+#define MESH_OVERDRAW_THRESHOLD 1.05f
+// Largest position error half floats may introduce, relative to the mesh's extent
+#define MESH_HALF_POSITION_TOLERANCE (1.0f / 1024.0f)
+
+static void *checkedRealloc(void *p, size_t size) {
+  p = realloc(p, size);
+  if (p == NULL) {
+    printf("Failed to allocate mesh data!\n");
+    exit(25);
+  }
+  return p;
+}
+
+void meshBuffersInit(MeshBuffers *pBuffers) {
+  memset(pBuffers, 0, sizeof(MeshBuffers));
+}
+
+void meshBuffersDestroy(MeshBuffers *pBuffers) {
+  for (u32 i = 0; i < MESH_VERTEX_FORMAT_COUNT; i++) {
+    free(pBuffers->vertices[i]);
+  }
+  free(pBuffers->indices);
+  memset(pBuffers, 0, sizeof(MeshBuffers));
+}
+
+static void appendIndices(MeshBuffers *pBuffers, const u32 *indices, u32 count) {
+  if (pBuffers->indexCount + count > pBuffers->indexCapacity) {
+    u32 capacity = pBuffers->indexCapacity > 0 ? pBuffers->indexCapacity : 1024;
+    while (capacity < pBuffers->indexCount + count) capacity *= 2;
+    pBuffers->indices = checkedRealloc(pBuffers->indices, sizeof(u32) * capacity);
+    pBuffers->indexCapacity = capacity;
+  }
+  memcpy(pBuffers->indices + pBuffers->indexCount, indices, sizeof(u32) * count);
+  pBuffers->indexCount += count;
+}
+
+static void appendVertices(MeshBuffers *pBuffers, MeshVertexFormat format, const void *vertices, u32 count) {
+  u32 stride = meshVertexStride(format);
+  if (pBuffers->vertexCount[format] + count > pBuffers->vertexCapacity[format]) {
+    u32 capacity = pBuffers->vertexCapacity[format] > 0 ? pBuffers->vertexCapacity[format] : 1024;
+    while (capacity < pBuffers->vertexCount[format] + count) capacity *= 2;
+    pBuffers->vertices[format] = checkedRealloc(pBuffers->vertices[format], (size_t)stride * capacity);
+    pBuffers->vertexCapacity[format] = capacity;
+  }
+  memcpy(pBuffers->vertices[format] + (size_t)stride * pBuffers->vertexCount[format], vertices, (size_t)stride * count);
+  pBuffers->vertexCount[format] += count;
+}
+
+void meshAdd(MeshBuffers *pBuffers, const MeshData *pData, Mesh *pMesh) {
+  memset(pMesh, 0, sizeof(Mesh));
+  pMesh->vertexFormat = pData->vertexFormat;
+  pMesh->vertexOffset = (i32)pBuffers->vertexCount[pData->vertexFormat];
+  pMesh->vertexCount = pData->vertexCount;
+  pMesh->radius = pData->radius;
+  memcpy(pMesh->uvOffset, pData->uvOffset, sizeof(pMesh->uvOffset));
+  memcpy(pMesh->uvScale, pData->uvScale, sizeof(pMesh->uvScale));
+  appendVertices(pBuffers, pData->vertexFormat, pData->vertices, pData->vertexCount);
+
+  u32 firstIndex = pBuffers->indexCount;
+  appendIndices(pBuffers, pData->indices, pData->indexCount);
+  for (u32 i = 0; i < pData->lodCount; i++) {
+    pMesh->lods[i] = pData->lods[i];
+    pMesh->lods[i].firstIndex += firstIndex;
+  }
+  pMesh->lodCount = pData->lodCount;
+}
+
+u32 meshVertexStride(MeshVertexFormat format) {
+  return format == MESH_VERTEX_FORMAT_WIDE ? sizeof(MeshWideVertex) : sizeof(MeshPackedVertex);
+}
+
+// Round to nearest even, like the GPU conversions
+static u16 halfFromFloat(float value) {
+  u32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  u32 sign = (bits >> 16) & 0x8000;
+  u32 magnitude = bits & 0x7FFFFFFF;
+
+  if (magnitude >= 0x7F800000) return (u16)(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+  if (magnitude >= 0x477FF000) return (u16)(sign | 0x7C00); // Rounds past 65504
+  if (magnitude < 0x33000000) return (u16)sign; // Rounds to zero
+
+  u32 half, remainder, halfway;
+  if (magnitude < 0x38800000) {
+    // Subnormal half, in units of 2^-24
+    u32 shift = 126 - (magnitude >> 23);
+    u32 mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+    half = mantissa >> shift;
+    remainder = mantissa & ((1u << shift) - 1);
+    halfway = 1u << (shift - 1);
+  } else {
+    u32 rebiased = magnitude - 0x38000000;
+    half = rebiased >> 13;
+    remainder = rebiased & 0x1FFF;
+    halfway = 0x1000;
+  }
+  if (remainder > halfway || (remainder == halfway && (half & 1))) {
+    half++;
+  }
+  return (u16)(sign | half);
+}
+
+static float floatFromHalf(u16 half) {
+  u32 exponent = (half >> 10) & 0x1F;
+  u32 mantissa = half & 0x3FF;
+  float value;
+  if (exponent == 0) {
+    value = mantissa / 16777216.0f;
+  } else if (exponent == 31) {
+    value = mantissa != 0 ? NAN : INFINITY;
+  } else {
+    value = ldexpf(1.0f + mantissa / 1024.0f, (int)exponent - 15);
+  }
+  return (half & 0x8000) ? -value : value;
+}
+
+static i8 snorm8(float value) {
+  value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+  return (i8)lrintf(value * 127.0f);
+}
+
+static u16 unorm16(float value) {
+  value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+  return (u16)lrintf(value * 65535.0f);
+}
+
+static void packNormal(const float *normal, i8 *pPacked) {
+  float length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+  float scale = length > 0.0f ? 1.0f / length : 0.0f;
+  for (u32 k = 0; k < 3; k++) {
+    pPacked[k] = snorm8(normal[k] * scale);
+  }
+  pPacked[3] = 0;
+}
+
+// Half floats keep 11 significant bits, which is plenty unless the mesh
+// sits far from its origin or is very large
+static bool halfPositionsFit(const MeshVertex *vertices, u32 vertexCount) {
+  float min[3] = { INFINITY, INFINITY, INFINITY }, max[3] = { -INFINITY, -INFINITY, -INFINITY };
+  float worst = 0.0f;
+  for (u32 i = 0; i < vertexCount; i++) {
+    for (u32 k = 0; k < 3; k++) {
+      float p = vertices[i].position[k];
+      min[k] = fminf(min[k], p);
+      max[k] = fmaxf(max[k], p);
+      worst = fmaxf(worst, fabsf(floatFromHalf(halfFromFloat(p)) - p));
+    }
+  }
+  float extent = 0.0f;
+  for (u32 k = 0; k < 3; k++) {
+    extent = fmaxf(extent, max[k] - min[k]);
+  }
+  return worst <= extent * MESH_HALF_POSITION_TOLERANCE;
+}
+
+// Offset and scale that map the UVs onto 0..1
+static void uvRange(const MeshVertex *vertices, u32 vertexCount, float *pOffset, float *pScale) {
+  for (u32 k = 0; k < 2; k++) {
+    float min = INFINITY, max = -INFINITY;
+    for (u32 i = 0; i < vertexCount; i++) {
+      min = fminf(min, vertices[i].uv[k]);
+      max = fmaxf(max, vertices[i].uv[k]);
+    }
+    pOffset[k] = vertexCount > 0 ? min : 0.0f;
+    pScale[k] = max > min ? max - min : 1.0f;
+  }
+}
+
+static void *packVertices(const MeshVertex *vertices, u32 vertexCount, MeshVertexFormat format, const float *uvOffset, const float *uvScale) {
+  void *packed = checkedRealloc(NULL, (size_t)meshVertexStride(format) * (vertexCount > 0 ? vertexCount : 1));
+  for (u32 i = 0; i < vertexCount; i++) {
+    const MeshVertex *pVertex = &vertices[i];
+    u16 uv[2];
+    for (u32 k = 0; k < 2; k++) {
+      uv[k] = unorm16((pVertex->uv[k] - uvOffset[k]) / uvScale[k]);
+    }
+    if (format == MESH_VERTEX_FORMAT_WIDE) {
+      MeshWideVertex *pOut = (MeshWideVertex*)packed + i;
+      memcpy(pOut->position, pVertex->position, sizeof(pOut->position));
+      packNormal(pVertex->normal, pOut->normal);
+      memcpy(pOut->uv, uv, sizeof(uv));
+    } else {
+      MeshPackedVertex *pOut = (MeshPackedVertex*)packed + i;
+      for (u32 k = 0; k < 3; k++) {
+        pOut->position[k] = halfFromFloat(pVertex->position[k]);
+      }
+      pOut->position[3] = halfFromFloat(1.0f);
+      packNormal(pVertex->normal, pOut->normal);
+      memcpy(pOut->uv, uv, sizeof(uv));
+    }
+  }
+  return packed;
+}
+
+void meshBuild(const MeshVertex *vertices, u32 vertexCount, const u32 *indices, u32 indexCount, u32 maxLods, bool allowHalfPositions, MeshData *pData) {
+  memset(pData, 0, sizeof(MeshData));
+  if (maxLods > MESH_MAX_LODS) maxLods = MESH_MAX_LODS;
+
+  u32 *lodIndices = checkedRealloc(NULL, sizeof(u32) * (indexCount > 0 ? indexCount : 1));
+  memcpy(lodIndices, indices, sizeof(u32) * indexCount);
+  u32 totalIndices = indexCount;
+  pData->lods[0] = (MeshLod){ .firstIndex = 0, .indexCount = indexCount, .error = 0.0f };
+  pData->lodCount = 1;
+
+  // Every LOD is simplified from the full mesh so errors don't compound
+  u32 *scratch = checkedRealloc(NULL, sizeof(u32) * (indexCount > 0 ? indexCount : 1));
+  while (pData->lodCount < maxLods) {
+    const MeshLod *pPrevious = &pData->lods[pData->lodCount - 1];
+    if (pPrevious->indexCount / 3 < MESH_MIN_LOD_TRIANGLES * 2) break;
+
+    u32 target = pPrevious->indexCount / 6 * 3;
+    float error = 0.0f;
+    u32 count = meshSimplify(scratch, indices, indexCount, vertices, vertexCount, target, &error);
+    if (count == 0 || count > pPrevious->indexCount * 9 / 10) break;
+
+    lodIndices = checkedRealloc(lodIndices, sizeof(u32) * (totalIndices + count));
+    memcpy(lodIndices + totalIndices, scratch, sizeof(u32) * count);
+    pData->lods[pData->lodCount] = (MeshLod){ .firstIndex = totalIndices, .indexCount = count, .error = fmaxf(error, pPrevious->error) };
+    pData->lodCount++;
+    totalIndices += count;
+  }
+  free(scratch);
+
+  for (u32 i = 0; i < pData->lodCount; i++) {
+    u32 *lod = lodIndices + pData->lods[i].firstIndex;
+    meshOptimizeVertexCache(lod, pData->lods[i].indexCount, vertexCount);
+    meshOptimizeOverdraw(lod, pData->lods[i].indexCount, (const float*)vertices, sizeof(MeshVertex), vertexCount, MESH_OVERDRAW_THRESHOLD);
+  }
+
+  // LOD 0 comes first, so the full mesh gets the most compact fetch order
+  u32 *remap = checkedRealloc(NULL, sizeof(u32) * (vertexCount > 0 ? vertexCount : 1));
+  u32 usedCount = meshOptimizeVertexFetch(remap, lodIndices, totalIndices, vertexCount);
+  MeshVertex *ordered = checkedRealloc(NULL, sizeof(MeshVertex) * (usedCount > 0 ? usedCount : 1));
+  for (u32 v = 0; v < vertexCount; v++) {
+    if (remap[v] != UINT32_MAX) ordered[remap[v]] = vertices[v];
+  }
+  free(remap);
+
+  for (u32 i = 0; i < usedCount; i++) {
+    const float *p = ordered[i].position;
+    pData->radius = fmaxf(pData->radius, sqrtf(p[0] * p[0] + p[1] * p[1] + p[2] * p[2]));
+  }
+  pData->vertexFormat = allowHalfPositions && halfPositionsFit(ordered, usedCount) ? MESH_VERTEX_FORMAT_PACKED : MESH_VERTEX_FORMAT_WIDE;
+  uvRange(ordered, usedCount, pData->uvOffset, pData->uvScale);
+  pData->vertices = packVertices(ordered, usedCount, pData->vertexFormat, pData->uvOffset, pData->uvScale);
+  pData->vertexCount = usedCount;
+  pData->indices = lodIndices;
+  pData->indexCount = totalIndices;
+  free(ordered);
+}
+
+void meshDataDestroy(MeshData *pData) {
+  free(pData->vertices);
+  free(pData->indices);
+  memset(pData, 0, sizeof(MeshData));
+}
+
+// Sum of squared distances to a set of planes, weighted by triangle area
+typedef struct Quadric {
+  double a00, a01, a02, a11, a12, a22;
+  double b0, b1, b2;
+  double c;
+  double weight;
+} Quadric;
+
+static void quadricAddPlane(Quadric *pQ, const double n[3], double d, double weight) {
+  pQ->a00 += weight * n[0] * n[0];
+  pQ->a01 += weight * n[0] * n[1];
+  pQ->a02 += weight * n[0] * n[2];
+  pQ->a11 += weight * n[1] * n[1];
+  pQ->a12 += weight * n[1] * n[2];
+  pQ->a22 += weight * n[2] * n[2];
+  pQ->b0 += weight * n[0] * d;
+  pQ->b1 += weight * n[1] * d;
+  pQ->b2 += weight * n[2] * d;
+  pQ->c += weight * d * d;
+  pQ->weight += weight;
+}
+
+static void quadricAdd(Quadric *pQ, const Quadric *pOther) {
+  pQ->a00 += pOther->a00;
+  pQ->a01 += pOther->a01;
+  pQ->a02 += pOther->a02;
+  pQ->a11 += pOther->a11;
+  pQ->a12 += pOther->a12;
+  pQ->a22 += pOther->a22;
+  pQ->b0 += pOther->b0;
+  pQ->b1 += pOther->b1;
+  pQ->b2 += pOther->b2;
+  pQ->c += pOther->c;
+  pQ->weight += pOther->weight;
+}
+
+// Root mean square distance of p to the planes of two quadrics
+static float quadricError(const Quadric *pA, const Quadric *pB, const float p[3]) {
+  double x = p[0], y = p[1], z = p[2];
+  double a00 = pA->a00 + pB->a00, a01 = pA->a01 + pB->a01, a02 = pA->a02 + pB->a02;
+  double a11 = pA->a11 + pB->a11, a12 = pA->a12 + pB->a12, a22 = pA->a22 + pB->a22;
+  double b0 = pA->b0 + pB->b0, b1 = pA->b1 + pB->b1, b2 = pA->b2 + pB->b2;
+  double c = pA->c + pB->c;
+  double weight = pA->weight + pB->weight;
+
+  double error = x * (a00 * x + a01 * y + a02 * z) +
+    y * (a01 * x + a11 * y + a12 * z) +
+    z * (a02 * x + a12 * y + a22 * z) +
+    2.0 * (b0 * x + b1 * y + b2 * z) + c;
+  if (!(error > 0.0) || !(weight > 0.0)) return 0.0f;
+  return (float)sqrt(error / weight);
+}
+
+static void triangleNormal(const float *p0, const float *p1, const float *p2, double n[3]) {
+  double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+  double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+  n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+  n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+  n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+// Bits of the position with -0.0 as 0.0, which a sine or a product with
+// zero easily produces
+static void positionKey(const float *p, u32 bits[3]) {
+  float q[3] = { p[0] + 0.0f, p[1] + 0.0f, p[2] + 0.0f };
+  memcpy(bits, q, sizeof(q));
+}
+
+static u32 hashPosition(const float *p) {
+  u32 bits[3];
+  positionKey(p, bits);
+  u32 h = bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u;
+  return h ^ (h >> 16);
+}
+
+// Maps every vertex to the first one sharing its position, so seams in
+// normals or UVs don't stop collapses across them
+static void weldPositions(const MeshVertex *vertices, u32 vertexCount, u32 *remap) {
+  u32 tableSize = 1;
+  while (tableSize < vertexCount * 2) tableSize *= 2;
+  u32 *table = checkedRealloc(NULL, sizeof(u32) * tableSize);
+  memset(table, 0xFF, sizeof(u32) * tableSize);
+
+  for (u32 i = 0; i < vertexCount; i++) {
+    u32 key[3];
+    positionKey(vertices[i].position, key);
+    u32 slot = hashPosition(vertices[i].position) & (tableSize - 1);
+    for (;;) {
+      u32 existing = table[slot];
+      if (existing == UINT32_MAX) {
+        table[slot] = i;
+        remap[i] = i;
+        break;
+      }
+      u32 existingKey[3];
+      positionKey(vertices[existing].position, existingKey);
+      if (memcmp(existingKey, key, sizeof(key)) == 0) {
+        remap[i] = existing;
+        break;
+      }
+      slot = (slot + 1) & (tableSize - 1);
+    }
+  }
+  free(table);
+}
+
+// Squared distance between two vertices' normals and UVs
+static float attributeDistance(const MeshVertex *pA, const MeshVertex *pB) {
+  float d = 0.0f;
+  for (u32 i = 0; i < 3; i++) d += (pA->normal[i] - pB->normal[i]) * (pA->normal[i] - pB->normal[i]);
+  for (u32 i = 0; i < 2; i++) d += (pA->uv[i] - pB->uv[i]) * (pA->uv[i] - pB->uv[i]);
+  return d;
+}
+
+// Of the vertices welded to the one at to, returns the one whose
+// attributes are closest to vertex's.
+static u32 nearestWedge(const MeshVertex *vertices, const u32 *nextWedge, u32 vertex, u32 to) {
+  u32 best = to;
+  float bestDistance = INFINITY;
+  for (u32 w = to; w != UINT32_MAX; w = nextWedge[w]) {
+    float d = attributeDistance(&vertices[vertex], &vertices[w]);
+    if (d < bestDistance) {
+      best = w;
+      bestDistance = d;
+    }
+  }
+  return best;
+}
+
+static int compareU64(const void *a, const void *b) {
+  u64 x = *(const u64*)a, y = *(const u64*)b;
+  return (x > y) - (x < y);
+}
+
+// Collapsing an open edge would eat into the hole, so its vertices stay put
+static void lockBoundaries(const u32 *indices, u32 indexCount, const u32 *remap, bool *locked) {
+  u64 *edges = checkedRealloc(NULL, sizeof(u64) * (indexCount > 0 ? indexCount : 1));
+  u32 edgeCount = 0;
+  for (u32 i = 0; i < indexCount; i += 3) {
+    for (u32 k = 0; k < 3; k++) {
+      u32 a = remap[indices[i + k]], b = remap[indices[i + (k + 1) % 3]];
+      if (a == b) continue;
+      u32 lo = a < b ? a : b, hi = a < b ? b : a;
+      edges[edgeCount++] = (u64)lo << 32 | hi;
+    }
+  }
+  qsort(edges, edgeCount, sizeof(u64), compareU64);
+  for (u32 i = 0; i < edgeCount;) {
+    u32 j = i + 1;
+    while (j < edgeCount && edges[j] == edges[i]) j++;
+    if (j - i == 1) {
+      locked[edges[i] >> 32] = true;
+      locked[edges[i] & 0xFFFFFFFF] = true;
+    }
+    i = j;
+  }
+  free(edges);
+}
+
+typedef struct Collapse {
+  u32 from;
+  u32 to;
+  float error;
+} Collapse;
+
+static int compareCollapses(const void *a, const void *b) {
+  float x = ((const Collapse*)a)->error, y = ((const Collapse*)b)->error;
+  return (x > y) - (x < y);
+}
+
+typedef struct Simplifier {
+  const MeshVertex *vertices;
+  const u32 *remap;
+  u32 *indices;
+  u32 *adjacencyOffsets; // Triangles around each welded vertex, CSR
+  u32 *adjacency;
+  u32 *marks; // Scratch stamps per welded vertex
+  u32 stamp;
+} Simplifier;
+
+static void buildAdjacency(Simplifier *pS, u32 indexCount, u32 vertexCount) {
+  memset(pS->adjacencyOffsets, 0, sizeof(u32) * (vertexCount + 1));
+  for (u32 i = 0; i < indexCount; i++) {
+    pS->adjacencyOffsets[pS->remap[pS->indices[i]] + 1]++;
+  }
+  for (u32 v = 0; v < vertexCount; v++) {
+    pS->adjacencyOffsets[v + 1] += pS->adjacencyOffsets[v];
+  }
+  // Filling advances each start to the next run's start, shift them back
+  for (u32 i = 0; i < indexCount; i++) {
+    pS->adjacency[pS->adjacencyOffsets[pS->remap[pS->indices[i]]]++] = i / 3;
+  }
+  for (u32 v = vertexCount; v > 0; v--) {
+    pS->adjacencyOffsets[v] = pS->adjacencyOffsets[v - 1];
+  }
+  pS->adjacencyOffsets[0] = 0;
+}
+
+// The edge may only have as many common neighbours as triangles on it,
+// anything else folds the surface onto itself
+static bool collapseKeepsManifold(Simplifier *pS, u32 from, u32 to) {
+  u32 mark = pS->stamp += 2;
+  for (u32 a = pS->adjacencyOffsets[to]; a < pS->adjacencyOffsets[to + 1]; a++) {
+    u32 t = pS->adjacency[a];
+    for (u32 k = 0; k < 3; k++) {
+      pS->marks[pS->remap[pS->indices[t * 3 + k]]] = mark;
+    }
+  }
+
+  u32 common = 0, shared = 0;
+  for (u32 a = pS->adjacencyOffsets[from]; a < pS->adjacencyOffsets[from + 1]; a++) {
+    u32 t = pS->adjacency[a];
+    bool hasTo = false;
+    for (u32 k = 0; k < 3; k++) {
+      u32 v = pS->remap[pS->indices[t * 3 + k]];
+      if (v == to) hasTo = true;
+      if (v == from || v == to || pS->marks[v] != mark) continue;
+      pS->marks[v] = mark + 1;
+      common++;
+    }
+    shared += hasTo;
+  }
+  return common == shared;
+}
+
+// Moving from onto to must not turn any remaining triangle around from over
+static bool collapseFlips(const Simplifier *pS, u32 from, u32 to, u32 adjacencyStart, u32 adjacencyEnd) {
+  const float *target = pS->vertices[to].position;
+  for (u32 a = adjacencyStart; a < adjacencyEnd; a++) {
+    u32 t = pS->adjacency[a];
+    u32 c[3] = { pS->remap[pS->indices[t * 3]], pS->remap[pS->indices[t * 3 + 1]], pS->remap[pS->indices[t * 3 + 2]] };
+    if (c[0] == to || c[1] == to || c[2] == to) continue; // Removed by the collapse
+
+    const float *p[3], *q[3];
+    for (u32 k = 0; k < 3; k++) {
+      p[k] = pS->vertices[c[k]].position;
+      q[k] = c[k] == from ? target : p[k];
+    }
+    double before[3], after[3];
+    triangleNormal(p[0], p[1], p[2], before);
+    triangleNormal(q[0], q[1], q[2], after);
+    if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A vertex on a seam may only move along it: each of its copies still in
+// use needs a triangle on the edge to tell which copy of to it becomes
+static bool collapseKeepsSeams(const Simplifier *pS, const u32 *nextWedge, u32 from, u32 to, u32 adjacencyStart, u32 adjacencyEnd) {
+  if (nextWedge[from] == UINT32_MAX) return true;
+  for (u32 w = from; w != UINT32_MAX; w = nextWedge[w]) {
+    bool used = false, paired = false;
+    for (u32 a = adjacencyStart; a < adjacencyEnd && !paired; a++) {
+      const u32 *corners = &pS->indices[pS->adjacency[a] * 3];
+      if (corners[0] != w && corners[1] != w && corners[2] != w) continue;
+      used = true;
+      paired = pS->remap[corners[0]] == to || pS->remap[corners[1]] == to || pS->remap[corners[2]] == to;
+    }
+    if (used && !paired) return false;
+  }
+  return true;
+}
+
+u32 meshSimplify(u32 *pDestination, const u32 *indices, u32 indexCount, const MeshVertex *vertices, u32 vertexCount, u32 targetIndexCount, float *pError) {
+  *pError = 0.0f;
+  memcpy(pDestination, indices, sizeof(u32) * indexCount);
+  if (indexCount <= targetIndexCount || vertexCount == 0) {
+    return indexCount;
+  }
+
+  u32 *remap = checkedRealloc(NULL, sizeof(u32) * vertexCount);
+  u32 *collapseTo = checkedRealloc(NULL, sizeof(u32) * vertexCount);
+  u32 *nextWedge = checkedRealloc(NULL, sizeof(u32) * vertexCount); // Chains the vertices sharing a welded position
+  u32 *wedgeTo = checkedRealloc(NULL, sizeof(u32) * vertexCount);
+  bool *locked = calloc(vertexCount, sizeof(bool));
+  bool *touched = calloc(vertexCount, sizeof(bool));
+  Quadric *quadrics = calloc(vertexCount, sizeof(Quadric));
+  Collapse *collapses = checkedRealloc(NULL, sizeof(Collapse) * indexCount);
+  Simplifier s = {
+    .vertices = vertices,
+    .remap = remap,
+    .indices = pDestination,
+    .adjacencyOffsets = checkedRealloc(NULL, sizeof(u32) * (vertexCount + 1)),
+    .adjacency = checkedRealloc(NULL, sizeof(u32) * indexCount),
+    .marks = calloc(vertexCount, sizeof(u32))
+  };
+  if (locked == NULL || touched == NULL || quadrics == NULL || s.marks == NULL) {
+    printf("Failed to allocate mesh data!\n");
+    exit(25);
+  }
+
+  weldPositions(vertices, vertexCount, remap);
+  lockBoundaries(pDestination, indexCount, remap, locked);
+  for (u32 v = 0; v < vertexCount; v++) {
+    collapseTo[v] = v;
+    wedgeTo[v] = UINT32_MAX;
+    nextWedge[v] = UINT32_MAX;
+    if (remap[v] != v) {
+      nextWedge[v] = nextWedge[remap[v]];
+      nextWedge[remap[v]] = v;
+    }
+  }
+
+  for (u32 i = 0; i < indexCount; i += 3) {
+    u32 c[3] = { remap[pDestination[i]], remap[pDestination[i + 1]], remap[pDestination[i + 2]] };
+    double n[3];
+    triangleNormal(vertices[c[0]].position, vertices[c[1]].position, vertices[c[2]].position, n);
+    double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length == 0.0) continue;
+    n[0] /= length, n[1] /= length, n[2] /= length;
+    const float *p = vertices[c[0]].position;
+    double d = -(n[0] * p[0] + n[1] * p[1] + n[2] * p[2]);
+    for (u32 k = 0; k < 3; k++) {
+      quadricAddPlane(&quadrics[c[k]], n, d, length * 0.5);
+    }
+  }
+
+  // Each pass collapses a batch of independent edges, cheapest first
+  while (indexCount > targetIndexCount) {
+    buildAdjacency(&s, indexCount, vertexCount);
+
+    u32 collapseCount = 0;
+    for (u32 i = 0; i < indexCount; i += 3) {
+      for (u32 k = 0; k < 3; k++) {
+        u32 a = remap[pDestination[i + k]], b = remap[pDestination[i + (k + 1) % 3]];
+        if (a == b) continue;
+        float ab = locked[a] ? INFINITY : quadricError(&quadrics[a], &quadrics[b], vertices[b].position);
+        float ba = locked[b] ? INFINITY : quadricError(&quadrics[a], &quadrics[b], vertices[a].position);
+        if (ab == INFINITY && ba == INFINITY) continue;
+        collapses[collapseCount++] = ab <= ba ? (Collapse){ a, b, ab } : (Collapse){ b, a, ba };
+      }
+    }
+    qsort(collapses, collapseCount, sizeof(Collapse), compareCollapses);
+
+    // A collapse removes about two triangles
+    u32 wanted = (indexCount - targetIndexCount) / 6 + 1;
+    u32 applied = 0;
+    for (u32 i = 0; i < collapseCount && applied < wanted; i++) {
+      Collapse *pCollapse = &collapses[i];
+      u32 from = pCollapse->from, to = pCollapse->to;
+      if (touched[from] || touched[to]) continue;
+
+      u32 start = s.adjacencyOffsets[from], end = s.adjacencyOffsets[from + 1];
+      if (!collapseKeepsManifold(&s, from, to) || !collapseKeepsSeams(&s, nextWedge, from, to, start, end) ||
+          collapseFlips(&s, from, to, start, end)) continue;
+
+      collapseTo[from] = to;
+      quadricAdd(&quadrics[to], &quadrics[from]);
+      if (pCollapse->error > *pError) *pError = pCollapse->error;
+      applied++;
+
+      // Neighbours keep their positions for the rest of the pass, so the
+      // flip checks above stay valid
+      for (u32 a = start; a < end; a++) {
+        u32 t = s.adjacency[a];
+        for (u32 k = 0; k < 3; k++) {
+          touched[remap[pDestination[t * 3 + k]]] = true;
+        }
+      }
+    }
+    if (applied == 0) break;
+
+    // Every vertex that moves keeps to its side of UV and normal seams: a
+    // triangle on the collapsed edge pairs it with the target vertex in the
+    // same chart. Off the edge, the target vertex with the closest
+    // attributes stands in.
+    for (u32 i = 0; i < indexCount; i += 3) {
+      for (u32 k = 0; k < 3; k++) {
+        u32 corner = pDestination[i + k];
+        u32 to = collapseTo[remap[corner]];
+        if (to == remap[corner] || wedgeTo[corner] != UINT32_MAX) continue;
+        for (u32 j = 1; j < 3; j++) {
+          u32 other = pDestination[i + (k + j) % 3];
+          if (remap[other] == to) wedgeTo[corner] = other;
+        }
+      }
+    }
+
+    u32 kept = 0;
+    for (u32 i = 0; i < indexCount; i += 3) {
+      u32 corner[3];
+      u32 c[3];
+      for (u32 k = 0; k < 3; k++) {
+        corner[k] = pDestination[i + k];
+        c[k] = remap[corner[k]];
+        if (collapseTo[c[k]] != c[k]) {
+          if (wedgeTo[corner[k]] == UINT32_MAX) {
+            wedgeTo[corner[k]] = nearestWedge(vertices, nextWedge, corner[k], collapseTo[c[k]]);
+          }
+          corner[k] = wedgeTo[corner[k]];
+          c[k] = collapseTo[c[k]];
+        }
+      }
+      if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) continue;
+      pDestination[kept++] = corner[0];
+      pDestination[kept++] = corner[1];
+      pDestination[kept++] = corner[2];
+    }
+    indexCount = kept;
+
+    for (u32 v = 0; v < vertexCount; v++) {
+      collapseTo[v] = v;
+      wedgeTo[v] = UINT32_MAX;
+      touched[v] = false;
+    }
+  }
+
+  free(remap);
+  free(collapseTo);
+  free(nextWedge);
+  free(wedgeTo);
+  free(locked);
+  free(touched);
+  free(quadrics);
+  free(collapses);
+  free(s.adjacencyOffsets);
+  free(s.adjacency);
+  free(s.marks);
+  return indexCount;
+}
+
+u32 meshSelectLod(const Mesh *pMesh, float scale, float distance, float pixelsPerUnit, float thresholdPixels, u32 currentLod) {
+  if (pMesh->lodCount <= 1 || !(thresholdPixels > 0.0f)) return 0;
+  if (currentLod >= pMesh->lodCount) currentLod = pMesh->lodCount - 1;
+  if (distance < 1e-3f) distance = 1e-3f;
+
+  float pixelsPerError = scale * pixelsPerUnit / distance;
+  bool currentFine = pMesh->lods[currentLod].error * pixelsPerError <= thresholdPixels * (1.0f + MESH_LOD_HYSTERESIS);
+  bool coarserFine = currentLod + 1 < pMesh->lodCount &&
+    pMesh->lods[currentLod + 1].error * pixelsPerError <= thresholdPixels * (1.0f - MESH_LOD_HYSTERESIS);
+  if (currentFine && !coarserFine) {
+    return currentLod;
+  }
+
+  u32 lod = 0;
+  for (u32 i = 1; i < pMesh->lodCount; i++) {
+    if (pMesh->lods[i].error * pixelsPerError <= thresholdPixels) lod = i;
+  }
+  return lod;
+}
+
+void meshGenerateSphere(u32 rings, u32 segments, MeshVertex *pVertices, u32 *pVertexCount, u32 *pIndices, u32 *pIndexCount) {
+  // The first and last rings are fans with one triangle per segment
+  *pVertexCount = (rings + 1) * (segments + 1);
+  *pIndexCount = (rings - 1) * segments * 6;
+  if (pVertices == NULL || pIndices == NULL) return;
+
+  const float pi = 3.14159265358979f;
+  for (u32 r = 0; r <= rings; r++) {
+    float theta = pi * r / rings;
+    // Exact poles and seam so the duplicated vertices weld back together
+    float y = cosf(theta), radius = r == 0 || r == rings ? 0.0f : sinf(theta);
+    for (u32 s = 0; s <= segments; s++) {
+      float phi = 2.0f * pi * (s % segments) / segments;
+      MeshVertex *pVertex = &pVertices[r * (segments + 1) + s];
+      pVertex->position[0] = radius * sinf(phi);
+      pVertex->position[1] = y;
+      pVertex->position[2] = radius * cosf(phi);
+      memcpy(pVertex->normal, pVertex->position, sizeof(pVertex->normal));
+      pVertex->uv[0] = (float)s / segments;
+      pVertex->uv[1] = (float)r / rings;
+    }
+  }
+
+  u32 count = 0;
+  for (u32 r = 0; r < rings; r++) {
+    for (u32 s = 0; s < segments; s++) {
+      u32 a = r * (segments + 1) + s, b = a + 1;
+      u32 c = a + segments + 1, d = c + 1;
+      if (r > 0) {
+        pIndices[count++] = a;
+        pIndices[count++] = c;
+        pIndices[count++] = b;
+      }
+      if (r + 1 < rings) {
+        pIndices[count++] = b;
+        pIndices[count++] = c;
+        pIndices[count++] = d;
+      }
+    }
+  }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+#define MESH_MAX_LODS 8
+
+// What importers and generators produce, before packing
+typedef struct MeshVertex {
+  float position[3];
+  float normal[3];
+  float uv[2];
+} MeshVertex;
+
+// Vertex layouts meshes are stored and drawn in
+typedef enum MeshVertexFormat {
+  MESH_VERTEX_FORMAT_PACKED = 0, // MeshPackedVertex
+  MESH_VERTEX_FORMAT_WIDE, // MeshWideVertex, for meshes half floats can't place precisely enough
+  MESH_VERTEX_FORMAT_COUNT
+} MeshVertexFormat;
+
+typedef struct MeshPackedVertex {
+  u16 position[4]; // Half floats, w is 1
+  i8 normal[4]; // Snorm, w is 0
+  u16 uv[2]; // Unorm over the mesh's UV range, see Mesh.uvOffset
+} MeshPackedVertex;
+
+typedef struct MeshWideVertex {
+  float position[3];
+  i8 normal[4]; // Snorm, w is 0
+  u16 uv[2]; // Unorm over the mesh's UV range, see Mesh.uvOffset
+} MeshWideVertex;
+
+typedef struct MeshLod {
+  u32 firstIndex; // Into MeshBuffers.indices
+  u32 indexCount;
+  float error; // Object space distance the surface may be off by
+} MeshLod;
+
+// Every LOD indexes the same vertices; only the index ranges differ
+typedef struct Mesh {
+  MeshVertexFormat vertexFormat;
+  i32 vertexOffset; // Into MeshBuffers.vertices[vertexFormat], added to every index
+  u32 vertexCount;
+  float radius; // Bounding sphere around the origin
+  float uvOffset[2]; // uv = packed uv * uvScale + uvOffset
+  float uvScale[2];
+  MeshLod lods[MESH_MAX_LODS]; // Finest first, errors never decrease
+  u32 lodCount;
+} Mesh;
+
+// One mesh ready to draw: packed vertices and the indices of every LOD.
+// This is what the cooker writes to disk.
+typedef struct MeshData {
+  MeshVertexFormat vertexFormat;
+  void *vertices;
+  u32 vertexCount;
+  u32 *indices;
+  u32 indexCount;
+  MeshLod lods[MESH_MAX_LODS]; // firstIndex is into indices
+  u32 lodCount;
+  float radius;
+  float uvOffset[2]; // As in Mesh
+  float uvScale[2];
+} MeshData;
+
+// Geometry of every mesh, one vertex buffer per format and one index buffer
+typedef struct MeshBuffers {
+  u8 *vertices[MESH_VERTEX_FORMAT_COUNT];
+  u32 vertexCount[MESH_VERTEX_FORMAT_COUNT];
+  u32 vertexCapacity[MESH_VERTEX_FORMAT_COUNT];
+  u32 *indices;
+  u32 indexCount;
+  u32 indexCapacity;
+} MeshBuffers;
+
+u32 meshVertexStride(MeshVertexFormat format);
+
+// Builds up to maxLods - 1 simplified versions of a mesh, each aiming for
+// half the triangles of the one before, and stops early when simplification
+// stops making progress. Every LOD is then ordered for the vertex cache and
+// overdraw, vertices are numbered in fetch order and packed. Positions are
+// stored as half floats unless that would move them by more than a small
+// fraction of the mesh's size or allowHalfPositions is false. UVs are
+// quantized over the mesh's UV bounds, so tiled and wrapped UVs keep their
+// range.
+void meshBuild(const MeshVertex *vertices, u32 vertexCount, const u32 *indices, u32 indexCount, u32 maxLods, bool allowHalfPositions, MeshData *pData);
+void meshDataDestroy(MeshData *pData);
+
+void meshBuffersInit(MeshBuffers *pBuffers);
+void meshBuffersDestroy(MeshBuffers *pBuffers);
+void meshAdd(MeshBuffers *pBuffers, const MeshData *pData, Mesh *pMesh);
+
+// Quadric error edge collapse. Vertices only ever collapse onto a neighbour,
+// so the result indexes the same vertex array, and UV and normal seams
+// only move along themselves. pDestination needs room for
+// indexCount indices. Returns the new index count and sets pError to the
+// largest error introduced, in the units of the positions.
+u32 meshSimplify(u32 *pDestination, const u32 *indices, u32 indexCount, const MeshVertex *vertices, u32 vertexCount, u32 targetIndexCount, float *pError);
+
+// Picks the coarsest LOD whose error projects to at most thresholdPixels.
+// Keeps currentLod while it stays within a band around the threshold so
+// objects near a switching distance don't flicker between LODs.
+// pixelsPerUnit is the projected size of one unit at a distance of one.
+u32 meshSelectLod(const Mesh *pMesh, float scale, float distance, float pixelsPerUnit, float thresholdPixels, u32 currentLod);
+
+// A unit UV sphere, counter-clockwise seen from outside. Returns the counts
+// when pVertices and pIndices are NULL.
+void meshGenerateSphere(u32 rings, u32 segments, MeshVertex *pVertices, u32 *pVertexCount, u32 *pIndices, u32 *pIndexCount);
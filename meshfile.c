@@ -0,0 +1,93 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meshfile.h"
+
+bool meshFileWrite(const char *path, const MeshData *pData) {
+  MeshFileHeader header = {
+    .magic = MESH_FILE_MAGIC,
+    .version = MESH_FILE_VERSION,
+    .vertexFormat = pData->vertexFormat,
+    .vertexCount = pData->vertexCount,
+    .indexCount = pData->indexCount,
+    .lodCount = pData->lodCount,
+    .radius = pData->radius
+  };
+  memcpy(header.uvOffset, pData->uvOffset, sizeof(header.uvOffset));
+  memcpy(header.uvScale, pData->uvScale, sizeof(header.uvScale));
+  memcpy(header.lods, pData->lods, sizeof(header.lods));
+
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) return false;
+  size_t vertexSize = (size_t)meshVertexStride(pData->vertexFormat) * pData->vertexCount;
+  bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+    (vertexSize == 0 || fwrite(pData->vertices, vertexSize, 1, file) == 1) &&
+    (pData->indexCount == 0 || fwrite(pData->indices, sizeof(u32) * pData->indexCount, 1, file) == 1);
+  return fclose(file) == 0 && written;
+}
+
+bool meshFileParse(const void *bytes, size_t size, MeshData *pData) {
+  memset(pData, 0, sizeof(MeshData));
+  MeshFileHeader header;
+  if (size < sizeof(header)) return false;
+  memcpy(&header, bytes, sizeof(header));
+  if (header.magic != MESH_FILE_MAGIC || header.version != MESH_FILE_VERSION ||
+      header.vertexFormat >= MESH_VERTEX_FORMAT_COUNT || header.lodCount == 0 || header.lodCount > MESH_MAX_LODS) {
+    return false;
+  }
+  for (u32 k = 0; k < 2; k++) {
+    if (!isfinite(header.uvOffset[k]) || !isfinite(header.uvScale[k]) || !(header.uvScale[k] > 0.0f)) return false;
+  }
+
+  size_t vertexSize = (size_t)meshVertexStride((MeshVertexFormat)header.vertexFormat) * header.vertexCount;
+  size_t indexSize = sizeof(u32) * (size_t)header.indexCount;
+  if (size != sizeof(header) + vertexSize + indexSize) return false;
+  for (u32 i = 0; i < header.lodCount; i++) {
+    const MeshLod *pLod = &header.lods[i];
+    if ((u64)pLod->firstIndex + pLod->indexCount > header.indexCount) return false;
+    if (pLod->firstIndex % 3 != 0 || pLod->indexCount % 3 != 0) return false;
+  }
+
+  const u8 *indexBytes = (const u8*)bytes + sizeof(header) + vertexSize;
+  for (u32 i = 0; i < header.indexCount; i++) {
+    u32 index;
+    memcpy(&index, indexBytes + sizeof(u32) * i, sizeof(index));
+    if (index >= header.vertexCount) return false;
+  }
+
+  pData->vertices = malloc(vertexSize > 0 ? vertexSize : 1);
+  pData->indices = malloc(indexSize > 0 ? indexSize : 1);
+  if (pData->vertices == NULL || pData->indices == NULL) {
+    meshDataDestroy(pData);
+    return false;
+  }
+  memcpy(pData->vertices, (const u8*)bytes + sizeof(header), vertexSize);
+  memcpy(pData->indices, indexBytes, indexSize);
+  pData->vertexFormat = (MeshVertexFormat)header.vertexFormat;
+  pData->vertexCount = header.vertexCount;
+  pData->indexCount = header.indexCount;
+  pData->lodCount = header.lodCount;
+  pData->radius = header.radius;
+  memcpy(pData->uvOffset, header.uvOffset, sizeof(pData->uvOffset));
+  memcpy(pData->uvScale, header.uvScale, sizeof(pData->uvScale));
+  memcpy(pData->lods, header.lods, sizeof(pData->lods));
+  return true;
+}
+
+bool meshFileRead(const char *path, MeshData *pData) {
+  memset(pData, 0, sizeof(MeshData));
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+
+  void *bytes = size > 0 ? malloc(size) : NULL;
+  bool read = bytes != NULL && fread(bytes, size, 1, file) == 1;
+  fclose(file);
+  bool parsed = read && meshFileParse(bytes, size, pData);
+  free(bytes);
+  return parsed;
+}
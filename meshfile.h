@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+#include "mesh.h"
+
+#define MESH_FILE_MAGIC 0x4853454Du // "MESH"
+#define MESH_FILE_VERSION 2
+
+// A cooked mesh is this header, the packed vertices and then the indices,
+// all little endian and laid out exactly as they are uploaded.
+typedef struct MeshFileHeader {
+  u32 magic;
+  u32 version;
+  u32 vertexFormat; // MeshVertexFormat
+  u32 vertexCount;
+  u32 indexCount;
+  u32 lodCount;
+  float radius;
+  float uvOffset[2];
+  float uvScale[2];
+  u32 reserved;
+  MeshLod lods[MESH_MAX_LODS];
+} MeshFileHeader;
+
+bool meshFileWrite(const char *path, const MeshData *pData);
+
+// Checks the header and every LOD range against the data, and that the
+// ranges hold whole triangles. On failure returns false and leaves pData
+// empty.
+bool meshFileParse(const void *bytes, size_t size, MeshData *pData);
+bool meshFileRead(const char *path, MeshData *pData);
@@ -0,0 +1,292 @@
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meshopt.h"
+
+static void *checkedCalloc(size_t count, size_t size) {
+  void *p = calloc(count > 0 ? count : 1, size);
+  if (p == NULL) {
+    printf("Failed to allocate mesh data!\n");
+    exit(25);
+  }
+  return p;
+}
+
+// Triangles around every vertex
+typedef struct Adjacency {
+  u32 *offsets; // vertexCount + 1 entries
+  u32 *triangles;
+} Adjacency;
+
+static void buildAdjacency(Adjacency *pAdjacency, const u32 *indices, u32 indexCount, u32 vertexCount) {
+  pAdjacency->offsets = checkedCalloc(vertexCount + 1, sizeof(u32));
+  pAdjacency->triangles = checkedCalloc(indexCount, sizeof(u32));
+  for (u32 i = 0; i < indexCount; i++) {
+    pAdjacency->offsets[indices[i] + 1]++;
+  }
+  for (u32 v = 0; v < vertexCount; v++) {
+    pAdjacency->offsets[v + 1] += pAdjacency->offsets[v];
+  }
+  for (u32 i = 0; i < indexCount; i++) {
+    pAdjacency->triangles[pAdjacency->offsets[indices[i]]++] = i / 3;
+  }
+  // Filling advanced each start to the next run's start, shift them back
+  for (u32 v = vertexCount; v > 0; v--) {
+    pAdjacency->offsets[v] = pAdjacency->offsets[v - 1];
+  }
+  pAdjacency->offsets[0] = 0;
+}
+
+static void destroyAdjacency(Adjacency *pAdjacency) {
+  free(pAdjacency->offsets);
+  free(pAdjacency->triangles);
+}
+
+typedef struct Tipsify {
+  const u32 *live; // Triangles left to emit around each vertex
+  const u32 *timestamps; // When each vertex last entered the cache
+  u32 time;
+  u32 *deadEnd; // Recently used vertices, to restart from
+  u32 deadEndCount;
+  u32 cursor; // Lowest vertex that may still have triangles left
+  u32 vertexCount;
+} Tipsify;
+
+// Prefers the candidate that stays in the cache for all its remaining
+// triangles and entered it earliest, so it is used before it is evicted
+static i64 nextVertex(Tipsify *pT, const u32 *candidates, u32 candidateCount) {
+  i64 best = -1;
+  i64 bestPriority = -1;
+  for (u32 i = 0; i < candidateCount; i++) {
+    u32 v = candidates[i];
+    if (pT->live[v] == 0) continue;
+    i64 priority = 0;
+    if (pT->time - pT->timestamps[v] + 2 * pT->live[v] <= MESHOPT_CACHE_SIZE) {
+      priority = pT->time - pT->timestamps[v];
+    }
+    if (priority > bestPriority) {
+      best = v;
+      bestPriority = priority;
+    }
+  }
+  if (best >= 0) return best;
+
+  while (pT->deadEndCount > 0) {
+    u32 v = pT->deadEnd[--pT->deadEndCount];
+    if (pT->live[v] > 0) return v;
+  }
+  while (pT->cursor < pT->vertexCount) {
+    if (pT->live[pT->cursor] > 0) return pT->cursor;
+    pT->cursor++;
+  }
+  return -1;
+}
+
+void meshOptimizeVertexCache(u32 *indices, u32 indexCount, u32 vertexCount) {
+  u32 triangleCount = indexCount / 3;
+  if (triangleCount < 2) return;
+
+  Adjacency adjacency;
+  buildAdjacency(&adjacency, indices, indexCount, vertexCount);
+  u32 *live = checkedCalloc(vertexCount, sizeof(u32));
+  u32 *timestamps = checkedCalloc(vertexCount, sizeof(u32));
+  u32 *candidates = checkedCalloc(indexCount, sizeof(u32));
+  u32 *output = checkedCalloc(indexCount, sizeof(u32));
+  bool *emitted = checkedCalloc(triangleCount, sizeof(bool));
+  for (u32 v = 0; v < vertexCount; v++) {
+    live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+  }
+
+  Tipsify t = {
+    .live = live,
+    .timestamps = timestamps,
+    .time = MESHOPT_CACHE_SIZE + 1,
+    .deadEnd = checkedCalloc(indexCount, sizeof(u32)),
+    .vertexCount = vertexCount
+  };
+  u32 outputCount = 0;
+
+  // Emit every triangle around the current vertex, then move to a neighbour
+  for (i64 current = indices[0]; current >= 0;) {
+    u32 candidateCount = 0;
+    for (u32 a = adjacency.offsets[current]; a < adjacency.offsets[current + 1]; a++) {
+      u32 triangle = adjacency.triangles[a];
+      if (emitted[triangle]) continue;
+      emitted[triangle] = true;
+
+      for (u32 k = 0; k < 3; k++) {
+        u32 v = indices[triangle * 3 + k];
+        output[outputCount++] = v;
+        t.deadEnd[t.deadEndCount++] = v;
+        candidates[candidateCount++] = v;
+        live[v]--;
+        if (t.time - timestamps[v] > MESHOPT_CACHE_SIZE) {
+          timestamps[v] = t.time++;
+        }
+      }
+    }
+    current = nextVertex(&t, candidates, candidateCount);
+  }
+
+  memcpy(indices, output, sizeof(u32) * outputCount);
+
+  destroyAdjacency(&adjacency);
+  free(live);
+  free(timestamps);
+  free(candidates);
+  free(output);
+  free(emitted);
+  free(t.deadEnd);
+}
+
+typedef struct Cluster {
+  u32 firstTriangle;
+  u32 triangleCount;
+  float sortKey; // Higher draws first
+  u32 order; // Keeps the sort stable
+} Cluster;
+
+static int compareClusters(const void *a, const void *b) {
+  const Cluster *x = a, *y = b;
+  if (x->sortKey != y->sortKey) return x->sortKey < y->sortKey ? 1 : -1;
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+static const float *vertexPosition(const float *positions, u32 stride, u32 v) {
+  return (const float*)((const u8*)positions + (size_t)v * stride);
+}
+
+// Area weighted centroid and normal (length twice the area) of a triangle range
+static void clusterShape(const u32 *indices, u32 firstTriangle, u32 triangleCount, const float *positions, u32 stride, double centroid[3], double normal[3], double *pArea) {
+  double weightedCentroid[3] = { 0.0, 0.0, 0.0 };
+  double area = 0.0;
+  normal[0] = normal[1] = normal[2] = 0.0;
+  for (u32 t = firstTriangle; t < firstTriangle + triangleCount; t++) {
+    const float *p0 = vertexPosition(positions, stride, indices[t * 3]);
+    const float *p1 = vertexPosition(positions, stride, indices[t * 3 + 1]);
+    const float *p2 = vertexPosition(positions, stride, indices[t * 3 + 2]);
+    double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+    double triangleArea = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]) * 0.5;
+    for (u32 k = 0; k < 3; k++) {
+      weightedCentroid[k] += (p0[k] + p1[k] + p2[k]) / 3.0 * triangleArea;
+      normal[k] += n[k];
+    }
+    area += triangleArea;
+  }
+  for (u32 k = 0; k < 3; k++) {
+    centroid[k] = area > 0.0 ? weightedCentroid[k] / area : 0.0;
+  }
+  *pArea = area;
+}
+
+void meshOptimizeOverdraw(u32 *indices, u32 indexCount, const float *positions, u32 positionStride, u32 vertexCount, float threshold) {
+  u32 triangleCount = indexCount / 3;
+  if (triangleCount < 2) return;
+
+  // A cluster ends where the cache order already had to jump (no vertex of
+  // the next triangle cached), or where its miss ratio starting from a cold
+  // cache is close enough to the whole list's that moving it costs little
+  float meshRatio = meshCacheMissRatio(indices, indexCount, vertexCount);
+  Cluster *clusters = checkedCalloc(triangleCount, sizeof(Cluster));
+  u32 *timestamps = checkedCalloc(vertexCount, sizeof(u32));
+  bool *hardEnds = checkedCalloc(triangleCount, sizeof(bool));
+  u32 time = MESHOPT_CACHE_SIZE + 1;
+  for (u32 t = 0; t < triangleCount; t++) {
+    u32 misses = 0;
+    for (u32 k = 0; k < 3; k++) {
+      u32 v = indices[t * 3 + k];
+      if (time - timestamps[v] > MESHOPT_CACHE_SIZE) {
+        timestamps[v] = time++;
+        misses++;
+      }
+    }
+    hardEnds[t] = misses == 3;
+  }
+
+  u32 clusterCount = 0;
+  u32 clusterMisses = 0;
+  for (u32 t = 0; t < triangleCount; t++) {
+    Cluster *pCurrent = clusterCount > 0 ? &clusters[clusterCount - 1] : NULL;
+    bool softEnd = pCurrent != NULL && (float)clusterMisses <= meshRatio * threshold * pCurrent->triangleCount;
+    if (pCurrent == NULL || hardEnds[t] || softEnd) {
+      clusters[clusterCount] = (Cluster){ .firstTriangle = t, .order = clusterCount };
+      clusterCount++;
+      clusterMisses = 0;
+      time += MESHOPT_CACHE_SIZE + 1; // Empties the cache
+    }
+    for (u32 k = 0; k < 3; k++) {
+      u32 v = indices[t * 3 + k];
+      if (time - timestamps[v] > MESHOPT_CACHE_SIZE) {
+        timestamps[v] = time++;
+        clusterMisses++;
+      }
+    }
+    clusters[clusterCount - 1].triangleCount++;
+  }
+
+  double meshCentroid[3], meshNormal[3], meshArea;
+  clusterShape(indices, 0, triangleCount, positions, positionStride, meshCentroid, meshNormal, &meshArea);
+
+  // Clusters facing away from the middle of the mesh are likely to be in
+  // front of the others, whatever the view
+  for (u32 c = 0; c < clusterCount; c++) {
+    double centroid[3], normal[3], area;
+    clusterShape(indices, clusters[c].firstTriangle, clusters[c].triangleCount, positions, positionStride, centroid, normal, &area);
+    double length = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    double key = 0.0;
+    if (length > 0.0) {
+      for (u32 k = 0; k < 3; k++) {
+        key += (centroid[k] - meshCentroid[k]) * normal[k] / length;
+      }
+    }
+    clusters[c].sortKey = (float)key;
+  }
+  qsort(clusters, clusterCount, sizeof(Cluster), compareClusters);
+
+  u32 *output = checkedCalloc(indexCount, sizeof(u32));
+  u32 outputCount = 0;
+  for (u32 c = 0; c < clusterCount; c++) {
+    memcpy(output + outputCount, indices + clusters[c].firstTriangle * 3, sizeof(u32) * clusters[c].triangleCount * 3);
+    outputCount += clusters[c].triangleCount * 3;
+  }
+  memcpy(indices, output, sizeof(u32) * outputCount);
+
+  free(clusters);
+  free(timestamps);
+  free(hardEnds);
+  free(output);
+}
+
+u32 meshOptimizeVertexFetch(u32 *remap, u32 *indices, u32 indexCount, u32 vertexCount) {
+  memset(remap, 0xFF, sizeof(u32) * vertexCount);
+  u32 next = 0;
+  for (u32 i = 0; i < indexCount; i++) {
+    u32 v = indices[i];
+    if (remap[v] == UINT32_MAX) {
+      remap[v] = next++;
+    }
+    indices[i] = remap[v];
+  }
+  return next;
+}
+
+float meshCacheMissRatio(const u32 *indices, u32 indexCount, u32 vertexCount) {
+  if (indexCount < 3) return 0.0f;
+  u32 *timestamps = checkedCalloc(vertexCount, sizeof(u32));
+  u32 time = MESHOPT_CACHE_SIZE + 1;
+  u32 misses = 0;
+  for (u32 i = 0; i < indexCount; i++) {
+    u32 v = indices[i];
+    if (time - timestamps[v] > MESHOPT_CACHE_SIZE) {
+      timestamps[v] = time++;
+      misses++;
+    }
+  }
+  free(timestamps);
+  return (float)misses / (indexCount / 3);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "types.h"
+
+#define MESHOPT_CACHE_SIZE 16 // FIFO entries assumed for the post-transform cache
+
+// Reorders triangles for the post-transform vertex cache (Tipsify, Sander et
+// al. 2007). Works in place on one triangle list.
+void meshOptimizeVertexCache(u32 *indices, u32 indexCount, u32 vertexCount);
+
+// Splits a cache optimized triangle list into clusters wherever that costs
+// little cache efficiency, then draws outward facing clusters first so they
+// occlude the rest. threshold bounds the cache miss ratio of any cluster
+// relative to the whole list, 1.05 is a good start. positions are xyz with
+// positionStride bytes between vertices.
+void meshOptimizeOverdraw(u32 *indices, u32 indexCount, const float *positions, u32 positionStride, u32 vertexCount, float threshold);
+
+// Numbers vertices in the order the indices first use them so fetches walk
+// memory forwards. Fills remap with the new index of every vertex, UINT32_MAX
+// for ones nothing uses, rewrites indices and returns the used vertex count.
+u32 meshOptimizeVertexFetch(u32 *remap, u32 *indices, u32 indexCount, u32 vertexCount);
+
+// Average vertex shader invocations per triangle with a FIFO cache of
+// MESHOPT_CACHE_SIZE. 3 is no reuse at all, about 0.5 is ideal for grids.
+float meshCacheMissRatio(const u32 *indices, u32 indexCount, u32 vertexCount);
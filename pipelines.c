@@ -0,0 +1,474 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipelines.h"
+#include "trace.h"
+#include "log.h"
+#include "memtrack.h"
+
+// Extended dynamic state can only change topology within a topology class
+// (unless dynamicPrimitiveTopologyUnrestricted), so keys keep the class.
+static VkPrimitiveTopology topologyClass(VkPrimitiveTopology topology) {
+  switch (topology) {
+    case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+      return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+    case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+    case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+      return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+    default:
+      return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  }
+}
+
+// State that is set dynamically doesn't need its own pipeline
+static PipelineKey normalizeKey(const PipelineManager *pManager, const PipelineKey *pKey) {
+  PipelineKey key = *pKey;
+  if (pManager->extendedDynamicState) {
+    key.cullMode = 0;
+    key.topology = (u8)topologyClass((VkPrimitiveTopology)pKey->topology);
+  }
+  return key;
+}
+
+// FNV-1a
+u64 pipelineKeyHash(const PipelineKey *pKey) {
+  const u8 *bytes = (const u8*)pKey;
+  u64 hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < sizeof(PipelineKey); i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+static VkPipeline compilePipeline(PipelineManager *pManager, const PipelineKey *pKey) {
+  VkSpecializationMapEntry specEntries[PIPELINE_MAX_SPEC_CONSTANTS];
+  for (u32 i = 0; i < PIPELINE_MAX_SPEC_CONSTANTS; i++) {
+    specEntries[i].constantID = i;
+    specEntries[i].offset = i * sizeof(u32);
+    specEntries[i].size = sizeof(u32);
+  }
+
+  // Entries for IDs a shader doesn't declare are ignored
+  VkSpecializationInfo specInfo = {
+    .mapEntryCount = PIPELINE_MAX_SPEC_CONSTANTS,
+    .pMapEntries = specEntries,
+    .dataSize = sizeof(pKey->specConstants),
+    .pData = pKey->specConstants
+  };
+
+  ShaderSetModules *pModules = &pManager->shaderSets[pKey->shaderSet];
+
+  VkPipelineShaderStageCreateInfo shaderStages[] = {
+    {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_VERTEX_BIT,
+      .module = pModules->vert,
+      .pName = "main",
+      .pSpecializationInfo = &specInfo
+    },
+    {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+      .module = pModules->frag,
+      .pName = "main",
+      .pSpecializationInfo = &specInfo
+    }
+  };
+
+  const PipelineVertexLayout *pLayout = &pManager->vertexLayouts[pKey->vertexLayout];
+  VkVertexInputBindingDescription vertexBindings[2] = {
+    { .binding = 0, .stride = pLayout->stride, .inputRate = VK_VERTEX_INPUT_RATE_VERTEX },
+    { .binding = 1, .stride = pLayout->instanceStride, .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE }
+  };
+  bool hasVertices = pLayout->stride > 0;
+  VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    .vertexBindingDescriptionCount = hasVertices ? (pLayout->instanceStride > 0 ? 2 : 1) : 0,
+    .pVertexBindingDescriptions = hasVertices ? vertexBindings : NULL,
+    .vertexAttributeDescriptionCount = hasVertices ? pLayout->attributeCount : 0,
+    .pVertexAttributeDescriptions = hasVertices ? pLayout->attributes : NULL
+  };
+
+  u32 dynamicStatesSize = 2;
+  VkDynamicState dynamicStates[4] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  if (pManager->extendedDynamicState) {
+    dynamicStates[dynamicStatesSize++] = VK_DYNAMIC_STATE_CULL_MODE_EXT;
+    dynamicStates[dynamicStatesSize++] = VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT;
+  }
+
+  VkPipelineDynamicStateCreateInfo dynamicState = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+    .dynamicStateCount = dynamicStatesSize,
+    .pDynamicStates = dynamicStates
+  };
+
+  VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+    .topology = (VkPrimitiveTopology)pKey->topology,
+    .primitiveRestartEnable = VK_FALSE
+  };
+
+  // Viewport and scissor are dynamic, only the counts matter
+  VkPipelineViewportStateCreateInfo viewportState = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+    .viewportCount = 1,
+    .scissorCount = 1
+  };
+
+  VkPipelineRasterizationStateCreateInfo rasterizer = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+    .depthClampEnable = VK_FALSE,
+    .rasterizerDiscardEnable = VK_FALSE,
+    .polygonMode = VK_POLYGON_MODE_FILL,
+    .lineWidth = 1.0f,
+    .cullMode = pKey->cullMode,
+    .frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, // Meshes wind counter-clockwise seen from outside
+    .depthBiasEnable = VK_FALSE
+  };
+
+  VkPipelineMultisampleStateCreateInfo multisampling = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+    .sampleShadingEnable = VK_FALSE,
+    .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    .minSampleShading = 1.0f
+  };
+
+  bool hasDepth = pKey->depthFormat != VK_FORMAT_UNDEFINED;
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+    .depthTestEnable = VK_TRUE,
+    .depthWriteEnable = pKey->blendMode == BLEND_MODE_OPAQUE,
+    .depthCompareOp = VK_COMPARE_OP_LESS,
+    .depthBoundsTestEnable = VK_FALSE,
+    .stencilTestEnable = VK_FALSE
+  };
+
+  VkPipelineColorBlendAttachmentState colorBlendAttachment = {
+    .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    .blendEnable = VK_FALSE,
+    .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+    .dstColorBlendFactor = VK_BLEND_FACTOR_ZERO,
+    .colorBlendOp = VK_BLEND_OP_ADD,
+    .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+    .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+    .alphaBlendOp = VK_BLEND_OP_ADD
+  };
+
+  switch ((BlendMode)pKey->blendMode) {
+    case BLEND_MODE_ALPHA:
+      colorBlendAttachment.blendEnable = VK_TRUE;
+      colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+      colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+      colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+      break;
+    case BLEND_MODE_ADDITIVE:
+      colorBlendAttachment.blendEnable = VK_TRUE;
+      colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+      colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+      break;
+    case BLEND_MODE_OPAQUE:
+      break;
+  }
+
+  VkPipelineColorBlendStateCreateInfo colorBlending = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+    .logicOpEnable = VK_FALSE,
+    .logicOp = VK_LOGIC_OP_COPY,
+    .attachmentCount = 1,
+    .pAttachments = &colorBlendAttachment
+  };
+
+  VkFormat colorFormat = (VkFormat)pKey->colorFormat;
+  VkPipelineRenderingCreateInfoKHR renderingInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+    .colorAttachmentCount = 1,
+    .pColorAttachmentFormats = &colorFormat,
+    .depthAttachmentFormat = (VkFormat)pKey->depthFormat,
+    .stencilAttachmentFormat = VK_FORMAT_UNDEFINED
+  };
+
+  VkGraphicsPipelineCreateInfo pipelineInfo = {
+    .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+    .stageCount = 2,
+    .pStages = shaderStages,
+    .pVertexInputState = &vertexInputInfo,
+    .pInputAssemblyState = &inputAssembly,
+    .pViewportState = &viewportState,
+    .pRasterizationState = &rasterizer,
+    .pMultisampleState = &multisampling,
+    .pDepthStencilState = hasDepth ? &depthStencil : NULL,
+    .pColorBlendState = &colorBlending,
+    .pDynamicState = &dynamicState,
+    .layout = pManager->layout,
+    .renderPass = pManager->renderPass,
+    .subpass = 0,
+    .basePipelineHandle = VK_NULL_HANDLE,
+    .basePipelineIndex = -1
+  };
+
+  // With dynamic rendering the pipeline only declares its attachment formats
+  if (pManager->renderPass == VK_NULL_HANDLE) {
+    pipelineInfo.pNext = &renderingInfo;
+  }
+
+  // VkPipelineCache is internally synchronized, workers can share it
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (vkCreateGraphicsPipelines(pManager->device, pManager->cache, 1, &pipelineInfo, &memoryVulkanCallbacks, &pipeline) != VK_SUCCESS) {
+    return VK_NULL_HANDLE;
+  }
+  return pipeline;
+}
+
+static void *pipelineWorker(void *pArg) {
+  PipelineManager *pManager = pArg;
+  TRACE_THREAD_NAME("pipeline worker");
+
+  for (;;) {
+    pthread_mutex_lock(&pManager->queueMutex);
+    while (pManager->queueHead == pManager->queueTail && !pManager->shuttingDown) {
+      pthread_cond_wait(&pManager->queueCond, &pManager->queueMutex);
+    }
+    if (pManager->shuttingDown) {
+      pthread_mutex_unlock(&pManager->queueMutex);
+      return NULL;
+    }
+    PipelineEntry *pEntry = pManager->queue[pManager->queueHead % PIPELINE_CACHE_CAPACITY];
+    pManager->queueHead++;
+    pthread_mutex_unlock(&pManager->queueMutex);
+
+    TRACE_BEGIN("compilePipeline");
+    pEntry->pipeline = compilePipeline(pManager, &pEntry->key);
+    TRACE_END();
+    if (pEntry->pipeline == VK_NULL_HANDLE) {
+      LOG_ERROR(LOG_CATEGORY_PIPELINE, "Failed to compile pipeline %016llx", (unsigned long long)pEntry->hash);
+      atomic_store_explicit(&pEntry->state, PIPELINE_STATE_FAILED, memory_order_release);
+    } else {
+      atomic_store_explicit(&pEntry->state, PIPELINE_STATE_READY, memory_order_release);
+    }
+  }
+}
+
+static void loadPipelineCache(PipelineManager *pManager) {
+  void *data = NULL;
+  size_t size = 0;
+
+  FILE *pFile = pManager->cachePath ? fopen(pManager->cachePath, "rb") : NULL;
+  if (pFile != NULL) {
+    fseek(pFile, 0L, SEEK_END);
+    long fileSize = ftell(pFile);
+    fseek(pFile, 0L, SEEK_SET);
+
+    // Anything shorter than the header can't be valid. Mismatched data (other
+    // driver or device) is rejected by the driver, which starts empty.
+    if (fileSize >= (long)sizeof(VkPipelineCacheHeaderVersionOne)) {
+      data = memoryAlloc(fileSize, MEMORY_TAG_PIPELINES);
+      if (fread(data, fileSize, 1, pFile) == 1) {
+        size = fileSize;
+      }
+    }
+    fclose(pFile);
+  }
+
+  VkPipelineCacheCreateInfo createInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .initialDataSize = size,
+    .pInitialData = size > 0 ? data : NULL
+  };
+
+  if (vkCreatePipelineCache(pManager->device, &createInfo, &memoryVulkanCallbacks, &pManager->cache) != VK_SUCCESS) {
+    printf("Failed to create pipeline cache!\n");
+    exit(9);
+  }
+  memoryFree(data);
+}
+
+static void savePipelineCache(PipelineManager *pManager) {
+  if (pManager->cachePath == NULL) return;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(pManager->device, pManager->cache, &size, NULL) != VK_SUCCESS || size == 0) {
+    return;
+  }
+
+  void *data = memoryAlloc(size, MEMORY_TAG_PIPELINES);
+  if (vkGetPipelineCacheData(pManager->device, pManager->cache, &size, data) == VK_SUCCESS) {
+    FILE *pFile = fopen(pManager->cachePath, "wb");
+    if (pFile != NULL) {
+      fwrite(data, size, 1, pFile);
+      fclose(pFile);
+    }
+  }
+  memoryFree(data);
+}
+
+// Returns the entry for a normalized key, inserting it when missing.
+// NULL when the table is full.
+static PipelineEntry *findOrInsert(PipelineManager *pManager, const PipelineKey *pKey, u64 hash, bool *inserted) {
+  *inserted = false;
+  u32 mask = PIPELINE_CACHE_CAPACITY - 1;
+
+  for (u32 probe = 0; probe < PIPELINE_CACHE_CAPACITY; probe++) {
+    PipelineEntry *pEntry = &pManager->entries[(hash + probe) & mask];
+    int state = atomic_load_explicit(&pEntry->state, memory_order_acquire);
+
+    if (state == PIPELINE_STATE_EMPTY) {
+      // Keep probe chains short
+      if (pManager->entryCount >= PIPELINE_CACHE_CAPACITY * 3 / 4) {
+        return NULL;
+      }
+      pEntry->hash = hash;
+      pEntry->key = *pKey;
+      pEntry->pipeline = VK_NULL_HANDLE;
+      atomic_store_explicit(&pEntry->state, PIPELINE_STATE_PENDING, memory_order_relaxed);
+      pManager->entryCount++;
+      *inserted = true;
+      return pEntry;
+    }
+
+    if (pEntry->hash == hash && memcmp(&pEntry->key, pKey, sizeof(PipelineKey)) == 0) {
+      return pEntry;
+    }
+  }
+  return NULL;
+}
+
+void pipelineManagerInit(PipelineManager *pManager, const PipelineManagerCreateInfo *pInfo, const PipelineKey *pFallbackKey) {
+  memset(pManager, 0, sizeof(PipelineManager));
+  pManager->device = pInfo->device;
+  pManager->layout = pInfo->layout;
+  pManager->renderPass = pInfo->renderPass;
+  pManager->cachePath = pInfo->cachePath;
+  pManager->extendedDynamicState = pInfo->extendedDynamicState;
+  memcpy(pManager->shaderSets, pInfo->shaderSets, sizeof(pManager->shaderSets));
+  memcpy(pManager->vertexLayouts, pInfo->vertexLayouts, sizeof(pManager->vertexLayouts));
+
+  if (pManager->extendedDynamicState) {
+    const char *cullModeName = pInfo->extendedDynamicStateIsCore ? "vkCmdSetCullMode" : "vkCmdSetCullModeEXT";
+    const char *topologyName = pInfo->extendedDynamicStateIsCore ? "vkCmdSetPrimitiveTopology" : "vkCmdSetPrimitiveTopologyEXT";
+    pManager->cmdSetCullMode = (PFN_vkCmdSetCullModeEXT) vkGetDeviceProcAddr(pManager->device, cullModeName);
+    pManager->cmdSetPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT) vkGetDeviceProcAddr(pManager->device, topologyName);
+    if (pManager->cmdSetCullMode == NULL || pManager->cmdSetPrimitiveTopology == NULL) {
+      LOG_WARN(LOG_CATEGORY_PIPELINE, "Extended dynamic state functions missing, baking state into pipelines");
+      pManager->extendedDynamicState = false;
+    }
+  }
+
+  loadPipelineCache(pManager);
+
+  PipelineKey fallbackKey = normalizeKey(pManager, pFallbackKey);
+  bool inserted;
+  pManager->fallback = findOrInsert(pManager, &fallbackKey, pipelineKeyHash(&fallbackKey), &inserted);
+  pManager->fallback->pipeline = compilePipeline(pManager, &fallbackKey);
+  if (pManager->fallback->pipeline == VK_NULL_HANDLE) {
+    printf("Failed to create graphics pipeline!\n");
+    exit(9);
+  }
+  atomic_store_explicit(&pManager->fallback->state, PIPELINE_STATE_READY, memory_order_release);
+
+  pthread_mutex_init(&pManager->queueMutex, NULL);
+  pthread_cond_init(&pManager->queueCond, NULL);
+
+  // Leave a core for the render thread
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  pManager->workerCount = cores > 2 ? (u32)(cores - 1) : 1;
+  if (pManager->workerCount > PIPELINE_MAX_WORKERS) {
+    pManager->workerCount = PIPELINE_MAX_WORKERS;
+  }
+  for (u32 i = 0; i < pManager->workerCount; i++) {
+    if (pthread_create(&pManager->workers[i], NULL, pipelineWorker, pManager) != 0) {
+      printf("Failed to start pipeline compile thread!\n");
+      exit(9);
+    }
+  }
+}
+
+void pipelineManagerDestroy(PipelineManager *pManager) {
+  pthread_mutex_lock(&pManager->queueMutex);
+  pManager->shuttingDown = true;
+  pthread_cond_broadcast(&pManager->queueCond);
+  pthread_mutex_unlock(&pManager->queueMutex);
+
+  for (u32 i = 0; i < pManager->workerCount; i++) {
+    pthread_join(pManager->workers[i], NULL);
+  }
+  pthread_cond_destroy(&pManager->queueCond);
+  pthread_mutex_destroy(&pManager->queueMutex);
+
+  for (u32 i = 0; i < PIPELINE_CACHE_CAPACITY; i++) {
+    if (atomic_load(&pManager->entries[i].state) == PIPELINE_STATE_READY) {
+      vkDestroyPipeline(pManager->device, pManager->entries[i].pipeline, &memoryVulkanCallbacks);
+    }
+  }
+
+  savePipelineCache(pManager);
+  vkDestroyPipelineCache(pManager->device, pManager->cache, &memoryVulkanCallbacks);
+
+  for (u32 i = 0; i < SHADER_SET_COUNT; i++) {
+    vkDestroyShaderModule(pManager->device, pManager->shaderSets[i].frag, &memoryVulkanCallbacks);
+    vkDestroyShaderModule(pManager->device, pManager->shaderSets[i].vert, &memoryVulkanCallbacks);
+  }
+}
+
+// A pipeline built for another vertex layout would misread the buffer
+static VkPipeline fallbackFor(const PipelineManager *pManager, const PipelineKey *pKey) {
+  if (pManager->fallback->key.vertexLayout != pKey->vertexLayout) {
+    return VK_NULL_HANDLE;
+  }
+  return pManager->fallback->pipeline;
+}
+
+VkPipeline pipelineManagerGet(PipelineManager *pManager, const PipelineKey *pKey) {
+  PipelineKey key = normalizeKey(pManager, pKey);
+  u64 hash = pipelineKeyHash(&key);
+
+  bool inserted;
+  PipelineEntry *pEntry = findOrInsert(pManager, &key, hash, &inserted);
+  if (pEntry == NULL) {
+    return fallbackFor(pManager, &key);
+  }
+
+  if (inserted) {
+    pthread_mutex_lock(&pManager->queueMutex);
+    pManager->queue[pManager->queueTail % PIPELINE_CACHE_CAPACITY] = pEntry;
+    pManager->queueTail++;
+    pthread_cond_signal(&pManager->queueCond);
+    pthread_mutex_unlock(&pManager->queueMutex);
+    return fallbackFor(pManager, &key);
+  }
+
+  if (atomic_load_explicit(&pEntry->state, memory_order_acquire) == PIPELINE_STATE_READY) {
+    return pEntry->pipeline;
+  }
+  return fallbackFor(pManager, &key);
+}
+
+void pipelineManagerBeginFrame(PipelineManager *pManager) {
+  pManager->boundPipeline = VK_NULL_HANDLE;
+}
+
+bool pipelineManagerBind(PipelineManager *pManager, VkCommandBuffer commandBuffer, const PipelineKey *pKey) {
+  VkPipeline pipeline = pipelineManagerGet(pManager, pKey);
+  if (pipeline == VK_NULL_HANDLE) {
+    return false;
+  }
+  bool pipelineChanged = pipeline != pManager->boundPipeline;
+
+  if (pipelineChanged) {
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    pManager->boundPipeline = pipeline;
+  }
+
+  if (pManager->extendedDynamicState) {
+    if (pipelineChanged || pManager->boundKey.cullMode != pKey->cullMode) {
+      pManager->cmdSetCullMode(commandBuffer, pKey->cullMode);
+    }
+    if (pipelineChanged || pManager->boundKey.topology != pKey->topology) {
+      pManager->cmdSetPrimitiveTopology(commandBuffer, (VkPrimitiveTopology)pKey->topology);
+    }
+  }
+  pManager->boundKey = *pKey;
+  return true;
+}
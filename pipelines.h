@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+
+#define PIPELINE_MAX_SPEC_CONSTANTS 4
+#define PIPELINE_CACHE_CAPACITY 256 // Must be a power of two
+#define PIPELINE_MAX_WORKERS 4
+#define PIPELINE_MAX_VERTEX_ATTRIBUTES 4
+#define PIPELINE_MAX_VERTEX_LAYOUTS 4
+
+typedef enum ShaderSet {
+  SHADER_SET_TRIANGLE = 0,
+  SHADER_SET_COUNT
+} ShaderSet;
+
+typedef enum BlendMode {
+  BLEND_MODE_OPAQUE = 0,
+  BLEND_MODE_ALPHA,
+  BLEND_MODE_ADDITIVE
+} BlendMode;
+
+// Everything that can make two pipelines differ. Laid out without padding so
+// it can be hashed and compared as raw bytes.
+typedef struct PipelineKey {
+  u8 shaderSet;   // ShaderSet
+  u8 blendMode;   // BlendMode
+  u8 cullMode;    // VkCullModeFlags
+  u8 topology;    // VkPrimitiveTopology
+  u8 vertexLayout; // Index into the manager's vertex layouts
+  u8 padding[3];
+  u32 colorFormat; // VkFormat
+  u32 depthFormat; // VkFormat
+  u32 specConstants[PIPELINE_MAX_SPEC_CONSTANTS]; // constant_id 0..3 in every stage
+} PipelineKey;
+
+typedef enum PipelineState {
+  PIPELINE_STATE_EMPTY = 0,
+  PIPELINE_STATE_PENDING,
+  PIPELINE_STATE_READY,
+  PIPELINE_STATE_FAILED
+} PipelineState;
+
+typedef struct PipelineEntry {
+  u64 hash;
+  PipelineKey key;
+  VkPipeline pipeline; // Written by a worker before state is released as READY
+  _Atomic int state;   // PipelineState
+} PipelineEntry;
+
+typedef struct ShaderSetModules {
+  VkShaderModule vert;
+  VkShaderModule frag;
+} ShaderSetModules;
+
+// How binding 0, and binding 1 when there is per-instance data, are laid out
+typedef struct PipelineVertexLayout {
+  u32 stride; // 0 when the vertex shader takes no vertex buffer
+  u32 instanceStride; // Of binding 1, advanced per instance. 0 without it.
+  u32 attributeCount;
+  VkVertexInputAttributeDescription attributes[PIPELINE_MAX_VERTEX_ATTRIBUTES];
+} PipelineVertexLayout;
+
+typedef struct PipelineManagerCreateInfo {
+  VkDevice device;
+  VkPipelineLayout layout;
+  VkRenderPass renderPass; // VK_NULL_HANDLE with dynamic rendering
+  bool extendedDynamicState;
+  bool extendedDynamicStateIsCore;
+  ShaderSetModules shaderSets[SHADER_SET_COUNT]; // Owned by the manager afterwards
+  PipelineVertexLayout vertexLayouts[PIPELINE_MAX_VERTEX_LAYOUTS];
+  const char *cachePath; // Pipeline cache persisted between runs, may be NULL
+} PipelineManagerCreateInfo;
+
+typedef struct PipelineManager {
+  VkDevice device;
+  VkPipelineLayout layout;
+  VkRenderPass renderPass;
+  VkPipelineCache cache;
+  const char *cachePath;
+  ShaderSetModules shaderSets[SHADER_SET_COUNT];
+  PipelineVertexLayout vertexLayouts[PIPELINE_MAX_VERTEX_LAYOUTS];
+
+  bool extendedDynamicState;
+  PFN_vkCmdSetCullModeEXT cmdSetCullMode;
+  PFN_vkCmdSetPrimitiveTopologyEXT cmdSetPrimitiveTopology;
+
+  // Open addressed, never shrinks. Only the render thread inserts; workers
+  // only fill in the pipeline of the entry they were handed.
+  PipelineEntry entries[PIPELINE_CACHE_CAPACITY];
+  u32 entryCount;
+  PipelineEntry *fallback;
+
+  // Compile queue
+  pthread_mutex_t queueMutex;
+  pthread_cond_t queueCond;
+  PipelineEntry *queue[PIPELINE_CACHE_CAPACITY];
+  u32 queueHead;
+  u32 queueTail;
+  bool shuttingDown;
+  pthread_t workers[PIPELINE_MAX_WORKERS];
+  u32 workerCount;
+
+  // Currently bound state, reset by pipelineManagerBeginFrame
+  VkPipeline boundPipeline;
+  PipelineKey boundKey;
+} PipelineManager;
+
+// Compiles the fallback pipeline synchronously so there is always something to bind.
+void pipelineManagerInit(PipelineManager *pManager, const PipelineManagerCreateInfo *pInfo, const PipelineKey *pFallbackKey);
+void pipelineManagerDestroy(PipelineManager *pManager);
+
+// Returns the pipeline for pKey when it is compiled. Otherwise queues it on a
+// worker thread and returns the fallback, or VK_NULL_HANDLE when the fallback
+// reads a different vertex layout and can't stand in.
+VkPipeline pipelineManagerGet(PipelineManager *pManager, const PipelineKey *pKey);
+
+// Binds the pipeline for pKey and sets the state that extended dynamic state
+// took out of the pipeline. Skips redundant binds within a command buffer.
+// Returns false when nothing can draw pKey yet, draws should be skipped then.
+bool pipelineManagerBind(PipelineManager *pManager, VkCommandBuffer commandBuffer, const PipelineKey *pKey);
+void pipelineManagerBeginFrame(PipelineManager *pManager);
+
+u64 pipelineKeyHash(const PipelineKey *pKey);
@@ -0,0 +1,641 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "post.h"
+#include "device.h"
+#include "shadercode.h"
+
+#define POST_TIMESTAMPS (POST_EFFECT_COUNT + 1) // Per frame, around each effect
+#define POST_PUSH_SIZE 64
+#define DOWNSAMPLE_GROUP 8 // Matches shaders/post_downsample.comp
+#define UPSAMPLE_GROUP 8
+#define COMPOSITE_GROUP 16 // Matches shaders/post_composite.glsl
+
+// Push constant blocks of the shaders
+typedef struct DownsampleParams {
+  i32 sourceSize[2]; // Valid texels of the source level
+  i32 destinationSize[2];
+  i32 sourceLevel;
+  u32 prefilter; // Set for the first level
+  float threshold;
+  float knee;
+} DownsampleParams;
+
+typedef struct UpsampleParams {
+  float destinationTexel[2]; // 1 / full level size
+  float sourceTexel[2];
+  float sourceMaxUv[2]; // Keeps the filter inside the source's valid texels
+  i32 destinationSize[2];
+  float sourceLevel;
+  float radius;
+} UpsampleParams;
+
+typedef struct CompositeParams {
+  i32 size[2];
+  float targetTexel[2];
+  float bloomMaxUv[2];
+  float bloomIntensity;
+  float saturation;
+  float contrast;
+  float padding[3];
+  float colorFilter[4];
+} CompositeParams;
+
+typedef struct AdaptParams {
+  float key;
+  float minExposure;
+  float maxExposure;
+  float adaptation; // Fraction of the way to the target this frame
+} AdaptParams;
+
+// Matches the Exposure buffer of the shaders
+typedef struct ExposureState {
+  float exposure;
+  i32 logLuminanceSum; // Sixteenths of a stop, summed over metered pixels
+  u32 pixelCount;
+  float target; // Where exposure is heading, read on the host
+} ExposureState;
+
+static const char *effectNames[POST_EFFECT_COUNT] = {
+  "bloom_downsample",
+  "bloom_upsample",
+  "composite"
+};
+
+const char *postEffectName(PostEffect effect) {
+  return effectNames[effect];
+}
+
+static u32 dispatchCount(u32 size, u32 groupSize) {
+  return (size + groupSize - 1) / groupSize;
+}
+
+static u32 levelSize(u32 size, u32 level) {
+  u32 n = size >> level;
+  return n > 0 ? n : 1;
+}
+
+// Texels of each bloom level covering the rendered part of the target
+static void validLevelExtents(const PostProcessing *pPost, VkExtent2D renderExtent, VkExtent2D *pValid) {
+  VkExtent2D previous = renderExtent;
+  for (u32 i = 0; i < pPost->bloomLevels; i++) {
+    u32 width = (previous.width + 1) / 2;
+    u32 height = (previous.height + 1) / 2;
+    u32 fullWidth = levelSize(pPost->extent.width / 2, i);
+    u32 fullHeight = levelSize(pPost->extent.height / 2, i);
+    pValid[i].width = width < fullWidth ? width : fullWidth;
+    pValid[i].height = height < fullHeight ? height : fullHeight;
+    previous = pValid[i];
+  }
+}
+
+static bool subgroupMeteringSupported(const PostCreateInfo *pInfo) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(pInfo->physicalDevice, &properties);
+  u32 apiVersion = properties.apiVersion < pInfo->apiVersion ? properties.apiVersion : pInfo->apiVersion;
+  if (apiVersion < VK_API_VERSION_1_1) {
+    return false;
+  }
+
+  VkPhysicalDeviceSubgroupProperties subgroup = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES
+  };
+  VkPhysicalDeviceProperties2 properties2 = {
+    .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+    .pNext = &subgroup
+  };
+  vkGetPhysicalDeviceProperties2(pInfo->physicalDevice, &properties2);
+  VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+  return (subgroup.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) && (subgroup.supportedOperations & required) == required;
+}
+
+static VkPipeline createComputePipeline(PostProcessing *pPost, const char *name, const char *shaderDir) {
+  ShaderCode code;
+  shaderCodeLoad(name, shaderDir, &code);
+  VkShaderModuleCreateInfo moduleInfo = {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = code.size,
+    .pCode = code.words
+  };
+  VkShaderModule module;
+  if (vkCreateShaderModule(pPost->device, &moduleInfo, &memoryVulkanCallbacks, &module) != VK_SUCCESS) {
+    printf("Failed to create %s shader module!\n", name);
+    exit(29);
+  }
+  shaderCodeFree(&code);
+
+  VkComputePipelineCreateInfo pipelineInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = module,
+      .pName = "main"
+    },
+    .layout = pPost->pipelineLayout
+  };
+  VkPipeline pipeline;
+  if (vkCreateComputePipelines(pPost->device, VK_NULL_HANDLE, 1, &pipelineInfo, &memoryVulkanCallbacks, &pipeline) != VK_SUCCESS) {
+    printf("Failed to create %s pipeline!\n", name);
+    exit(29);
+  }
+  vkDestroyShaderModule(pPost->device, module, &memoryVulkanCallbacks);
+  return pipeline;
+}
+
+static void createPipelines(PostProcessing *pPost, const PostCreateInfo *pInfo) {
+  VkDescriptorSetLayoutBinding bindings[3] = {
+    { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL },
+    { 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, NULL }
+  };
+  VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+    .bindingCount = 3,
+    .pBindings = bindings
+  };
+  if (vkCreateDescriptorSetLayout(pPost->device, &setLayoutInfo, &memoryVulkanCallbacks, &pPost->setLayout) != VK_SUCCESS) {
+    printf("Failed to create post descriptor set layout!\n");
+    exit(29);
+  }
+
+  VkPushConstantRange pushConstantRange = {
+    .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    .offset = 0,
+    .size = POST_PUSH_SIZE
+  };
+  VkPipelineLayoutCreateInfo layoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &pPost->setLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &pushConstantRange
+  };
+  if (vkCreatePipelineLayout(pPost->device, &layoutInfo, &memoryVulkanCallbacks, &pPost->pipelineLayout) != VK_SUCCESS) {
+    printf("Failed to create post pipeline layout!\n");
+    exit(29);
+  }
+
+  pPost->subgroupMetering = subgroupMeteringSupported(pInfo);
+  pPost->downsamplePipeline = createComputePipeline(pPost, "post_downsample.comp", pInfo->shaderDir);
+  pPost->upsamplePipeline = createComputePipeline(pPost, "post_upsample.comp", pInfo->shaderDir);
+  pPost->compositePipeline = createComputePipeline(
+    pPost, pPost->subgroupMetering ? "post_composite_subgroup.comp" : "post_composite.comp", pInfo->shaderDir);
+  pPost->adaptPipeline = createComputePipeline(pPost, "post_adapt.comp", pInfo->shaderDir);
+}
+
+static void createExposureBuffer(PostProcessing *pPost) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = sizeof(ExposureState),
+    .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  if (vkCreateBuffer(pPost->device, &bufferInfo, &memoryVulkanCallbacks, &pPost->exposureBuffer) != VK_SUCCESS) {
+    printf("Failed to create exposure buffer!\n");
+    exit(29);
+  }
+
+  // Host visible so it can start at an exposure of 1 without a transfer,
+  // and stays mapped to tell when adaptation is done
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pPost->device, pPost->exposureBuffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pPost->physicalDevice, requirements.memoryTypeBits,
+                                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+  };
+  if (deviceAllocateMemory(pPost->device, pPost->physicalDevice, &allocInfo, MEMORY_TAG_POST, &pPost->exposureMemory) != VK_SUCCESS ||
+      vkBindBufferMemory(pPost->device, pPost->exposureBuffer, pPost->exposureMemory, 0) != VK_SUCCESS ||
+      vkMapMemory(pPost->device, pPost->exposureMemory, 0, VK_WHOLE_SIZE, 0, &pPost->pExposureState) != VK_SUCCESS) {
+    printf("Failed to allocate exposure buffer memory!\n");
+    exit(29);
+  }
+  ExposureState initial = { .exposure = 1.0f, .target = 1.0f };
+  memcpy(pPost->pExposureState, &initial, sizeof(initial));
+}
+
+static void createDescriptorPool(PostProcessing *pPost) {
+  u32 sets = pPost->frameCount * 2 * POST_BLOOM_LEVELS;
+  VkDescriptorPoolSize poolSizes[] = {
+    { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, sets },
+    { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, sets },
+    { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, sets }
+  };
+  VkDescriptorPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+    .maxSets = sets,
+    .poolSizeCount = 3,
+    .pPoolSizes = poolSizes
+  };
+  if (vkCreateDescriptorPool(pPost->device, &poolInfo, &memoryVulkanCallbacks, &pPost->descriptorPool) != VK_SUCCESS) {
+    printf("Failed to create post descriptor pool!\n");
+    exit(29);
+  }
+
+  VkDescriptorSetLayout layouts[2 * POST_BLOOM_LEVELS];
+  for (u32 i = 0; i < 2 * POST_BLOOM_LEVELS; i++) {
+    layouts[i] = pPost->setLayout;
+  }
+  for (u32 i = 0; i < pPost->frameCount; i++) {
+    PostFrame *pFrame = &pPost->frames[i];
+    VkDescriptorSet sets[2 * POST_BLOOM_LEVELS];
+    VkDescriptorSetAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = pPost->descriptorPool,
+      .descriptorSetCount = 2 * POST_BLOOM_LEVELS,
+      .pSetLayouts = layouts
+    };
+    if (vkAllocateDescriptorSets(pPost->device, &allocInfo, sets) != VK_SUCCESS) {
+      printf("Failed to allocate post descriptor sets!\n");
+      exit(29);
+    }
+    memcpy(pFrame->downsampleSets, sets, sizeof(pFrame->downsampleSets));
+    memcpy(pFrame->upsampleSets, sets + POST_BLOOM_LEVELS, sizeof(pFrame->upsampleSets));
+    pFrame->compositeSet = sets[2 * POST_BLOOM_LEVELS - 1];
+  }
+}
+
+static void writeSet(PostProcessing *pPost, VkDescriptorSet set, VkImageView sampled, VkImageView storage) {
+  VkDescriptorImageInfo sampledInfo = { pPost->sampler, sampled, VK_IMAGE_LAYOUT_GENERAL };
+  VkDescriptorImageInfo storageInfo = { VK_NULL_HANDLE, storage, VK_IMAGE_LAYOUT_GENERAL };
+  VkDescriptorBufferInfo bufferInfo = { pPost->exposureBuffer, 0, VK_WHOLE_SIZE };
+  VkWriteDescriptorSet writes[3] = {
+    {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 0,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      .pImageInfo = &sampledInfo
+    },
+    {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 1,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+      .pImageInfo = &storageInfo
+    },
+    {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .dstBinding = 2,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pBufferInfo = &bufferInfo
+    }
+  };
+  vkUpdateDescriptorSets(pPost->device, 3, writes, 0, NULL);
+}
+
+static void createBloomChain(PostProcessing *pPost, PostFrame *pFrame) {
+  VkImageCreateInfo imageInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+    .imageType = VK_IMAGE_TYPE_2D,
+    .format = POST_HDR_FORMAT,
+    .extent = { levelSize(pPost->extent.width / 2, 0), levelSize(pPost->extent.height / 2, 0), 1 },
+    .mipLevels = pPost->bloomLevels,
+    .arrayLayers = 1,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .tiling = VK_IMAGE_TILING_OPTIMAL,
+    .usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  if (vkCreateImage(pPost->device, &imageInfo, &memoryVulkanCallbacks, &pFrame->bloomImage) != VK_SUCCESS) {
+    printf("Failed to create bloom image!\n");
+    exit(29);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(pPost->device, pFrame->bloomImage, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pPost->physicalDevice, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pPost->device, pPost->physicalDevice, &allocInfo, MEMORY_TAG_POST, &pFrame->bloomMemory) != VK_SUCCESS ||
+      vkBindImageMemory(pPost->device, pFrame->bloomImage, pFrame->bloomMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate bloom image memory!\n");
+    exit(29);
+  }
+
+  VkImageViewCreateInfo viewInfo = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+    .image = pFrame->bloomImage,
+    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+    .format = POST_HDR_FORMAT,
+    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pPost->bloomLevels, 0, 1 }
+  };
+  if (vkCreateImageView(pPost->device, &viewInfo, &memoryVulkanCallbacks, &pFrame->bloomView) != VK_SUCCESS) {
+    printf("Failed to create bloom image view!\n");
+    exit(29);
+  }
+  for (u32 i = 0; i < pPost->bloomLevels; i++) {
+    viewInfo.subresourceRange.baseMipLevel = i;
+    viewInfo.subresourceRange.levelCount = 1;
+    if (vkCreateImageView(pPost->device, &viewInfo, &memoryVulkanCallbacks, &pFrame->bloomLevelViews[i]) != VK_SUCCESS) {
+      printf("Failed to create bloom image view!\n");
+      exit(29);
+    }
+  }
+}
+
+static void destroyBloomChains(PostProcessing *pPost) {
+  for (u32 i = 0; i < pPost->frameCount; i++) {
+    PostFrame *pFrame = &pPost->frames[i];
+    for (u32 level = 0; level < pPost->bloomLevels; level++) {
+      vkDestroyImageView(pPost->device, pFrame->bloomLevelViews[level], &memoryVulkanCallbacks);
+    }
+    vkDestroyImageView(pPost->device, pFrame->bloomView, &memoryVulkanCallbacks);
+    vkDestroyImage(pPost->device, pFrame->bloomImage, &memoryVulkanCallbacks);
+    deviceFreeMemory(pPost->device, pFrame->bloomMemory);
+  }
+}
+
+// Sets of levels that don't exist on small targets are written anyway,
+// pointing at the last level, and never bound
+static void createBloomChains(PostProcessing *pPost, VkExtent2D extent, const VkImageView *targetViews) {
+  pPost->extent = extent;
+  u32 largest = extent.width / 2 > extent.height / 2 ? extent.width / 2 : extent.height / 2;
+  pPost->bloomLevels = 1;
+  while (pPost->bloomLevels < POST_BLOOM_LEVELS && (largest >> pPost->bloomLevels) > 0) {
+    pPost->bloomLevels++;
+  }
+
+  for (u32 i = 0; i < pPost->frameCount; i++) {
+    PostFrame *pFrame = &pPost->frames[i];
+    createBloomChain(pPost, pFrame);
+    u32 last = pPost->bloomLevels - 1;
+    for (u32 level = 0; level < POST_BLOOM_LEVELS; level++) {
+      VkImageView destination = pFrame->bloomLevelViews[level < last ? level : last];
+      writeSet(pPost, pFrame->downsampleSets[level], level == 0 ? targetViews[i] : pFrame->bloomView, destination);
+      if (level < POST_BLOOM_LEVELS - 1) {
+        writeSet(pPost, pFrame->upsampleSets[level], pFrame->bloomView, destination);
+      }
+    }
+    writeSet(pPost, pFrame->compositeSet, pFrame->bloomView, targetViews[i]);
+    pFrame->timestampsPending = false;
+  }
+}
+
+void postInit(PostProcessing *pPost, const PostCreateInfo *pInfo) {
+  memset(pPost, 0, sizeof(PostProcessing));
+  pPost->device = pInfo->device;
+  pPost->physicalDevice = pInfo->physicalDevice;
+  pPost->frameCount = pInfo->frameCount < POST_MAX_FRAMES ? pInfo->frameCount : POST_MAX_FRAMES;
+  pPost->settings = (PostSettings){
+    .bloomThreshold = 1.0f,
+    .bloomKnee = 0.5f,
+    .bloomIntensity = 0.6f,
+    .bloomRadius = 1.0f,
+    .exposureKey = 0.25f,
+    .exposureMin = 0.25f,
+    .exposureMax = 4.0f,
+    .adaptationSpeed = 1.5f,
+    .saturation = 1.1f,
+    .contrast = 1.05f,
+    .colorFilter = { 1.0f, 1.0f, 1.0f }
+  };
+
+  VkSamplerCreateInfo samplerInfo = {
+    .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+    .magFilter = VK_FILTER_LINEAR,
+    .minFilter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+    .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    .maxLod = (float)POST_BLOOM_LEVELS
+  };
+  if (vkCreateSampler(pPost->device, &samplerInfo, &memoryVulkanCallbacks, &pPost->sampler) != VK_SUCCESS) {
+    printf("Failed to create post sampler!\n");
+    exit(29);
+  }
+
+  createPipelines(pPost, pInfo);
+  createExposureBuffer(pPost);
+  createDescriptorPool(pPost);
+  createBloomChains(pPost, pInfo->extent, pInfo->targetViews);
+
+  if (pInfo->timestampBits > 0) {
+    VkQueryPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = POST_TIMESTAMPS * pPost->frameCount
+    };
+    if (vkCreateQueryPool(pPost->device, &poolInfo, &memoryVulkanCallbacks, &pPost->timestampPool) != VK_SUCCESS) {
+      printf("Failed to create post timestamp query pool!\n");
+      exit(29);
+    }
+    pPost->timestampMask = pInfo->timestampBits >= 64 ? ~0ull : (1ull << pInfo->timestampBits) - 1;
+    pPost->timestampPeriodNs = pInfo->timestampPeriodNs;
+  }
+}
+
+void postDestroy(PostProcessing *pPost) {
+  destroyBloomChains(pPost);
+  if (pPost->timestampPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(pPost->device, pPost->timestampPool, &memoryVulkanCallbacks);
+  }
+  vkDestroyPipeline(pPost->device, pPost->downsamplePipeline, &memoryVulkanCallbacks);
+  vkDestroyPipeline(pPost->device, pPost->upsamplePipeline, &memoryVulkanCallbacks);
+  vkDestroyPipeline(pPost->device, pPost->compositePipeline, &memoryVulkanCallbacks);
+  vkDestroyPipeline(pPost->device, pPost->adaptPipeline, &memoryVulkanCallbacks);
+  vkDestroyPipelineLayout(pPost->device, pPost->pipelineLayout, &memoryVulkanCallbacks);
+  vkDestroyDescriptorPool(pPost->device, pPost->descriptorPool, &memoryVulkanCallbacks);
+  vkDestroyDescriptorSetLayout(pPost->device, pPost->setLayout, &memoryVulkanCallbacks);
+  vkDestroySampler(pPost->device, pPost->sampler, &memoryVulkanCallbacks);
+  vkDestroyBuffer(pPost->device, pPost->exposureBuffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pPost->device, pPost->exposureMemory);
+  memset(pPost, 0, sizeof(PostProcessing));
+}
+
+void postResize(PostProcessing *pPost, VkExtent2D extent, const VkImageView *targetViews) {
+  destroyBloomChains(pPost);
+  createBloomChains(pPost, extent, targetViews);
+}
+
+// Orders each dispatch's writes before the next one's reads
+static void computeBarrier(VkCommandBuffer commandBuffer) {
+  VkMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                       1, &barrier, 0, NULL, 0, NULL);
+}
+
+static void writeTimestamp(PostProcessing *pPost, VkCommandBuffer commandBuffer, u32 frame, u32 index) {
+  if (pPost->timestampPool != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pPost->timestampPool, frame * POST_TIMESTAMPS + index);
+  }
+}
+
+void postRecord(PostProcessing *pPost, VkCommandBuffer commandBuffer, u32 frame, VkImage target, VkExtent2D extent, float deltaSeconds) {
+  PostFrame *pFrame = &pPost->frames[frame];
+  const PostSettings *pSettings = &pPost->settings;
+  VkExtent2D valid[POST_BLOOM_LEVELS];
+  validLevelExtents(pPost, extent, valid);
+
+  if (pPost->timestampPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(commandBuffer, pPost->timestampPool, frame * POST_TIMESTAMPS, POST_TIMESTAMPS);
+  }
+  writeTimestamp(pPost, commandBuffer, frame, 0);
+
+  // Last frame's bloom is never read again, so its chain starts undefined
+  VkImageMemoryBarrier startBarriers[2] = {
+    {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = target,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    },
+    {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = 0,
+      .dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = pFrame->bloomImage,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, pPost->bloomLevels, 0, 1 }
+    }
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 2, startBarriers);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->downsamplePipeline);
+  for (u32 level = 0; level < pPost->bloomLevels; level++) {
+    VkExtent2D source = level == 0 ? extent : valid[level - 1];
+    DownsampleParams params = {
+      .sourceSize = { (i32)source.width, (i32)source.height },
+      .destinationSize = { (i32)valid[level].width, (i32)valid[level].height },
+      .sourceLevel = level == 0 ? 0 : (i32)level - 1,
+      .prefilter = level == 0,
+      .threshold = pSettings->bloomThreshold,
+      .knee = pSettings->bloomKnee
+    };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->pipelineLayout, 0, 1,
+                            &pFrame->downsampleSets[level], 0, NULL);
+    vkCmdPushConstants(commandBuffer, pPost->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer, dispatchCount(valid[level].width, DOWNSAMPLE_GROUP), dispatchCount(valid[level].height, DOWNSAMPLE_GROUP), 1);
+    computeBarrier(commandBuffer);
+  }
+  writeTimestamp(pPost, commandBuffer, frame, 1);
+
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->upsamplePipeline);
+  for (i32 level = (i32)pPost->bloomLevels - 2; level >= 0; level--) {
+    float sourceWidth = (float)levelSize(pPost->extent.width / 2, level + 1);
+    float sourceHeight = (float)levelSize(pPost->extent.height / 2, level + 1);
+    UpsampleParams params = {
+      .destinationTexel = { 1.0f / levelSize(pPost->extent.width / 2, level), 1.0f / levelSize(pPost->extent.height / 2, level) },
+      .sourceTexel = { 1.0f / sourceWidth, 1.0f / sourceHeight },
+      .sourceMaxUv = { (valid[level + 1].width - 0.5f) / sourceWidth, (valid[level + 1].height - 0.5f) / sourceHeight },
+      .destinationSize = { (i32)valid[level].width, (i32)valid[level].height },
+      .sourceLevel = (float)(level + 1),
+      .radius = pSettings->bloomRadius
+    };
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->pipelineLayout, 0, 1,
+                            &pFrame->upsampleSets[level], 0, NULL);
+    vkCmdPushConstants(commandBuffer, pPost->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+    vkCmdDispatch(commandBuffer, dispatchCount(valid[level].width, UPSAMPLE_GROUP), dispatchCount(valid[level].height, UPSAMPLE_GROUP), 1);
+    computeBarrier(commandBuffer);
+  }
+  writeTimestamp(pPost, commandBuffer, frame, 2);
+
+  // Moves exposure toward what the previous composite metered, then resets
+  // the sums for this one
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->pipelineLayout, 0, 1,
+                          &pFrame->compositeSet, 0, NULL);
+  AdaptParams adaptParams = {
+    .key = pSettings->exposureKey,
+    .minExposure = pSettings->exposureMin,
+    .maxExposure = pSettings->exposureMax,
+    .adaptation = 1.0f - expf(-deltaSeconds * pSettings->adaptationSpeed)
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->adaptPipeline);
+  vkCmdPushConstants(commandBuffer, pPost->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(adaptParams), &adaptParams);
+  vkCmdDispatch(commandBuffer, 1, 1, 1);
+  computeBarrier(commandBuffer);
+
+  float bloomWidth = (float)levelSize(pPost->extent.width / 2, 0);
+  float bloomHeight = (float)levelSize(pPost->extent.height / 2, 0);
+  CompositeParams compositeParams = {
+    .size = { (i32)extent.width, (i32)extent.height },
+    .targetTexel = { 1.0f / pPost->extent.width, 1.0f / pPost->extent.height },
+    .bloomMaxUv = { (valid[0].width - 0.5f) / bloomWidth, (valid[0].height - 0.5f) / bloomHeight },
+    .bloomIntensity = pSettings->bloomIntensity / pPost->bloomLevels, // Every level was summed into the first
+    .saturation = pSettings->saturation,
+    .contrast = pSettings->contrast,
+    .colorFilter = { pSettings->colorFilter[0], pSettings->colorFilter[1], pSettings->colorFilter[2], 1.0f }
+  };
+  vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pPost->compositePipeline);
+  vkCmdPushConstants(commandBuffer, pPost->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(compositeParams), &compositeParams);
+  vkCmdDispatch(commandBuffer, dispatchCount(extent.width, COMPOSITE_GROUP), dispatchCount(extent.height, COMPOSITE_GROUP), 1);
+  writeTimestamp(pPost, commandBuffer, frame, 3);
+
+  VkImageMemoryBarrier endBarrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+    .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = target,
+    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+  };
+  VkBufferMemoryBarrier exposureBarrier = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+    .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+    .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = pPost->exposureBuffer,
+    .offset = 0,
+    .size = VK_WHOLE_SIZE
+  };
+  vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+                       0, NULL, 1, &exposureBarrier, 1, &endBarrier);
+  pFrame->timestampsPending = pPost->timestampPool != VK_NULL_HANDLE;
+}
+
+bool postCollectTimings(PostProcessing *pPost, u32 frame) {
+  PostFrame *pFrame = &pPost->frames[frame];
+  if (!pFrame->timestampsPending) {
+    return false;
+  }
+  pFrame->timestampsPending = false;
+
+  u64 timestamps[POST_TIMESTAMPS];
+  VkResult result = vkGetQueryPoolResults(
+    pPost->device, pPost->timestampPool, frame * POST_TIMESTAMPS, POST_TIMESTAMPS,
+    sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) {
+    return false;
+  }
+  for (u32 effect = 0; effect < POST_EFFECT_COUNT; effect++) {
+    u64 ticks = (timestamps[effect + 1] - timestamps[effect]) & pPost->timestampMask;
+    pPost->effectMs[effect] = ticks * pPost->timestampPeriodNs / 1e6;
+  }
+  return true;
+}
+
+bool postExposureSettled(const PostProcessing *pPost) {
+  const volatile ExposureState *pState = pPost->pExposureState;
+  float target = pState->target;
+  return fabsf(pState->exposure - target) <= POST_EXPOSURE_SETTLED * target;
+}
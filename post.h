@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdbool.h>
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+
+// The scene renders into an HDR target that compute passes finish in place:
+// a bloom chain is downsampled from it and accumulated back up, then one
+// composite dispatch adds the bloom, exposes, tonemaps and grades each
+// pixel while metering luminance for the next frame's exposure.
+#define POST_HDR_FORMAT VK_FORMAT_R16G16B16A16_SFLOAT
+#define POST_BLOOM_LEVELS 5 // Mips of the half resolution bloom chain, fewer on tiny windows
+#define POST_MAX_FRAMES 4
+#define POST_EXPOSURE_SETTLED 0.01f // Distance to the target, relative to it, that counts as adapted
+
+typedef enum PostEffect {
+  POST_EFFECT_BLOOM_DOWNSAMPLE = 0, // Includes the threshold, fused into the first level
+  POST_EFFECT_BLOOM_UPSAMPLE,
+  POST_EFFECT_COMPOSITE, // Exposure, tonemapping, grading and metering
+  POST_EFFECT_COUNT
+} PostEffect;
+
+// May be changed between frames
+typedef struct PostSettings {
+  float bloomThreshold; // Luminance where bloom starts
+  float bloomKnee; // Width of the soft transition around the threshold
+  float bloomIntensity;
+  float bloomRadius; // Upsample filter spread in texels
+  float exposureKey; // Average scene luminance is exposed to this
+  float exposureMin;
+  float exposureMax;
+  float adaptationSpeed; // Per second
+  float saturation;
+  float contrast;
+  float colorFilter[3]; // Multiplies the graded colour
+} PostSettings;
+
+typedef struct PostCreateInfo {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  u32 apiVersion; // Subgroup metering needs 1.1
+  u32 frameCount; // One per frame in flight
+  VkExtent2D extent; // Of the HDR targets
+  const VkImageView *targetViews; // frameCount views of the HDR targets
+  const char *shaderDir; // Passed to shaderCodeLoad
+  u32 timestampBits; // 0 disables timings
+  double timestampPeriodNs;
+} PostCreateInfo;
+
+// Everything one frame in flight reads and writes besides its HDR target
+typedef struct PostFrame {
+  VkImage bloomImage; // Stays in VK_IMAGE_LAYOUT_GENERAL
+  VkDeviceMemory bloomMemory;
+  VkImageView bloomLevelViews[POST_BLOOM_LEVELS]; // Storage, one per mip
+  VkImageView bloomView; // Sampled, every mip
+  VkDescriptorSet downsampleSets[POST_BLOOM_LEVELS]; // Level i is written from level i - 1, 0 from the target
+  VkDescriptorSet upsampleSets[POST_BLOOM_LEVELS - 1]; // Level i accumulates level i + 1
+  VkDescriptorSet compositeSet;
+  bool timestampsPending;
+} PostFrame;
+
+typedef struct PostProcessing {
+  VkDevice device;
+  VkPhysicalDevice physicalDevice;
+  PostSettings settings;
+  VkExtent2D extent;
+  u32 bloomLevels;
+  VkSampler sampler;
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool descriptorPool;
+  VkPipelineLayout pipelineLayout;
+  VkPipeline downsamplePipeline;
+  VkPipeline upsamplePipeline;
+  VkPipeline compositePipeline;
+  VkPipeline adaptPipeline;
+  bool subgroupMetering; // The composite reduces with subgroup arithmetic
+  VkBuffer exposureBuffer; // Current exposure and the luminance metered for the next
+  VkDeviceMemory exposureMemory;
+  void *pExposureState; // Mapped
+  PostFrame frames[POST_MAX_FRAMES];
+  u32 frameCount;
+  VkQueryPool timestampPool; // VK_NULL_HANDLE without timings
+  u64 timestampMask;
+  double timestampPeriodNs;
+  double effectMs[POST_EFFECT_COUNT]; // From the last frame collected
+} PostProcessing;
+
+void postInit(PostProcessing *pPost, const PostCreateInfo *pInfo);
+// The device must be idle
+void postDestroy(PostProcessing *pPost);
+// Rebuilds the bloom chains for new targets. The device must be idle.
+void postResize(PostProcessing *pPost, VkExtent2D extent, const VkImageView *targetViews);
+
+const char *postEffectName(PostEffect effect);
+
+// Runs the chain over target, whose top-left extent holds the frame in
+// VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL. Leaves it graded in
+// VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL. deltaSeconds drives adaptation.
+void postRecord(PostProcessing *pPost, VkCommandBuffer commandBuffer, u32 frame, VkImage target, VkExtent2D extent, float deltaSeconds);
+
+// Reads the frame's effect timings into effectMs once its fence has
+// signaled. Returns false when there were none.
+bool postCollectTimings(PostProcessing *pPost, u32 frame);
+
+// Whether exposure has reached the target metered from the newest finished
+// frame. A frame still in flight may be moving it meanwhile.
+bool postExposureSettled(const PostProcessing *pPost);
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "renderqueue.h"
+#include "memtrack.h"
+
+static void renderQueueGrow(RenderQueue *pQueue, u32 capacity) {
+  pQueue->items = memoryRealloc(pQueue->items, sizeof(RenderQueueItem) * capacity, MEMORY_TAG_SCENE);
+  pQueue->scratch = memoryRealloc(pQueue->scratch, sizeof(RenderQueueItem) * capacity, MEMORY_TAG_SCENE);
+  pQueue->draws = memoryRealloc(pQueue->draws, sizeof(RenderDraw) * capacity, MEMORY_TAG_SCENE);
+  if (pQueue->items == NULL || pQueue->scratch == NULL || pQueue->draws == NULL) {
+    printf("Failed to allocate render queue!\n");
+    exit(18);
+  }
+  pQueue->capacity = capacity;
+}
+
+void renderQueueInit(RenderQueue *pQueue, u32 initialCapacity) {
+  memset(pQueue, 0, sizeof(RenderQueue));
+  renderQueueGrow(pQueue, initialCapacity > 0 ? initialCapacity : 64);
+}
+
+void renderQueueDestroy(RenderQueue *pQueue) {
+  memoryFree(pQueue->items);
+  memoryFree(pQueue->scratch);
+  memoryFree(pQueue->draws);
+  memset(pQueue, 0, sizeof(RenderQueue));
+}
+
+void renderQueueReset(RenderQueue *pQueue) {
+  pQueue->count = 0;
+}
+
+void renderQueueSubmit(RenderQueue *pQueue, u64 key, const RenderDraw *pDraw) {
+  if (pQueue->count == pQueue->capacity) {
+    renderQueueGrow(pQueue, pQueue->capacity * 2);
+  }
+
+  u32 index = pQueue->count++;
+  pQueue->draws[index] = *pDraw;
+  pQueue->items[index].key = key;
+  pQueue->items[index].drawIndex = index;
+  pQueue->items[index].padding = 0;
+}
+
+void renderQueueSort(RenderQueue *pQueue) {
+  u32 count = pQueue->count;
+  if (count < 2) return;
+
+  // One read of the keys builds the histograms for all 8 digits
+  u32 histograms[8][256];
+  memset(histograms, 0, sizeof(histograms));
+  for (u32 i = 0; i < count; i++) {
+    u64 key = pQueue->items[i].key;
+    for (u32 digit = 0; digit < 8; digit++) {
+      histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+    }
+  }
+
+  RenderQueueItem *src = pQueue->items;
+  RenderQueueItem *dst = pQueue->scratch;
+
+  for (u32 digit = 0; digit < 8; digit++) {
+    u32 *histogram = histograms[digit];
+    u32 shift = digit * 8;
+
+    // Every key shares this digit, order wouldn't change
+    if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+      continue;
+    }
+
+    u32 offset = 0;
+    for (u32 bucket = 0; bucket < 256; bucket++) {
+      u32 bucketCount = histogram[bucket];
+      histogram[bucket] = offset;
+      offset += bucketCount;
+    }
+
+    for (u32 i = 0; i < count; i++) {
+      u32 bucket = (src[i].key >> shift) & 0xFF;
+      dst[histogram[bucket]++] = src[i];
+    }
+
+    RenderQueueItem *tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  // An odd number of passes leaves the result in the scratch buffer
+  if (src != pQueue->items) {
+    pQueue->scratch = pQueue->items;
+    pQueue->items = src;
+  }
+}
+
+RenderQueueStats renderQueueReplay(const RenderQueue *pQueue, const RenderQueueCallbacks *pCallbacks) {
+  RenderQueueStats stats = {0};
+  void *pUserData = pCallbacks->pUserData;
+
+  u32 currentPass = 0;
+  u32 currentPipeline = 0;
+  u32 currentMaterial = 0;
+  bool first = true;
+
+  for (u32 i = 0; i < pQueue->count; i++) {
+    u64 key = pQueue->items[i].key;
+    u32 pass = renderKeyPass(key);
+    u32 pipeline = renderKeyPipeline(key);
+    u32 material = renderKeyMaterial(key);
+
+    bool passChanged = first || pass != currentPass;
+    if (passChanged) {
+      if (pCallbacks->bindPass) pCallbacks->bindPass(pUserData, pass);
+      currentPass = pass;
+      stats.passChanges++;
+    }
+    if (passChanged || pipeline != currentPipeline) {
+      if (pCallbacks->bindPipeline) pCallbacks->bindPipeline(pUserData, pipeline);
+      currentPipeline = pipeline;
+      stats.pipelineChanges++;
+    }
+    if (passChanged || material != currentMaterial) {
+      if (pCallbacks->bindMaterial) pCallbacks->bindMaterial(pUserData, material);
+      currentMaterial = material;
+      stats.materialChanges++;
+    }
+    first = false;
+
+    if (pCallbacks->draw) pCallbacks->draw(pUserData, &pQueue->draws[pQueue->items[i].drawIndex]);
+    stats.draws++;
+  }
+
+  return stats;
+}
+
+static u64 quantizeDepth(float depth) {
+  if (!(depth > 0.0f)) depth = 0.0f; // Also catches NaN
+  if (depth > 1.0f) depth = 1.0f;
+  return (u64)(depth * (float)RENDER_KEY_MASK(RENDER_KEY_DEPTH_BITS));
+}
+
+u64 renderKeyEncode(u32 pass, u32 pipeline, u32 material, float depth) {
+  return ((u64)(pass & RENDER_KEY_MASK(RENDER_KEY_PASS_BITS)) << RENDER_KEY_PASS_SHIFT) |
+    ((u64)(pipeline & RENDER_KEY_MASK(RENDER_KEY_PIPELINE_BITS)) << RENDER_KEY_PIPELINE_SHIFT) |
+    ((u64)(material & RENDER_KEY_MASK(RENDER_KEY_MATERIAL_BITS)) << RENDER_KEY_MATERIAL_SHIFT) |
+    (quantizeDepth(depth) << RENDER_KEY_DEPTH_SHIFT);
+}
+
+u64 renderKeyEncodeBackToFront(u32 pass, u32 pipeline, u32 material, float depth) {
+  u64 key = renderKeyEncode(pass, pipeline, material, 0.0f);
+  u64 inverted = RENDER_KEY_MASK(RENDER_KEY_DEPTH_BITS) - quantizeDepth(depth);
+  return key | (inverted << RENDER_KEY_DEPTH_SHIFT);
+}
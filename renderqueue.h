@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+// Sort key layout, most significant first. Sorting by key groups draws by
+// pass, then pipeline, then material, and orders by depth within those.
+//
+//  63    60 59        48 47          32 31            8 7     0
+// | pass   | pipeline   | material     | depth          | unused |
+#define RENDER_KEY_PASS_BITS 4
+#define RENDER_KEY_PIPELINE_BITS 12
+#define RENDER_KEY_MATERIAL_BITS 16
+#define RENDER_KEY_DEPTH_BITS 24
+
+#define RENDER_KEY_PASS_SHIFT 60
+#define RENDER_KEY_PIPELINE_SHIFT 48
+#define RENDER_KEY_MATERIAL_SHIFT 32
+#define RENDER_KEY_DEPTH_SHIFT 8
+
+#define RENDER_KEY_MASK(bits) ((1ULL << (bits)) - 1)
+
+typedef struct RenderDraw {
+  u32 vertexCount;
+  u32 instanceCount;
+  u32 firstVertex;
+  u32 firstInstance;
+  u32 objectIndex; // Per-object data for the draw callback
+  u32 indexCount; // Indexed when nonzero, vertexCount and firstVertex are unused then
+  u32 firstIndex;
+  i32 vertexOffset;
+} RenderDraw;
+
+typedef struct RenderQueueItem {
+  u64 key;
+  u32 drawIndex;
+  u32 padding;
+} RenderQueueItem;
+
+typedef struct RenderQueue {
+  RenderQueueItem *items;
+  RenderQueueItem *scratch; // Radix sort ping-pong buffer
+  RenderDraw *draws;
+  u32 count;
+  u32 capacity;
+} RenderQueue;
+
+typedef struct RenderQueueStats {
+  u32 draws;
+  u32 passChanges;
+  u32 pipelineChanges;
+  u32 materialChanges;
+} RenderQueueStats;
+
+// Called by renderQueueReplay only when the value differs from the previous
+// draw. Any callback may be NULL, which makes replay usable for counting.
+typedef struct RenderQueueCallbacks {
+  void *pUserData;
+  void (*bindPass)(void *pUserData, u32 pass);
+  void (*bindPipeline)(void *pUserData, u32 pipeline);
+  void (*bindMaterial)(void *pUserData, u32 material);
+  void (*draw)(void *pUserData, const RenderDraw *pDraw);
+} RenderQueueCallbacks;
+
+void renderQueueInit(RenderQueue *pQueue, u32 initialCapacity);
+void renderQueueDestroy(RenderQueue *pQueue);
+void renderQueueReset(RenderQueue *pQueue);
+
+void renderQueueSubmit(RenderQueue *pQueue, u64 key, const RenderDraw *pDraw);
+
+// Stable LSD radix sort on the key, 8 bits per pass. Passes where every key
+// has the same digit are skipped, so unused key bits cost nothing.
+void renderQueueSort(RenderQueue *pQueue);
+
+// Walks the queue in its current order, skipping redundant binds. A pass
+// change forces the pipeline and material to be rebound.
+RenderQueueStats renderQueueReplay(const RenderQueue *pQueue, const RenderQueueCallbacks *pCallbacks);
+
+// depth is a view depth normalized to 0..1
+u64 renderKeyEncode(u32 pass, u32 pipeline, u32 material, float depth);
+// Same, but far draws sort first (for blending)
+u64 renderKeyEncodeBackToFront(u32 pass, u32 pipeline, u32 material, float depth);
+
+static inline u32 renderKeyPass(u64 key) {
+  return (u32)((key >> RENDER_KEY_PASS_SHIFT) & RENDER_KEY_MASK(RENDER_KEY_PASS_BITS));
+}
+
+static inline u32 renderKeyPipeline(u64 key) {
+  return (u32)((key >> RENDER_KEY_PIPELINE_SHIFT) & RENDER_KEY_MASK(RENDER_KEY_PIPELINE_BITS));
+}
+
+static inline u32 renderKeyMaterial(u64 key) {
+  return (u32)((key >> RENDER_KEY_MATERIAL_SHIFT) & RENDER_KEY_MASK(RENDER_KEY_MATERIAL_BITS));
+}
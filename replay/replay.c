@@ -0,0 +1,842 @@
+// Plays back a recording made with `game --record` on a headless device:
+// the same pipelines, geometry, lights and draws, frame by frame, without
+// the window, simulation or culling that produced them. Reports like the
+// game's --bench, so runs can be compared with bench/benchcmp.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vulkan/vulkan.h>
+
+#include "types.h"
+#include "device.h"
+#include "memtrack.h"
+#include "pipelines.h"
+#include "clusters.h"
+#include "post.h"
+#include "shadercode.h"
+#include "replayfile.h"
+#include "bench.h"
+#include "log.h"
+
+#define FRAMES_IN_FLIGHT 2
+#define WARMUP_FRAMES 60 // Also covers pipelines still compiling in the background
+
+typedef struct Replay {
+  ReplayFile file;
+  const char *shaderDir;
+  VkInstance instance;
+  u32 apiVersion; // Instance API version, capped at 1.3
+  DeviceSelection selection;
+  VkDevice device;
+  VkQueue queue;
+  VkExtent2D extent; // Of every target, the largest any frame rendered to
+  VkFilter upscaleFilter;
+  VkImage targets[FRAMES_IN_FLIGHT]; // In the setup's renderFormat
+  VkDeviceMemory targetMemory[FRAMES_IN_FLIGHT];
+  VkImageView targetViews[FRAMES_IN_FLIGHT];
+  VkImage presentImages[FRAMES_IN_FLIGHT]; // Stand in for the swap chain, in its format
+  VkDeviceMemory presentMemory[FRAMES_IN_FLIGHT];
+  VkFormat depthFormat; // VK_FORMAT_UNDEFINED when the game drew without a depth buffer
+  VkImage depthImages[FRAMES_IN_FLIGHT];
+  VkDeviceMemory depthMemory[FRAMES_IN_FLIGHT];
+  VkImageView depthViews[FRAMES_IN_FLIGHT];
+  VkFramebuffer framebuffers[FRAMES_IN_FLIGHT];
+  VkRenderPass renderPass;
+  VkPipelineLayout pipelineLayout;
+  PipelineManager pipelines;
+  ClusteredLighting lighting;
+  bool postProcessing;
+  PostProcessing post;
+  VkBuffer vertexBuffers[PIPELINE_MAX_VERTEX_LAYOUTS]; // VK_NULL_HANDLE for layouts without vertices
+  VkDeviceMemory vertexMemory[PIPELINE_MAX_VERTEX_LAYOUTS];
+  VkBuffer indexBuffer;
+  VkDeviceMemory indexMemory;
+  VkBuffer instanceBuffer; // VK_NULL_HANDLE without instance data
+  VkDeviceMemory instanceMemory;
+  VkCommandPool commandPool;
+  VkCommandBuffer commandBuffers[FRAMES_IN_FLIGHT];
+  VkFence fences[FRAMES_IN_FLIGHT];
+  VkQueryPool timestampPool; // Start and end of each frame in flight
+  bool timestampsPending[FRAMES_IN_FLIGHT];
+  u64 timestampMask;
+  double timestampPeriodNs;
+  Light *lights; // The frame being replayed
+  ReplayCommand *commands;
+  Bench bench;
+} Replay;
+
+static const char *gpuNames[1 + POST_EFFECT_COUNT];
+
+static void usage(const char *program) {
+  printf("Usage: %s [--paced] [--loops n] [--warmup n] [--output file] [--shader-dir dir] recording\n", program);
+  exit(1);
+}
+
+// Nothing is presented, so the instance needs no extensions
+static void createInstance(Replay *pReplay) {
+  PFN_vkEnumerateInstanceVersion enumerateVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+  u32 version = VK_API_VERSION_1_0;
+  if (enumerateVersion != NULL && enumerateVersion(&version) != VK_SUCCESS) {
+    version = VK_API_VERSION_1_0;
+  }
+  if (version > VK_API_VERSION_1_3) {
+    version = VK_API_VERSION_1_3;
+  }
+
+  VkApplicationInfo appInfo = {
+    .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+    .pApplicationName = "SeEngine replay",
+    .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+    .pEngineName = "No Engine",
+    .engineVersion = VK_MAKE_VERSION(1, 0, 0),
+    .apiVersion = version
+  };
+  pReplay->apiVersion = version;
+  VkInstanceCreateInfo createInfo = {
+    .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+    .pApplicationInfo = &appInfo
+  };
+  if (vkCreateInstance(&createInfo, &memoryVulkanCallbacks, &pReplay->instance) != VK_SUCCESS) {
+    printf("Failed to create Vulkan Instance\n");
+    exit(3);
+  }
+
+  DeviceRequirements requirements = {
+    .minApiVersion = VK_API_VERSION_1_0,
+    .extendedDynamicState = true
+  };
+  if (!deviceSelect(pReplay->instance, VK_NULL_HANDLE, version, &requirements, &pReplay->selection)) {
+    printf("Failed to find a suitable GPU!\n");
+    exit(3);
+  }
+  LOG_INFO(LOG_CATEGORY_DEVICE, "Selected GPU: %s", pReplay->selection.properties.deviceName);
+
+  DeviceQueues queues;
+  pReplay->device = deviceCreate(&pReplay->selection, 0, NULL, &queues);
+  if (pReplay->device == VK_NULL_HANDLE) {
+    printf("Failed to create logical device!\n");
+    exit(3);
+  }
+  pReplay->queue = queues.graphics;
+}
+
+static VkDeviceMemory allocateImage(Replay *pReplay, VkImage image) {
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(pReplay->device, image, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pReplay->selection.physicalDevice, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+  };
+  VkDeviceMemory memory;
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pReplay->device, pReplay->selection.physicalDevice, &allocInfo, MEMORY_TAG_FRAME, &memory) != VK_SUCCESS ||
+      vkBindImageMemory(pReplay->device, image, memory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate target memory!\n");
+    exit(4);
+  }
+  return memory;
+}
+
+// Offscreen targets as the game renders into with post-processing or
+// dynamic resolution, and the images it would blit them into
+static void createTargets(Replay *pReplay) {
+  const ReplaySetup *pSetup = &pReplay->file.setup;
+  VkFormatProperties properties;
+  vkGetPhysicalDeviceFormatProperties(pReplay->selection.physicalDevice, pSetup->renderFormat, &properties);
+  VkFormatFeatureFlags required = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_BLIT_SRC_BIT;
+  if ((properties.optimalTilingFeatures & required) != required) {
+    printf("Render format %u not supported!\n", pSetup->renderFormat);
+    exit(4);
+  }
+  pReplay->upscaleFilter = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+  VkAttachmentDescription colorAttachment = {
+    .format = pSetup->renderFormat,
+    .samples = VK_SAMPLE_COUNT_1_BIT,
+    .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+  };
+  // The pipelines were recorded with the game's depth format. Occlusion
+  // culling isn't replayed, the recording has every draw.
+  pReplay->depthFormat = (VkFormat)pSetup->pipelines[0].depthFormat;
+  bool depth = pReplay->depthFormat != VK_FORMAT_UNDEFINED;
+  VkAttachmentDescription attachments[2] = {
+    colorAttachment,
+    {
+      .format = pReplay->depthFormat,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+      .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    }
+  };
+  VkAttachmentReference colorAttachmentRef = { .attachment = 0, .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+  VkAttachmentReference depthAttachmentRef = { .attachment = 1, .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+  VkSubpassDescription subpass = {
+    .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+    .colorAttachmentCount = 1,
+    .pColorAttachments = &colorAttachmentRef,
+    .pDepthStencilAttachment = depth ? &depthAttachmentRef : NULL
+  };
+  VkSubpassDependency dependency = {
+    .srcSubpass = VK_SUBPASS_EXTERNAL,
+    .dstSubpass = 0,
+    .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+    .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+  };
+  if (depth) {
+    dependency.srcStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+    dependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+  }
+  VkRenderPassCreateInfo renderPassInfo = {
+    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+    .attachmentCount = depth ? 2 : 1,
+    .pAttachments = attachments,
+    .subpassCount = 1,
+    .pSubpasses = &subpass,
+    .dependencyCount = 1,
+    .pDependencies = &dependency
+  };
+  if (vkCreateRenderPass(pReplay->device, &renderPassInfo, &memoryVulkanCallbacks, &pReplay->renderPass) != VK_SUCCESS) {
+    printf("Failed to create render pass!\n");
+    exit(4);
+  }
+
+  pReplay->extent = (VkExtent2D){ pReplay->file.maxTargetWidth, pReplay->file.maxTargetHeight };
+  for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++) {
+    VkImageCreateInfo imageInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = pSetup->renderFormat,
+      .extent = { pReplay->extent.width, pReplay->extent.height, 1 },
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    if (pReplay->postProcessing) {
+      imageInfo.usage |= VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+    }
+    if (vkCreateImage(pReplay->device, &imageInfo, &memoryVulkanCallbacks, &pReplay->targets[i]) != VK_SUCCESS) {
+      printf("Failed to create target image!\n");
+      exit(4);
+    }
+    pReplay->targetMemory[i] = allocateImage(pReplay, pReplay->targets[i]);
+
+    imageInfo.format = pSetup->swapChainFormat;
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if (vkCreateImage(pReplay->device, &imageInfo, &memoryVulkanCallbacks, &pReplay->presentImages[i]) != VK_SUCCESS) {
+      printf("Failed to create target image!\n");
+      exit(4);
+    }
+    pReplay->presentMemory[i] = allocateImage(pReplay, pReplay->presentImages[i]);
+
+    VkImageViewCreateInfo viewInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = pReplay->targets[i],
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = pSetup->renderFormat,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    if (vkCreateImageView(pReplay->device, &viewInfo, &memoryVulkanCallbacks, &pReplay->targetViews[i]) != VK_SUCCESS) {
+      printf("Failed to create target image view!\n");
+      exit(4);
+    }
+
+    if (depth) {
+      imageInfo.format = pReplay->depthFormat;
+      imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+      if (vkCreateImage(pReplay->device, &imageInfo, &memoryVulkanCallbacks, &pReplay->depthImages[i]) != VK_SUCCESS) {
+        printf("Failed to create target image!\n");
+        exit(4);
+      }
+      pReplay->depthMemory[i] = allocateImage(pReplay, pReplay->depthImages[i]);
+      viewInfo.image = pReplay->depthImages[i];
+      viewInfo.format = pReplay->depthFormat;
+      viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+      if (vkCreateImageView(pReplay->device, &viewInfo, &memoryVulkanCallbacks, &pReplay->depthViews[i]) != VK_SUCCESS) {
+        printf("Failed to create target image view!\n");
+        exit(4);
+      }
+    }
+
+    VkImageView framebufferViews[2] = { pReplay->targetViews[i], pReplay->depthViews[i] };
+    VkFramebufferCreateInfo framebufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+      .renderPass = pReplay->renderPass,
+      .attachmentCount = depth ? 2 : 1,
+      .pAttachments = framebufferViews,
+      .width = pReplay->extent.width,
+      .height = pReplay->extent.height,
+      .layers = 1
+    };
+    if (vkCreateFramebuffer(pReplay->device, &framebufferInfo, &memoryVulkanCallbacks, &pReplay->framebuffers[i]) != VK_SUCCESS) {
+      printf("Failed to create framebuffer!\n");
+      exit(4);
+    }
+  }
+}
+
+static VkShaderModule createShaderModule(Replay *pReplay, const char *name) {
+  ShaderCode code;
+  shaderCodeLoad(name, pReplay->shaderDir, &code);
+  VkShaderModuleCreateInfo createInfo = {
+    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+    .codeSize = code.size,
+    .pCode = code.words
+  };
+  VkShaderModule module;
+  if (vkCreateShaderModule(pReplay->device, &createInfo, &memoryVulkanCallbacks, &module) != VK_SUCCESS) {
+    printf("Failed to create shader module %s!\n", name);
+    exit(5);
+  }
+  shaderCodeFree(&code);
+  return module;
+}
+
+// Everything the game's initVulkan creates that frames are drawn with
+static void createPipelines(Replay *pReplay) {
+  const ReplaySetup *pSetup = &pReplay->file.setup;
+  ShaderCode binningShader;
+  shaderCodeLoad("cluster.comp", pReplay->shaderDir, &binningShader);
+  ClusteredLightingCreateInfo lightingInfo = {
+    .device = pReplay->device,
+    .physicalDevice = pReplay->selection.physicalDevice,
+    .frameCount = FRAMES_IN_FLIGHT,
+    .maxLights = pSetup->maxLights,
+    .pBinningShader = &binningShader
+  };
+  clusteredLightingInit(&pReplay->lighting, &lightingInfo);
+  shaderCodeFree(&binningShader);
+
+  VkPushConstantRange transformRange = {
+    .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+    .offset = 0,
+    .size = 2 * sizeof(Mat4)
+  };
+  VkPipelineLayoutCreateInfo layoutInfo = {
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    .setLayoutCount = 1,
+    .pSetLayouts = &pReplay->lighting.setLayout,
+    .pushConstantRangeCount = 1,
+    .pPushConstantRanges = &transformRange
+  };
+  if (vkCreatePipelineLayout(pReplay->device, &layoutInfo, &memoryVulkanCallbacks, &pReplay->pipelineLayout) != VK_SUCCESS) {
+    printf("Failed to create pipeline layout!\n");
+    exit(5);
+  }
+
+  PipelineManagerCreateInfo managerInfo = {
+    .device = pReplay->device,
+    .layout = pReplay->pipelineLayout,
+    .renderPass = pReplay->renderPass,
+    .extendedDynamicState = pReplay->selection.extendedDynamicState,
+    .extendedDynamicStateIsCore = pReplay->selection.extendedDynamicStateIsCore,
+    .cachePath = "pipeline_cache.bin"
+  };
+  managerInfo.shaderSets[SHADER_SET_TRIANGLE].vert = createShaderModule(pReplay, "shader.vert");
+  managerInfo.shaderSets[SHADER_SET_TRIANGLE].frag = createShaderModule(pReplay, "shader.frag");
+  memcpy(managerInfo.vertexLayouts, pSetup->vertexLayouts, sizeof(PipelineVertexLayout) * pSetup->vertexLayoutCount);
+  pipelineManagerInit(&pReplay->pipelines, &managerInfo, &pSetup->pipelines[0]);
+  for (u32 i = 1; i < pSetup->pipelineCount; i++) {
+    pipelineManagerGet(&pReplay->pipelines, &pSetup->pipelines[i]);
+  }
+
+  if (pReplay->postProcessing) {
+    PostCreateInfo postInfo = {
+      .device = pReplay->device,
+      .physicalDevice = pReplay->selection.physicalDevice,
+      .apiVersion = pReplay->apiVersion,
+      .frameCount = FRAMES_IN_FLIGHT,
+      .extent = pReplay->extent,
+      .targetViews = pReplay->targetViews,
+      .shaderDir = pReplay->shaderDir,
+      .timestampBits = pReplay->selection.queueFamilies.graphicsTimestampBits,
+      .timestampPeriodNs = pReplay->selection.properties.limits.timestampPeriod
+    };
+    postInit(&pReplay->post, &postInfo);
+  }
+}
+
+static void createBuffer(Replay *pReplay, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *pBuffer, VkDeviceMemory *pMemory) {
+  VkBufferCreateInfo bufferInfo = {
+    .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+    .size = size,
+    .usage = usage,
+    .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  if (vkCreateBuffer(pReplay->device, &bufferInfo, &memoryVulkanCallbacks, pBuffer) != VK_SUCCESS) {
+    printf("Failed to create geometry buffer!\n");
+    exit(6);
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(pReplay->device, *pBuffer, &requirements);
+  VkMemoryAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = requirements.size,
+    .memoryTypeIndex = deviceFindMemoryType(pReplay->selection.physicalDevice, requirements.memoryTypeBits, properties)
+  };
+  if (allocInfo.memoryTypeIndex == UINT32_MAX ||
+      deviceAllocateMemory(pReplay->device, pReplay->selection.physicalDevice, &allocInfo, MEMORY_TAG_GEOMETRY, pMemory) != VK_SUCCESS ||
+      vkBindBufferMemory(pReplay->device, *pBuffer, *pMemory, 0) != VK_SUCCESS) {
+    printf("Failed to allocate geometry buffer memory!\n");
+    exit(6);
+  }
+}
+
+// Copies the recorded geometry into device local buffers, like the game's
+// uploadMeshes, then waits for the copy
+static void uploadGeometry(Replay *pReplay) {
+  const ReplayFile *pFile = &pReplay->file;
+  VkDeviceSize indexSize = sizeof(u32) * (VkDeviceSize)pFile->indexCount;
+  VkDeviceSize stagingSize = indexSize + pFile->instanceSize;
+  for (u32 layout = 0; layout < pFile->setup.vertexLayoutCount; layout++) {
+    stagingSize += pFile->vertexSizes[layout];
+  }
+  if (stagingSize == 0) return;
+
+  VkBuffer staging;
+  VkDeviceMemory stagingMemory;
+  createBuffer(pReplay, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging, &stagingMemory);
+  u8 *pMapped;
+  if (vkMapMemory(pReplay->device, stagingMemory, 0, VK_WHOLE_SIZE, 0, (void**)&pMapped) != VK_SUCCESS) {
+    printf("Failed to map geometry staging buffer!\n");
+    exit(6);
+  }
+
+  VkCommandBufferAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .commandPool = pReplay->commandPool,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = 1
+  };
+  VkCommandBufferBeginInfo beginInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+    .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  VkCommandBuffer commandBuffer;
+  if (vkAllocateCommandBuffers(pReplay->device, &allocInfo, &commandBuffer) != VK_SUCCESS ||
+      vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("Failed to record geometry upload!\n");
+    exit(6);
+  }
+
+  VkDeviceSize stagingOffset = 0;
+  for (u32 layout = 0; layout < pFile->setup.vertexLayoutCount; layout++) {
+    VkDeviceSize size = pFile->vertexSizes[layout];
+    if (size == 0) continue;
+    memcpy(pMapped + stagingOffset, pFile->vertices[layout], size);
+    createBuffer(pReplay, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pReplay->vertexBuffers[layout], &pReplay->vertexMemory[layout]);
+    VkBufferCopy copy = { .srcOffset = stagingOffset, .dstOffset = 0, .size = size };
+    vkCmdCopyBuffer(commandBuffer, staging, pReplay->vertexBuffers[layout], 1, &copy);
+    stagingOffset += size;
+  }
+  if (indexSize > 0) {
+    memcpy(pMapped + stagingOffset, pFile->indices, indexSize);
+    createBuffer(pReplay, indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pReplay->indexBuffer, &pReplay->indexMemory);
+    VkBufferCopy copy = { .srcOffset = stagingOffset, .dstOffset = 0, .size = indexSize };
+    vkCmdCopyBuffer(commandBuffer, staging, pReplay->indexBuffer, 1, &copy);
+    stagingOffset += indexSize;
+  }
+  if (pFile->instanceSize > 0) {
+    memcpy(pMapped + stagingOffset, pFile->instances, pFile->instanceSize);
+    createBuffer(pReplay, pFile->instanceSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &pReplay->instanceBuffer, &pReplay->instanceMemory);
+    VkBufferCopy copy = { .srcOffset = stagingOffset, .dstOffset = 0, .size = pFile->instanceSize };
+    vkCmdCopyBuffer(commandBuffer, staging, pReplay->instanceBuffer, 1, &copy);
+  }
+  vkUnmapMemory(pReplay->device, stagingMemory);
+
+  VkSubmitInfo submitInfo = {
+    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+    .commandBufferCount = 1,
+    .pCommandBuffers = &commandBuffer
+  };
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS ||
+      vkQueueSubmit(pReplay->queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS ||
+      vkQueueWaitIdle(pReplay->queue) != VK_SUCCESS) {
+    printf("Failed to upload geometry!\n");
+    exit(6);
+  }
+  vkFreeCommandBuffers(pReplay->device, pReplay->commandPool, 1, &commandBuffer);
+  vkDestroyBuffer(pReplay->device, staging, &memoryVulkanCallbacks);
+  deviceFreeMemory(pReplay->device, stagingMemory);
+}
+
+static void createFrames(Replay *pReplay) {
+  VkCommandPoolCreateInfo poolInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+    .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+    .queueFamilyIndex = pReplay->selection.queueFamilies.graphics
+  };
+  VkCommandBufferAllocateInfo allocInfo = {
+    .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    .commandBufferCount = FRAMES_IN_FLIGHT
+  };
+  if (vkCreateCommandPool(pReplay->device, &poolInfo, &memoryVulkanCallbacks, &pReplay->commandPool) != VK_SUCCESS) {
+    printf("Failed to create command pool!\n");
+    exit(7);
+  }
+  allocInfo.commandPool = pReplay->commandPool;
+  if (vkAllocateCommandBuffers(pReplay->device, &allocInfo, pReplay->commandBuffers) != VK_SUCCESS) {
+    printf("Failed to allocate command buffers!\n");
+    exit(7);
+  }
+
+  VkFenceCreateInfo fenceInfo = {
+    .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    .flags = VK_FENCE_CREATE_SIGNALED_BIT
+  };
+  for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++) {
+    if (vkCreateFence(pReplay->device, &fenceInfo, &memoryVulkanCallbacks, &pReplay->fences[i]) != VK_SUCCESS) {
+      printf("Failed to create fence!\n");
+      exit(7);
+    }
+  }
+
+  u32 bits = pReplay->selection.queueFamilies.graphicsTimestampBits;
+  if (bits > 0) {
+    VkQueryPoolCreateInfo queryInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2 * FRAMES_IN_FLIGHT
+    };
+    if (vkCreateQueryPool(pReplay->device, &queryInfo, &memoryVulkanCallbacks, &pReplay->timestampPool) != VK_SUCCESS) {
+      printf("Failed to create timestamp query pool!\n");
+      exit(7);
+    }
+    pReplay->timestampMask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+    pReplay->timestampPeriodNs = pReplay->selection.properties.limits.timestampPeriod;
+  }
+
+  pReplay->lights = memoryAlloc(sizeof(Light) * (pReplay->file.maxLightCount + 1), MEMORY_TAG_SCENE);
+  pReplay->commands = memoryAlloc(sizeof(ReplayCommand) * (pReplay->file.maxCommandCount + 1), MEMORY_TAG_SCENE);
+  if (pReplay->lights == NULL || pReplay->commands == NULL) {
+    printf("Failed to allocate frame!\n");
+    exit(7);
+  }
+}
+
+static void transitionImage(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout oldLayout, VkImageLayout newLayout,
+                            VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, VkPipelineStageFlags srcStageMask, VkPipelineStageFlags dstStageMask) {
+  VkImageMemoryBarrier barrier = {
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+    .srcAccessMask = srcAccessMask,
+    .dstAccessMask = dstAccessMask,
+    .oldLayout = oldLayout,
+    .newLayout = newLayout,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = image,
+    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+  };
+  vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+// The game's recordCommandBuffer, with the render queue's callbacks read
+// back from the recording. Returns the triangles drawn.
+static u64 recordFrame(Replay *pReplay, u32 slot, const ReplayFrameHeader *pFrame) {
+  VkCommandBuffer commandBuffer = pReplay->commandBuffers[slot];
+  VkCommandBufferBeginInfo beginInfo = { .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+  if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+    printf("Failed to begin recording command buffer!\n");
+    exit(8);
+  }
+  if (pReplay->timestampPool != VK_NULL_HANDLE) {
+    vkCmdResetQueryPool(commandBuffer, pReplay->timestampPool, slot * 2, 2);
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, pReplay->timestampPool, slot * 2);
+  }
+
+  VkExtent2D renderExtent = { pFrame->renderWidth, pFrame->renderHeight };
+  clusteredLightingRecord(&pReplay->lighting, commandBuffer, slot);
+
+  VkClearValue clearValues[2] = {
+    { .color = {{0.0f, 0.0f, 0.0f, pReplay->postProcessing ? 0.0f : 1.0f}} },
+    { .depthStencil = { 1.0f, 0 } }
+  };
+  VkRenderPassBeginInfo renderPassInfo = {
+    .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+    .renderPass = pReplay->renderPass,
+    .framebuffer = pReplay->framebuffers[slot],
+    .renderArea = { { 0, 0 }, renderExtent },
+    .clearValueCount = pReplay->depthFormat != VK_FORMAT_UNDEFINED ? 2 : 1,
+    .pClearValues = clearValues
+  };
+  vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  pipelineManagerBeginFrame(&pReplay->pipelines);
+
+  VkViewport viewport = { 0.0f, 0.0f, (float)renderExtent.width, (float)renderExtent.height, 0.0f, 1.0f };
+  vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+  VkRect2D scissor = { { 0, 0 }, renderExtent };
+  vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+  if (pReplay->indexBuffer != VK_NULL_HANDLE) {
+    vkCmdBindIndexBuffer(commandBuffer, pReplay->indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+  }
+  vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pReplay->pipelineLayout, 0, 1,
+                          &pReplay->lighting.frames[slot].descriptorSet, 0, NULL);
+
+  u64 triangles = 0;
+  bool skipDraws = false;
+  for (u32 i = 0; i < pFrame->commandCount; i++) {
+    const ReplayCommand *pCommand = &pReplay->commands[i];
+    if (pCommand->op == REPLAY_COMMAND_BIND_PIPELINE) {
+      const PipelineKey *pKey = &pReplay->file.setup.pipelines[pCommand->pipeline];
+      skipDraws = !pipelineManagerBind(&pReplay->pipelines, commandBuffer, pKey);
+      VkBuffer buffers[2] = { pReplay->vertexBuffers[pKey->vertexLayout], pReplay->instanceBuffer };
+      VkDeviceSize offsets[2] = { 0, 0 };
+      if (!skipDraws && buffers[0] != VK_NULL_HANDLE) {
+        u32 bindingCount = pReplay->file.setup.vertexLayouts[pKey->vertexLayout].instanceStride > 0 ? 2 : 1;
+        vkCmdBindVertexBuffers(commandBuffer, 0, bindingCount, buffers, offsets);
+      }
+      continue;
+    }
+
+    const ReplayDraw *pDraw = &pCommand->draw;
+    if (skipDraws) continue;
+    vkCmdPushConstants(commandBuffer, pReplay->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(Mat4), &pDraw->transform);
+    vkCmdPushConstants(commandBuffer, pReplay->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, sizeof(Mat4), sizeof(Mat4), &pDraw->model);
+    if (pDraw->indexCount > 0) {
+      vkCmdDrawIndexed(commandBuffer, pDraw->indexCount, pDraw->instanceCount, pDraw->firstIndex, pDraw->vertexOffset, pDraw->firstInstance);
+      triangles += (u64)(pDraw->indexCount / 3) * pDraw->instanceCount;
+    } else {
+      vkCmdDraw(commandBuffer, pDraw->vertexCount, pDraw->instanceCount, pDraw->firstVertex, pDraw->firstInstance);
+      triangles += (u64)(pDraw->vertexCount / 3) * pDraw->instanceCount;
+    }
+  }
+  vkCmdEndRenderPass(commandBuffer);
+
+  VkImage source = pReplay->targets[slot];
+  if (pReplay->postProcessing) {
+    postRecord(&pReplay->post, commandBuffer, slot, source, renderExtent, pFrame->postDeltaSeconds);
+  } else {
+    transitionImage(commandBuffer, source,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  }
+  VkImage destination = pReplay->presentImages[slot];
+  transitionImage(commandBuffer, destination,
+    VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    0, VK_ACCESS_TRANSFER_WRITE_BIT,
+    VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  VkImageBlit region = {
+    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+    .srcOffsets = { { 0, 0, 0 }, { (i32)renderExtent.width, (i32)renderExtent.height, 1 } },
+    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+    .dstOffsets = { { 0, 0, 0 }, { (i32)pFrame->targetWidth, (i32)pFrame->targetHeight, 1 } }
+  };
+  vkCmdBlitImage(commandBuffer, source, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+    destination, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, pReplay->upscaleFilter);
+
+  if (pReplay->timestampPool != VK_NULL_HANDLE) {
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pReplay->timestampPool, slot * 2 + 1);
+  }
+  if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+    printf("Failed to record command buffer!\n");
+    exit(8);
+  }
+  return triangles;
+}
+
+// The slot's fence has signaled, so its timestamps from the last time
+// around are ready
+static void collectGpuTimes(Replay *pReplay, u32 slot) {
+  if (!pReplay->timestampsPending[slot]) return;
+  pReplay->timestampsPending[slot] = false;
+
+  double ms[1 + POST_EFFECT_COUNT] = { 0.0 };
+  u64 timestamps[2];
+  VkResult result = vkGetQueryPoolResults(
+    pReplay->device, pReplay->timestampPool, slot * 2, 2,
+    sizeof(timestamps), timestamps, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+  if (result != VK_SUCCESS) return;
+  ms[0] = ((timestamps[1] - timestamps[0]) & pReplay->timestampMask) * pReplay->timestampPeriodNs / 1e6;
+
+  u32 count = 1;
+  if (pReplay->postProcessing && postCollectTimings(&pReplay->post, slot)) {
+    memcpy(&ms[1], pReplay->post.effectMs, sizeof(pReplay->post.effectMs));
+    count += POST_EFFECT_COUNT;
+  }
+  benchRecordGpuTimes(&pReplay->bench, gpuNames, ms, count);
+}
+
+static void sleepUntil(double targetMs) {
+  double remainingMs = targetMs - benchNowMs();
+  if (remainingMs <= 0.0) return;
+  struct timespec delay = { (time_t)(remainingMs / 1000.0), (long)(((u64)(remainingMs * 1e6)) % 1000000000ull) };
+  nanosleep(&delay, NULL);
+}
+
+static void destroyReplay(Replay *pReplay) {
+  vkDeviceWaitIdle(pReplay->device);
+  memoryFree(pReplay->lights);
+  memoryFree(pReplay->commands);
+  if (pReplay->timestampPool != VK_NULL_HANDLE) {
+    vkDestroyQueryPool(pReplay->device, pReplay->timestampPool, &memoryVulkanCallbacks);
+  }
+  for (u32 i = 0; i < FRAMES_IN_FLIGHT; i++) {
+    vkDestroyFence(pReplay->device, pReplay->fences[i], &memoryVulkanCallbacks);
+    vkDestroyFramebuffer(pReplay->device, pReplay->framebuffers[i], &memoryVulkanCallbacks);
+    vkDestroyImageView(pReplay->device, pReplay->targetViews[i], &memoryVulkanCallbacks);
+    vkDestroyImage(pReplay->device, pReplay->targets[i], &memoryVulkanCallbacks);
+    deviceFreeMemory(pReplay->device, pReplay->targetMemory[i]);
+    vkDestroyImageView(pReplay->device, pReplay->depthViews[i], &memoryVulkanCallbacks);
+    vkDestroyImage(pReplay->device, pReplay->depthImages[i], &memoryVulkanCallbacks);
+    deviceFreeMemory(pReplay->device, pReplay->depthMemory[i]);
+    vkDestroyImage(pReplay->device, pReplay->presentImages[i], &memoryVulkanCallbacks);
+    deviceFreeMemory(pReplay->device, pReplay->presentMemory[i]);
+  }
+  vkDestroyCommandPool(pReplay->device, pReplay->commandPool, &memoryVulkanCallbacks);
+  for (u32 layout = 0; layout < PIPELINE_MAX_VERTEX_LAYOUTS; layout++) {
+    vkDestroyBuffer(pReplay->device, pReplay->vertexBuffers[layout], &memoryVulkanCallbacks);
+    deviceFreeMemory(pReplay->device, pReplay->vertexMemory[layout]);
+  }
+  vkDestroyBuffer(pReplay->device, pReplay->indexBuffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pReplay->device, pReplay->indexMemory);
+  vkDestroyBuffer(pReplay->device, pReplay->instanceBuffer, &memoryVulkanCallbacks);
+  deviceFreeMemory(pReplay->device, pReplay->instanceMemory);
+  if (pReplay->postProcessing) {
+    postDestroy(&pReplay->post);
+  }
+  pipelineManagerDestroy(&pReplay->pipelines);
+  vkDestroyPipelineLayout(pReplay->device, pReplay->pipelineLayout, &memoryVulkanCallbacks);
+  clusteredLightingDestroy(&pReplay->lighting);
+  vkDestroyRenderPass(pReplay->device, pReplay->renderPass, &memoryVulkanCallbacks);
+  vkDestroyDevice(pReplay->device, &memoryVulkanCallbacks);
+  vkDestroyInstance(pReplay->instance, &memoryVulkanCallbacks);
+  replayFileDestroy(&pReplay->file);
+  benchDestroy(&pReplay->bench);
+}
+
+int main(int argc, char **argv) {
+  double processStartMs = benchNowMs();
+  Replay replay = {0};
+  const char *path = NULL;
+  const char *outputPath = NULL;
+  bool paced = false;
+  u32 loops = 1;
+  i32 warmup = -1;
+
+  for (int i = 1; i < argc; i++) {
+    bool hasValue = i + 1 < argc;
+    if (strcmp(argv[i], "--paced") == 0) {
+      paced = true;
+    } else if (strcmp(argv[i], "--loops") == 0 && hasValue && atoi(argv[i + 1]) > 0) {
+      loops = (u32)atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--warmup") == 0 && hasValue && atoi(argv[i + 1]) >= 0) {
+      warmup = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+      outputPath = argv[++i];
+    } else if (strcmp(argv[i], "--shader-dir") == 0 && hasValue) {
+      replay.shaderDir = argv[++i];
+    } else if (argv[i][0] != '-' && path == NULL) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (path == NULL) {
+    usage(argv[0]);
+  }
+  logInit(LOG_FORMAT_TEXT);
+
+  if (!replayFileRead(path, &replay.file)) {
+    printf("Failed to read recording %s!\n", path);
+    exit(2);
+  }
+  ReplayFile *pFile = &replay.file;
+  u64 totalFrames = (u64)pFile->frameCount * loops;
+  // Short recordings are warmed up over their first loop at most
+  u32 warmupFrames = warmup >= 0 ? (u32)warmup : WARMUP_FRAMES;
+  if (warmupFrames >= totalFrames) {
+    warmupFrames = pFile->frameCount < totalFrames ? pFile->frameCount : 0;
+  }
+  if (totalFrames - warmupFrames > UINT32_MAX) {
+    printf("Too many frames to measure!\n");
+    exit(1);
+  }
+  benchInit(&replay.bench, BENCH_SCENARIO_REPLAY, (u32)(totalFrames - warmupFrames), outputPath, processStartMs);
+  replay.bench.warmupFrames = warmupFrames;
+  replay.bench.lightCount = pFile->maxLightCount;
+  gpuNames[0] = "frame";
+  for (u32 effect = 0; effect < POST_EFFECT_COUNT; effect++) {
+    gpuNames[1 + effect] = postEffectName(effect);
+  }
+
+  replay.postProcessing = (pFile->setup.flags & REPLAY_FLAG_POST) != 0;
+  createInstance(&replay);
+  createTargets(&replay);
+  createPipelines(&replay);
+  createFrames(&replay);
+  uploadGeometry(&replay);
+  LOG_INFO(LOG_CATEGORY_ENGINE, "Replaying %u frames of %s %u times", pFile->frameCount, path, loops);
+
+  u32 slot = 0;
+  double loopStartMs = benchNowMs();
+  for (u64 frame = 0; !benchFinished(&replay.bench); frame++) {
+    u32 index = (u32)(frame % pFile->frameCount);
+    if (index == 0) {
+      loopStartMs = benchNowMs();
+    }
+    ReplayFrameHeader header;
+    replayFileFrame(pFile, index, &header, replay.lights, replay.commands);
+    if (paced) {
+      sleepUntil(loopStartMs + header.timeMs);
+    }
+
+    benchBeginFrame(&replay.bench);
+    vkWaitForFences(replay.device, 1, &replay.fences[slot], VK_TRUE, UINT64_MAX);
+    benchMark(&replay.bench, BENCH_STAGE_WAIT);
+    collectGpuTimes(&replay, slot);
+    vkResetFences(replay.device, 1, &replay.fences[slot]);
+
+    VkExtent2D renderExtent = { header.renderWidth, header.renderHeight };
+    clusteredLightingUpdate(&replay.lighting, slot, replay.lights, header.lightCount, &header.view, &header.projection,
+                            renderExtent, pFile->setup.zNear, pFile->setup.zFar);
+    benchMark(&replay.bench, BENCH_STAGE_BUILD);
+
+    vkResetCommandBuffer(replay.commandBuffers[slot], 0);
+    benchCountTriangles(&replay.bench, recordFrame(&replay, slot, &header));
+    benchMark(&replay.bench, BENCH_STAGE_RECORD);
+
+    VkSubmitInfo submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &replay.commandBuffers[slot]
+    };
+    if (vkQueueSubmit(replay.queue, 1, &submitInfo, replay.fences[slot]) != VK_SUCCESS) {
+      printf("Failed to submit draw command buffer!\n");
+      exit(8);
+    }
+    replay.timestampsPending[slot] = replay.timestampPool != VK_NULL_HANDLE;
+    benchMark(&replay.bench, BENCH_STAGE_SUBMIT);
+    benchEndFrame(&replay.bench);
+    slot = (slot + 1) % FRAMES_IN_FLIGHT;
+  }
+
+  benchWriteReport(&replay.bench);
+  destroyReplay(&replay);
+  memoryReport();
+  logShutdown();
+  return 0;
+}
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replayfile.h"
+#include "memtrack.h"
+
+static void writeBytes(ReplayWriter *pWriter, const void *data, size_t size) {
+  if (pWriter->failed || size == 0) return;
+  if (fwrite(data, size, 1, pWriter->file) != 1) {
+    pWriter->failed = true;
+  }
+}
+
+static void writeChunk(ReplayWriter *pWriter, ReplayChunkType type, const void *prefix, size_t prefixSize, const void *data, size_t size) {
+  if (prefixSize + size > UINT32_MAX) {
+    pWriter->failed = true;
+    return;
+  }
+  ReplayChunkHeader header = { .type = type, .size = (u32)(prefixSize + size) };
+  writeBytes(pWriter, &header, sizeof(header));
+  writeBytes(pWriter, prefix, prefixSize);
+  writeBytes(pWriter, data, size);
+}
+
+static void appendCommand(ReplayWriter *pWriter, const void *data, size_t size) {
+  if (pWriter->commandSize + size > pWriter->commandCapacity) {
+    size_t capacity = pWriter->commandCapacity > 0 ? pWriter->commandCapacity * 2 : 4096;
+    while (capacity < pWriter->commandSize + size) capacity *= 2;
+    pWriter->commands = memoryRealloc(pWriter->commands, capacity, MEMORY_TAG_CAPTURE);
+    pWriter->commandCapacity = capacity;
+  }
+  memcpy(pWriter->commands + pWriter->commandSize, data, size);
+  pWriter->commandSize += size;
+}
+
+bool replayWriterOpen(ReplayWriter *pWriter, const char *path) {
+  memset(pWriter, 0, sizeof(ReplayWriter));
+  pWriter->file = fopen(path, "wb");
+  if (pWriter->file == NULL) return false;
+  ReplayFileHeader header = { .magic = REPLAY_FILE_MAGIC, .version = REPLAY_FILE_VERSION };
+  writeBytes(pWriter, &header, sizeof(header));
+  return !pWriter->failed;
+}
+
+bool replayWriterClose(ReplayWriter *pWriter) {
+  bool written = !pWriter->failed;
+  if (pWriter->file != NULL && fclose(pWriter->file) != 0) {
+    written = false;
+  }
+  memoryFree(pWriter->commands);
+  memset(pWriter, 0, sizeof(ReplayWriter));
+  return written;
+}
+
+void replayWriteSetup(ReplayWriter *pWriter, const ReplaySetup *pSetup) {
+  writeChunk(pWriter, REPLAY_CHUNK_SETUP, pSetup, sizeof(ReplaySetup), NULL, 0);
+}
+
+void replayWriteVertices(ReplayWriter *pWriter, u32 vertexFormat, const void *data, size_t size) {
+  writeChunk(pWriter, REPLAY_CHUNK_VERTICES, &vertexFormat, sizeof(vertexFormat), data, size);
+}
+
+void replayWriteIndices(ReplayWriter *pWriter, const u32 *indices, u32 indexCount) {
+  writeChunk(pWriter, REPLAY_CHUNK_INDICES, NULL, 0, indices, sizeof(u32) * (size_t)indexCount);
+}
+
+void replayWriteInstances(ReplayWriter *pWriter, const void *data, size_t size) {
+  writeChunk(pWriter, REPLAY_CHUNK_INSTANCES, NULL, 0, data, size);
+}
+
+void replayBeginFrame(ReplayWriter *pWriter, const ReplayFrameHeader *pFrame, const Light *lights) {
+  if (pWriter->frameCount == 0) {
+    pWriter->firstFrameMs = pFrame->timeMs;
+  }
+  pWriter->frame = *pFrame;
+  pWriter->frame.timeMs -= pWriter->firstFrameMs;
+  pWriter->frame.commandCount = 0;
+  pWriter->lights = lights;
+  pWriter->commandSize = 0;
+}
+
+void replayBindPipeline(ReplayWriter *pWriter, u32 pipeline) {
+  u32 command[2] = { REPLAY_COMMAND_BIND_PIPELINE, pipeline };
+  appendCommand(pWriter, command, sizeof(command));
+  pWriter->frame.commandCount++;
+}
+
+void replayDraw(ReplayWriter *pWriter, const RenderDraw *pDraw, const Mat4 *pTransform, const Mat4 *pModel) {
+  ReplayDraw draw;
+  memset(&draw, 0, sizeof(draw)); // No stray padding bytes in the file
+  draw.vertexCount = pDraw->vertexCount;
+  draw.instanceCount = pDraw->instanceCount;
+  draw.firstVertex = pDraw->firstVertex;
+  draw.firstInstance = pDraw->firstInstance;
+  draw.indexCount = pDraw->indexCount;
+  draw.firstIndex = pDraw->firstIndex;
+  draw.vertexOffset = pDraw->vertexOffset;
+  draw.transform = *pTransform;
+  draw.model = *pModel;
+  u32 op = REPLAY_COMMAND_DRAW;
+  appendCommand(pWriter, &op, sizeof(op));
+  appendCommand(pWriter, &draw, sizeof(draw));
+  pWriter->frame.commandCount++;
+}
+
+void replayEndFrame(ReplayWriter *pWriter) {
+  size_t lightSize = sizeof(Light) * (size_t)pWriter->frame.lightCount;
+  size_t size = sizeof(ReplayFrameHeader) + lightSize + pWriter->commandSize;
+  if (size > UINT32_MAX) {
+    pWriter->failed = true;
+    return;
+  }
+  ReplayChunkHeader header = { .type = REPLAY_CHUNK_FRAME, .size = (u32)size };
+  writeBytes(pWriter, &header, sizeof(header));
+  writeBytes(pWriter, &pWriter->frame, sizeof(ReplayFrameHeader));
+  writeBytes(pWriter, pWriter->lights, lightSize);
+  writeBytes(pWriter, pWriter->commands, pWriter->commandSize);
+  pWriter->frameCount++;
+}
+
+// Walks a frame's commands, checking each against the setup and geometry.
+// Returns false if any is malformed or would read outside the buffers.
+static bool checkCommands(const ReplayFile *pFile, const u8 *bytes, size_t size, u32 commandCount) {
+  const ReplaySetup *pSetup = &pFile->setup;
+  size_t offset = 0;
+  bool bound = false;
+  u32 vertexCount = 0; // Of the bound pipeline's vertex format
+  u32 instanceCount = 0; // Its binding 1 can hold, UINT32_MAX without one
+  for (u32 i = 0; i < commandCount; i++) {
+    u32 op;
+    if (size - offset < sizeof(op)) return false;
+    memcpy(&op, bytes + offset, sizeof(op));
+    offset += sizeof(op);
+
+    if (op == REPLAY_COMMAND_BIND_PIPELINE) {
+      u32 pipeline;
+      if (size - offset < sizeof(pipeline)) return false;
+      memcpy(&pipeline, bytes + offset, sizeof(pipeline));
+      offset += sizeof(pipeline);
+      if (pipeline >= pSetup->pipelineCount) return false;
+      u32 layout = pSetup->pipelines[pipeline].vertexLayout;
+      if (layout >= pSetup->vertexLayoutCount) return false;
+      u32 stride = pSetup->vertexLayouts[layout].stride;
+      if (stride == 0) {
+        vertexCount = UINT32_MAX; // Vertices come from the shader alone
+      } else if (pFile->vertices[layout] == NULL) {
+        return false;
+      } else {
+        vertexCount = (u32)(pFile->vertexSizes[layout] / stride);
+      }
+      u32 instanceStride = pSetup->vertexLayouts[layout].instanceStride;
+      if (stride == 0 || instanceStride == 0) {
+        instanceCount = UINT32_MAX;
+      } else if (pFile->instances == NULL) {
+        return false;
+      } else {
+        instanceCount = (u32)(pFile->instanceSize / instanceStride);
+      }
+      bound = true;
+    } else if (op == REPLAY_COMMAND_DRAW) {
+      ReplayDraw draw;
+      if (!bound || size - offset < sizeof(draw)) return false;
+      memcpy(&draw, bytes + offset, sizeof(draw));
+      offset += sizeof(draw);
+      if (instanceCount != UINT32_MAX && (u64)draw.firstInstance + draw.instanceCount > instanceCount) return false;
+      if (draw.indexCount > 0) {
+        if ((u64)draw.firstIndex + draw.indexCount > pFile->indexCount) return false;
+        for (u32 index = 0; index < draw.indexCount; index++) {
+          u32 vertex;
+          memcpy(&vertex, pFile->indices + sizeof(u32) * ((size_t)draw.firstIndex + index), sizeof(vertex));
+          if ((i64)vertex + draw.vertexOffset < 0 || (i64)vertex + draw.vertexOffset >= vertexCount) return false;
+        }
+      } else if ((u64)draw.firstVertex + draw.vertexCount > vertexCount) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+  }
+  return offset == size;
+}
+
+static bool parseChunks(ReplayFile *pFile) {
+  ReplayFileHeader fileHeader;
+  if (pFile->size < sizeof(fileHeader)) return false;
+  memcpy(&fileHeader, pFile->bytes, sizeof(fileHeader));
+  if (fileHeader.magic != REPLAY_FILE_MAGIC || fileHeader.version != REPLAY_FILE_VERSION) return false;
+
+  // Frames are indexed on a first pass, then checked once the geometry
+  // they draw from is known
+  bool hasSetup = false;
+  u32 frameCapacity = 0;
+  size_t offset = sizeof(fileHeader);
+  while (offset < pFile->size) {
+    ReplayChunkHeader chunk;
+    if (pFile->size - offset < sizeof(chunk)) return false;
+    memcpy(&chunk, pFile->bytes + offset, sizeof(chunk));
+    offset += sizeof(chunk);
+    if (pFile->size - offset < chunk.size) return false;
+    const u8 *payload = pFile->bytes + offset;
+
+    if (chunk.type == REPLAY_CHUNK_SETUP) {
+      if (hasSetup || chunk.size != sizeof(ReplaySetup)) return false;
+      memcpy(&pFile->setup, payload, sizeof(ReplaySetup));
+      const ReplaySetup *pSetup = &pFile->setup;
+      if (pSetup->vertexLayoutCount > PIPELINE_MAX_VERTEX_LAYOUTS || pSetup->pipelineCount == 0 ||
+          pSetup->pipelineCount > REPLAY_MAX_PIPELINES || pSetup->zNear <= 0.0f || pSetup->zFar <= pSetup->zNear) {
+        return false;
+      }
+      hasSetup = true;
+    } else if (chunk.type == REPLAY_CHUNK_VERTICES) {
+      u32 format;
+      if (!hasSetup || chunk.size < sizeof(format)) return false;
+      memcpy(&format, payload, sizeof(format));
+      if (format >= pFile->setup.vertexLayoutCount || pFile->vertices[format] != NULL ||
+          pFile->setup.vertexLayouts[format].stride == 0) {
+        return false;
+      }
+      pFile->vertices[format] = payload + sizeof(format);
+      pFile->vertexSizes[format] = chunk.size - sizeof(format);
+    } else if (chunk.type == REPLAY_CHUNK_INDICES) {
+      if (pFile->indices != NULL || chunk.size % sizeof(u32) != 0) return false;
+      pFile->indices = payload;
+      pFile->indexCount = chunk.size / sizeof(u32);
+    } else if (chunk.type == REPLAY_CHUNK_INSTANCES) {
+      if (pFile->instances != NULL) return false;
+      pFile->instances = payload;
+      pFile->instanceSize = chunk.size;
+    } else if (chunk.type == REPLAY_CHUNK_FRAME) {
+      if (!hasSetup || chunk.size < sizeof(ReplayFrameHeader)) return false;
+      if (pFile->frameCount == frameCapacity) {
+        frameCapacity = frameCapacity > 0 ? frameCapacity * 2 : 256;
+        pFile->frameOffsets = memoryRealloc(pFile->frameOffsets, sizeof(size_t) * frameCapacity, MEMORY_TAG_CAPTURE);
+      }
+      pFile->frameOffsets[pFile->frameCount++] = offset;
+    } else {
+      return false;
+    }
+    offset += chunk.size;
+  }
+  if (!hasSetup || pFile->frameCount == 0) return false;
+
+  for (u32 i = 0; i < pFile->frameCount; i++) {
+    size_t frameOffset = pFile->frameOffsets[i];
+    ReplayChunkHeader chunk;
+    memcpy(&chunk, pFile->bytes + frameOffset - sizeof(chunk), sizeof(chunk));
+    ReplayFrameHeader header;
+    memcpy(&header, pFile->bytes + frameOffset, sizeof(header));
+    size_t lightSize = sizeof(Light) * (size_t)header.lightCount;
+    if (header.lightCount > pFile->setup.maxLights || chunk.size - sizeof(header) < lightSize ||
+        header.targetWidth == 0 || header.targetHeight == 0 ||
+        header.renderWidth == 0 || header.renderWidth > header.targetWidth ||
+        header.renderHeight == 0 || header.renderHeight > header.targetHeight) {
+      return false;
+    }
+    const u8 *commands = pFile->bytes + frameOffset + sizeof(header) + lightSize;
+    if (!checkCommands(pFile, commands, chunk.size - sizeof(header) - lightSize, header.commandCount)) return false;
+
+    if (header.targetWidth > pFile->maxTargetWidth) pFile->maxTargetWidth = header.targetWidth;
+    if (header.targetHeight > pFile->maxTargetHeight) pFile->maxTargetHeight = header.targetHeight;
+    if (header.lightCount > pFile->maxLightCount) pFile->maxLightCount = header.lightCount;
+    if (header.commandCount > pFile->maxCommandCount) pFile->maxCommandCount = header.commandCount;
+  }
+  return true;
+}
+
+bool replayFileRead(const char *path, ReplayFile *pFile) {
+  memset(pFile, 0, sizeof(ReplayFile));
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  rewind(file);
+
+  pFile->bytes = size > 0 ? memoryAlloc((size_t)size, MEMORY_TAG_CAPTURE) : NULL;
+  pFile->size = size > 0 ? (size_t)size : 0;
+  bool read = pFile->bytes != NULL && fread(pFile->bytes, pFile->size, 1, file) == 1;
+  fclose(file);
+  if (!read || !parseChunks(pFile)) {
+    replayFileDestroy(pFile);
+    return false;
+  }
+  return true;
+}
+
+void replayFileDestroy(ReplayFile *pFile) {
+  memoryFree(pFile->bytes);
+  memoryFree(pFile->frameOffsets);
+  memset(pFile, 0, sizeof(ReplayFile));
+}
+
+void replayFileFrame(const ReplayFile *pFile, u32 frame, ReplayFrameHeader *pHeader, Light *lights, ReplayCommand *commands) {
+  const u8 *bytes = pFile->bytes + pFile->frameOffsets[frame];
+  memcpy(pHeader, bytes, sizeof(ReplayFrameHeader));
+  bytes += sizeof(ReplayFrameHeader);
+  size_t lightSize = sizeof(Light) * (size_t)pHeader->lightCount;
+  if (lights != NULL) {
+    memcpy(lights, bytes, lightSize);
+  }
+  bytes += lightSize;
+  if (commands == NULL) return;
+
+  for (u32 i = 0; i < pHeader->commandCount; i++) {
+    ReplayCommand *pCommand = &commands[i];
+    memcpy(&pCommand->op, bytes, sizeof(u32));
+    bytes += sizeof(u32);
+    if (pCommand->op == REPLAY_COMMAND_BIND_PIPELINE) {
+      memcpy(&pCommand->pipeline, bytes, sizeof(u32));
+      bytes += sizeof(u32);
+    } else {
+      memcpy(&pCommand->draw, bytes, sizeof(ReplayDraw));
+      bytes += sizeof(ReplayDraw);
+    }
+  }
+}
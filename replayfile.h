@@ -0,0 +1,145 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "types.h"
+#include "vmath.h"
+#include "pipelines.h"
+#include "renderqueue.h"
+#include "clusters.h"
+
+#define REPLAY_FILE_MAGIC 0x594C5052u // "RPLY"
+#define REPLAY_FILE_VERSION 2
+#define REPLAY_MAX_PIPELINES 16
+
+// A recording is a ReplayFileHeader followed by chunks, each a
+// ReplayChunkHeader and its payload, all little endian. Setup comes first,
+// then the geometry, then one chunk per frame.
+typedef enum ReplayChunkType {
+  REPLAY_CHUNK_SETUP = 1, // ReplaySetup
+  REPLAY_CHUNK_VERTICES, // u32 vertex format, then the vertex buffer's bytes
+  REPLAY_CHUNK_INDICES, // The u32 index buffer
+  REPLAY_CHUNK_FRAME, // ReplayFrameHeader, its lights, then its commands
+  REPLAY_CHUNK_INSTANCES // The instance buffer's bytes, laid out by instanceStride
+} ReplayChunkType;
+
+typedef enum ReplayCommandOp {
+  REPLAY_COMMAND_BIND_PIPELINE = 1, // u32 index into the setup's pipelines
+  REPLAY_COMMAND_DRAW // ReplayDraw
+} ReplayCommandOp;
+
+#define REPLAY_FLAG_POST 1u // Frames were post-processed
+
+typedef struct ReplayFileHeader {
+  u32 magic;
+  u32 version;
+} ReplayFileHeader;
+
+typedef struct ReplayChunkHeader {
+  u32 type; // ReplayChunkType
+  u32 size; // Payload bytes
+} ReplayChunkHeader;
+
+// What initVulkan created that the frames depend on
+typedef struct ReplaySetup {
+  u32 swapChainFormat; // VkFormat of the presented images
+  u32 renderFormat; // VkFormat the scene renders into
+  u32 flags;
+  u32 maxLights;
+  float zNear;
+  float zFar;
+  u32 vertexLayoutCount;
+  u32 pipelineCount;
+  PipelineVertexLayout vertexLayouts[PIPELINE_MAX_VERTEX_LAYOUTS];
+  PipelineKey pipelines[REPLAY_MAX_PIPELINES];
+} ReplaySetup;
+
+typedef struct ReplayFrameHeader {
+  double timeMs; // Since the first recorded frame
+  u32 targetWidth; // Swap chain extent
+  u32 targetHeight;
+  u32 renderWidth; // What the scene rendered at
+  u32 renderHeight;
+  Mat4 view;
+  Mat4 projection;
+  float postDeltaSeconds;
+  u32 lightCount;
+  u32 commandCount;
+  u32 reserved;
+} ReplayFrameHeader;
+
+typedef struct ReplayDraw {
+  u32 vertexCount;
+  u32 instanceCount;
+  u32 firstVertex;
+  u32 firstInstance;
+  u32 indexCount; // Indexed when nonzero
+  u32 firstIndex;
+  i32 vertexOffset;
+  Mat4 transform; // The push constants
+  Mat4 model;
+} ReplayDraw;
+
+typedef struct ReplayCommand {
+  u32 op; // ReplayCommandOp
+  u32 pipeline;
+  ReplayDraw draw;
+} ReplayCommand;
+
+// Streams a recording to disk a frame at a time
+typedef struct ReplayWriter {
+  FILE *file;
+  bool failed; // A write failed, the rest are skipped
+  u8 *commands; // The frame being recorded
+  size_t commandSize;
+  size_t commandCapacity;
+  ReplayFrameHeader frame;
+  const Light *lights;
+  double firstFrameMs;
+  u32 frameCount;
+} ReplayWriter;
+
+bool replayWriterOpen(ReplayWriter *pWriter, const char *path);
+// Returns false if any write failed
+bool replayWriterClose(ReplayWriter *pWriter);
+void replayWriteSetup(ReplayWriter *pWriter, const ReplaySetup *pSetup);
+void replayWriteVertices(ReplayWriter *pWriter, u32 vertexFormat, const void *data, size_t size);
+void replayWriteIndices(ReplayWriter *pWriter, const u32 *indices, u32 indexCount);
+void replayWriteInstances(ReplayWriter *pWriter, const void *data, size_t size);
+
+// pFrame's timeMs is the absolute time the frame was recorded at, and
+// lights must stay valid until replayEndFrame
+void replayBeginFrame(ReplayWriter *pWriter, const ReplayFrameHeader *pFrame, const Light *lights);
+void replayBindPipeline(ReplayWriter *pWriter, u32 pipeline);
+void replayDraw(ReplayWriter *pWriter, const RenderDraw *pDraw, const Mat4 *pTransform, const Mat4 *pModel);
+void replayEndFrame(ReplayWriter *pWriter);
+
+// A whole recording in memory, checked once on load so replaying it needs
+// no further validation
+typedef struct ReplayFile {
+  u8 *bytes;
+  size_t size;
+  ReplaySetup setup;
+  const u8 *vertices[PIPELINE_MAX_VERTEX_LAYOUTS]; // NULL for formats without vertices
+  size_t vertexSizes[PIPELINE_MAX_VERTEX_LAYOUTS];
+  const u8 *indices;
+  u32 indexCount;
+  const u8 *instances; // NULL without instance data
+  size_t instanceSize;
+  size_t *frameOffsets; // Of each frame's payload
+  u32 frameCount;
+  u32 maxTargetWidth; // Largest extent any frame rendered to
+  u32 maxTargetHeight;
+  u32 maxLightCount; // Of any one frame
+  u32 maxCommandCount;
+} ReplayFile;
+
+// On failure returns false and leaves pFile empty
+bool replayFileRead(const char *path, ReplayFile *pFile);
+void replayFileDestroy(ReplayFile *pFile);
+
+// lights receives the frame's lightCount lights, commands its commandCount
+// commands. Either may be NULL.
+void replayFileFrame(const ReplayFile *pFile, u32 frame, ReplayFrameHeader *pHeader, Light *lights, ReplayCommand *commands);
@@ -0,0 +1,69 @@
+#include <math.h>
+
+#include "resolution.h"
+
+// Weight of each new frame time in the exponential moving average; higher
+// reacts faster but chases noise
+#define RESOLUTION_SMOOTHING 0.15f
+// Down as soon as the budget is exceeded, up only with clear headroom, so the
+// scale doesn't oscillate around the budget
+#define RESOLUTION_HIGH_WATER 1.0f
+#define RESOLUTION_LOW_WATER 0.8f
+#define RESOLUTION_MAX_STEP_DOWN 0.15f
+#define RESOLUTION_MAX_STEP_UP 0.05f
+// Timestamps are read frames in flight after they were recorded
+#define RESOLUTION_COOLDOWN 4
+
+static float clampf(float value, float min, float max) {
+  return value < min ? min : (value > max ? max : value);
+}
+
+void resolutionInit(ResolutionController *pController, float budgetMs, float minScale, float maxScale) {
+  pController->minScale = minScale;
+  pController->maxScale = maxScale;
+  pController->scale = maxScale;
+  pController->budgetMs = budgetMs;
+  pController->filteredMs = 0.0f;
+  pController->cooldown = 0;
+}
+
+bool resolutionUpdate(ResolutionController *pController, float gpuMs) {
+  if (!(gpuMs > 0.0f)) return false;
+
+  if (pController->cooldown > 0) {
+    pController->cooldown--;
+    return false;
+  }
+
+  if (pController->filteredMs == 0.0f) {
+    pController->filteredMs = gpuMs;
+  } else {
+    pController->filteredMs += (gpuMs - pController->filteredMs) * RESOLUTION_SMOOTHING;
+  }
+
+  // Treat GPU time as proportional to pixel count and aim for the budget
+  float ratio = pController->budgetMs / pController->filteredMs;
+  float target = pController->scale;
+  if (ratio < RESOLUTION_HIGH_WATER) {
+    target = pController->scale * sqrtf(ratio);
+    target = fmaxf(target, pController->scale - RESOLUTION_MAX_STEP_DOWN);
+  } else if (ratio > 1.0f / RESOLUTION_LOW_WATER) {
+    target = pController->scale * sqrtf(ratio * RESOLUTION_LOW_WATER);
+    target = fminf(target, pController->scale + RESOLUTION_MAX_STEP_UP);
+  }
+  target = clampf(target, pController->minScale, pController->maxScale);
+  // Don't get stuck a hair below full resolution
+  if (target > pController->scale && pController->maxScale - target < 0.01f) {
+    target = pController->maxScale;
+  }
+
+  if (fabsf(target - pController->scale) < 0.01f) {
+    return false;
+  }
+
+  // The smoothed time belongs to the old scale, rescale it for the new one
+  pController->filteredMs *= (target * target) / (pController->scale * pController->scale);
+  pController->scale = target;
+  pController->cooldown = RESOLUTION_COOLDOWN;
+  return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "types.h"
+
+// Picks the fraction of the swap chain extent to render at so GPU frame time
+// stays under a budget. Pure CPU logic; the caller measures and applies it.
+typedef struct ResolutionController {
+  float minScale;
+  float maxScale;
+  float scale; // Applied to width and height, so cost goes with its square
+  float budgetMs;
+  float filteredMs; // Smoothed GPU frame time, 0 until the first sample
+  u32 cooldown; // Samples to skip after a change, they predate it
+} ResolutionController;
+
+void resolutionInit(ResolutionController *pController, float budgetMs, float minScale, float maxScale);
+
+// Feeds one GPU frame time. Returns true when the scale changed.
+bool resolutionUpdate(ResolutionController *pController, float gpuMs);
+
+// Scales an extent, never below one pixel
+static inline u32 resolutionScaleDimension(u32 dimension, float scale) {
+  u32 scaled = (u32)(dimension * scale + 0.5f);
+  return scaled > 0 ? scaled : 1;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shadercode.h"
+#include "memtrack.h"
+
+// Generated by the Makefile from shaders/*.spv, one word per entry
+static const u32 triangleVert[] = {
+#include "shaders/shader.vert.inc"
+};
+static const u32 triangleFrag[] = {
+#include "shaders/shader.frag.inc"
+};
+static const u32 clusterComp[] = {
+#include "shaders/cluster.comp.inc"
+};
+static const u32 postDownsampleComp[] = {
+#include "shaders/post_downsample.comp.inc"
+};
+static const u32 postUpsampleComp[] = {
+#include "shaders/post_upsample.comp.inc"
+};
+static const u32 postCompositeComp[] = {
+#include "shaders/post_composite.comp.inc"
+};
+static const u32 postCompositeSubgroupComp[] = {
+#include "shaders/post_composite_subgroup.comp.inc"
+};
+static const u32 postAdaptComp[] = {
+#include "shaders/post_adapt.comp.inc"
+};
+static const u32 hizBuildComp[] = {
+#include "shaders/hiz_build.comp.inc"
+};
+static const u32 hizCullComp[] = {
+#include "shaders/hiz_cull.comp.inc"
+};
+
+typedef struct EmbeddedShader {
+  const char *name;
+  const u32 *words;
+  size_t size;
+} EmbeddedShader;
+
+static const EmbeddedShader embeddedShaders[] = {
+  { "shader.vert", triangleVert, sizeof(triangleVert) },
+  { "shader.frag", triangleFrag, sizeof(triangleFrag) },
+  { "cluster.comp", clusterComp, sizeof(clusterComp) },
+  { "post_downsample.comp", postDownsampleComp, sizeof(postDownsampleComp) },
+  { "post_upsample.comp", postUpsampleComp, sizeof(postUpsampleComp) },
+  { "post_composite.comp", postCompositeComp, sizeof(postCompositeComp) },
+  { "post_composite_subgroup.comp", postCompositeSubgroupComp, sizeof(postCompositeSubgroupComp) },
+  { "post_adapt.comp", postAdaptComp, sizeof(postAdaptComp) },
+  { "hiz_build.comp", hizBuildComp, sizeof(hizBuildComp) },
+  { "hiz_cull.comp", hizCullComp, sizeof(hizCullComp) }
+};
+
+static void readShaderFile(const char *path, ShaderCode *pCode) {
+  FILE *pFile = fopen(path, "rb");
+  if (pFile == NULL) {
+    printf("Failed to open %s\n", path);
+    exit(7);
+  }
+  fseek(pFile, 0L, SEEK_END);
+  long size = ftell(pFile);
+  fseek(pFile, 0L, SEEK_SET);
+
+  // SPIR-V is a stream of words, and pCode must be aligned to them
+  pCode->allocated = memoryAlloc(size > 0 ? (size_t)size : 1, MEMORY_TAG_SHADERS);
+  if (size <= 0 || size % sizeof(u32) != 0 || pCode->allocated == NULL ||
+      fread(pCode->allocated, (size_t)size, 1, pFile) != 1) {
+    printf("Failed to read %s\n", path);
+    exit(7);
+  }
+  fclose(pFile);
+  pCode->words = pCode->allocated;
+  pCode->size = (size_t)size;
+}
+
+void shaderCodeLoad(const char *name, const char *overrideDir, ShaderCode *pCode) {
+  memset(pCode, 0, sizeof(ShaderCode));
+  if (overrideDir != NULL) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s.spv", overrideDir, name);
+    readShaderFile(path, pCode);
+    return;
+  }
+
+  for (u32 i = 0; i < sizeof(embeddedShaders) / sizeof(embeddedShaders[0]); i++) {
+    if (strcmp(embeddedShaders[i].name, name) == 0) {
+      pCode->words = embeddedShaders[i].words;
+      pCode->size = embeddedShaders[i].size;
+      return;
+    }
+  }
+  printf("No embedded shader %s\n", name);
+  exit(7);
+}
+
+void shaderCodeFree(ShaderCode *pCode) {
+  memoryFree(pCode->allocated);
+  memset(pCode, 0, sizeof(ShaderCode));
+}
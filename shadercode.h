@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "types.h"
+
+// SPIR-V for one shader stage
+typedef struct ShaderCode {
+  const u32 *words;
+  size_t size; // Bytes
+  u32 *allocated; // Set when read from disk, freed by shaderCodeFree
+} ShaderCode;
+
+// name is the shader source's file name, e.g. "shader.vert". The code is
+// the optimized SPIR-V built into the binary, unless overrideDir is set:
+// then <overrideDir>/<name>.spv is read, so shaders can be iterated on
+// without relinking.
+void shaderCodeLoad(const char *name, const char *overrideDir, ShaderCode *pCode);
+void shaderCodeFree(ShaderCode *pCode);
@@ -0,0 +1,52 @@
+// Shared by the light binning pass and the fragment shader. Sizes match
+// clusters.h.
+
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define CLUSTER_COUNT (CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z)
+#define CLUSTER_MAX_LIGHTS 64
+
+#ifndef CLUSTER_ACCESS
+#define CLUSTER_ACCESS readonly
+#endif
+
+struct Light {
+    vec4 positionRadius; // World space
+    vec4 color;
+};
+
+layout(set = 0, binding = 0) uniform ClusterParams {
+    mat4 view;
+    mat4 inverseProjection;
+    vec4 screen; // Render width and height in pixels, near and far
+    vec4 slicing; // Slice = log(depth) * x - y
+    uint lightCount;
+} params;
+
+layout(std430, set = 0, binding = 1) readonly buffer Lights {
+    Light lights[];
+};
+
+// Offset into lightIndices and count per cluster
+layout(std430, set = 0, binding = 2) CLUSTER_ACCESS buffer Clusters {
+    uvec2 clusters[];
+};
+
+// CLUSTER_MAX_LIGHTS slots per cluster
+layout(std430, set = 0, binding = 3) CLUSTER_ACCESS buffer LightIndices {
+    uint lightIndices[];
+};
+
+// Slices are exponential in view depth so clusters stay roughly cubic
+uint clusterSlice(float viewDepth) {
+    return uint(clamp(log(viewDepth) * params.slicing.x - params.slicing.y, 0.0, float(CLUSTER_GRID_Z - 1)));
+}
+
+float sliceDepth(uint slice) {
+    return params.screen.z * pow(params.screen.w / params.screen.z, float(slice) / float(CLUSTER_GRID_Z));
+}
+
+uint clusterIndex(uvec3 cluster) {
+    return (cluster.z * CLUSTER_GRID_Y + cluster.y) * CLUSTER_GRID_X + cluster.x;
+}
@@ -0,0 +1,104 @@
+// The per-pixel end of the post chain in one dispatch: adds the bloom,
+// exposes, tonemaps and grades the HDR target in place. Covered pixels are
+// metered on the way, reduced per workgroup and added to the exposure
+// buffer for the next frame's adaptation. Defining USE_SUBGROUPS reduces
+// with subgroup arithmetic instead of a shared memory tree.
+
+#define GROUP_SIZE 16
+#define GROUP_INVOCATIONS (GROUP_SIZE * GROUP_SIZE)
+#define METER_MIN_LOG -8.0 // Stops, so the fixed point sums can't overflow
+#define METER_MAX_LOG 8.0
+
+layout(local_size_x = GROUP_SIZE, local_size_y = GROUP_SIZE) in;
+
+layout(set = 0, binding = 0) uniform sampler2D bloom;
+layout(set = 0, binding = 1, rgba16f) uniform image2D target;
+
+layout(std430, set = 0, binding = 2) buffer Exposure {
+    float exposure;
+    int logLuminanceSum; // Sixteenths of a stop
+    uint pixelCount;
+    float target;
+} state;
+
+layout(push_constant) uniform Params {
+    ivec2 size; // Rendered part of the target
+    vec2 targetTexel;
+    vec2 bloomMaxUv;
+    float bloomIntensity;
+    float saturation;
+    float contrast;
+    vec4 colorFilter;
+} params;
+
+shared float partialLogs[GROUP_INVOCATIONS];
+shared uint partialCounts[GROUP_INVOCATIONS];
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Narkowicz's fit of the ACES filmic curve
+vec3 tonemap(vec3 x) {
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+vec3 grade(vec3 color) {
+    color = mix(vec3(luminance(color)), color, params.saturation);
+    color = (color - 0.18) * params.contrast + 0.18;
+    return clamp(color * params.colorFilter.rgb, 0.0, 1.0);
+}
+
+// Adds this workgroup's metering to the buffer from one invocation
+void meter(float logLuminance, uint count) {
+#ifdef USE_SUBGROUPS
+    float subgroupLog = subgroupAdd(logLuminance);
+    uint subgroupCount = subgroupAdd(count);
+    if (subgroupElect()) {
+        partialLogs[gl_SubgroupID] = subgroupLog;
+        partialCounts[gl_SubgroupID] = subgroupCount;
+    }
+    barrier();
+    if (gl_LocalInvocationIndex == 0) {
+        for (uint i = 1; i < gl_NumSubgroups; i++) {
+            partialLogs[0] += partialLogs[i];
+            partialCounts[0] += partialCounts[i];
+        }
+    }
+#else
+    uint index = gl_LocalInvocationIndex;
+    partialLogs[index] = logLuminance;
+    partialCounts[index] = count;
+    for (uint stride = GROUP_INVOCATIONS / 2; stride > 0; stride /= 2) {
+        barrier();
+        if (index < stride) {
+            partialLogs[index] += partialLogs[index + stride];
+            partialCounts[index] += partialCounts[index + stride];
+        }
+    }
+#endif
+    if (gl_LocalInvocationIndex == 0 && partialCounts[0] > 0) {
+        atomicAdd(state.logLuminanceSum, int(round(partialLogs[0] * 16.0)));
+        atomicAdd(state.pixelCount, partialCounts[0]);
+    }
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    bool inside = all(lessThan(pixel, params.size));
+    vec4 hdr = inside ? imageLoad(target, pixel) : vec4(0.0);
+
+    // The scene clears to zero alpha, so the background doesn't drag the
+    // exposure up
+    bool covered = inside && hdr.a > 0.5;
+    float logLuminance = covered ? clamp(log2(max(luminance(hdr.rgb), 1e-5)), METER_MIN_LOG, METER_MAX_LOG) : 0.0;
+    meter(logLuminance, covered ? 1u : 0u);
+
+    if (!inside) {
+        return;
+    }
+    vec2 uv = (vec2(pixel) + 0.5) * params.targetTexel;
+    vec3 color = hdr.rgb + textureLod(bloom, min(uv, params.bloomMaxUv), 0.0).rgb * params.bloomIntensity;
+    color = tonemap(color * state.exposure);
+    imageStore(target, pixel, vec4(grade(color), 1.0));
+}
@@ -1,9 +1,44 @@
 #version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "clusters.glsl"
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 fragPosition;
+layout(location = 2) in vec3 fragNormal;
 
 layout(location = 0) out vec4 outColor;
 
+// Selected per pipeline through VkSpecializationInfo: 0 = vertex colour, 1 = luminance
+layout(constant_id = 0) const uint COLOR_MODE = 0;
+
+const float AMBIENT = 0.15;
+
+// Only the lights binned into this fragment's cluster are shaded
+vec3 shadeLights(vec3 albedo) {
+    float near = params.screen.z;
+    float far = params.screen.w;
+    float viewDepth = near * far / (far - gl_FragCoord.z * (far - near));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy / params.screen.xy * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y)),
+                     uvec2(CLUSTER_GRID_X - 1, CLUSTER_GRID_Y - 1));
+    uvec2 cluster = clusters[clusterIndex(uvec3(tile, clusterSlice(viewDepth)))];
+
+    vec3 normal = normalize(fragNormal);
+    vec3 light = vec3(AMBIENT);
+    for (uint i = 0; i < cluster.y; i++) {
+        Light l = lights[lightIndices[cluster.x + i]];
+        vec3 toLight = l.positionRadius.xyz - fragPosition;
+        float lightDistance = length(toLight);
+        float falloff = max(1.0 - lightDistance / l.positionRadius.w, 0.0);
+        light += l.color.rgb * (falloff * falloff * max(dot(normal, toLight / max(lightDistance, 1e-4)), 0.0));
+    }
+    return albedo * light;
+}
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    vec3 color = shadeLights(fragColor);
+    if (COLOR_MODE == 1) {
+        color = vec3(dot(color, vec3(0.2126, 0.7152, 0.0722)));
+    }
+    outColor = vec4(color, 1.0);
 }
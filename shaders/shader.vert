@@ -1,20 +1,23 @@
 #version 450
 
-layout(location = 0) out vec3 fragColor;
+layout(push_constant) uniform PushConstants {
+    mat4 transform; // Model-view-projection
+    mat4 model;
+} pushConstants;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inNormal;
+layout(location = 2) in vec4 inInstance; // Offset in xyz and scale in w, in model space
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 fragPosition; // World space
+layout(location = 2) out vec3 fragNormal;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    vec4 position = vec4(inPosition * inInstance.w + inInstance.xyz, 1.0);
+    gl_Position = pushConstants.transform * position;
+    fragColor = inNormal * 0.5 + 0.5;
+    fragPosition = (pushConstants.model * position).xyz;
+    // Objects are only ever scaled uniformly
+    fragNormal = mat3(pushConstants.model) * inNormal;
 }
@@ -0,0 +1,176 @@
+#ifdef TRACE_ENABLED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_EVENTS_PER_THREAD 65536
+#define TRACE_MAX_DEPTH 32
+
+typedef struct TraceEvent {
+  const char *name;
+  u64 start;
+  u64 end;
+} TraceEvent;
+
+// Only the owning thread writes events; count is published with release so
+// the dump sees complete events.
+typedef struct TraceBuffer {
+  struct TraceBuffer *next;
+  const char *threadName;
+  u32 threadId;
+  _Atomic u32 count;
+  u32 dropped;
+  u32 depth;
+  TraceScope stack[TRACE_MAX_DEPTH];
+  TraceEvent events[TRACE_EVENTS_PER_THREAD];
+} TraceBuffer;
+
+static _Atomic(TraceBuffer*) traceBuffers = NULL;
+static _Thread_local TraceBuffer *threadBuffer = NULL;
+
+static u64 startTicks;
+static u64 startNs;
+
+static u64 nowNs(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static TraceBuffer *getThreadBuffer(void) {
+  if (threadBuffer != NULL) {
+    return threadBuffer;
+  }
+
+  TraceBuffer *pBuffer = calloc(1, sizeof(TraceBuffer));
+  if (pBuffer == NULL) {
+    return NULL;
+  }
+  pBuffer->threadId = (u32)syscall(SYS_gettid);
+
+  // Lock-free push onto the list of all buffers
+  TraceBuffer *head = atomic_load_explicit(&traceBuffers, memory_order_relaxed);
+  do {
+    pBuffer->next = head;
+  } while (!atomic_compare_exchange_weak_explicit(&traceBuffers, &head, pBuffer, memory_order_release, memory_order_relaxed));
+
+  threadBuffer = pBuffer;
+  return pBuffer;
+}
+
+void traceInit(void) {
+  startTicks = traceTimestamp();
+  startNs = nowNs();
+  traceSetThreadName("main");
+}
+
+void traceSetThreadName(const char *name) {
+  TraceBuffer *pBuffer = getThreadBuffer();
+  if (pBuffer != NULL) {
+    pBuffer->threadName = name;
+  }
+}
+
+void traceRecord(const char *name, u64 start, u64 end) {
+  TraceBuffer *pBuffer = getThreadBuffer();
+  if (pBuffer == NULL) return;
+
+  u32 count = atomic_load_explicit(&pBuffer->count, memory_order_relaxed);
+  if (count == TRACE_EVENTS_PER_THREAD) {
+    pBuffer->dropped++;
+    return;
+  }
+  pBuffer->events[count] = (TraceEvent){ name, start, end };
+  atomic_store_explicit(&pBuffer->count, count + 1, memory_order_release);
+}
+
+void traceBegin(const char *name) {
+  TraceBuffer *pBuffer = getThreadBuffer();
+  if (pBuffer == NULL) return;
+
+  if (pBuffer->depth < TRACE_MAX_DEPTH) {
+    pBuffer->stack[pBuffer->depth] = (TraceScope){ name, traceTimestamp() };
+  }
+  pBuffer->depth++;
+}
+
+void traceEnd(void) {
+  u64 end = traceTimestamp();
+  TraceBuffer *pBuffer = getThreadBuffer();
+  if (pBuffer == NULL || pBuffer->depth == 0) return;
+
+  pBuffer->depth--;
+  if (pBuffer->depth < TRACE_MAX_DEPTH) {
+    TraceScope *pScope = &pBuffer->stack[pBuffer->depth];
+    traceRecord(pScope->name, pScope->start, end);
+  }
+}
+
+void traceShutdown(const char *path) {
+  // Calibrate ticks against the monotonic clock over the whole run
+  u64 endTicks = traceTimestamp();
+  u64 endNs = nowNs();
+  double ticksPerUs = 1.0;
+#if defined(__x86_64__) || defined(__i386__)
+  if (endNs > startNs) {
+    ticksPerUs = (double)(endTicks - startTicks) / ((endNs - startNs) / 1000.0);
+  }
+#else
+  ticksPerUs = 1000.0;
+#endif
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    printf("Failed to open %s!\n", path);
+  }
+
+  TraceBuffer *pBuffer = atomic_exchange_explicit(&traceBuffers, NULL, memory_order_acquire);
+  bool first = true;
+  if (file != NULL) {
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  }
+
+  while (pBuffer != NULL) {
+    TraceBuffer *next = pBuffer->next;
+    u32 count = atomic_load_explicit(&pBuffer->count, memory_order_acquire);
+
+    if (file != NULL) {
+      if (pBuffer->threadName != NULL) {
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+          first ? "" : ",\n", pBuffer->threadId, pBuffer->threadName);
+        first = false;
+      }
+      for (u32 i = 0; i < count; i++) {
+        TraceEvent *pEvent = &pBuffer->events[i];
+        double ts = (double)(i64)(pEvent->start - startTicks) / ticksPerUs;
+        double dur = (double)(pEvent->end - pEvent->start) / ticksPerUs;
+        fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+          first ? "" : ",\n", pEvent->name, pBuffer->threadId, ts, dur);
+        first = false;
+      }
+    }
+    if (pBuffer->dropped > 0) {
+      printf("Trace buffer full, dropped %u events on thread %u\n", pBuffer->dropped, pBuffer->threadId);
+    }
+
+    free(pBuffer);
+    pBuffer = next;
+  }
+
+  if (file != NULL) {
+    fprintf(file, "\n]}\n");
+    fclose(file);
+  }
+  // This thread's cached buffer was just freed
+  threadBuffer = NULL;
+}
+
+#endif // TRACE_ENABLED
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "types.h"
+
+// Scoped CPU trace zones, written to Chrome trace JSON (chrome://tracing or
+// ui.perfetto.dev). Build with `make TRACE=1`; otherwise every macro expands
+// to nothing and trace.c compiles empty.
+//
+//   TRACE_ZONE("drawFrame");       // Ends when the enclosing scope exits
+//   TRACE_BEGIN("acquire"); ... TRACE_END();
+
+#ifdef TRACE_ENABLED
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+typedef struct TraceScope {
+  const char *name;
+  u64 start;
+} TraceScope;
+
+void traceInit(void);
+// Writes every thread's events to path and frees the buffers. Threads that
+// record events must have finished by then.
+void traceShutdown(const char *path);
+// Shown as the thread's name in the viewer. name must outlive tracing.
+void traceSetThreadName(const char *name);
+// name must be a string literal or otherwise outlive tracing
+void traceRecord(const char *name, u64 start, u64 end);
+void traceBegin(const char *name);
+void traceEnd(void);
+
+static inline u64 traceTimestamp(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static inline void traceScopeEnd(TraceScope *pScope) {
+  traceRecord(pScope->name, pScope->start, traceTimestamp());
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#define TRACE_INIT() traceInit()
+#define TRACE_SHUTDOWN(path) traceShutdown(path)
+#define TRACE_THREAD_NAME(name) traceSetThreadName(name)
+#define TRACE_ZONE(name) \
+  TraceScope TRACE_CONCAT(traceScope, __LINE__) __attribute__((cleanup(traceScopeEnd))) = { name, traceTimestamp() }
+#define TRACE_BEGIN(name) traceBegin(name)
+#define TRACE_END() traceEnd()
+
+#else
+
+#define TRACE_INIT() ((void)0)
+#define TRACE_SHUTDOWN(path) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+#define TRACE_ZONE(name) ((void)0)
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END() ((void)0)
+
+#endif
@@ -0,0 +1,22 @@
+#include "triplebuffer.h"
+
+void tripleBufferInit(TripleBuffer *pBuffer) {
+  pBuffer->writeIndex = 0;
+  pBuffer->readIndex = 1;
+  atomic_init(&pBuffer->middle, 2);
+}
+
+void tripleBufferPublish(TripleBuffer *pBuffer) {
+  // Release makes the slot's contents visible along with the index
+  u32 previous = atomic_exchange_explicit(&pBuffer->middle, pBuffer->writeIndex | TRIPLE_BUFFER_DIRTY, memory_order_acq_rel);
+  pBuffer->writeIndex = previous & ~TRIPLE_BUFFER_DIRTY;
+}
+
+bool tripleBufferAcquire(TripleBuffer *pBuffer) {
+  if ((atomic_load_explicit(&pBuffer->middle, memory_order_relaxed) & TRIPLE_BUFFER_DIRTY) == 0) {
+    return false;
+  }
+  u32 previous = atomic_exchange_explicit(&pBuffer->middle, pBuffer->readIndex, memory_order_acq_rel);
+  pBuffer->readIndex = previous & ~TRIPLE_BUFFER_DIRTY;
+  return true;
+}
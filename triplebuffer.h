@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "types.h"
+
+// Lock-free single-producer single-consumer handoff of the latest value
+// between three slots. The writer always has a slot to fill and the reader
+// always has a complete one to read, so neither ever waits. Intermediate
+// values are skipped when the writer is faster.
+//
+// The slots themselves live with the caller; this only hands out indices.
+typedef struct TripleBuffer {
+  u32 writeIndex; // Owned by the writer
+  u32 readIndex; // Owned by the reader
+  _Atomic u32 middle; // Slot index, plus TRIPLE_BUFFER_DIRTY when it holds unread data
+} TripleBuffer;
+
+#define TRIPLE_BUFFER_DIRTY 0x4u
+
+void tripleBufferInit(TripleBuffer *pBuffer);
+
+// The slot the writer may fill
+static inline u32 tripleBufferWriteIndex(const TripleBuffer *pBuffer) {
+  return pBuffer->writeIndex;
+}
+
+// Hands the filled write slot to the reader and takes back a free one
+void tripleBufferPublish(TripleBuffer *pBuffer);
+
+// Switches to the newest published slot if there is one. Returns true when
+// the read slot changed.
+bool tripleBufferAcquire(TripleBuffer *pBuffer);
+
+static inline u32 tripleBufferReadIndex(const TripleBuffer *pBuffer) {
+  return pBuffer->readIndex;
+}
@@ -0,0 +1,509 @@
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VMATH_X86 1
+#include <immintrin.h>
+#endif
+
+#include "vmath.h"
+
+static VmathImpl vmathImpl = VMATH_IMPL_SCALAR;
+static pthread_once_t vmathDetectOnce = PTHREAD_ONCE_INIT;
+
+Mat4 mat4Identity(void) {
+  Mat4 result = {0};
+  result.m[0] = 1.0f;
+  result.m[5] = 1.0f;
+  result.m[10] = 1.0f;
+  result.m[15] = 1.0f;
+  return result;
+}
+
+Mat4 mat4Transpose(const Mat4 *pM) {
+  Mat4 result;
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      result.m[column * 4 + row] = pM->m[row * 4 + column];
+    }
+  }
+  return result;
+}
+
+Mat4 mat4Translation(Vec3 translation) {
+  Mat4 result = mat4Identity();
+  result.m[12] = translation.x;
+  result.m[13] = translation.y;
+  result.m[14] = translation.z;
+  return result;
+}
+
+Mat4 mat4Scaling(Vec3 scale) {
+  Mat4 result = {0};
+  result.m[0] = scale.x;
+  result.m[5] = scale.y;
+  result.m[10] = scale.z;
+  result.m[15] = 1.0f;
+  return result;
+}
+
+Mat4 mat4FromQuat(Quat q) {
+  return mat4Compose(vec3(0.0f, 0.0f, 0.0f), q, vec3(1.0f, 1.0f, 1.0f));
+}
+
+Mat4 mat4Compose(Vec3 translation, Quat q, Vec3 scale) {
+  float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+  float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+  float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+  Mat4 result;
+  result.m[0] = (1.0f - 2.0f * (yy + zz)) * scale.x;
+  result.m[1] = 2.0f * (xy + wz) * scale.x;
+  result.m[2] = 2.0f * (xz - wy) * scale.x;
+  result.m[3] = 0.0f;
+
+  result.m[4] = 2.0f * (xy - wz) * scale.y;
+  result.m[5] = (1.0f - 2.0f * (xx + zz)) * scale.y;
+  result.m[6] = 2.0f * (yz + wx) * scale.y;
+  result.m[7] = 0.0f;
+
+  result.m[8] = 2.0f * (xz + wy) * scale.z;
+  result.m[9] = 2.0f * (yz - wx) * scale.z;
+  result.m[10] = (1.0f - 2.0f * (xx + yy)) * scale.z;
+  result.m[11] = 0.0f;
+
+  result.m[12] = translation.x;
+  result.m[13] = translation.y;
+  result.m[14] = translation.z;
+  result.m[15] = 1.0f;
+  return result;
+}
+
+Mat4 mat4LookAt(Vec3 eye, Vec3 target, Vec3 up) {
+  Vec3 forward = vec3Normalize(vec3Sub(target, eye));
+  Vec3 right = vec3Normalize(vec3Cross(forward, up));
+  Vec3 cameraUp = vec3Cross(right, forward);
+
+  Mat4 result = mat4Identity();
+  result.m[0] = right.x;
+  result.m[4] = right.y;
+  result.m[8] = right.z;
+  result.m[1] = cameraUp.x;
+  result.m[5] = cameraUp.y;
+  result.m[9] = cameraUp.z;
+  result.m[2] = -forward.x;
+  result.m[6] = -forward.y;
+  result.m[10] = -forward.z;
+  result.m[12] = -vec3Dot(right, eye);
+  result.m[13] = -vec3Dot(cameraUp, eye);
+  result.m[14] = vec3Dot(forward, eye);
+  return result;
+}
+
+// Maps view space z = -zNear to depth 0 and z = -zFar to depth 1, and
+// negates Y since Vulkan's clip space Y points down.
+Mat4 mat4Perspective(float fovY, float aspect, float zNear, float zFar) {
+  float f = 1.0f / tanf(fovY * 0.5f);
+
+  Mat4 result = {0};
+  result.m[0] = f / aspect;
+  result.m[5] = -f;
+  result.m[10] = zFar / (zNear - zFar);
+  result.m[11] = -1.0f;
+  result.m[14] = zNear * zFar / (zNear - zFar);
+  return result;
+}
+
+Mat4 mat4Orthographic(float left, float right, float bottom, float top, float zNear, float zFar) {
+  Mat4 result = mat4Identity();
+  result.m[0] = 2.0f / (right - left);
+  result.m[5] = -2.0f / (top - bottom);
+  result.m[10] = 1.0f / (zNear - zFar);
+  result.m[12] = -(right + left) / (right - left);
+  result.m[13] = (top + bottom) / (top - bottom);
+  result.m[14] = zNear / (zNear - zFar);
+  return result;
+}
+
+void mat4MultiplyScalar(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB) {
+  Mat4 result;
+  for (int column = 0; column < 4; column++) {
+    for (int row = 0; row < 4; row++) {
+      float sum = 0.0f;
+      for (int k = 0; k < 4; k++) {
+        sum += pA->m[k * 4 + row] * pB->m[column * 4 + k];
+      }
+      result.m[column * 4 + row] = sum;
+    }
+  }
+  *pOut = result;
+}
+
+bool mat4InverseScalar(Mat4 *pOut, const Mat4 *pM) {
+  const float *m = pM->m;
+  float inv[16];
+
+  inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+  inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+  inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+  inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+  inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+  inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+  inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+  inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+  inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+  inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+  inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+  inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+  inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+  inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+  inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+  inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+  float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+  if (det == 0.0f) {
+    return false;
+  }
+
+  float inverseDet = 1.0f / det;
+  for (int i = 0; i < 16; i++) {
+    pOut->m[i] = inv[i] * inverseDet;
+  }
+  return true;
+}
+
+#ifdef VMATH_X86
+
+#define SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define SWIZZLE(v, x, y, z, w) _mm_shuffle_ps(v, v, SHUFFLE_MASK(x, y, z, w))
+#define SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, SHUFFLE_MASK(x, y, z, w))
+
+static inline __m128 mat4MultiplyColumn(const __m128 a[4], __m128 b) {
+  __m128 result = _mm_mul_ps(a[0], SWIZZLE(b, 0, 0, 0, 0));
+  result = _mm_add_ps(result, _mm_mul_ps(a[1], SWIZZLE(b, 1, 1, 1, 1)));
+  result = _mm_add_ps(result, _mm_mul_ps(a[2], SWIZZLE(b, 2, 2, 2, 2)));
+  result = _mm_add_ps(result, _mm_mul_ps(a[3], SWIZZLE(b, 3, 3, 3, 3)));
+  return result;
+}
+
+static inline void mat4MultiplySse(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB) {
+  __m128 a[4] = {
+    _mm_load_ps(&pA->m[0]),
+    _mm_load_ps(&pA->m[4]),
+    _mm_load_ps(&pA->m[8]),
+    _mm_load_ps(&pA->m[12])
+  };
+  __m128 b[4] = {
+    _mm_load_ps(&pB->m[0]),
+    _mm_load_ps(&pB->m[4]),
+    _mm_load_ps(&pB->m[8]),
+    _mm_load_ps(&pB->m[12])
+  };
+  for (int column = 0; column < 4; column++) {
+    _mm_store_ps(&pOut->m[column * 4], mat4MultiplyColumn(a, b[column]));
+  }
+}
+
+// 2x2 blocks are stored as (m00, m01, m10, m11)
+static inline __m128 mat2Multiply(__m128 a, __m128 b) {
+  return _mm_add_ps(_mm_mul_ps(a, SWIZZLE(b, 0, 3, 0, 3)), _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// adj(a) * b
+static inline __m128 mat2AdjugateMultiply(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(SWIZZLE(a, 3, 3, 0, 0), b), _mm_mul_ps(SWIZZLE(a, 1, 1, 2, 2), SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+// a * adj(b)
+static inline __m128 mat2MultiplyAdjugate(__m128 a, __m128 b) {
+  return _mm_sub_ps(_mm_mul_ps(a, SWIZZLE(b, 3, 0, 3, 0)), _mm_mul_ps(SWIZZLE(a, 1, 0, 3, 2), SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// Block-wise inverse using 2x2 adjugates. Columns are treated as rows, which
+// inverts the transpose and so gives the transposed result back in columns.
+static bool mat4InverseSse(Mat4 *pOut, const Mat4 *pM) {
+  __m128 c0 = _mm_load_ps(&pM->m[0]);
+  __m128 c1 = _mm_load_ps(&pM->m[4]);
+  __m128 c2 = _mm_load_ps(&pM->m[8]);
+  __m128 c3 = _mm_load_ps(&pM->m[12]);
+
+  __m128 a = _mm_movelh_ps(c0, c1);
+  __m128 b = _mm_movehl_ps(c1, c0);
+  __m128 c = _mm_movelh_ps(c2, c3);
+  __m128 d = _mm_movehl_ps(c3, c2);
+
+  // (|A|, |B|, |C|, |D|)
+  __m128 detSub = _mm_sub_ps(
+    _mm_mul_ps(SHUFFLE(c0, c2, 0, 2, 0, 2), SHUFFLE(c1, c3, 1, 3, 1, 3)),
+    _mm_mul_ps(SHUFFLE(c0, c2, 1, 3, 1, 3), SHUFFLE(c1, c3, 0, 2, 0, 2)));
+  __m128 detA = SWIZZLE(detSub, 0, 0, 0, 0);
+  __m128 detB = SWIZZLE(detSub, 1, 1, 1, 1);
+  __m128 detC = SWIZZLE(detSub, 2, 2, 2, 2);
+  __m128 detD = SWIZZLE(detSub, 3, 3, 3, 3);
+
+  __m128 dc = mat2AdjugateMultiply(d, c);
+  __m128 ab = mat2AdjugateMultiply(a, b);
+  __m128 x = _mm_sub_ps(_mm_mul_ps(detD, a), mat2Multiply(b, dc));
+  __m128 w = _mm_sub_ps(_mm_mul_ps(detA, d), mat2Multiply(c, ab));
+  __m128 y = _mm_sub_ps(_mm_mul_ps(detB, c), mat2MultiplyAdjugate(d, ab));
+  __m128 z = _mm_sub_ps(_mm_mul_ps(detC, b), mat2MultiplyAdjugate(a, dc));
+
+  // |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+  __m128 trace = _mm_mul_ps(ab, SWIZZLE(dc, 0, 2, 1, 3));
+  trace = _mm_add_ps(trace, SWIZZLE(trace, 2, 3, 0, 1));
+  trace = _mm_add_ps(trace, SWIZZLE(trace, 1, 0, 3, 2));
+  __m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), trace);
+  if (_mm_cvtss_f32(det) == 0.0f) {
+    return false;
+  }
+
+  __m128 inverseDet = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), det);
+  x = _mm_mul_ps(x, inverseDet);
+  y = _mm_mul_ps(y, inverseDet);
+  z = _mm_mul_ps(z, inverseDet);
+  w = _mm_mul_ps(w, inverseDet);
+
+  // The shuffles apply the final adjugate of each block
+  _mm_store_ps(&pOut->m[0], SHUFFLE(x, y, 3, 1, 3, 1));
+  _mm_store_ps(&pOut->m[4], SHUFFLE(x, y, 2, 0, 2, 0));
+  _mm_store_ps(&pOut->m[8], SHUFFLE(z, w, 3, 1, 3, 1));
+  _mm_store_ps(&pOut->m[12], SHUFFLE(z, w, 2, 0, 2, 0));
+  return true;
+}
+
+static void mat4MultiplyBatchSse(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB, u32 count) {
+  __m128 a[4] = {
+    _mm_load_ps(&pA->m[0]),
+    _mm_load_ps(&pA->m[4]),
+    _mm_load_ps(&pA->m[8]),
+    _mm_load_ps(&pA->m[12])
+  };
+  for (u32 i = 0; i < count; i++) {
+    for (int column = 0; column < 4; column++) {
+      __m128 b = _mm_load_ps(&pB[i].m[column * 4]);
+      _mm_store_ps(&pOut[i].m[column * 4], mat4MultiplyColumn(a, b));
+    }
+  }
+}
+
+static void mat4TransformBatchSse(Vec4 *pOut, const Mat4 *pM, const Vec4 *pIn, u32 count) {
+  __m128 m[4] = {
+    _mm_load_ps(&pM->m[0]),
+    _mm_load_ps(&pM->m[4]),
+    _mm_load_ps(&pM->m[8]),
+    _mm_load_ps(&pM->m[12])
+  };
+  for (u32 i = 0; i < count; i++) {
+    _mm_store_ps(&pOut[i].x, mat4MultiplyColumn(m, _mm_load_ps(&pIn[i].x)));
+  }
+}
+
+// Two columns per register: each 128-bit lane holds one column, and the
+// in-lane shuffle broadcasts element k of that lane's column.
+__attribute__((target("avx")))
+static inline __m256 mat4MultiplyColumnPairAvx(const __m256 a[4], __m256 b) {
+  __m256 result = _mm256_mul_ps(a[0], _mm256_shuffle_ps(b, b, SHUFFLE_MASK(0, 0, 0, 0)));
+  result = _mm256_add_ps(result, _mm256_mul_ps(a[1], _mm256_shuffle_ps(b, b, SHUFFLE_MASK(1, 1, 1, 1))));
+  result = _mm256_add_ps(result, _mm256_mul_ps(a[2], _mm256_shuffle_ps(b, b, SHUFFLE_MASK(2, 2, 2, 2))));
+  result = _mm256_add_ps(result, _mm256_mul_ps(a[3], _mm256_shuffle_ps(b, b, SHUFFLE_MASK(3, 3, 3, 3))));
+  return result;
+}
+
+__attribute__((target("avx")))
+static void mat4MultiplyBatchAvx(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB, u32 count) {
+  __m256 a[4] = {
+    _mm256_broadcast_ps((const __m128*)&pA->m[0]),
+    _mm256_broadcast_ps((const __m128*)&pA->m[4]),
+    _mm256_broadcast_ps((const __m128*)&pA->m[8]),
+    _mm256_broadcast_ps((const __m128*)&pA->m[12])
+  };
+  for (u32 i = 0; i < count; i++) {
+    __m256 b01 = _mm256_load_ps(&pB[i].m[0]);
+    __m256 b23 = _mm256_load_ps(&pB[i].m[8]);
+    _mm256_store_ps(&pOut[i].m[0], mat4MultiplyColumnPairAvx(a, b01));
+    _mm256_store_ps(&pOut[i].m[8], mat4MultiplyColumnPairAvx(a, b23));
+  }
+}
+
+__attribute__((target("avx")))
+static void mat4TransformBatchAvx(Vec4 *pOut, const Mat4 *pM, const Vec4 *pIn, u32 count) {
+  __m256 m[4] = {
+    _mm256_broadcast_ps((const __m128*)&pM->m[0]),
+    _mm256_broadcast_ps((const __m128*)&pM->m[4]),
+    _mm256_broadcast_ps((const __m128*)&pM->m[8]),
+    _mm256_broadcast_ps((const __m128*)&pM->m[12])
+  };
+  u32 i = 0;
+  for (; i + 2 <= count; i += 2) {
+    // Vec4 arrays are only 16-byte aligned
+    __m256 v = _mm256_loadu_ps(&pIn[i].x);
+    _mm256_storeu_ps(&pOut[i].x, mat4MultiplyColumnPairAvx(m, v));
+  }
+  if (i < count) {
+    mat4TransformBatchSse(pOut + i, pM, pIn + i, count - i);
+  }
+}
+
+#endif // VMATH_X86
+
+void mat4Multiply(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB) {
+#ifdef __SSE2__
+  mat4MultiplySse(pOut, pA, pB);
+#else
+  mat4MultiplyScalar(pOut, pA, pB);
+#endif
+}
+
+bool mat4Inverse(Mat4 *pOut, const Mat4 *pM) {
+#ifdef __SSE2__
+  return mat4InverseSse(pOut, pM);
+#else
+  return mat4InverseScalar(pOut, pM);
+#endif
+}
+
+Vec4 mat4TransformVec4(const Mat4 *pM, Vec4 v) {
+  const float *m = pM->m;
+  return vec4(
+    m[0] * v.x + m[4] * v.y + m[8] * v.z + m[12] * v.w,
+    m[1] * v.x + m[5] * v.y + m[9] * v.z + m[13] * v.w,
+    m[2] * v.x + m[6] * v.y + m[10] * v.z + m[14] * v.w,
+    m[3] * v.x + m[7] * v.y + m[11] * v.z + m[15] * v.w);
+}
+
+Quat quatIdentity(void) {
+  return (Quat){ 0.0f, 0.0f, 0.0f, 1.0f };
+}
+
+Quat quatFromAxisAngle(Vec3 axis, float angle) {
+  float s = sinf(angle * 0.5f);
+  return (Quat){ axis.x * s, axis.y * s, axis.z * s, cosf(angle * 0.5f) };
+}
+
+Quat quatMultiply(Quat a, Quat b) {
+  return (Quat){
+    a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+    a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+    a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+    a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+  };
+}
+
+Quat quatNormalize(Quat q) {
+  float length = sqrtf(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+  if (length == 0.0f) {
+    return quatIdentity();
+  }
+  float inverse = 1.0f / length;
+  return (Quat){ q.x * inverse, q.y * inverse, q.z * inverse, q.w * inverse };
+}
+
+Vec3 quatRotate(Quat q, Vec3 v) {
+  // v + 2w(u x v) + 2u x (u x v), with u the vector part
+  Vec3 u = vec3(q.x, q.y, q.z);
+  Vec3 t = vec3Scale(vec3Cross(u, v), 2.0f);
+  return vec3Add(vec3Add(v, vec3Scale(t, q.w)), vec3Cross(u, t));
+}
+
+static void mat4MultiplyBatchScalar(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB, u32 count) {
+  for (u32 i = 0; i < count; i++) {
+    mat4MultiplyScalar(&pOut[i], pA, &pB[i]);
+  }
+}
+
+static void mat4TransformBatchScalar(Vec4 *pOut, const Mat4 *pM, const Vec4 *pIn, u32 count) {
+  for (u32 i = 0; i < count; i++) {
+    pOut[i] = mat4TransformVec4(pM, pIn[i]);
+  }
+}
+
+static bool cpuSupports(VmathImpl impl) {
+  switch (impl) {
+    case VMATH_IMPL_SCALAR:
+      return true;
+#ifdef VMATH_X86
+    case VMATH_IMPL_SSE:
+      return __builtin_cpu_supports("sse2");
+    case VMATH_IMPL_AVX:
+      return __builtin_cpu_supports("avx");
+#endif
+    default:
+      return false;
+  }
+}
+
+static void detectImpl(void) {
+#ifdef VMATH_X86
+  __builtin_cpu_init();
+#endif
+  vmathImpl = VMATH_IMPL_SCALAR;
+  for (int impl = VMATH_IMPL_COUNT - 1; impl > VMATH_IMPL_SCALAR; impl--) {
+    if (cpuSupports((VmathImpl)impl)) {
+      vmathImpl = (VmathImpl)impl;
+      break;
+    }
+  }
+}
+
+VmathImpl vmathDetectImpl(void) {
+  pthread_once(&vmathDetectOnce, detectImpl);
+  return vmathImpl;
+}
+
+bool vmathSetImpl(VmathImpl impl) {
+  vmathDetectImpl();
+  if (!cpuSupports(impl)) {
+    return false;
+  }
+  vmathImpl = impl;
+  return true;
+}
+
+VmathImpl vmathGetImpl(void) {
+  return vmathDetectImpl();
+}
+
+const char *vmathImplName(VmathImpl impl) {
+  switch (impl) {
+    case VMATH_IMPL_SCALAR: return "scalar";
+    case VMATH_IMPL_SSE: return "sse";
+    case VMATH_IMPL_AVX: return "avx";
+    default: return "unknown";
+  }
+}
+
+void mat4MultiplyBatch(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB, u32 count) {
+  switch (vmathDetectImpl()) {
+#ifdef VMATH_X86
+    case VMATH_IMPL_AVX:
+      mat4MultiplyBatchAvx(pOut, pA, pB, count);
+      return;
+    case VMATH_IMPL_SSE:
+      mat4MultiplyBatchSse(pOut, pA, pB, count);
+      return;
+#endif
+    default:
+      mat4MultiplyBatchScalar(pOut, pA, pB, count);
+  }
+}
+
+void mat4TransformBatch(Vec4 *pOut, const Mat4 *pM, const Vec4 *pIn, u32 count) {
+  switch (vmathDetectImpl()) {
+#ifdef VMATH_X86
+    case VMATH_IMPL_AVX:
+      mat4TransformBatchAvx(pOut, pM, pIn, count);
+      return;
+    case VMATH_IMPL_SSE:
+      mat4TransformBatchSse(pOut, pM, pIn, count);
+      return;
+#endif
+    default:
+      mat4TransformBatchScalar(pOut, pM, pIn, count);
+  }
+}
+
+void mat4ComposeBatch(Mat4 *pOut, const Vec3 *pTranslations, const Quat *pRotations, const Vec3 *pScales, u32 count) {
+  for (u32 i = 0; i < count; i++) {
+    pOut[i] = mat4Compose(pTranslations[i], pRotations[i], pScales[i]);
+  }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdbool.h>
+#include <math.h>
+
+#include "types.h"
+
+// Matrices are column-major like GLSL, so a Mat4 can be pushed to a shader
+// as is. Element (row, column) is m[column * 4 + row].
+
+// Padded to 16 bytes so it loads as one SSE register
+typedef struct Vec3 {
+  _Alignas(16) float x;
+  float y;
+  float z;
+  float padding;
+} Vec3;
+
+typedef struct Vec4 {
+  _Alignas(16) float x;
+  float y;
+  float z;
+  float w;
+} Vec4;
+
+typedef struct Quat {
+  _Alignas(16) float x;
+  float y;
+  float z;
+  float w;
+} Quat;
+
+typedef struct Mat4 {
+  _Alignas(32) float m[16];
+} Mat4;
+
+typedef enum VmathImpl {
+  VMATH_IMPL_SCALAR = 0,
+  VMATH_IMPL_SSE,
+  VMATH_IMPL_AVX,
+  VMATH_IMPL_COUNT
+} VmathImpl;
+
+static inline Vec3 vec3(float x, float y, float z) {
+  return (Vec3){ x, y, z, 0.0f };
+}
+
+static inline Vec3 vec3Add(Vec3 a, Vec3 b) {
+  return vec3(a.x + b.x, a.y + b.y, a.z + b.z);
+}
+
+static inline Vec3 vec3Sub(Vec3 a, Vec3 b) {
+  return vec3(a.x - b.x, a.y - b.y, a.z - b.z);
+}
+
+static inline Vec3 vec3Scale(Vec3 v, float s) {
+  return vec3(v.x * s, v.y * s, v.z * s);
+}
+
+static inline float vec3Dot(Vec3 a, Vec3 b) {
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline Vec3 vec3Cross(Vec3 a, Vec3 b) {
+  return vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+static inline float vec3Length(Vec3 v) {
+  return sqrtf(vec3Dot(v, v));
+}
+
+static inline Vec3 vec3Normalize(Vec3 v) {
+  float length = vec3Length(v);
+  return length > 0.0f ? vec3Scale(v, 1.0f / length) : v;
+}
+
+static inline Vec4 vec4(float x, float y, float z, float w) {
+  return (Vec4){ x, y, z, w };
+}
+
+Mat4 mat4Identity(void);
+Mat4 mat4Transpose(const Mat4 *pM);
+Mat4 mat4Translation(Vec3 translation);
+Mat4 mat4Scaling(Vec3 scale);
+Mat4 mat4FromQuat(Quat rotation);
+// Translation * rotation * scale
+Mat4 mat4Compose(Vec3 translation, Quat rotation, Vec3 scale);
+
+// Right handed view matrix, the camera looks down -Z
+Mat4 mat4LookAt(Vec3 eye, Vec3 target, Vec3 up);
+// Vulkan clip space: Y points down and depth is 0..1. fovY is in radians.
+Mat4 mat4Perspective(float fovY, float aspect, float zNear, float zFar);
+Mat4 mat4Orthographic(float left, float right, float bottom, float top, float zNear, float zFar);
+
+// pOut may alias either input. Uses SSE where the target has it.
+void mat4Multiply(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB);
+void mat4MultiplyScalar(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB);
+// Returns false and leaves pOut untouched if pM is singular
+bool mat4Inverse(Mat4 *pOut, const Mat4 *pM);
+bool mat4InverseScalar(Mat4 *pOut, const Mat4 *pM);
+Vec4 mat4TransformVec4(const Mat4 *pM, Vec4 v);
+
+Quat quatIdentity(void);
+// axis must be normalized
+Quat quatFromAxisAngle(Vec3 axis, float angle);
+Quat quatMultiply(Quat a, Quat b);
+Quat quatNormalize(Quat q);
+Vec3 quatRotate(Quat q, Vec3 v);
+
+// Batch entry points dispatch to the widest kernel the CPU supports
+VmathImpl vmathDetectImpl(void);
+// Forces a kernel, for benchmarks. Returns false if the CPU can't run it.
+bool vmathSetImpl(VmathImpl impl);
+VmathImpl vmathGetImpl(void);
+const char *vmathImplName(VmathImpl impl);
+
+// pOut[i] = *pA * pB[i], e.g. view-projection times each model matrix.
+// pOut must not alias pB.
+void mat4MultiplyBatch(Mat4 *pOut, const Mat4 *pA, const Mat4 *pB, u32 count);
+// pOut[i] = *pM * pIn[i]. pOut may alias pIn.
+void mat4TransformBatch(Vec4 *pOut, const Mat4 *pM, const Vec4 *pIn, u32 count);
+void mat4ComposeBatch(Mat4 *pOut, const Vec3 *pTranslations, const Quat *pRotations, const Vec3 *pScales, u32 count);